@@ -0,0 +1,64 @@
+#ifndef B9_ARRAYKERNELS_HPP_
+#define B9_ARRAYKERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace b9 {
+
+/// Bulk operations on the elements of int arrays. Arithmetic wraps to int48,
+/// as it does in the VM, so results read back the same as if each element
+/// had been computed by bytecode. Elements are assumed to be int48s.
+struct ArrayKernels {
+  const char *name;
+
+  std::int64_t (*sum)(const std::int64_t *data, std::size_t length);
+
+  /// The smallest element, or 0 for an empty array.
+  std::int64_t (*min)(const std::int64_t *data, std::size_t length);
+
+  /// The largest element, or 0 for an empty array.
+  std::int64_t (*max)(const std::int64_t *data, std::size_t length);
+
+  void (*fill)(std::int64_t *data, std::size_t length, std::int64_t value);
+
+  /// The ranges may overlap.
+  void (*copy)(std::int64_t *to, const std::int64_t *from, std::size_t length);
+
+  /// -1 or 1 as the first differing element of a is less than or greater
+  /// than that of b, or 0 if there is none.
+  int (*compare)(const std::int64_t *a, const std::int64_t *b,
+                 std::size_t length);
+
+  /// The index of the first element equal to value, or -1.
+  std::int64_t (*find)(const std::int64_t *data, std::size_t length,
+                       std::int64_t value);
+
+  /// Replace each element with the sum of it and those before it. Returns
+  /// the total.
+  std::int64_t (*prefixSum)(std::int64_t *data, std::size_t length);
+
+  void (*addScalar)(std::int64_t *data, std::size_t length,
+                    std::int64_t value);
+
+  void (*mulScalar)(std::int64_t *data, std::size_t length,
+                    std::int64_t value);
+
+  /// to[i] += from[i]
+  void (*add)(std::int64_t *to, const std::int64_t *from, std::size_t length);
+
+  /// to[i] *= from[i]
+  void (*mul)(std::int64_t *to, const std::int64_t *from, std::size_t length);
+};
+
+/// The fastest kernels this CPU supports, chosen on first use.
+const ArrayKernels &arrayKernels();
+
+/// Every set of kernels this CPU supports, fastest first. The last is the
+/// portable scalar code.
+std::vector<const ArrayKernels *> supportedArrayKernels();
+
+}  // namespace b9
+
+#endif  // B9_ARRAYKERNELS_HPP_
@@ -0,0 +1,51 @@
+#ifndef B9_CODEARENA_HPP_
+#define B9_CODEARENA_HPP_
+
+#include <b9/Module.hpp>
+#include <b9/instructions.hpp>
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace b9 {
+
+/// The bytecode of some of a module's functions, copied into one cache line
+/// aligned block. Functions are placed in call graph order: depth first from
+/// each function in turn, so a callee follows its first caller.
+class CodeArena {
+ public:
+  static constexpr std::size_t ALIGNMENT = 64;
+
+  CodeArena() = default;
+
+  /// Lay out the functions of module that include selects.
+  CodeArena(const Module &module, const std::vector<bool> &include);
+
+  /// The first instruction of a function, or nullptr if it is not here.
+  const Instruction *entry(std::size_t function) const {
+    if (function >= offsets_.size() || offsets_[function] == NONE) {
+      return nullptr;
+    }
+    return code_.get() + offsets_[function];
+  }
+
+  /// The number of instructions in the arena.
+  std::size_t size() const { return size_; }
+
+ private:
+  static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+  struct Free {
+    void operator()(Instruction *code) const { std::free(code); }
+  };
+
+  std::unique_ptr<Instruction, Free> code_;
+  std::vector<std::size_t> offsets_;
+  std::size_t size_ = 0;
+};
+
+}  // namespace b9
+
+#endif  // B9_CODEARENA_HPP_
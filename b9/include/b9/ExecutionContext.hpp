@@ -4,6 +4,7 @@
 #include <b9/OperandStack.hpp>
 #include <b9/VirtualMachine.hpp>
 
+#include <cstdint>
 #include <iostream>
 
 namespace b9 {
@@ -35,9 +36,29 @@ class ExecutionContext {
 
   VirtualMachine *virtualMachine() const { return virtualMachine_; }
 
+  /// Output of the print primitives that has not been written yet.
+  OutputBuffer &output() { return output_; }
+
+  void flushOutput() { output_.flush(); }
+
+  /// Heap bytes the whole VM allocated since the context was created. This
+  /// includes what other contexts allocated meanwhile, such as the root
+  /// context restoring a snapshot, so it is only what this context
+  /// allocated when nothing else used the heap in between.
+  std::uint64_t allocatedBytes() const {
+    return virtualMachine_->allocatedBytes() - allocationBase_;
+  }
+
   // Available externally for jit-to-primitive calls.
   void doPrimitiveCall(Immediate value);
 
+  // Available externally for compiled object stores.
+  void doPopIntoObject(Om::Id slotId);
+
+  // Available externally for compiled calls whose callee returned
+  // tailCallPending(): runs the function it tail called.
+  StackElement resumeTailCall() { return interpret(tailCallTarget_); }
+
   friend std::ostream &operator<<(std::ostream &stream,
                                   const ExecutionContext &ec);
 
@@ -45,11 +66,21 @@ class ExecutionContext {
   friend class VirtualMachine;
   friend class ExecutionContextOffset;
 
-  void doFunctionCall(Immediate value);
+  void doFunctionCall(std::size_t target);
+
+  /// Replace the frame at params with the arguments on top of the stack, for
+  /// the callee of a TAIL_CALL.
+  void doTailCall(StackElement *params, std::size_t argCount);
 
   /// A helper for interpreter-to-jit transitions.
   Om::Value callJitFunction(JitFunction jitFunction, std::size_t argCount);
 
+  /// The trampoline for compiled tail calls. Runs functionIndex if it is
+  /// compiled, then each compiled function it tail calls, in turn. Returns
+  /// true with the result, or false with functionIndex set to the first
+  /// function that must be interpreted, its arguments on top of the stack.
+  bool callCompiled(std::size_t &functionIndex, StackElement &result);
+
   void doFunctionReturn(StackElement returnVal);
 
   Immediate doJmp(Immediate offset);
@@ -76,6 +107,22 @@ class ExecutionContext {
 
   void doIntPushConstant(Immediate value);
 
+  void doIntPushConstantWide(std::int64_t value);
+
+  void doIntMod();
+
+  void doIntAnd();
+
+  void doIntOr();
+
+  void doIntXor();
+
+  void doIntShl();
+
+  void doIntShr();
+
+  void doIntNeg();
+
   void doIntNot();
 
   Immediate doJmpEq(Immediate delta);
@@ -90,23 +137,60 @@ class ExecutionContext {
 
   Immediate doJmpLe(Immediate delta);
 
-  void doStrPushConstant(Immediate value);
+  void doStrPushConstant(std::size_t index);
 
   void doNewObject();
 
   void doPushFromObject(Om::Id slotId);
 
-  void doPopIntoObject(Om::Id slotId);
-
   void doCallIndirect();
 
   void doSystemCollect();
 
+  void doNewIntArray();
+
+  void doIntArrayLoad();
+
+  void doIntArrayStore();
+
+  void doArrayLength();
+
+  void doDblPushConstant(double value);
+
+  void doDblAdd();
+
+  void doDblSub();
+
+  void doDblMul();
+
+  void doDblDiv();
+
+  Immediate doDblJmpEq(Immediate delta);
+
+  Immediate doDblJmpNeq(Immediate delta);
+
+  Immediate doDblJmpGt(Immediate delta);
+
+  Immediate doDblJmpGe(Immediate delta);
+
+  Immediate doDblJmpLt(Immediate delta);
+
+  Immediate doDblJmpLe(Immediate delta);
+
+  void doIntToDbl();
+
+  void doDblToInt();
+
+  Immediate doTableSwitch(const JumpTable &table);
+
   Om::RunContext omContext_;
   OperandStack stack_;
   const Config *cfg_;
   VirtualMachine *virtualMachine_;
   Instruction *programCounter_ = 0;
+  std::size_t tailCallTarget_ = 0;
+  OutputBuffer output_;
+  std::uint64_t allocationBase_;
 };
 
 // static_assert(std::is_standard_layout<ExecutionContext>::value);
@@ -117,8 +201,23 @@ struct ExecutionContextOffset {
   static constexpr std::size_t STACK = offsetof(ExecutionContext, stack_);
   static constexpr std::size_t PROGRAM_COUNTER =
       offsetof(ExecutionContext, programCounter_);
+  static constexpr std::size_t TAIL_CALL_TARGET =
+      offsetof(ExecutionContext, tailCallTarget_);
 };
 
+/// Compiled code that ends in a tail call to another function returns this
+/// in place of a result, after storing the callee in the context and the
+/// arguments over its own. b9 code makes no PTR values, so no result is
+/// ever mistaken for it.
+inline Om::RawValue tailCallPending() {
+  return Om::Value(Om::AS_PTR, static_cast<void *>(nullptr)).raw();
+}
+
+/// Round a double toward zero, as DBL_TO_INT does. Out of range values, which
+/// C++ leaves undefined, give the same result as the x86 conversion compiled
+/// code uses.
+std::int64_t truncateDouble(double value);
+
 }  // namespace b9
 
 #endif  // B9_EXECUTIONCONTEXT_HPP_
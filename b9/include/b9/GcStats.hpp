@@ -0,0 +1,132 @@
+#ifndef B9_GCSTATS_HPP_
+#define B9_GCSTATS_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+struct OMR_VM;
+
+namespace b9 {
+
+/// A histogram of GC pause times. Bucket 0 counts pauses under a
+/// microsecond, and bucket i pauses from 2^(i-1) up to 2^i microseconds.
+/// The last bucket also takes anything longer.
+class PauseHistogram {
+ public:
+  static constexpr std::size_t BUCKETS = 24;
+
+  void record(std::chrono::nanoseconds pause);
+
+  std::uint64_t count() const { return count_; }
+
+  std::chrono::nanoseconds total() const { return total_; }
+
+  std::chrono::nanoseconds max() const { return max_; }
+
+  /// The limit of the bucket holding the pause at this fraction of the way
+  /// through the pauses, in order. Zero with no pauses.
+  std::chrono::microseconds percentile(double fraction) const;
+
+  const std::array<std::uint64_t, BUCKETS> &buckets() const {
+    return buckets_;
+  }
+
+  /// The limit every pause in a bucket is under. The last bucket's is just
+  /// over the longest pause, if that is past the bucket's start.
+  std::chrono::microseconds bucketLimit(std::size_t bucket) const;
+
+ private:
+  std::array<std::uint64_t, BUCKETS> buckets_{};
+  std::uint64_t count_ = 0;
+  std::chrono::nanoseconds total_{0};
+  std::chrono::nanoseconds max_{0};
+};
+
+/// A VM's GC statistics, as of when they were taken. Heap sizes are OMR's
+/// approximations, which are exact right after a collection.
+struct GcStats {
+  std::uint64_t globalCollections = 0;  //< Collections of the whole heap
+  std::uint64_t localCollections = 0;   //< Collections of the nursery
+
+  /// The pauses of both kinds of collection.
+  PauseHistogram pauses;
+
+  std::uint64_t heapSize = 0;   //< The heap's size now
+  std::uint64_t heapUsed = 0;   //< Occupied heap bytes now
+  std::uint64_t liveBytes = 0;  //< Occupied heap bytes after the last GC
+
+  /// Bytes allocated since the VM started, including since-collected ones.
+  std::uint64_t allocatedBytes = 0;
+
+  /// Time since the VM started.
+  std::chrono::nanoseconds uptime{0};
+
+  /// Bytes allocated per second of uptime.
+  double allocationRate() const;
+};
+
+/// A human readable summary, over several lines.
+std::ostream &operator<<(std::ostream &out, const GcStats &stats);
+
+/// The stats as a JSON object. Times are in microseconds.
+void writeJson(std::ostream &out, const GcStats &stats);
+
+/// Gathers the GC statistics of a VM from OMR's GC start and end hooks.
+/// Collections happen on the thread that allocates, so stats are only to be
+/// taken between runs, or from that thread.
+class GcMonitor {
+ public:
+  /// Start monitoring the collections of an OMR VM.
+  explicit GcMonitor(OMR_VM *vm);
+
+  ~GcMonitor() noexcept;
+
+  GcMonitor(const GcMonitor &) = delete;
+
+  GcMonitor &operator=(const GcMonitor &) = delete;
+
+  GcStats stats() const;
+
+  /// Bytes allocated since monitoring started. The difference between two
+  /// readings is what was allocated in between.
+  std::uint64_t allocatedBytes() const;
+
+  /// Called from the hooks.
+  void collectionStarted(bool global);
+
+  /// Called from the hooks.
+  void collectionEnded();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  std::uint64_t heapSize() const;
+
+  std::uint64_t heapUsed() const;
+
+  OMR_VM *vm_;
+  Clock::time_point started_;
+  Clock::time_point collectionStarted_;
+
+  /// Collections in progress. A nursery collection can turn into a global
+  /// one, and the pause lasts until both end.
+  std::size_t depth_ = 0;
+
+  std::uint64_t globalCollections_ = 0;
+  std::uint64_t localCollections_ = 0;
+  PauseHistogram pauses_;
+
+  /// Bytes allocated up to the last collection.
+  std::uint64_t allocatedBefore_ = 0;
+
+  /// Occupied heap bytes after the last collection. Anything occupied since
+  /// was allocated since.
+  std::uint64_t liveBytes_ = 0;
+};
+
+}  // namespace b9
+
+#endif  // B9_GCSTATS_HPP_
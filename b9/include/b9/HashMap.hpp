@@ -0,0 +1,138 @@
+#ifndef B9_HASHMAP_HPP_
+#define B9_HASHMAP_HPP_
+
+#include <b9/IntArray.hpp>
+
+#include <OMR/Om/ArrayBuffer.hpp>
+#include <OMR/Om/Context.hpp>
+#include <OMR/Om/ObjectOperations.hpp>
+#include <OMR/Om/Value.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace b9 {
+
+namespace Om = ::OMR::Om;
+
+/// An open addressing hash table, laid out in one block of memory: this
+/// header, a control byte per slot, then the keys and the values. A control
+/// byte is empty, deleted, or seven bits of the hash of the slot's key, and
+/// lookups compare a group of them at a time, with SIMD where the CPU has it.
+///
+/// Keys and values are raw values. The table holds no references, so the GC
+/// never scans it.
+class HashTable {
+ public:
+  /// Control bytes compared at once. Tables have a whole number of groups.
+  static constexpr std::size_t GROUP = 16;
+
+  /// The bytes taken by a table with room for capacity slots.
+  static std::size_t bytes(std::size_t capacity);
+
+  /// Lay out an empty table in memory of at least bytes(capacity), aligned for
+  /// a 64-bit value. The capacity is a power of two, and at least GROUP.
+  static HashTable *initialize(void *memory, std::size_t capacity);
+
+  std::size_t size() const { return size_; }
+
+  std::size_t capacity() const { return capacity_; }
+
+  /// The key's value, or null if the key is absent.
+  const Om::RawValue *find(Om::RawValue key) const;
+
+  /// Whether another key fits without rehashing.
+  bool hasRoom() const { return (size_ + deleted_ + 1) * 8 <= capacity_ * 7; }
+
+  /// Add or replace a key's value. A new key needs room.
+  void put(Om::RawValue key, Om::RawValue value);
+
+  /// Remove a key. Returns false if it was absent.
+  bool erase(Om::RawValue key);
+
+  /// The capacity to rehash into when out of room. Tables that are mostly
+  /// deleted slots are rehashed at the same size.
+  std::size_t grownCapacity() const {
+    return (size_ + 1) * 16 > capacity_ * 7 ? capacity_ * 2 : capacity_;
+  }
+
+  /// Call f(key, value) for every entry, in slot order.
+  template <typename Function>
+  void forEach(Function f) const {
+    for (std::size_t slot = 0; slot < capacity_; slot++) {
+      if ((control()[slot] & EMPTY) == 0) f(keys()[slot], values()[slot]);
+    }
+  }
+
+  /// Add every entry to another table, which has room for them.
+  void copyInto(HashTable &other) const;
+
+ private:
+  static constexpr std::uint8_t EMPTY = 0x80;
+  static constexpr std::uint8_t DELETED = 0xFE;
+  static constexpr std::size_t NOT_FOUND = SIZE_MAX;
+
+  std::size_t slotOf(Om::RawValue key, std::uint64_t hash) const;
+
+  const std::uint8_t *control() const {
+    return reinterpret_cast<const std::uint8_t *>(this + 1);
+  }
+
+  std::uint8_t *control() { return reinterpret_cast<std::uint8_t *>(this + 1); }
+
+  const Om::RawValue *keys() const {
+    return reinterpret_cast<const Om::RawValue *>(control() + capacity_);
+  }
+
+  Om::RawValue *keys() {
+    return reinterpret_cast<Om::RawValue *>(control() + capacity_);
+  }
+
+  const Om::RawValue *values() const { return keys() + capacity_; }
+
+  Om::RawValue *values() { return keys() + capacity_; }
+
+  std::uint64_t capacity_;
+  std::uint64_t size_;
+  std::uint64_t deleted_;
+};
+
+/// Hash maps are objects with a single slot, which holds the map's table in
+/// an array buffer. Every map has the same shape, however many keys it holds.
+/// Growing a map replaces its buffer.
+///
+/// Keys are ints or strings. Strings are interned, so a string key is
+/// compared by its id. Values are anything but references: the GC does not
+/// scan the table, so a map can't hold objects, arrays or other maps.
+using HashMap = Om::Object;
+
+/// The id of the table slot. Object bytecodes have 24-bit immediates, which
+/// can't name it.
+constexpr Om::Id HASH_MAP_TABLE_SLOT{0x100'0000};
+
+inline bool isHashMapKey(Om::Value key) {
+  return key.isInt48() || key.isUint48();
+}
+
+inline bool isHashMapValue(Om::Value value) {
+  return !value.isRef() && !value.isPtr();
+}
+
+/// Whether a value references a map: an object with a table slot. The kind
+/// is checked first, since only objects have slots.
+bool isHashMap(Om::RunContext &cx, Om::Value value);
+
+/// Allocate an empty map. May trigger a GC.
+HashMap *allocateHashMap(Om::RunContext &cx);
+
+/// The table of a map. Throws std::runtime_error if the object is not a map.
+HashTable &hashMapTable(Om::RunContext &cx, HashMap *map);
+
+/// Add or replace a key's value. May trigger a GC, when the map grows.
+/// Throws std::runtime_error if the key or value can't go in a map.
+void hashMapPut(Om::RunContext &cx, HashMap *map, Om::Value key,
+                Om::Value value);
+
+}  // namespace b9
+
+#endif  // B9_HASHMAP_HPP_
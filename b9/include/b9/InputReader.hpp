@@ -0,0 +1,90 @@
+#ifndef B9_INPUTREADER_HPP_
+#define B9_INPUTREADER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+struct InputException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// Reads a file one record at a time, for the input primitives. Regular files
+/// are mapped into memory, and records point straight into the mapping.
+/// Pipes and terminals are read into a buffer in chunks instead.
+class InputReader {
+ public:
+  /// How far ahead of the reader the kernel is asked to read a mapped file,
+  /// and how much is read at once from a stream.
+  static constexpr std::size_t CHUNK_SIZE = 4 * 1024 * 1024;
+
+  /// Open a file, or standard input for "-". Throws InputException.
+  explicit InputReader(const std::string &path);
+
+  /// Read from an open file descriptor, which the reader takes over.
+  explicit InputReader(int fd);
+
+  InputReader(const InputReader &) = delete;
+
+  InputReader &operator=(const InputReader &) = delete;
+
+  ~InputReader() noexcept;
+
+  /// Advance to the next record, which ends before the next delimiter or at
+  /// the end of input. Returns false when there are no records left.
+  bool nextRecord(char delimiter = '\n');
+
+  /// The current record, which stays valid until the reader advances.
+  const char *record() const { return data_ + record_; }
+
+  std::size_t recordSize() const { return recordSize_; }
+
+  /// Parse the next integer, skipping anything that is not part of one.
+  /// Returns false at the end of input.
+  bool readInt(std::int64_t &value);
+
+  /// Read up to count integers. Returns how many were read.
+  std::size_t readInts(std::int64_t *values, std::size_t count);
+
+  bool atEnd();
+
+  bool isMapped() const { return mapping_ != nullptr; }
+
+ private:
+  void open(int fd);
+
+  /// Make more input available, discarding anything before keep. Offsets at
+  /// or after keep are moved down by the number of bytes discarded. Returns
+  /// false at the end of input.
+  bool fill(std::size_t &keep);
+
+  /// Ask the kernel to read ahead of the reader, and to drop what is far
+  /// behind it.
+  void advise();
+
+  int fd_ = -1;
+  bool ownsFd_ = true;
+  void *mapping_ = nullptr;
+  const char *data_ = nullptr;
+  std::size_t size_ = 0;
+  std::size_t position_ = 0;
+  std::size_t record_ = 0;
+  std::size_t recordSize_ = 0;
+  std::size_t advised_ = 0;
+  std::size_t dropped_ = 0;
+  bool eof_ = false;
+  std::vector<char> buffer_;
+};
+
+/// Parse the integer in a whitespace separated field of a record, counting
+/// fields from 0. Returns 0 when the field is missing or not a number.
+std::int64_t parseField(const char *record, std::size_t size,
+                        std::size_t field);
+
+}  // namespace b9
+
+#endif  // B9_INPUTREADER_HPP_
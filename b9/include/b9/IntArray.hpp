@@ -0,0 +1,60 @@
+#ifndef B9_INTARRAY_HPP_
+#define B9_INTARRAY_HPP_
+
+#include <OMR/Om/ArrayBuffer.hpp>
+#include <OMR/Om/ArrayBufferOperations.hpp>
+#include <OMR/Om/Cell.hpp>
+#include <OMR/Om/Context.hpp>
+#include <OMR/Om/Map.hpp>
+#include <OMR/Om/Value.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace b9 {
+
+namespace Om = ::OMR::Om;
+
+/// Int arrays are Om array buffers of unboxed int64s. A buffer holds no
+/// references, so the GC never scans the elements. An array's length is
+/// fixed when it is allocated.
+using IntArray = Om::ArrayBuffer;
+
+/// Whether a value references an int array, rather than an object. A
+/// reference's kind is in its cell's map.
+inline bool isIntArray(Om::Value value) {
+  return value.isRef() && value.getRef<Om::Cell>()->map()->kind() ==
+                              Om::MapKind::ARRAY_BUFFER_MAP;
+}
+
+/// Whether a value references an object. Values only ever reference objects
+/// and int arrays.
+inline bool isObject(Om::Value value) {
+  return value.isRef() && !isIntArray(value);
+}
+
+/// Allocate an array of zeros. May trigger a GC.
+inline IntArray *allocateIntArray(Om::RunContext &cx, std::size_t length) {
+  auto array = Om::allocateArrayBuffer(cx, length * sizeof(std::int64_t));
+  std::memset(array->data, 0, array->size);
+  return array;
+}
+
+inline std::size_t intArrayLength(const IntArray *array) {
+  return array->size / sizeof(std::int64_t);
+}
+
+inline std::int64_t *intArrayData(IntArray *array) {
+  return reinterpret_cast<std::int64_t *>(array->data);
+}
+
+/// The layout of an int array, for compiled code.
+struct IntArrayOffset {
+  static constexpr std::size_t SIZE = offsetof(IntArray, size);
+  static constexpr std::size_t DATA = offsetof(IntArray, data);
+};
+
+}  // namespace b9
+
+#endif  // B9_INTARRAY_HPP_
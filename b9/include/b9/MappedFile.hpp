@@ -0,0 +1,35 @@
+#ifndef B9_MAPPEDFILE_HPP_
+#define B9_MAPPEDFILE_HPP_
+
+#include <cstddef>
+#include <string>
+
+namespace b9 {
+
+/// A read-only mapping of a whole file. An empty file has no data.
+class MappedFile {
+ public:
+  /// Throws std::system_error if the file cannot be opened or mapped.
+  explicit MappedFile(const std::string &path);
+
+  MappedFile(const MappedFile &) = delete;
+
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() noexcept;
+
+  const char *data() const { return static_cast<const char *>(data_); }
+
+  std::size_t size() const { return size_; }
+
+  /// Tell the kernel how the mapping will be read, as for madvise.
+  void advise(int advice) const;
+
+ private:
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+}  // namespace b9
+
+#endif  // B9_MAPPEDFILE_HPP_
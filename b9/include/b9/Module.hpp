@@ -4,7 +4,9 @@
 #include <b9/instructions.hpp>
 
 #include <cstdint>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -15,6 +17,10 @@ class Compiler;
 class ExecutionContext;
 class VirtualMachine;
 
+/// The range of the integer constants, which are pushed as int48s.
+constexpr std::int64_t INT48_MIN = -0x8000'0000'0000;
+constexpr std::int64_t INT48_MAX = 0x7FFF'FFFF'FFFF;
+
 // Function Definition
 
 struct FunctionDef {
@@ -24,8 +30,33 @@ struct FunctionDef {
   std::uint32_t nlocals;
 };
 
+/// Print a double quoted string, escaping the characters the assembler
+/// requires.
+inline void printQuoted(std::ostream& out, const std::string& string) {
+  out << '"';
+  for (char c : string) {
+    switch (c) {
+      case '"':
+      case '\\':
+        out << '\\' << c;
+        break;
+      case '\n':
+        out << "\\n";
+        break;
+      case '\t':
+        out << "\\t";
+        break;
+      default:
+        out << c;
+    }
+  }
+  out << '"';
+}
+
 inline void operator<<(std::ostream& out, const FunctionDef& f) {
-  out << "(function \"" << f.name << "\" " << f.nparams << " " << f.nlocals;
+  out << "(function ";
+  printQuoted(out, f.name);
+  out << " " << f.nparams << " " << f.nlocals;
   std::size_t i = 0;
   for (auto instruction : f.instructions) {
     out << std::endl << "  " << i << "  " << instruction;
@@ -39,6 +70,20 @@ inline bool operator==(const FunctionDef& lhs, const FunctionDef& rhs) {
          lhs.nlocals == rhs.nlocals;
 }
 
+/// The targets of a TABLE_SWITCH. The value low selects offsets[0], and any
+/// value not in the table takes the default. Offsets are relative to the
+/// TABLE_SWITCH, as for the other jumps.
+struct JumpTable {
+  std::int32_t low;
+  std::int32_t defaultOffset;
+  std::vector<std::int32_t> offsets;
+};
+
+inline bool operator==(const JumpTable& lhs, const JumpTable& rhs) {
+  return lhs.low == rhs.low && lhs.defaultOffset == rhs.defaultOffset &&
+         lhs.offsets == rhs.offsets;
+}
+
 /// Function not found exception.
 struct FunctionNotFoundException : public std::runtime_error {
   using std::runtime_error::runtime_error;
@@ -47,12 +92,63 @@ struct FunctionNotFoundException : public std::runtime_error {
 // Primitive Function from Interpreter call
 extern "C" typedef void(PrimitiveFunction)(ExecutionContext* context);
 
+/// A source of FunctionDefs that are built on first use, rather than when the
+/// module is loaded. Returned references stay valid for the loader's lifetime.
+class FunctionLoader {
+ public:
+  virtual ~FunctionLoader() = default;
+
+  virtual std::size_t functionCount() const = 0;
+
+  virtual const FunctionDef& getFunction(std::size_t index) = 0;
+
+  /// Find a function by name, without materializing it.
+  virtual bool findFunction(const std::string& name,
+                            std::size_t& index) const = 0;
+};
+
 /// An interpreter module.
+///
+/// A FUNCTION_CALL or TAIL_CALL immediate indexes the module's functions,
+/// followed by its imports. Imports are resolved by name against the exports
+/// of previously loaded modules when the module is loaded into a
+/// VirtualMachine.
 struct Module {
   std::vector<FunctionDef> functions;
   std::vector<std::string> strings;
+  std::vector<std::string> imports;
+  std::vector<std::string> exports;
+
+  /// Constant doubles, pushed by DBL_PUSH_CONSTANT.
+  std::vector<double> doubles;
+
+  /// Constant integers too wide for an immediate, pushed by
+  /// INT_PUSH_CONSTANT_WIDE. Each fits in an int48.
+  std::vector<std::int64_t> integers;
+
+  /// Jump tables, used by TABLE_SWITCH.
+  std::vector<JumpTable> jumpTables;
+
+  /// When set, functions are materialized on demand by the loader, and the
+  /// functions vector is unused.
+  std::shared_ptr<FunctionLoader> loader;
+
+  std::size_t functionCount() const {
+    return loader ? loader->functionCount() : functions.size();
+  }
+
+  const FunctionDef& getFunction(std::size_t index) const {
+    return loader ? loader->getFunction(index) : functions[index];
+  }
 
   std::size_t getFunctionIndex(const std::string& name) const {
+    if (loader) {
+      std::size_t index;
+      if (loader->findFunction(name, index)) {
+        return index;
+      }
+      throw FunctionNotFoundException{name};
+    }
     for (std::size_t i = 0; i < functions.size(); i++) {
       if (functions[i].name == name) {
         return i;
@@ -63,19 +159,55 @@ struct Module {
 };
 
 inline void operator<<(std::ostream& out, const Module& m) {
-  int32_t index = 0;
-  for (auto function : m.functions) {
-    out << function;
-    ++index;
+  for (auto name : m.imports) {
+    out << "(import ";
+    printQuoted(out, name);
+    out << ")" << std::endl;
+  }
+  for (auto name : m.exports) {
+    out << "(export ";
+    printQuoted(out, name);
+    out << ")" << std::endl;
+  }
+  if (!m.imports.empty() || !m.exports.empty()) {
+    out << std::endl;
+  }
+  for (std::size_t i = 0; i < m.functionCount(); i++) {
+    out << m.getFunction(i);
   }
   for (auto string : m.strings) {
-    out << "(string \"" << string << "\")" << std::endl;
+    out << "(string ";
+    printQuoted(out, string);
+    out << ")" << std::endl;
+  }
+  for (auto value : m.doubles) {
+    out << "(double " << std::setprecision(17) << value << ")" << std::endl;
+  }
+  for (auto value : m.integers) {
+    out << "(integer " << value << ")" << std::endl;
+  }
+  for (auto& table : m.jumpTables) {
+    out << "(jump_table " << table.low << " " << table.defaultOffset;
+    for (auto offset : table.offsets) {
+      out << " " << offset;
+    }
+    out << ")" << std::endl;
   }
   out << std::endl;
 }
 
 inline bool operator==(const Module& lhs, const Module& rhs) {
-  return lhs.functions == rhs.functions && lhs.strings == rhs.strings;
+  if (lhs.functionCount() != rhs.functionCount()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < lhs.functionCount(); i++) {
+    if (!(lhs.getFunction(i) == rhs.getFunction(i))) {
+      return false;
+    }
+  }
+  return lhs.strings == rhs.strings && lhs.imports == rhs.imports &&
+         lhs.exports == rhs.exports && lhs.doubles == rhs.doubles &&
+         lhs.integers == rhs.integers && lhs.jumpTables == rhs.jumpTables;
 }
 
 }  // namespace b9
@@ -0,0 +1,111 @@
+#ifndef B9_OUTPUTSINK_HPP_
+#define B9_OUTPUTSINK_HPP_
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+/// Where the print primitives' output goes. Execution contexts collect
+/// output in an OutputBuffer, and hand it to the sink in large batches.
+class OutputSink {
+ public:
+  virtual ~OutputSink() = default;
+
+  /// Write a batch of pieces, in order. Batches are never interleaved.
+  virtual void write(const struct iovec *pieces, std::size_t count) = 0;
+};
+
+/// Writes to a file descriptor, with one writev per batch.
+class FdOutputSink : public OutputSink {
+ public:
+  explicit FdOutputSink(int fd) : fd_(fd) {}
+
+  /// Throws std::system_error if the write fails.
+  void write(const struct iovec *pieces, std::size_t count) override;
+
+ private:
+  int fd_;
+  std::mutex mutex_;
+};
+
+/// Collects output in memory, for embedders and tests.
+class StringOutputSink : public OutputSink {
+ public:
+  void write(const struct iovec *pieces, std::size_t count) override;
+
+  std::string str() const;
+
+  void clear();
+
+ private:
+  std::string output_;
+  mutable std::mutex mutex_;
+};
+
+/// The output of one execution context that has not been written yet.
+/// Strings that live as long as the VM, such as interned strings, are
+/// referenced rather than copied.
+class OutputBuffer {
+ public:
+  /// Flush once this many bytes are waiting.
+  static constexpr std::size_t FLUSH_THRESHOLD = 64 * 1024;
+
+  explicit OutputBuffer(OutputSink &sink) : sink_(&sink) {}
+
+  ~OutputBuffer() noexcept;
+
+  /// Write pending output to sink, and continue with a new one.
+  void redirect(OutputSink &sink);
+
+  /// Add a string that stays valid until the buffer is flushed.
+  void appendStable(const char *data, std::size_t size);
+
+  /// Add a copy of a string.
+  void append(const char *data, std::size_t size);
+
+  void append(const std::string &string) {
+    append(string.data(), string.size());
+  }
+
+  /// Add anything that can be written to an ostream.
+  template <typename T>
+  void print(const T &value) {
+    if (formatter_ == nullptr) {
+      formatter_ = std::make_unique<std::ostringstream>();
+    }
+    formatter_->str("");
+    *formatter_ << value;
+    append(formatter_->str());
+  }
+
+  /// Write everything pending to the sink.
+  void flush();
+
+  std::size_t pending() const { return size_; }
+
+ private:
+  /// Pieces with a null data point into text_, at offset.
+  struct Piece {
+    const char *data;
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  void added(std::size_t size);
+
+  OutputSink *sink_;
+  std::vector<Piece> pieces_;
+  std::string text_;
+  std::size_t size_ = 0;
+  std::unique_ptr<std::ostringstream> formatter_;
+};
+
+}  // namespace b9
+
+#endif  // B9_OUTPUTSINK_HPP_
@@ -0,0 +1,104 @@
+#ifndef B9_STRINGTABLE_HPP_
+#define B9_STRINGTABLE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace b9 {
+
+/// A string, stored once per VM. Its hash and length are computed once, when
+/// it is interned.
+struct InternedString {
+  static constexpr std::uint32_t UNRANKED = UINT32_MAX;
+
+  std::string string;
+  std::size_t hash;
+
+  /// The position of the string in sorted order, among the strings ranked
+  /// together with it.
+  std::uint32_t rank;
+
+  /// Kept for the life of the VM, rather than released when the run that
+  /// made it ends.
+  bool permanent;
+
+  std::size_t length() const { return string.size(); }
+};
+
+/// The VM's interned strings. A string value is the id of an interned string,
+/// so two string values are equal exactly when their ids are.
+///
+/// Constants are permanent. Strings made while running are temporary, and
+/// released when the run ends, unless kept because they escaped the run. The
+/// ids of released strings are reused, so a temporary id must not outlive
+/// its run.
+class StringTable {
+ public:
+  /// The id of a string, interning it permanently if it is new, and keeping
+  /// it if it was temporary.
+  std::size_t intern(const std::string &string);
+
+  /// The id of a string, interning it as a temporary if it is new.
+  std::size_t internTemporary(const std::string &string);
+
+  /// Make a string permanent, so it outlives the current run.
+  void keep(std::size_t id);
+
+  /// Release the temporaries that were not kept, and reuse their ids.
+  void releaseTemporaries();
+
+  const InternedString &get(std::size_t id) const { return strings_[id]; }
+
+  /// The number of ids, including those free for reuse.
+  std::size_t size() const { return strings_.size(); }
+
+  /// Rank the permanent strings, so that ordering them is an integer compare.
+  /// Done when a module has been loaded. Only strings made permanent since
+  /// the last call are sorted, and merged into the existing order. Other
+  /// strings are compared by content.
+  void rank();
+
+  /// Compare two strings, returning less than, equal to, or greater than
+  /// zero, like std::string::compare.
+  int compare(std::size_t left, std::size_t right) const {
+    if (left == right) {
+      return 0;
+    }
+    const auto &l = strings_[left];
+    const auto &r = strings_[right];
+    if (l.rank != InternedString::UNRANKED &&
+        r.rank != InternedString::UNRANKED) {
+      return l.rank < r.rank ? -1 : 1;
+    }
+    return l.string.compare(r.string);
+  }
+
+ private:
+  std::size_t find(const std::string &string, std::size_t hash) const;
+
+  std::size_t add(const std::string &string, std::size_t hash,
+                  bool permanent);
+
+  std::deque<InternedString> strings_;
+  std::unordered_multimap<std::size_t, std::size_t> index_;
+
+  /// The ranked strings, in order.
+  std::vector<std::size_t> ranked_;
+
+  /// Permanent strings not yet ranked.
+  std::vector<std::size_t> unranked_;
+
+  /// Strings interned as temporaries since they were last released.
+  std::vector<std::size_t> temporaries_;
+
+  /// Ids free for reuse.
+  std::vector<std::size_t> free_;
+};
+
+}  // namespace b9
+
+#endif  // B9_STRINGTABLE_HPP_
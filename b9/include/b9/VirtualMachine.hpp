@@ -1,10 +1,17 @@
 #ifndef B9_VIRTUALMACHINE_HPP_
 #define B9_VIRTUALMACHINE_HPP_
 
+#include <b9/CodeArena.hpp>
+#include <b9/GcStats.hpp>
+#include <b9/InputReader.hpp>
+#include <b9/IntArray.hpp>
 #include <b9/Module.hpp>
 #include <b9/OperandStack.hpp>
+#include <b9/OutputSink.hpp>
+#include <b9/StringTable.hpp>
 #include <b9/compiler/Compiler.hpp>
 #include <b9/instructions.hpp>
+#include <b9/primitives.hpp>
 
 #include <OMR/Om/Context.inl.hpp>
 #include <OMR/Om/MemorySystem.hpp>
@@ -14,17 +21,76 @@
 #include <OMR/Om/ShapeOperations.hpp>
 #include <OMR/Om/Value.hpp>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 extern "C" {
 b9::PrimitiveFunction b9_prim_print_string;
 b9::PrimitiveFunction b9_prim_print_number;
 b9::PrimitiveFunction b9_prim_print_stack;
+b9::PrimitiveFunction b9_prim_string_concat;
+b9::PrimitiveFunction b9_prim_string_substring;
+b9::PrimitiveFunction b9_prim_string_length;
+b9::PrimitiveFunction b9_prim_int_to_string;
+b9::PrimitiveFunction b9_prim_builder_new;
+b9::PrimitiveFunction b9_prim_builder_append;
+b9::PrimitiveFunction b9_prim_builder_to_string;
+b9::PrimitiveFunction b9_prim_flush_output;
+b9::PrimitiveFunction b9_prim_input_open;
+b9::PrimitiveFunction b9_prim_input_close;
+b9::PrimitiveFunction b9_prim_input_next_line;
+b9::PrimitiveFunction b9_prim_input_next_record;
+b9::PrimitiveFunction b9_prim_input_record_string;
+b9::PrimitiveFunction b9_prim_input_record_byte;
+b9::PrimitiveFunction b9_prim_input_record_find;
+b9::PrimitiveFunction b9_prim_input_record_int;
+b9::PrimitiveFunction b9_prim_input_read_int;
+b9::PrimitiveFunction b9_prim_input_at_end;
+
+// Fast primitives over int arrays
+OMR::Om::RawValue b9_prim_array_sum(b9::ExecutionContext *, OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_min(b9::ExecutionContext *, OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_max(b9::ExecutionContext *, OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_fill(b9::ExecutionContext *, OMR::Om::RawValue,
+                                     OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_copy(b9::ExecutionContext *, OMR::Om::RawValue,
+                                     OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_compare(b9::ExecutionContext *,
+                                        OMR::Om::RawValue, OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_find(b9::ExecutionContext *, OMR::Om::RawValue,
+                                     OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_prefix_sum(b9::ExecutionContext *,
+                                           OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_add_scalar(
+    b9::ExecutionContext *, OMR::Om::RawValue, OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_mul_scalar(
+    b9::ExecutionContext *, OMR::Om::RawValue, OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_add(b9::ExecutionContext *, OMR::Om::RawValue,
+                                    OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_array_mul(b9::ExecutionContext *, OMR::Om::RawValue,
+                                    OMR::Om::RawValue);
+
+// Fast primitives over hash maps
+OMR::Om::RawValue b9_prim_map_new(b9::ExecutionContext *);
+OMR::Om::RawValue b9_prim_map_get(b9::ExecutionContext *, OMR::Om::RawValue,
+                                  OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_map_has(b9::ExecutionContext *, OMR::Om::RawValue,
+                                  OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_map_put(b9::ExecutionContext *, OMR::Om::RawValue,
+                                  OMR::Om::RawValue, OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_map_delete(b9::ExecutionContext *, OMR::Om::RawValue,
+                                     OMR::Om::RawValue);
+OMR::Om::RawValue b9_prim_map_size(b9::ExecutionContext *, OMR::Om::RawValue);
 }
 
 namespace b9 {
@@ -35,6 +101,38 @@ class Compiler;
 class ExecutionContext;
 class VirtualMachine;
 
+/// The OMR GC policies a VM can run with.
+enum class GcPolicy {
+  OPTTHRUPUT,   //< Mark and sweep the whole heap
+  OPTAVGPAUSE,  //< Mark concurrently with the program, then sweep
+  GENCON,       //< Copy a nursery, and mark and sweep the tenured heap
+};
+
+inline const char *toString(GcPolicy policy) {
+  switch (policy) {
+    case GcPolicy::OPTTHRUPUT:
+      return "optthruput";
+    case GcPolicy::OPTAVGPAUSE:
+      return "optavgpause";
+    case GcPolicy::GENCON:
+      return "gencon";
+  }
+  return "unknown";
+}
+
+/// Parse a policy by its name, as toString gives it. Returns false for
+/// unknown names.
+inline bool parseGcPolicy(const char *name, GcPolicy &policy) {
+  for (auto p :
+       {GcPolicy::OPTTHRUPUT, GcPolicy::OPTAVGPAUSE, GcPolicy::GENCON}) {
+    if (std::strcmp(name, toString(p)) == 0) {
+      policy = p;
+      return true;
+    }
+  }
+  return false;
+}
+
 struct Config {
   std::size_t maxInlineDepth = 0;  //< The JIT's max inline depth
   bool jit = false;                //< Enable the JIT
@@ -43,24 +141,85 @@ struct Config {
   bool lazyVmState = false;        //< Simulate the VM state
   bool debug = false;              //< Enable debug code
   bool verbose = false;            //< Enable verbose printing and tracing
+  GcPolicy gcPolicy = GcPolicy::OPTTHRUPUT;  //< The GC policy
+  std::size_t nurserySize = 0;  //< Gencon's nursery bytes, 0 for the default
+  std::size_t initialHeapSize = 0;  //< Initial heap bytes, 0 for the default
+  std::size_t maxHeapSize = 0;      //< Maximum heap bytes, 0 for the default
+  double minHeapFree = 0.3;  //< Expand the heap when less is free after a GC
+  double maxHeapFree = 0.6;  //< Shrink the heap when more is free after a GC
 };
 
 inline std::ostream &operator<<(std::ostream &out, const Config &cfg) {
+  auto size = [](std::size_t bytes) {
+    return bytes == 0 ? std::string("default") : std::to_string(bytes);
+  };
   out << std::boolalpha;
   out << "Mode:         " << (cfg.jit ? "JIT" : "Interpreter") << std::endl
       << "Inline depth: " << cfg.maxInlineDepth << std::endl
       << "directcall:   " << cfg.directCall << std::endl
       << "passparam:    " << cfg.passParam << std::endl
       << "lazyvmstate:  " << cfg.lazyVmState << std::endl
-      << "debug:        " << cfg.debug;
+      << "debug:        " << cfg.debug << std::endl
+      << "gcpolicy:     " << toString(cfg.gcPolicy) << std::endl
+      << "heap size:    " << size(cfg.initialHeapSize) << " initial, "
+      << size(cfg.maxHeapSize) << " max" << std::endl
+      << "heap free:    " << cfg.minHeapFree << " min, " << cfg.maxHeapFree
+      << " max";
+  if (cfg.gcPolicy == GcPolicy::GENCON) {
+    out << std::endl << "nursery:      " << size(cfg.nurserySize);
+  }
   out << std::noboolalpha;
   return out;
 }
 
+/// The GC options a config gives OMR's GC, in OMR's command line form.
+std::string gcOptions(const Config &cfg);
+
 struct BadFunctionCallException : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+/// Failure to link a module into the VM: an unresolved import or export, or
+/// reloading a module that was never loaded.
+struct LinkException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/// A module that has been loaded into a VirtualMachine. Functions of all
+/// loaded modules share one index space in the VM, and their strings are
+/// interned in the VM's string table. A LinkedModule is
+/// never modified once loaded: reloading a module links a new one, and VM
+/// function indexes are never reused, so code that is already running keeps
+/// seeing the old version.
+struct LinkedModule {
+  std::shared_ptr<const Module> module;
+
+  /// The VM string id of each of the module's constant strings.
+  std::vector<std::size_t> strings;
+
+  /// The VM function index for each FUNCTION_CALL or TAIL_CALL immediate: the
+  /// module's own functions, followed by its resolved imports.
+  std::vector<std::size_t> callTargets;
+
+  /// VM function indexes by name, for modules without a name index of their
+  /// own.
+  std::unordered_map<std::string, std::size_t> functionIndex;
+
+  /// VM function indexes of the exported functions, by name.
+  std::unordered_map<std::string, std::size_t> exports;
+
+  /// The bytecode of the functions this module added to the VM.
+  CodeArena code;
+};
+
+/// A function resolved ahead of time. Running through a handle skips the
+/// lookup by name. A handle keeps running the same version of a function
+/// after its module is reloaded.
+struct FunctionHandle {
+  std::size_t index;
+  const FunctionDef *function;
+};
+
 extern "C" typedef Om::RawValue (*JitFunction)(void *executionContext, ...);
 
 class VirtualMachine {
@@ -69,33 +228,167 @@ class VirtualMachine {
 
   ~VirtualMachine() noexcept;
 
-  /// Load a module into the VM.
+  /// Load a module into the VM, alongside any modules already loaded. The
+  /// module's imports are linked against the exports of the loaded modules.
+  /// Throws LinkException.
   void load(std::shared_ptr<const Module> module);
 
+  /// Replace a loaded module with a new version, without discarding the heap
+  /// or the code of the functions that did not change. Functions are matched
+  /// by name. A function keeps its VM index, and its compiled code, when its
+  /// bytecode hash is unchanged and everything it calls is kept too. Other
+  /// functions, including callers in modules that import the changed ones,
+  /// get new indexes. Calls that are already running finish on the old
+  /// version. With the JIT enabled, the new functions are compiled in the
+  /// background. Throws LinkException, leaving the VM unchanged.
+  void reload(const std::shared_ptr<const Module> &oldVersion,
+              std::shared_ptr<const Module> newVersion);
+
   StackElement run(const std::size_t index,
                    const std::vector<StackElement> &usrArgs);
 
   StackElement run(const std::string &name,
                    const std::vector<StackElement> &usrArgs);
 
-  const FunctionDef *getFunction(std::size_t index);
+  StackElement run(FunctionHandle function,
+                   const std::vector<StackElement> &usrArgs);
 
-  PrimitiveFunction *getPrimitive(std::size_t index);
+  const FunctionDef *getFunction(std::size_t index) {
+    return functionTable_.definition[index];
+  }
+
+  /// The first instruction of a function, in its module's code arena.
+  const Instruction *getEntry(std::size_t index) {
+    return functionTable_.entry[index];
+  }
+
+  std::uint32_t getParamCount(std::size_t index) {
+    return functionTable_.nparams[index];
+  }
+
+  std::uint32_t getLocalCount(std::size_t index) {
+    return functionTable_.nlocals[index];
+  }
+
+  /// The loaded module that defines a function.
+  const LinkedModule &functionModule(std::size_t functionIndex) {
+    return *functionTable_.module[functionIndex];
+  }
+
+  /// Find a function by name. Modules loaded later shadow those loaded
+  /// earlier. Throws FunctionNotFoundException.
+  std::size_t getFunctionIndex(const std::string &name);
+
+  /// Resolve a function by name, for repeated calls through run.
+  FunctionHandle getFunctionHandle(const std::string &name);
+
+  /// Register a primitive that takes its arguments from the operand stack,
+  /// and pushes its result. Returns its PRIMITIVE_CALL index. Throws
+  /// std::invalid_argument if the name is taken.
+  std::size_t registerPrimitive(const std::string &name,
+                                PrimitiveFunction *function);
+
+  /// Register a primitive that is called with its arguments directly. The
+  /// interpreter checks the argument types, and the JIT calls it without
+  /// going through the operand stack. Throws std::invalid_argument if the
+  /// name is taken or there are too many parameters.
+  std::size_t registerPrimitive(const std::string &name,
+                                FastPrimitiveFunction function,
+                                PrimitiveSignature signature);
+
+  const Primitive &getPrimitive(std::size_t index) {
+    return primitives_[index];
+  }
+
+  /// Throws std::out_of_range if no primitive has the name.
+  std::size_t getPrimitiveIndex(const std::string &name) {
+    return primitiveIndex_.at(name);
+  }
+
+  std::size_t getPrimitiveCount() { return primitives_.size(); }
+
+  JitFunction getJitAddress(std::size_t functionIndex) {
+    if (functionIndex >= functionTable_.jitAddress.size()) {
+      return nullptr;
+    }
+    return functionTable_.jitAddress[functionIndex];
+  }
+
+  void setJitAddress(std::size_t functionIndex, JitFunction value) {
+    functionTable_.jitAddress[functionIndex] = value;
+  }
+
+  std::size_t getFunctionCount() { return functionTable_.module.size(); }
 
-  JitFunction getJitAddress(std::size_t functionIndex);
+  JitFunction generateCode(const std::size_t functionIndex);
 
-  void setJitAddress(std::size_t functionIndex, JitFunction value);
+  void generateAllCode();
 
-  std::size_t getFunctionCount();
+  /// Queue a function for compilation on the background compiler thread.
+  /// Finished code is installed the next time run is called.
+  void compileInBackground(std::size_t functionIndex);
 
-  JitFunction generateCode(const std::size_t functionIndex);
+  /// Wait for the background compiler to go idle, and install its code.
+  void finishBackgroundCompilation();
 
-  void generateAllCode();
+  const std::string &getString(int index) {
+    return strings_.get(index).string;
+  }
+
+  std::size_t getStringCount() const { return strings_.size(); }
+
+  StringTable &strings() { return strings_; }
+
+  /// Make a string value permanent. Strings made during a run are released
+  /// when it ends, so those that escape into the heap, or are returned, are
+  /// kept. Values that are not strings are ignored.
+  void keepString(Om::Value value) {
+    if (value.isUint48() && value.getUint48() < strings_.size()) {
+      strings_.keep(value.getUint48());
+    }
+  }
+
+  /// Create an empty string builder, returning its handle. A handle holds
+  /// the builder's slot and the slot's generation, which changes whenever
+  /// the builder is released, so a stale handle is never taken for the
+  /// slot's next builder. Small integers are never handles.
+  std::int64_t newStringBuilder();
+
+  /// The buffer of a string builder. Throws std::runtime_error if the handle
+  /// is not a live builder's.
+  std::string &stringBuilder(std::int64_t handle);
+
+  /// Intern the contents of a builder, and release it. Returns the string id.
+  std::size_t finishStringBuilder(std::int64_t handle);
+
+  /// Release the builders that were never finished. Done when a run ends.
+  void releaseStringBuilders();
 
-  const std::string &getString(int index);
+  /// Open a file for the input primitives, returning its id. Throws
+  /// InputException.
+  std::size_t openInput(const std::string &path);
 
+  /// Throws InputException if the id is not an open input.
+  InputReader &input(std::size_t id);
+
+  void closeInput(std::size_t id);
+
+  /// Where the print primitives write. Each context buffers its output, and
+  /// writes it out in order when the buffer fills, at the end of run, or
+  /// through the flush_output primitive. Defaults to stdout.
+  OutputSink &output() { return *output_; }
+
+  /// Send output to a new sink. Contexts created afterwards, and the root
+  /// context, write to it. Not to be called while a function is running.
+  void setOutput(std::shared_ptr<OutputSink> sink);
+
+  /// The most recently loaded module.
   const std::shared_ptr<const Module> &module() { return module_; }
 
+  const std::vector<std::unique_ptr<LinkedModule>> &modules() const {
+    return modules_;
+  }
+
   Om::MemorySystem &memoryManager() { return memoryManager_; }
 
   const Om::MemorySystem &memoryManager() const { return memoryManager_; }
@@ -104,15 +397,107 @@ class VirtualMachine {
 
   const Config &config() { return cfg_; }
 
+  /// Values that stay alive, and are updated when the GC moves objects, for
+  /// the lifetime of the VM.
+  std::vector<Om::Value> &roots() { return roots_; }
+
+  /// A long lived context for work on the heap outside of run, such as
+  /// restoring a snapshot. The roots are marked through this context.
+  ExecutionContext &rootContext();
+
+  /// The GC's statistics since the VM started. The monitor starts after the
+  /// root context is made, and until then, like allocatedBytes, these are
+  /// all zero.
+  GcStats gcStats() const {
+    return gcMonitor_ ? gcMonitor_->stats() : GcStats{};
+  }
+
+  /// Bytes allocated on the heap since the VM started.
+  std::uint64_t allocatedBytes() const {
+    return gcMonitor_ ? gcMonitor_->allocatedBytes() : 0;
+  }
+
  private:
-  static constexpr PrimitiveFunction *const primitives_[] = {
-      b9_prim_print_string, b9_prim_print_number, b9_prim_print_stack};
+  /// A function, by its module.
+  struct FunctionSlot {
+    const LinkedModule *module;
+    std::size_t index;  //< index of the function within module
+  };
+
+  /// Everything known about each function, by VM function index. The fields
+  /// are kept in parallel arrays, so a call only touches the ones it reads.
+  struct FunctionTable {
+    std::vector<const LinkedModule *> module;
+    std::vector<const FunctionDef *> definition;
+    std::vector<const Instruction *> entry;
+    std::vector<std::uint32_t> nparams;
+    std::vector<std::uint32_t> nlocals;
+    std::vector<JitFunction> jitAddress;
+
+    void push_back(const FunctionSlot &slot);
+  };
 
   Config cfg_;
   Om::MemorySystem memoryManager_;
   std::shared_ptr<Compiler> compiler_;
+
+  std::size_t resolveImport(const std::string &name);
+
+  std::size_t addPrimitive(Primitive primitive);
+
+  void linkExports(LinkedModule &linked);
+
+  std::vector<std::size_t> internStrings(const Module &module);
+
+  void retainUnchanged(const Module &module,
+                       const std::vector<std::size_t> &imports,
+                       std::vector<std::size_t> &slots);
+
+  JitFunction compile(std::size_t functionIndex);
+
+  void backgroundCompileLoop();
+
+  /// Install the code finished by the background compiler. Returns without
+  /// installing anything when wait is false and a compile is in progress.
+  void installBackgroundCode(bool wait);
+
+  /// Free a builder's slot, and move it to its next generation.
+  void releaseStringBuilder(std::size_t slot);
+
   std::shared_ptr<const Module> module_;
-  std::vector<JitFunction> compiledFunctions_;
+  std::vector<std::unique_ptr<LinkedModule>> modules_;
+  std::vector<std::unique_ptr<LinkedModule>> retiredModules_;
+  FunctionTable functionTable_;
+  StringTable strings_;
+  std::deque<Primitive> primitives_;
+  std::unordered_map<std::string, std::size_t> primitiveIndex_;
+
+  struct StringBuilder {
+    std::string buffer;
+    std::int64_t generation = 1;
+    bool live = false;
+  };
+
+  std::vector<StringBuilder> stringBuilders_;
+  std::vector<std::size_t> freeStringBuilders_;
+  std::vector<std::unique_ptr<InputReader>> inputs_;
+  std::vector<Om::Value> roots_;
+  std::shared_ptr<OutputSink> output_;
+  std::unique_ptr<ExecutionContext> rootContext_;
+  std::unique_ptr<GcMonitor> gcMonitor_;
+
+  /// Held while compiling, and while the tables above are modified, so the
+  /// background compiler never sees them change underneath it.
+  std::mutex compileMutex_;
+
+  std::mutex queueMutex_;
+  std::condition_variable queueCondition_;
+  std::deque<std::size_t> compileQueue_;
+  std::vector<std::pair<std::size_t, JitFunction>> finishedCode_;
+  std::size_t compilesInProgress_ = 0;
+  std::atomic<bool> finishedCodeReady_{false};
+  bool stopCompiler_ = false;
+  std::thread compilerThread_;
 };
 
 }  // namespace b9
@@ -128,7 +513,35 @@ using namespace b9;
 Om::RawValue interpret(ExecutionContext *context,
                        const std::size_t functionIndex);
 
+Om::RawValue resume_tail_call(ExecutionContext *context);
+
 void primitive_call(ExecutionContext *context, Immediate value);
+
+std::int32_t has_primitive_type(ExecutionContext *context, std::int32_t type,
+                                Om::RawValue value);
+
+void primitive_arg_error(ExecutionContext *context, Immediate index,
+                         std::int32_t param);
+
+Om::RawValue new_object(ExecutionContext *context);
+
+void pop_into_object(ExecutionContext *context, Immediate slotId);
+
+Om::RawValue new_int_array(ExecutionContext *context, std::int64_t length);
+
+std::int32_t is_int_array(Om::RawValue value);
+
+std::int32_t is_int48(Om::RawValue value);
+
+void int_mod_by_zero(std::int64_t dividend);
+
+void array_type_error(Om::RawValue value);
+
+void array_index_error(std::int64_t index, std::int64_t length);
+
+Om::RawValue int_to_double(Om::RawValue value);
+
+Om::RawValue double_to_int(Om::RawValue value);
 }
 
 #endif  // B9_VIRTUALMACHINE_HPP_
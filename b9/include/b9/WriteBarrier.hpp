@@ -0,0 +1,39 @@
+#ifndef B9_WRITEBARRIER_HPP_
+#define B9_WRITEBARRIER_HPP_
+
+#include <OMR/Om/Context.hpp>
+#include <OMR/Om/ObjectOperations.hpp>
+#include <OMR/Om/Value.hpp>
+
+#include <StandardWriteBarrier.hpp>
+
+namespace b9 {
+
+namespace Om = ::OMR::Om;
+
+/// Tell the GC that an object now references value. Under gencon, a nursery
+/// collection only scans the nursery and the roots, so an old object that
+/// references a new one is put in the remembered set. Under a concurrent
+/// policy, the object's card is dirtied for the marker to rescan. Values
+/// that are not references need no barrier.
+inline void writeBarrier(Om::RunContext &cx, Om::Object *object,
+                         Om::Value value) {
+  if (value.isRef()) {
+    standardWriteBarrier(cx.vmContext(),
+                         reinterpret_cast<omrobjectptr_t>(object),
+                         reinterpret_cast<omrobjectptr_t>(value.getRef()));
+  }
+}
+
+/// Set an object's slot, with a write barrier. Every store into a heap
+/// object's slots goes through here.
+inline void storeValue(Om::RunContext &cx, Om::Object *object,
+                       const Om::SlotDescriptor &descriptor,
+                       Om::Value value) {
+  Om::setValue(cx, object, descriptor, value);
+  writeBarrier(cx, object, value);
+}
+
+}  // namespace b9
+
+#endif  // B9_WRITEBARRIER_HPP_
@@ -1,24 +1,39 @@
 #ifndef B9_ASSEMBLE_HPP_
 #define B9_ASSEMBLE_HPP_
 
+#include <b9/Module.hpp>
 #include <b9/instructions.hpp>
 
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 namespace b9 {
 
-void assembleStringTable(std::istream &in, std::ostream &out);
+/// Malformed base9 assembly. The message starts with the line number.
+struct AssemblerException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
 
-void assembleInstruction(std::istream &in, std::ostream &out);
+/// Read one instruction, `(opcode [immediate])`. The immediate of an
+/// instruction without one may be omitted.
+Instruction assembleInstruction(std::istream &in);
 
-void assembleFunctionData(std::istream &in, std::ostream &out);
+/// Read a function, `(function "name" nparams nlocals instruction...)`.
+/// Instructions may be prefixed by their index, as b9disasm prints them.
+/// END_SECTION is appended when the function does not end with it.
+FunctionDef assembleFunction(std::istream &in);
 
-void assembleFunction(std::istream &in, std::ostream &out);
+/// Read a module in the text format printed by b9disasm: a sequence of
+/// function, `(string "...")`, `(import "...")` and `(export "...")`
+/// expressions. Comments run from `;` to the end of the line. Throws
+/// AssemblerException.
+std::shared_ptr<Module> assembleModule(std::istream &in);
 
+/// Assemble a module, and write it as a binary module with serialize.
 void assemble(std::istream &in, std::ostream &out);
 
 }  // namespace b9
@@ -1,6 +1,101 @@
-#if !defined(B9_BINARY_HPP_)
+#if !defined(B9_BINARYFORMAT_HPP_)
 #define B9_BINARYFORMAT_HPP_
 
 #include <b9/instructions.hpp>
 
+#include <cstddef>
+#include <cstdint>
+
+namespace b9 {
+
+/// Every binary module begins with these magic bytes.
+static constexpr char MODULE_MAGIC[] = {'b', '9', 'm', 'o', 'd', 'u', 'l', 'e'};
+
+/// In an indexed (version 2) module, the magic is followed by this tag. A
+/// version 1 module has a section code in the same position, so the tag is
+/// chosen to never collide with one.
+static constexpr std::uint32_t MODULE_INDEX_TAG = 0x3276'3962;  // "b9v2"
+
+static constexpr std::uint32_t MODULE_FORMAT_VERSION = 2;
+
+/// Section codes. FUNCTION through JUMP_TABLE make up a sequential (version 1)
+/// module. An indexed module lists its sections in a table of contents, and
+/// shares all but FUNCTION with version 1. STRING, IMPORT and EXPORT are a
+/// uint32 count followed by length-prefixed strings. DOUBLE and INTEGER are a
+/// uint32 count followed by the constant doubles or int64s, 8 bytes each.
+/// JUMP_TABLE is a uint32 count followed by the tables, each an int32 low, an
+/// int32 default offset, a uint32 count and the int32 offsets.
+enum class SectionCode : std::uint32_t {
+  FUNCTION = 1,
+  STRING = 2,
+  IMPORT = 3,
+  EXPORT = 4,
+  DOUBLE = 5,
+  INTEGER = 6,
+  JUMP_TABLE = 7,
+  FUNCTION_TABLE = 16,
+  NAME_INDEX = 17,
+  NAME_DATA = 18,
+  CODE = 19,
+};
+
+/// Header of an indexed module. Immediately followed by `sectionCount`
+/// SectionEntries.
+struct ModuleHeader {
+  char magic[8];
+  std::uint32_t tag;
+  std::uint32_t version;
+  std::uint32_t sectionCount;
+  std::uint32_t reserved;
+};
+
+/// A table of contents entry. Offsets are from the start of the module.
+struct SectionEntry {
+  std::uint32_t code;
+  std::uint32_t reserved;
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+/// An entry in the FUNCTION_TABLE section. The name is stored in NAME_DATA,
+/// and the instructions, including the trailing END_SECTION, in CODE.
+struct FunctionEntry {
+  std::uint32_t nameOffset;
+  std::uint32_t nameSize;
+  std::uint32_t nparams;
+  std::uint32_t nlocals;
+  std::uint64_t codeOffset;
+  std::uint32_t codeSize;  //< in instructions
+  std::uint32_t nameHash;
+};
+
+/// Instruction arrays in the CODE section start on this boundary.
+static constexpr std::size_t CODE_ALIGNMENT = 16;
+
+static_assert(sizeof(ModuleHeader) == 24, "ModuleHeader must be packed");
+static_assert(sizeof(SectionEntry) == 24, "SectionEntry must be packed");
+static_assert(sizeof(FunctionEntry) == 32, "FunctionEntry must be packed");
+
+/// The NAME_INDEX section is a uint32 bucket count, followed by the buckets.
+/// A bucket holds a function index plus one, or zero when empty. Collisions
+/// are resolved by linear probing.
+static constexpr std::uint32_t EMPTY_BUCKET = 0;
+
+/// FNV-1a hash of a function name.
+inline std::uint32_t hashName(const char *name, std::size_t size) {
+  std::uint32_t hash = 0x811c'9dc5;
+  for (std::size_t i = 0; i < size; i++) {
+    hash ^= static_cast<std::uint8_t>(name[i]);
+    hash *= 0x0100'0193;
+  }
+  return hash;
+}
+
+/// Round up to the next multiple of alignment, a power of two.
+constexpr std::uint64_t alignUp(std::uint64_t n, std::uint64_t alignment) {
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+}  // namespace b9
+
 #endif  // B9_BINARYFORMAT_HPP_
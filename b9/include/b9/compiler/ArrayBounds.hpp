@@ -0,0 +1,29 @@
+#if !defined(B9_ARRAYBOUNDS_HPP_)
+#define B9_ARRAYBOUNDS_HPP_
+
+#include "b9/Module.hpp"
+#include "b9/instructions.hpp"
+
+#include <vector>
+
+namespace b9 {
+
+/// Find the int array accesses whose index is known to be in bounds, so
+/// compiled code can skip the check. Returns a flag per instruction.
+///
+/// An access is in bounds when it is in a counted loop of the shape compile.js
+/// emits for
+///
+///     for (var i = c; i < a.length; i++) { ... a[i] ... }
+///
+/// where c >= 0, the loop is only entered through its test, neither i nor a
+/// is assigned in the loop other than by increments of i, and the access
+/// comes before the first increment. The tables are those of the program's
+/// module, for its TABLE_SWITCHes.
+std::vector<bool> findInBoundsAccesses(
+    const std::vector<Instruction> &program,
+    const std::vector<JumpTable> &tables = {});
+
+}  // namespace b9
+
+#endif  // B9_ARRAYBOUNDS_HPP_
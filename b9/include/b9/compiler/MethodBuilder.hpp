@@ -12,7 +12,9 @@
 #include <ilgen/MethodBuilder.hpp>
 #include <ilgen/TypeDictionary.hpp>
 
+#include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace b9 {
@@ -33,9 +35,12 @@ class MethodBuilder : public TR::MethodBuilder {
 
   void defineLocals();
 
+  /// The name a compiled function is known by in the JIT.
+  const char *functionSymbol(std::size_t functionIndex);
+
   /// For a single bytecode, generate the
   bool generateILForBytecode(
-      const FunctionDef *function,
+      const FunctionDef *function, const LinkedModule &module,
       std::vector<TR::BytecodeBuilder *> bytecodeBuilderTable,
       std::size_t instructionIndex,
       TR::BytecodeBuilder *jumpToBuilderForInlinedReturn);
@@ -59,6 +64,17 @@ class MethodBuilder : public TR::MethodBuilder {
 
   TR::IlValue *popUint48(TR::BytecodeBuilder *builder);
 
+  /// input is an unboxed double.
+  void pushDouble(TR::BytecodeBuilder *builder, TR::IlValue *value);
+
+  /// output is an unboxed double. A value pushed by pushDouble and popped
+  /// before the VM state is committed is never boxed and unboxed: with a lazy
+  /// VM state, doubles stay in FP registers.
+  TR::IlValue *popDouble(TR::BytecodeBuilder *builder);
+
+  /// The double a boxed value was made from, or null if that is not known.
+  TR::IlValue *knownDouble(TR::IlValue *value);
+
   void drop(TR::BytecodeBuilder *builder, std::size_t n = 1);
 
   TR::IlValue *loadLocal(TR::IlBuilder *b, std::size_t index);
@@ -75,12 +91,52 @@ class MethodBuilder : public TR::MethodBuilder {
 
   void passParamCall(TR::BytecodeBuilder *builder, std::size_t target);
 
+  /// The result of a call to a compiled function. If the callee returned
+  /// tailCallPending(), the function it tail called is run first.
+  TR::IlValue *finishTailCall(TR::IlBuilder *b, TR::IlValue *result);
+
+  /// Call a fast primitive directly, with its arguments in registers.
+  void fastPrimitiveCall(TR::BytecodeBuilder *builder, std::size_t index,
+                         bool resultDiscarded);
+
+  /// Whether a value has a primitive parameter type, as an Int32. Ints,
+  /// strings and references are told apart by their box tags, inline. The
+  /// types that need a cell's map are asked of the VM.
+  TR::IlValue *hasPrimitiveType(TR::IlBuilder *b, TR::IlValue *context,
+                                TR::IlValue *value, PrimitiveType type);
+
+  /// The int array accesses in a function that need no bounds check.
+  const std::vector<bool> &inBoundsAccesses(const FunctionDef *function,
+                                            const LinkedModule &module);
+
+  /// The array a value references. Unless unchecked, a value that is not an
+  /// int array is fatal. An in bounds access needs no check, since its loop
+  /// test took the same array's length.
+  TR::IlValue *toIntArray(TR::IlBuilder *b, TR::IlValue *value,
+                          bool checked = true);
+
+  TR::IlValue *intArrayLength(TR::IlBuilder *b, TR::IlValue *array);
+
+  /// The address of an element, after checking the index unless it is
+  /// known to be in bounds.
+  TR::IlValue *intArrayElement(TR::IlBuilder *b, TR::IlValue *array,
+                               TR::IlValue *index, bool inBounds);
+
   // Bytecode Handlers
 
   void handle_bc_function_call(TR::BytecodeBuilder *builder,
                                TR::BytecodeBuilder *nextBuilder,
                                std::size_t target);
 
+  /// A call to this function becomes a jump back to its start. Other calls
+  /// return tailCallPending(), leaving the caller to make the call.
+  void handle_bc_tail_call(
+      TR::BytecodeBuilder *builder,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+      std::size_t target);
+
+  void handle_bc_function_return(TR::BytecodeBuilder *builder);
+
   void handle_bc_push_constant(TR::BytecodeBuilder *builder,
                                TR::BytecodeBuilder *nextBuilder);
   void handle_bc_push_string(TR::BytecodeBuilder *builder,
@@ -105,8 +161,65 @@ class MethodBuilder : public TR::MethodBuilder {
                      TR::BytecodeBuilder *nextBuilder);
   void handle_bc_not(TR::BytecodeBuilder *builder,
                      TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_mod(TR::BytecodeBuilder *builder,
+                     TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_and(TR::BytecodeBuilder *builder,
+                     TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_or(TR::BytecodeBuilder *builder,
+                    TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_xor(TR::BytecodeBuilder *builder,
+                     TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_shl(TR::BytecodeBuilder *builder,
+                     TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_shr(TR::BytecodeBuilder *builder,
+                     TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_neg(TR::BytecodeBuilder *builder,
+                     TR::BytecodeBuilder *nextBuilder);
   void handle_bc_call(TR::BytecodeBuilder *builder,
                       TR::BytecodeBuilder *nextBuilder);
+  /// Allocate an empty object through the new_object helper.
+  void handle_bc_new_object(TR::BytecodeBuilder *builder,
+                            TR::BytecodeBuilder *nextBuilder);
+  /// Store through the interpreter's POP_INTO_OBJECT, which has the write
+  /// barrier.
+  void handle_bc_pop_into_object(TR::BytecodeBuilder *builder,
+                                 TR::BytecodeBuilder *nextBuilder,
+                                 Immediate slotId);
+  void handle_bc_new_int_array(TR::BytecodeBuilder *builder,
+                               TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_int_array_load(TR::BytecodeBuilder *builder,
+                                TR::BytecodeBuilder *nextBuilder,
+                                bool inBounds);
+  void handle_bc_int_array_store(TR::BytecodeBuilder *builder,
+                                 TR::BytecodeBuilder *nextBuilder,
+                                 bool inBounds);
+  void handle_bc_array_length(TR::BytecodeBuilder *builder,
+                              TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_dbl_push_constant(TR::BytecodeBuilder *builder,
+                                   TR::BytecodeBuilder *nextBuilder,
+                                   double value);
+  void handle_bc_dbl_add(TR::BytecodeBuilder *builder,
+                         TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_dbl_sub(TR::BytecodeBuilder *builder,
+                         TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_dbl_mul(TR::BytecodeBuilder *builder,
+                         TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_dbl_div(TR::BytecodeBuilder *builder,
+                         TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_int_to_dbl(TR::BytecodeBuilder *builder,
+                            TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_dbl_to_int(TR::BytecodeBuilder *builder,
+                            TR::BytecodeBuilder *nextBuilder);
+  /// All of the DBL_JMP_* compare-and-branch bytecodes.
+  void handle_bc_dbl_jmp(
+      TR::BytecodeBuilder *builder,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+      const std::vector<Instruction> &program, long bytecodeIndex,
+      TR::BytecodeBuilder *nextBuilder);
+  void handle_bc_table_switch(
+      TR::BytecodeBuilder *builder,
+      const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+      long bytecodeIndex, const JumpTable &table);
   void handle_bc_jmp(
       TR::BytecodeBuilder *builder,
       const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
@@ -151,6 +264,10 @@ class MethodBuilder : public TR::MethodBuilder {
   const std::size_t functionIndex_;
   std::vector<std::string> params_;
   std::vector<std::string> locals_;
+  std::vector<std::string> functionSymbols_;
+  std::vector<std::string> primitiveSymbols_;
+  std::map<const FunctionDef *, std::vector<bool>> inBoundsAccesses_;
+  std::unordered_map<TR::IlValue *, TR::IlValue *> unboxedDoubles_;
   int32_t maxInlineDepth_;
   int32_t firstArgumentIndex = 0;
 };
@@ -1,10 +1,13 @@
 #ifndef B9_DESERIALIZE_HPP_
 #define B9_DESERIALIZE_HPP_
 
+#include <b9/MappedFile.hpp>
 #include <b9/Module.hpp>
+#include <b9/binaryformat.hpp>
 #include <b9/instructions.hpp>
 
 #include <string.h>
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -15,6 +18,15 @@ struct DeserializeException : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
+/// A read-only streambuf over a block of memory.
+class MemoryBuffer : public std::streambuf {
+ public:
+  MemoryBuffer(const char *data, std::size_t size) {
+    char *begin = const_cast<char *>(data);
+    setg(begin, begin, begin + size);
+  }
+};
+
 inline bool readBytes(std::istream &in, char *buffer, long bytes) {
   long count = 0;
   do {
@@ -30,7 +42,7 @@ bool readNumber(std::istream &in, Number &out, long bytes = sizeof(Number)) {
   return readBytes(in, buffer, bytes);
 }
 
-void readString(std::istream &in, std::string &toRead) {
+inline void readString(std::istream &in, std::string &toRead) {
   uint32_t length;
   if (!readNumber(in, length, sizeof(length))) {
     throw DeserializeException{"Error reading string length"};
@@ -46,6 +58,29 @@ void readString(std::istream &in, std::string &toRead) {
 
 void readStringSection(std::istream &in, std::vector<std::string> &strings);
 
+/// A section of constant numbers: a uint32 count followed by the numbers.
+template <typename Number>
+void readNumberSection(std::istream &in, std::vector<Number> &numbers) {
+  std::uint32_t count;
+  if (!readNumber(in, count)) {
+    throw DeserializeException{"Error reading number count"};
+  }
+  for (std::uint32_t i = 0; i < count; i++) {
+    Number number;
+    if (!readNumber(in, number)) {
+      throw DeserializeException{"Error reading number"};
+    }
+    numbers.push_back(number);
+  }
+}
+
+/// A number section of integer constants. Throws DeserializeException if one
+/// does not fit in an int48.
+void readIntegerSection(std::istream &in,
+                        std::vector<std::int64_t> &integers);
+
+void readJumpTableSection(std::istream &in, std::vector<JumpTable> &tables);
+
 bool readInstructions(std::istream &in, std::vector<Instruction> &instructions);
 
 void readFunctionData(std::istream &in, FunctionDef &functionSpec);
@@ -56,10 +91,88 @@ void readFunctionSection(std::istream &in, std::vector<FunctionDef> &functions);
 
 void readSection(std::istream &in, std::shared_ptr<Module> &module);
 
-void readHeader(std::istream &in, char *buffer);
+void readSectionBody(std::istream &in, std::uint32_t sectionCode,
+                     std::shared_ptr<Module> &module);
+
+void readHeader(std::istream &in);
+
+/// An in-memory indexed (version 2) module. Only the table of contents is
+/// examined up front; each FunctionDef is built the first time it is asked
+/// for. Functions may be asked for from several threads.
+class ModuleImage : public FunctionLoader {
+ public:
+  /// Takes the complete module, starting with the magic bytes.
+  explicit ModuleImage(std::vector<char> data);
+
+  /// Reads the module in place from a mapped file, so only the pages of the
+  /// functions that are used are read.
+  explicit ModuleImage(std::unique_ptr<const MappedFile> file);
+
+  ~ModuleImage() noexcept override;
+
+  std::size_t functionCount() const override { return functionCount_; }
+
+  /// Lock free once the function has been built.
+  const FunctionDef &getFunction(std::size_t index) override;
 
+  bool findFunction(const std::string &name, std::size_t &index) const override;
+
+  /// Read a section made of strings: the constant strings, imports or
+  /// exports.
+  void readStrings(std::vector<std::string> &strings,
+                   SectionCode code = SectionCode::STRING) const;
+
+  /// Read a section of constant numbers, such as the doubles.
+  template <typename Number>
+  void readNumbers(std::vector<Number> &numbers, SectionCode code) const;
+
+  void readIntegers(std::vector<std::int64_t> &integers) const;
+
+  void readJumpTables(std::vector<JumpTable> &tables) const;
+
+  /// The number of functions that have been materialized so far.
+  std::size_t materializedCount() const;
+
+ private:
+  const SectionEntry *findSection(SectionCode code) const;
+
+  FunctionEntry functionEntry(std::size_t index) const;
+
+  std::uint32_t bucket(std::uint32_t index) const;
+
+  void readTableOfContents();
+
+  std::unique_ptr<FunctionDef> readFunction(std::size_t index) const;
+
+  std::vector<char> buffer_;
+  std::unique_ptr<const MappedFile> file_;
+  const char *data_ = nullptr;
+  std::size_t size_ = 0;
+  std::vector<SectionEntry> sections_;
+  const SectionEntry *functionTable_ = nullptr;
+  const SectionEntry *nameIndex_ = nullptr;
+  const SectionEntry *nameData_ = nullptr;
+  const SectionEntry *code_ = nullptr;
+  std::size_t functionCount_ = 0;
+  std::uint32_t bucketCount_ = 0;
+
+  /// The functions built so far, owned by the image. Each is set once, by
+  /// the first thread to finish building it.
+  std::unique_ptr<std::atomic<const FunctionDef *>[]> materialized_;
+};
+
+/// Read the remainder of an indexed module. The magic and tag have already
+/// been consumed from the stream.
+void readIndexedModule(std::istream &in, std::shared_ptr<Module> &module);
+
+/// Read a module in either the sequential (version 1) or the indexed
+/// (version 2) format.
 std::shared_ptr<Module> deserialize(std::istream &in);
 
+/// Read a module file. An indexed module is mapped rather than copied, and
+/// its functions are read from the mapping when they are first used.
+std::shared_ptr<Module> deserializeFile(const std::string &path);
+
 }  // namespace b9
 
 #endif  // B9_DESERIALIZE_HPP_
@@ -70,6 +70,29 @@ enum class OpCode : RawOpCode {
   // Push a string from this module's constant pool
   STR_PUSH_CONSTANT = 0x17,
 
+  // Push an integer from this module's constant pool, for constants that
+  // don't fit in an immediate
+  INT_PUSH_CONSTANT_WIDE = 0x18,
+
+  // More integer opcodes. Results wrap to int48. Shift counts are taken
+  // modulo 64, and INT_SHR shifts in the sign bit.
+
+  // The remainder of dividing two integers, with the sign of the dividend.
+  // A zero divisor is an error
+  INT_MOD = 0x19,
+  // Bitwise and of two integers
+  INT_AND = 0x1a,
+  // Bitwise or of two integers
+  INT_OR = 0x1b,
+  // Bitwise exclusive or of two integers
+  INT_XOR = 0x1c,
+  // Shift an integer left
+  INT_SHL = 0x1d,
+  // Shift an integer right. Counts of 47 to 63 leave only the sign: 0 or -1
+  INT_SHR = 0x1e,
+  // Negate an integer. The least int48 wraps to itself
+  INT_NEG = 0x1f,
+
   // Object Bytecodes
 
   NEW_OBJECT = 0x20,
@@ -81,6 +104,56 @@ enum class OpCode : RawOpCode {
   CALL_INDIRECT = 0x23,
 
   SYSTEM_COLLECT = 0x24,
+
+  // Array ByteCodes
+
+  // Allocate an int array of the given length, filled with zeros
+  NEW_INT_ARRAY = 0x30,
+  // Push an element of an int array
+  INT_ARRAY_LOAD = 0x31,
+  // Pop into an element of an int array
+  INT_ARRAY_STORE = 0x32,
+  // Push the length of an array
+  ARRAY_LENGTH = 0x33,
+
+  // Double ByteCodes
+
+  // Push a double from this module's constant pool
+  DBL_PUSH_CONSTANT = 0x40,
+  // Add two doubles
+  DBL_ADD = 0x41,
+  // Subtract two doubles
+  DBL_SUB = 0x42,
+  // Multiply two doubles
+  DBL_MUL = 0x43,
+  // Divide two doubles
+  DBL_DIV = 0x44,
+  // Jump if two doubles are equal
+  DBL_JMP_EQ = 0x45,
+  // Jump if two doubles are not equal
+  DBL_JMP_NEQ = 0x46,
+  // Jump if the first double is greater than the second
+  DBL_JMP_GT = 0x47,
+  // Jump if the first double is greater than or equal to the second
+  DBL_JMP_GE = 0x48,
+  // Jump if the first double is less than the second
+  DBL_JMP_LT = 0x49,
+  // Jump if the first double is less than or equal to the second
+  DBL_JMP_LE = 0x4a,
+  // Convert an integer to a double. Doubles are left as they are.
+  INT_TO_DBL = 0x4b,
+  // Convert a double to an integer, rounding toward zero. Integers are left
+  // as they are. Doubles out of the integer range give an unspecified result.
+  DBL_TO_INT = 0x4c,
+
+  // Control ByteCodes
+
+  // Pop an integer and jump through this module's jump table with the
+  // immediate's index
+  TABLE_SWITCH = 0x50,
+  // Call a Base9 function and return its result, reusing the caller's frame
+  // for the callee's
+  TAIL_CALL = 0x51,
 };
 
 inline const char *toString(OpCode bc) {
@@ -133,6 +206,22 @@ inline const char *toString(OpCode bc) {
       return "jmp_le";
     case OpCode::STR_PUSH_CONSTANT:
       return "str_push_constant";
+    case OpCode::INT_PUSH_CONSTANT_WIDE:
+      return "int_push_constant_wide";
+    case OpCode::INT_MOD:
+      return "int_mod";
+    case OpCode::INT_AND:
+      return "int_and";
+    case OpCode::INT_OR:
+      return "int_or";
+    case OpCode::INT_XOR:
+      return "int_xor";
+    case OpCode::INT_SHL:
+      return "int_shl";
+    case OpCode::INT_SHR:
+      return "int_shr";
+    case OpCode::INT_NEG:
+      return "int_neg";
     case OpCode::NEW_OBJECT:
       return "new_object";
     case OpCode::PUSH_FROM_OBJECT:
@@ -143,11 +232,55 @@ inline const char *toString(OpCode bc) {
       return "call_indirect";
     case OpCode::SYSTEM_COLLECT:
       return "system_collect";
+    case OpCode::NEW_INT_ARRAY:
+      return "new_int_array";
+    case OpCode::INT_ARRAY_LOAD:
+      return "int_array_load";
+    case OpCode::INT_ARRAY_STORE:
+      return "int_array_store";
+    case OpCode::ARRAY_LENGTH:
+      return "array_length";
+    case OpCode::DBL_PUSH_CONSTANT:
+      return "dbl_push_constant";
+    case OpCode::DBL_ADD:
+      return "dbl_add";
+    case OpCode::DBL_SUB:
+      return "dbl_sub";
+    case OpCode::DBL_MUL:
+      return "dbl_mul";
+    case OpCode::DBL_DIV:
+      return "dbl_div";
+    case OpCode::DBL_JMP_EQ:
+      return "dbl_jmp_eq";
+    case OpCode::DBL_JMP_NEQ:
+      return "dbl_jmp_neq";
+    case OpCode::DBL_JMP_GT:
+      return "dbl_jmp_gt";
+    case OpCode::DBL_JMP_GE:
+      return "dbl_jmp_ge";
+    case OpCode::DBL_JMP_LT:
+      return "dbl_jmp_lt";
+    case OpCode::DBL_JMP_LE:
+      return "dbl_jmp_le";
+    case OpCode::INT_TO_DBL:
+      return "int_to_dbl";
+    case OpCode::DBL_TO_INT:
+      return "dbl_to_int";
+    case OpCode::TABLE_SWITCH:
+      return "table_switch";
+    case OpCode::TAIL_CALL:
+      return "tail_call";
     default:
       return "UNKNOWN_BYTECODE";
   }
 }
 
+/// Whether the opcode calls the function its immediate indexes, as
+/// FUNCTION_CALL and TAIL_CALL do.
+inline bool isFunctionCall(OpCode op) {
+  return op == OpCode::FUNCTION_CALL || op == OpCode::TAIL_CALL;
+}
+
 /// Print a OpCode
 inline std::ostream &operator<<(std::ostream &out, OpCode bc) {
   return out << toString(bc);
@@ -247,9 +380,26 @@ inline std::ostream &operator<<(std::ostream &out, Instruction i) {
     case OpCode::INT_MUL:
     case OpCode::INT_DIV:
     case OpCode::INT_NOT:
+    case OpCode::INT_MOD:
+    case OpCode::INT_AND:
+    case OpCode::INT_OR:
+    case OpCode::INT_XOR:
+    case OpCode::INT_SHL:
+    case OpCode::INT_SHR:
+    case OpCode::INT_NEG:
     case OpCode::NEW_OBJECT:
     case OpCode::CALL_INDIRECT:
     case OpCode::SYSTEM_COLLECT:
+    case OpCode::NEW_INT_ARRAY:
+    case OpCode::INT_ARRAY_LOAD:
+    case OpCode::INT_ARRAY_STORE:
+    case OpCode::ARRAY_LENGTH:
+    case OpCode::DBL_ADD:
+    case OpCode::DBL_SUB:
+    case OpCode::DBL_MUL:
+    case OpCode::DBL_DIV:
+    case OpCode::INT_TO_DBL:
+    case OpCode::DBL_TO_INT:
       break;
     // 1 immediate
     case OpCode::FUNCTION_CALL:
@@ -267,8 +417,18 @@ inline std::ostream &operator<<(std::ostream &out, Instruction i) {
     case OpCode::JMP_LT:
     case OpCode::JMP_LE:
     case OpCode::STR_PUSH_CONSTANT:
+    case OpCode::INT_PUSH_CONSTANT_WIDE:
     case OpCode::PUSH_FROM_OBJECT:
     case OpCode::POP_INTO_OBJECT:
+    case OpCode::DBL_PUSH_CONSTANT:
+    case OpCode::DBL_JMP_EQ:
+    case OpCode::DBL_JMP_NEQ:
+    case OpCode::DBL_JMP_GT:
+    case OpCode::DBL_JMP_GE:
+    case OpCode::DBL_JMP_LT:
+    case OpCode::DBL_JMP_LE:
+    case OpCode::TABLE_SWITCH:
+    case OpCode::TAIL_CALL:
     default:
       out << " " << i.immediate();
       break;
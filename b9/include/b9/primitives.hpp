@@ -0,0 +1,90 @@
+#ifndef B9_PRIMITIVES_HPP_
+#define B9_PRIMITIVES_HPP_
+
+#include <b9/HashMap.hpp>
+#include <b9/IntArray.hpp>
+#include <b9/Module.hpp>
+
+#include <OMR/Om/Value.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace b9 {
+
+class ExecutionContext;
+
+/// The type of a primitive's parameter or result.
+enum class PrimitiveType : std::uint8_t {
+  VALUE,      //< Any value
+  INT,        //< An int48
+  STRING,     //< A string id
+  REF,        //< An object reference
+  INT_ARRAY,  //< An int array
+  MAP,        //< A hash map
+  MAP_KEY,    //< An int or a string
+  MAP_VALUE,  //< Anything but a reference
+};
+
+inline bool hasType(OMR::Om::RunContext &cx, OMR::Om::Value value,
+                    PrimitiveType type) {
+  switch (type) {
+    case PrimitiveType::INT:
+      return value.isInt48();
+    case PrimitiveType::STRING:
+      return value.isUint48();
+    case PrimitiveType::REF:
+      return value.isRef();
+    case PrimitiveType::INT_ARRAY:
+      return isIntArray(value);
+    case PrimitiveType::MAP:
+      return isHashMap(cx, value);
+    case PrimitiveType::MAP_KEY:
+      return isHashMapKey(value);
+    case PrimitiveType::MAP_VALUE:
+      return isHashMapValue(value);
+    default:
+      return true;
+  }
+}
+
+/// A native function that takes its arguments as raw values, rather than on
+/// the operand stack. Implementations take exactly the parameters their
+/// signature declares, after the context, and are cast to this type.
+extern "C" typedef OMR::Om::RawValue (*FastPrimitiveFunction)(
+    ExecutionContext *context, ...);
+
+/// What the VM and the JIT may assume about a fast primitive.
+struct PrimitiveSignature {
+  static constexpr std::size_t MAX_PARAMS = 4;
+
+  /// Checked before every call. The interpreter throws std::runtime_error on
+  /// a mismatch, and compiled code aborts.
+  std::vector<PrimitiveType> params;
+  PrimitiveType result = PrimitiveType::VALUE;
+
+  /// No side effects. The JIT drops calls whose result is discarded.
+  bool pure = false;
+
+  /// May allocate, and so trigger a GC. Compiled code writes its operand
+  /// stack back to the VM before calling, so the GC sees every reference.
+  bool allocates = true;
+};
+
+/// A native function callable through PRIMITIVE_CALL. Either function works
+/// on the operand stack, or fastFunction is called directly with the
+/// arguments declared by signature.
+struct Primitive {
+  std::string name;
+  PrimitiveFunction *function = nullptr;
+  FastPrimitiveFunction fastFunction = nullptr;
+  PrimitiveSignature signature;
+
+  bool isFast() const { return fastFunction != nullptr; }
+};
+
+}  // namespace b9
+
+#endif  // B9_PRIMITIVES_HPP_
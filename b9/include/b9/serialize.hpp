@@ -2,6 +2,8 @@
 #define B9_SERIALIZE_HPP_
 
 #include <b9/Module.hpp>
+#include <b9/binaryformat.hpp>
+
 #include <fstream>
 #include <iostream>
 
@@ -33,6 +35,23 @@ inline void writeString(std::ostream &out, std::string toWrite) {
 void writeStringSection(std::ostream &out,
                         const std::vector<std::string> &strings);
 
+/// A section of constant numbers: a uint32 count followed by the numbers.
+template <typename Number>
+void writeNumberSection(std::ostream &out, const std::vector<Number> &numbers) {
+  std::uint32_t count = numbers.size();
+  if (!writeNumber(out, count)) {
+    throw SerializeException("Error writing number section");
+  }
+  for (auto number : numbers) {
+    if (!writeNumber(out, number)) {
+      throw SerializeException("Error writing number");
+    }
+  }
+}
+
+void writeJumpTableSection(std::ostream &out,
+                           const std::vector<JumpTable> &tables);
+
 bool writeInstructions(std::ostream &out,
                        const std::vector<Instruction> &instructions);
 
@@ -47,6 +66,14 @@ void writeSections(std::ostream &out, const Module &module);
 
 void writeHeader(std::ostream &out);
 
+/// Write an indexed (version 2) module: a header, a table of contents, and
+/// the sections it lists. See binaryformat.hpp.
+void writeIndexedModule(std::ostream &out, const Module &module);
+
+/// Write a sequential (version 1) module.
+void serializeV1(std::ostream &out, const Module &module);
+
+/// Write a module in the current (version 2) format.
 void serialize(std::ostream &out, const Module &module);
 
 }  // namespace b9
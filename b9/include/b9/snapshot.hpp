@@ -0,0 +1,43 @@
+#ifndef B9_SNAPSHOT_HPP_
+#define B9_SNAPSHOT_HPP_
+
+#include <b9/VirtualMachine.hpp>
+
+#include <OMR/Om/Value.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace b9 {
+
+/// A snapshot file holds the modules loaded into a VM, and the part of its
+/// heap reachable from a single root value. Restoring a snapshot skips
+/// running the code that built that heap.
+struct SnapshotException : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+static constexpr char SNAPSHOT_MAGIC[] = {'b', '9', 's', 'n',
+                                          'a', 'p', 's', 'h'};
+static constexpr std::uint32_t SNAPSHOT_VERSION = 2;
+
+/// Write the VM's modules, and every object, int array and map reachable from
+/// root. Strings are written by content, so they survive being renumbered on
+/// restore.
+void writeSnapshot(std::ostream &out, VirtualMachine &vm, Om::Value root);
+
+/// Restore a snapshot into a VM with no modules loaded. Loads the modules,
+/// rebuilds the objects, and returns the root. The VM keeps the root alive in
+/// its roots. Throws SnapshotException, DeserializeException or
+/// LinkException.
+Om::Value readSnapshot(std::istream &in, VirtualMachine &vm);
+
+/// Restore a snapshot from a file. The file is mapped rather than read, so
+/// its pages are shared with other processes restoring the same snapshot.
+Om::Value readSnapshotFile(const std::string &path, VirtualMachine &vm);
+
+}  // namespace b9
+
+#endif  // B9_SNAPSHOT_HPP_
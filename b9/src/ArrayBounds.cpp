@@ -0,0 +1,297 @@
+#include "b9/compiler/ArrayBounds.hpp"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace b9 {
+
+namespace {
+
+bool isJump(OpCode op) {
+  switch (op) {
+    case OpCode::JMP:
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+    case OpCode::DBL_JMP_EQ:
+    case OpCode::DBL_JMP_NEQ:
+    case OpCode::DBL_JMP_GT:
+    case OpCode::DBL_JMP_GE:
+    case OpCode::DBL_JMP_LT:
+    case OpCode::DBL_JMP_LE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::size_t jumpTarget(const std::vector<Instruction> &program,
+                       std::size_t index) {
+  return index + program[index].immediate() + 1;
+}
+
+/// Where an instruction can jump to, other than the next instruction.
+std::vector<std::size_t> jumpTargets(const std::vector<Instruction> &program,
+                                     const std::vector<JumpTable> &tables,
+                                     std::size_t index) {
+  auto instruction = program[index];
+  if (isJump(instruction.opCode())) {
+    return {jumpTarget(program, index)};
+  }
+  if (instruction.opCode() != OpCode::TABLE_SWITCH) {
+    return {};
+  }
+  auto &table = tables[instruction.immediate()];
+  std::vector<std::size_t> targets = {index + table.defaultOffset + 1};
+  for (auto offset : table.offsets) {
+    targets.push_back(index + offset + 1);
+  }
+  return targets;
+}
+
+bool isVariablePush(Instruction instruction) {
+  return instruction.opCode() == OpCode::PUSH_FROM_LOCAL ||
+         instruction.opCode() == OpCode::PUSH_FROM_PARAM;
+}
+
+/// The instruction that assigns the variable a push reads.
+Instruction storeTo(Instruction push) {
+  auto op = push.opCode() == OpCode::PUSH_FROM_LOCAL ? OpCode::POP_INTO_LOCAL
+                                                     : OpCode::POP_INTO_PARAM;
+  return {op, push.immediate()};
+}
+
+/// How many values an instruction pops and pushes. Returns false when the
+/// stack is not known afterwards: after calls, whose effect depends on the
+/// callee, and after unconditional jumps and returns.
+bool stackEffect(OpCode op, int &pops, int &pushes) {
+  pops = 0;
+  pushes = 0;
+  switch (op) {
+    case OpCode::INT_PUSH_CONSTANT:
+    case OpCode::INT_PUSH_CONSTANT_WIDE:
+    case OpCode::STR_PUSH_CONSTANT:
+    case OpCode::NEW_OBJECT:
+    case OpCode::DBL_PUSH_CONSTANT:
+      pushes = 1;
+      return true;
+    case OpCode::DROP:
+    case OpCode::POP_INTO_LOCAL:
+    case OpCode::POP_INTO_PARAM:
+      pops = 1;
+      return true;
+    case OpCode::INT_ADD:
+    case OpCode::INT_SUB:
+    case OpCode::INT_MUL:
+    case OpCode::INT_DIV:
+    case OpCode::INT_MOD:
+    case OpCode::INT_AND:
+    case OpCode::INT_OR:
+    case OpCode::INT_XOR:
+    case OpCode::INT_SHL:
+    case OpCode::INT_SHR:
+    case OpCode::INT_ARRAY_LOAD:
+    case OpCode::DBL_ADD:
+    case OpCode::DBL_SUB:
+    case OpCode::DBL_MUL:
+    case OpCode::DBL_DIV:
+      pops = 2;
+      pushes = 1;
+      return true;
+    case OpCode::INT_NOT:
+    case OpCode::INT_NEG:
+    case OpCode::PUSH_FROM_OBJECT:
+    case OpCode::NEW_INT_ARRAY:
+    case OpCode::ARRAY_LENGTH:
+    case OpCode::INT_TO_DBL:
+    case OpCode::DBL_TO_INT:
+      pops = 1;
+      pushes = 1;
+      return true;
+    case OpCode::JMP_EQ:
+    case OpCode::JMP_NEQ:
+    case OpCode::JMP_GT:
+    case OpCode::JMP_GE:
+    case OpCode::JMP_LT:
+    case OpCode::JMP_LE:
+    case OpCode::DBL_JMP_EQ:
+    case OpCode::DBL_JMP_NEQ:
+    case OpCode::DBL_JMP_GT:
+    case OpCode::DBL_JMP_GE:
+    case OpCode::DBL_JMP_LT:
+    case OpCode::DBL_JMP_LE:
+    case OpCode::POP_INTO_OBJECT:
+      pops = 2;
+      return true;
+    case OpCode::INT_ARRAY_STORE:
+      pops = 3;
+      return true;
+    case OpCode::SYSTEM_COLLECT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// The values on the operand stack that are copies of a variable, as the
+/// push that read the variable. Anything else, including the slots below
+/// those being tracked, is END_SECTION.
+class AbstractStack {
+ public:
+  void push(Instruction source) { slots_.push_back(source); }
+
+  void pop() {
+    if (!slots_.empty()) slots_.pop_back();
+  }
+
+  Instruction peek(std::size_t depth) const {
+    if (depth >= slots_.size()) return END_SECTION;
+    return slots_[slots_.size() - 1 - depth];
+  }
+
+  void clear() { slots_.clear(); }
+
+ private:
+  std::vector<Instruction> slots_;
+};
+
+/// A loop that runs an index up to the length of an array.
+struct CountedLoop {
+  std::size_t head;   // The loop test
+  std::size_t end;    // The last jump back to the test
+  Instruction index;  // Pushes the index
+  Instruction array;  // Pushes the array
+};
+
+/// Match `push i; push a; array_length; jmp_ge exit` at head, preceded by
+/// `int_push_constant c; pop_into i`.
+bool matchLoop(const std::vector<Instruction> &program,
+               const std::vector<std::vector<std::size_t>> &jumpsTo,
+               std::size_t head, CountedLoop &loop) {
+  if (head < 2 || head + 3 >= program.size()) return false;
+  auto index = program[head];
+  auto array = program[head + 1];
+  if (!isVariablePush(index) || !isVariablePush(array) ||
+      program[head + 2].opCode() != OpCode::ARRAY_LENGTH ||
+      program[head + 3].opCode() != OpCode::JMP_GE) {
+    return false;
+  }
+  auto exit = jumpTarget(program, head + 3);
+  if (exit <= head + 3 || exit > program.size()) return false;
+
+  // The index starts at a constant c >= 0.
+  auto start = program[head - 2];
+  if (program[head - 1] != storeTo(index) || !jumpsTo[head - 1].empty() ||
+      start.opCode() != OpCode::INT_PUSH_CONSTANT || start.immediate() < 0) {
+    return false;
+  }
+
+  // Only the loop jumps back to the test, and nothing jumps into the loop.
+  loop.end = head;
+  for (auto from : jumpsTo[head]) {
+    if (from <= head || from >= exit) return false;
+    loop.end = std::max(loop.end, from);
+  }
+  if (loop.end == head) return false;
+  for (auto target = head + 1; target <= loop.end; target++) {
+    for (auto from : jumpsTo[target]) {
+      if (from < head || from > loop.end) return false;
+    }
+  }
+
+  loop.head = head;
+  loop.index = index;
+  loop.array = array;
+  return true;
+}
+
+void markAccesses(const std::vector<Instruction> &program,
+                  const std::vector<JumpTable> &tables,
+                  const std::vector<std::vector<std::size_t>> &jumpsTo,
+                  const CountedLoop &loop, std::vector<bool> &inBounds) {
+  // The index is below the length from the test up to the first increment.
+  auto limit = loop.end + 1;
+  for (auto i = loop.head + 4; i <= loop.end; i++) {
+    if (program[i] == storeTo(loop.array)) return;
+    if (program[i] == storeTo(loop.index)) {
+      bool increment = program[i - 3] == loop.index &&
+                       program[i - 2].opCode() == OpCode::INT_PUSH_CONSTANT &&
+                       program[i - 2].immediate() > 0 &&
+                       program[i - 1].opCode() == OpCode::INT_ADD;
+      if (!increment) return;
+      limit = std::min(limit, i - 3);
+    }
+  }
+
+  // Once incremented, the index only gets back to an access through the
+  // test.
+  for (auto i = limit; i <= loop.end; i++) {
+    for (auto target : jumpTargets(program, tables, i)) {
+      if (target <= i && target != loop.head) return;
+    }
+  }
+
+  AbstractStack stack;
+  for (auto i = loop.head + 4; i < limit; i++) {
+    if (!jumpsTo[i].empty()) stack.clear();
+    auto instruction = program[i];
+    switch (instruction.opCode()) {
+      case OpCode::PUSH_FROM_LOCAL:
+      case OpCode::PUSH_FROM_PARAM:
+        stack.push(instruction);
+        continue;
+      case OpCode::DUPLICATE:
+        stack.push(stack.peek(0));
+        continue;
+      case OpCode::INT_ARRAY_LOAD:
+        if (stack.peek(1) == loop.array && stack.peek(0) == loop.index) {
+          inBounds[i] = true;
+        }
+        break;
+      case OpCode::INT_ARRAY_STORE:
+        if (stack.peek(2) == loop.array && stack.peek(1) == loop.index) {
+          inBounds[i] = true;
+        }
+        break;
+      default:
+        break;
+    }
+
+    int pops, pushes;
+    if (!stackEffect(instruction.opCode(), pops, pushes)) {
+      stack.clear();
+      continue;
+    }
+    while (pops-- > 0) stack.pop();
+    while (pushes-- > 0) stack.push(END_SECTION);
+  }
+}
+
+}  // namespace
+
+std::vector<bool> findInBoundsAccesses(
+    const std::vector<Instruction> &program,
+    const std::vector<JumpTable> &tables) {
+  std::vector<std::vector<std::size_t>> jumpsTo(program.size() + 1);
+  for (std::size_t i = 0; i < program.size(); i++) {
+    for (auto target : jumpTargets(program, tables, i)) {
+      if (target < jumpsTo.size()) {
+        jumpsTo[target].push_back(i);
+      }
+    }
+  }
+
+  std::vector<bool> inBounds(program.size(), false);
+  for (std::size_t head = 0; head < program.size(); head++) {
+    CountedLoop loop;
+    if (matchLoop(program, jumpsTo, head, loop)) {
+      markAccesses(program, tables, jumpsTo, loop, inBounds);
+    }
+  }
+  return inBounds;
+}
+
+}  // namespace b9
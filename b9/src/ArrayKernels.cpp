@@ -0,0 +1,451 @@
+#include <b9/ArrayKernels.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define B9_X86_KERNELS 1
+#endif
+
+namespace b9 {
+
+namespace {
+
+constexpr std::uint64_t INT48_MASK = (std::uint64_t(1) << 48) - 1;
+constexpr std::uint64_t INT48_SIGN = std::uint64_t(1) << 47;
+
+/// Wrap to int48. Sums and products are done unsigned, where overflow is
+/// defined, and wrapped once at the end.
+inline std::int64_t toInt48(std::uint64_t x) {
+  return static_cast<std::int64_t>(((x & INT48_MASK) ^ INT48_SIGN) -
+                                   INT48_SIGN);
+}
+
+//
+// Scalar kernels. The vector kernels finish off with these.
+//
+
+std::int64_t scalarSum(const std::int64_t *data, std::size_t length) {
+  std::uint64_t sum = 0;
+  for (std::size_t i = 0; i < length; i++) sum += data[i];
+  return toInt48(sum);
+}
+
+std::int64_t scalarMin(const std::int64_t *data, std::size_t length) {
+  return length == 0 ? 0 : *std::min_element(data, data + length);
+}
+
+std::int64_t scalarMax(const std::int64_t *data, std::size_t length) {
+  return length == 0 ? 0 : *std::max_element(data, data + length);
+}
+
+/// The library's fill and memmove are already vectorized.
+void fillElements(std::int64_t *data, std::size_t length, std::int64_t value) {
+  std::fill_n(data, length, value);
+}
+
+void copyElements(std::int64_t *to, const std::int64_t *from,
+                  std::size_t length) {
+  std::memmove(to, from, length * sizeof(std::int64_t));
+}
+
+int scalarCompare(const std::int64_t *a, const std::int64_t *b,
+                  std::size_t length) {
+  for (std::size_t i = 0; i < length; i++) {
+    if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+std::int64_t scalarFind(const std::int64_t *data, std::size_t length,
+                        std::int64_t value) {
+  for (std::size_t i = 0; i < length; i++) {
+    if (data[i] == value) return i;
+  }
+  return -1;
+}
+
+/// The prefix sum, continuing from sum. Returns the unwrapped total.
+std::uint64_t prefixSumFrom(std::int64_t *data, std::size_t length,
+                            std::uint64_t sum) {
+  for (std::size_t i = 0; i < length; i++) {
+    sum += data[i];
+    data[i] = toInt48(sum);
+  }
+  return sum;
+}
+
+std::int64_t scalarPrefixSum(std::int64_t *data, std::size_t length) {
+  return toInt48(prefixSumFrom(data, length, 0));
+}
+
+void scalarAddScalar(std::int64_t *data, std::size_t length,
+                     std::int64_t value) {
+  for (std::size_t i = 0; i < length; i++) {
+    data[i] = toInt48(std::uint64_t(data[i]) + value);
+  }
+}
+
+void scalarMulScalar(std::int64_t *data, std::size_t length,
+                     std::int64_t value) {
+  for (std::size_t i = 0; i < length; i++) {
+    data[i] = toInt48(std::uint64_t(data[i]) * value);
+  }
+}
+
+void scalarAdd(std::int64_t *to, const std::int64_t *from,
+               std::size_t length) {
+  for (std::size_t i = 0; i < length; i++) {
+    to[i] = toInt48(std::uint64_t(to[i]) + from[i]);
+  }
+}
+
+void scalarMul(std::int64_t *to, const std::int64_t *from,
+               std::size_t length) {
+  for (std::size_t i = 0; i < length; i++) {
+    to[i] = toInt48(std::uint64_t(to[i]) * from[i]);
+  }
+}
+
+const ArrayKernels SCALAR_KERNELS = {
+    "scalar",        scalarSum,       scalarMin,       scalarMax,
+    fillElements,    copyElements,    scalarCompare,   scalarFind,
+    scalarPrefixSum, scalarAddScalar, scalarMulScalar, scalarAdd,
+    scalarMul};
+
+#if defined(B9_X86_KERNELS)
+
+// The vector kernels are compiled for their instruction set alone, and only
+// called when the CPU has it.
+#define B9_AVX2 __attribute__((target("avx2")))
+#define B9_SSE42 __attribute__((target("sse4.2")))
+
+//
+// AVX2 kernels, four elements at a time.
+//
+
+B9_AVX2 inline __m256i load4(const std::int64_t *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+B9_AVX2 inline void store4(std::int64_t *p, __m256i x) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), x);
+}
+
+B9_AVX2 inline __m256i toInt48x4(__m256i x) {
+  auto mask = _mm256_set1_epi64x(INT48_MASK);
+  auto sign = _mm256_set1_epi64x(INT48_SIGN);
+  return _mm256_sub_epi64(_mm256_xor_si256(_mm256_and_si256(x, mask), sign),
+                          sign);
+}
+
+/// The low 64 bits of each product, from 32 bit multiplies. AVX2 has no
+/// 64 bit multiply.
+B9_AVX2 inline __m256i mul4(__m256i a, __m256i b) {
+  auto low = _mm256_mul_epu32(a, b);
+  auto cross = _mm256_add_epi64(_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)),
+                                _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b));
+  return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+}
+
+B9_AVX2 std::int64_t avx2Sum(const std::int64_t *data, std::size_t length) {
+  auto sum = _mm256_setzero_si256();
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    sum = _mm256_add_epi64(sum, load4(data + i));
+  }
+  std::int64_t lanes[4];
+  store4(lanes, sum);
+  std::uint64_t total = std::uint64_t(lanes[0]) + lanes[1] + lanes[2] +
+                        lanes[3] + scalarSum(data + i, length - i);
+  return toInt48(total);
+}
+
+B9_AVX2 std::int64_t avx2Min(const std::int64_t *data, std::size_t length) {
+  if (length < 4) return scalarMin(data, length);
+  auto min = load4(data);
+  std::size_t i = 4;
+  for (; i + 4 <= length; i += 4) {
+    auto x = load4(data + i);
+    min = _mm256_blendv_epi8(min, x, _mm256_cmpgt_epi64(min, x));
+  }
+  std::int64_t lanes[4];
+  store4(lanes, min);
+  auto result = *std::min_element(lanes, lanes + 4);
+  if (i == length) return result;
+  return std::min(result, scalarMin(data + i, length - i));
+}
+
+B9_AVX2 std::int64_t avx2Max(const std::int64_t *data, std::size_t length) {
+  if (length < 4) return scalarMax(data, length);
+  auto max = load4(data);
+  std::size_t i = 4;
+  for (; i + 4 <= length; i += 4) {
+    auto x = load4(data + i);
+    max = _mm256_blendv_epi8(max, x, _mm256_cmpgt_epi64(x, max));
+  }
+  std::int64_t lanes[4];
+  store4(lanes, max);
+  auto result = *std::max_element(lanes, lanes + 4);
+  if (i == length) return result;
+  return std::max(result, scalarMax(data + i, length - i));
+}
+
+/// Skip the blocks that are equal, and find the difference in the rest.
+B9_AVX2 int avx2Compare(const std::int64_t *a, const std::int64_t *b,
+                        std::size_t length) {
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    auto equal = _mm256_cmpeq_epi64(load4(a + i), load4(b + i));
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(equal)) != 0xF) break;
+  }
+  return scalarCompare(a + i, b + i, length - i);
+}
+
+B9_AVX2 std::int64_t avx2Find(const std::int64_t *data, std::size_t length,
+                              std::int64_t value) {
+  auto needle = _mm256_set1_epi64x(value);
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    auto equal = _mm256_cmpeq_epi64(load4(data + i), needle);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(equal));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  auto found = scalarFind(data + i, length - i, value);
+  return found < 0 ? -1 : i + found;
+}
+
+B9_AVX2 std::int64_t avx2PrefixSum(std::int64_t *data, std::size_t length) {
+  auto zero = _mm256_setzero_si256();
+  auto carry = zero;
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    // Add each lane into the lanes above it, shifting by one lane then two.
+    auto x = load4(data + i);
+    auto up1 = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 0));
+    x = _mm256_add_epi64(x, _mm256_blend_epi32(up1, zero, 0x03));
+    auto up2 = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 0, 0));
+    x = _mm256_add_epi64(x, _mm256_blend_epi32(up2, zero, 0x0F));
+    x = _mm256_add_epi64(x, carry);
+    store4(data + i, toInt48x4(x));
+    carry = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  std::int64_t lanes[4];
+  store4(lanes, carry);
+  return toInt48(prefixSumFrom(data + i, length - i, lanes[0]));
+}
+
+B9_AVX2 void avx2AddScalar(std::int64_t *data, std::size_t length,
+                           std::int64_t value) {
+  auto addend = _mm256_set1_epi64x(value);
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    store4(data + i, toInt48x4(_mm256_add_epi64(load4(data + i), addend)));
+  }
+  scalarAddScalar(data + i, length - i, value);
+}
+
+B9_AVX2 void avx2MulScalar(std::int64_t *data, std::size_t length,
+                           std::int64_t value) {
+  auto factor = _mm256_set1_epi64x(value);
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    store4(data + i, toInt48x4(mul4(load4(data + i), factor)));
+  }
+  scalarMulScalar(data + i, length - i, value);
+}
+
+B9_AVX2 void avx2Add(std::int64_t *to, const std::int64_t *from,
+                     std::size_t length) {
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    store4(to + i, toInt48x4(_mm256_add_epi64(load4(to + i), load4(from + i))));
+  }
+  scalarAdd(to + i, from + i, length - i);
+}
+
+B9_AVX2 void avx2Mul(std::int64_t *to, const std::int64_t *from,
+                     std::size_t length) {
+  std::size_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    store4(to + i, toInt48x4(mul4(load4(to + i), load4(from + i))));
+  }
+  scalarMul(to + i, from + i, length - i);
+}
+
+const ArrayKernels AVX2_KERNELS = {
+    "avx2",        avx2Sum,       avx2Min,       avx2Max,
+    fillElements,  copyElements,  avx2Compare,   avx2Find,
+    avx2PrefixSum, avx2AddScalar, avx2MulScalar, avx2Add,
+    avx2Mul};
+
+//
+// SSE4.2 kernels, two elements at a time.
+//
+
+B9_SSE42 inline __m128i load2(const std::int64_t *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+B9_SSE42 inline void store2(std::int64_t *p, __m128i x) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(p), x);
+}
+
+B9_SSE42 inline __m128i toInt48x2(__m128i x) {
+  auto mask = _mm_set1_epi64x(INT48_MASK);
+  auto sign = _mm_set1_epi64x(INT48_SIGN);
+  return _mm_sub_epi64(_mm_xor_si128(_mm_and_si128(x, mask), sign), sign);
+}
+
+B9_SSE42 inline __m128i mul2(__m128i a, __m128i b) {
+  auto low = _mm_mul_epu32(a, b);
+  auto cross = _mm_add_epi64(_mm_mul_epu32(a, _mm_srli_epi64(b, 32)),
+                             _mm_mul_epu32(_mm_srli_epi64(a, 32), b));
+  return _mm_add_epi64(low, _mm_slli_epi64(cross, 32));
+}
+
+B9_SSE42 std::int64_t sse42Sum(const std::int64_t *data, std::size_t length) {
+  auto sum = _mm_setzero_si128();
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    sum = _mm_add_epi64(sum, load2(data + i));
+  }
+  std::int64_t lanes[2];
+  store2(lanes, sum);
+  std::uint64_t total =
+      std::uint64_t(lanes[0]) + lanes[1] + scalarSum(data + i, length - i);
+  return toInt48(total);
+}
+
+B9_SSE42 std::int64_t sse42Min(const std::int64_t *data, std::size_t length) {
+  if (length < 2) return scalarMin(data, length);
+  auto min = load2(data);
+  std::size_t i = 2;
+  for (; i + 2 <= length; i += 2) {
+    auto x = load2(data + i);
+    min = _mm_blendv_epi8(min, x, _mm_cmpgt_epi64(min, x));
+  }
+  std::int64_t lanes[2];
+  store2(lanes, min);
+  auto result = std::min(lanes[0], lanes[1]);
+  return i == length ? result : std::min(result, data[i]);
+}
+
+B9_SSE42 std::int64_t sse42Max(const std::int64_t *data, std::size_t length) {
+  if (length < 2) return scalarMax(data, length);
+  auto max = load2(data);
+  std::size_t i = 2;
+  for (; i + 2 <= length; i += 2) {
+    auto x = load2(data + i);
+    max = _mm_blendv_epi8(max, x, _mm_cmpgt_epi64(x, max));
+  }
+  std::int64_t lanes[2];
+  store2(lanes, max);
+  auto result = std::max(lanes[0], lanes[1]);
+  return i == length ? result : std::max(result, data[i]);
+}
+
+B9_SSE42 int sse42Compare(const std::int64_t *a, const std::int64_t *b,
+                          std::size_t length) {
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    auto equal = _mm_cmpeq_epi64(load2(a + i), load2(b + i));
+    if (_mm_movemask_pd(_mm_castsi128_pd(equal)) != 0x3) break;
+  }
+  return scalarCompare(a + i, b + i, length - i);
+}
+
+B9_SSE42 std::int64_t sse42Find(const std::int64_t *data, std::size_t length,
+                                std::int64_t value) {
+  auto needle = _mm_set1_epi64x(value);
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    auto equal = _mm_cmpeq_epi64(load2(data + i), needle);
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(equal));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  auto found = scalarFind(data + i, length - i, value);
+  return found < 0 ? -1 : i + found;
+}
+
+B9_SSE42 std::int64_t sse42PrefixSum(std::int64_t *data, std::size_t length) {
+  auto carry = _mm_setzero_si128();
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    auto x = load2(data + i);
+    x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi64(x, carry);
+    store2(data + i, toInt48x2(x));
+    carry = _mm_unpackhi_epi64(x, x);
+  }
+  std::int64_t lanes[2];
+  store2(lanes, carry);
+  return toInt48(prefixSumFrom(data + i, length - i, lanes[0]));
+}
+
+B9_SSE42 void sse42AddScalar(std::int64_t *data, std::size_t length,
+                             std::int64_t value) {
+  auto addend = _mm_set1_epi64x(value);
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    store2(data + i, toInt48x2(_mm_add_epi64(load2(data + i), addend)));
+  }
+  scalarAddScalar(data + i, length - i, value);
+}
+
+B9_SSE42 void sse42MulScalar(std::int64_t *data, std::size_t length,
+                             std::int64_t value) {
+  auto factor = _mm_set1_epi64x(value);
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    store2(data + i, toInt48x2(mul2(load2(data + i), factor)));
+  }
+  scalarMulScalar(data + i, length - i, value);
+}
+
+B9_SSE42 void sse42Add(std::int64_t *to, const std::int64_t *from,
+                       std::size_t length) {
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    store2(to + i, toInt48x2(_mm_add_epi64(load2(to + i), load2(from + i))));
+  }
+  scalarAdd(to + i, from + i, length - i);
+}
+
+B9_SSE42 void sse42Mul(std::int64_t *to, const std::int64_t *from,
+                       std::size_t length) {
+  std::size_t i = 0;
+  for (; i + 2 <= length; i += 2) {
+    store2(to + i, toInt48x2(mul2(load2(to + i), load2(from + i))));
+  }
+  scalarMul(to + i, from + i, length - i);
+}
+
+const ArrayKernels SSE42_KERNELS = {
+    "sse4.2",       sse42Sum,       sse42Min,       sse42Max,
+    fillElements,   copyElements,   sse42Compare,   sse42Find,
+    sse42PrefixSum, sse42AddScalar, sse42MulScalar, sse42Add,
+    sse42Mul};
+
+#endif  // B9_X86_KERNELS
+
+}  // namespace
+
+std::vector<const ArrayKernels *> supportedArrayKernels() {
+  std::vector<const ArrayKernels *> kernels;
+#if defined(B9_X86_KERNELS)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) kernels.push_back(&AVX2_KERNELS);
+  if (__builtin_cpu_supports("sse4.2")) kernels.push_back(&SSE42_KERNELS);
+#endif
+  kernels.push_back(&SCALAR_KERNELS);
+  return kernels;
+}
+
+const ArrayKernels &arrayKernels() {
+  static const ArrayKernels &kernels = *supportedArrayKernels().front();
+  return kernels;
+}
+
+}  // namespace b9
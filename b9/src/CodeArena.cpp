@@ -0,0 +1,63 @@
+#include <b9/CodeArena.hpp>
+
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+#include <new>
+
+namespace b9 {
+
+constexpr std::size_t CodeArena::ALIGNMENT;
+constexpr std::size_t CodeArena::NONE;
+
+CodeArena::CodeArena(const Module &module, const std::vector<bool> &include)
+    : offsets_(module.functionCount(), NONE) {
+  const auto count = module.functionCount();
+
+  // Order the functions by a depth first walk of the local call graph.
+  std::vector<std::size_t> order;
+  std::vector<bool> visited(count, false);
+  std::vector<std::size_t> pending;
+  for (std::size_t root = 0; root < count; root++) {
+    pending.push_back(root);
+    while (!pending.empty()) {
+      auto function = pending.back();
+      pending.pop_back();
+      if (visited[function]) continue;
+      visited[function] = true;
+      if (include[function]) {
+        order.push_back(function);
+        size_ += module.getFunction(function).instructions.size();
+      }
+      const auto &instructions = module.getFunction(function).instructions;
+      for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+        if (isFunctionCall(it->opCode()) &&
+            static_cast<std::size_t>(it->immediate()) < count &&
+            !visited[it->immediate()]) {
+          pending.push_back(it->immediate());
+        }
+      }
+    }
+  }
+
+  if (size_ == 0) {
+    return;
+  }
+  auto bytes = size_ * sizeof(Instruction);
+  bytes = (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  void *code = nullptr;
+  if (posix_memalign(&code, ALIGNMENT, bytes) != 0) {
+    throw std::bad_alloc{};
+  }
+  code_.reset(static_cast<Instruction *>(code));
+
+  auto next = code_.get();
+  for (auto function : order) {
+    const auto &instructions = module.getFunction(function).instructions;
+    offsets_[function] = next - code_.get();
+    next = std::uninitialized_copy(instructions.begin(), instructions.end(),
+                                   next);
+  }
+}
+
+}  // namespace b9
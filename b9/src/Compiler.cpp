@@ -53,6 +53,8 @@ GlobalTypes::GlobalTypes(TR::TypeDictionary &td) {
   td.DefineField(ec, "stack_", operandStack, ExecutionContextOffset::STACK);
   // td.DefineField(ec, "programCounter", ???,
   // ExecutionContextOffset::PROGRAM_COUNTER);
+  td.DefineField(ec, "tailCallTarget_", size,
+                 ExecutionContextOffset::TAIL_CALL_TARGET);
   td.CloseStruct(ec);
 
   executionContextPtr = td.PointerTo(executionContext);
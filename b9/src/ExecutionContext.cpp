@@ -1,5 +1,6 @@
 #include <b9/ExecutionContext.hpp>
 #include <b9/VirtualMachine.hpp>
+#include <b9/WriteBarrier.hpp>
 #include <b9/compiler/Compiler.hpp>
 
 #include <omrgc.h>
@@ -12,12 +13,15 @@
 #include <OMR/Om/Value.hpp>
 
 #include <sys/time.h>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 
 namespace b9 {
@@ -26,7 +30,9 @@ ExecutionContext::ExecutionContext(VirtualMachine &virtualMachine,
                                    const Config &cfg)
     : omContext_(virtualMachine.memoryManager()),
       virtualMachine_(&virtualMachine),
-      cfg_(&cfg) {
+      cfg_(&cfg),
+      output_(virtualMachine.output()),
+      allocationBase_(virtualMachine.allocatedBytes()) {
   omContext().userMarkingFns().push_back(
       [this](Om::MarkingVisitor &v) { this->visit(v); });
 }
@@ -79,25 +85,42 @@ Om::Value ExecutionContext::callJitFunction(JitFunction jitFunction,
   return Om::Value(Om::AS_RAW, result);
 }
 
-StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
-  auto function = virtualMachine_->getFunction(functionIndex);
-  auto paramsCount = function->nparams;
-  auto localsCount = function->nlocals;
+bool ExecutionContext::callCompiled(std::size_t &functionIndex,
+                                    StackElement &result) {
   auto jitFunction = virtualMachine_->getJitAddress(functionIndex);
+  while (jitFunction) {
+    auto paramsCount = virtualMachine_->getParamCount(functionIndex);
+    result = callJitFunction(jitFunction, paramsCount);
+    if (result.raw() != tailCallPending()) {
+      return true;
+    }
+    functionIndex = tailCallTarget_;
+    jitFunction = virtualMachine_->getJitAddress(functionIndex);
+  }
+  return false;
+}
+
+StackElement ExecutionContext::interpret(std::size_t functionIndex) {
+  auto paramsCount = virtualMachine_->getParamCount(functionIndex);
 
   if (cfg_->debug) {
-    std::cerr << "intepret: " << function->name
-              << " nparams: " << function->nparams << std::endl;
+    auto function = virtualMachine_->getFunction(functionIndex);
+    std::cerr << "intepret: " << function->name << " nparams: " << paramsCount
+              << std::endl;
   }
 
-  if (jitFunction) {
-    return callJitFunction(jitFunction, paramsCount);
+  StackElement *params = stack_.top() - paramsCount;
+
+  StackElement result;
+  if (callCompiled(functionIndex, result)) {
+    return result;
   }
 
   // interpret the method otherwise
-  const Instruction *instructionPointer = function->instructions.data();
-
-  StackElement *params = stack_.top() - paramsCount;
+  const LinkedModule *module = &virtualMachine_->functionModule(functionIndex);
+  auto localsCount = virtualMachine_->getLocalCount(functionIndex);
+  const Instruction *instructionPointer =
+      virtualMachine_->getEntry(functionIndex);
 
   stack_.pushn(localsCount);  // make room for locals in the stack
   StackElement *locals = stack_.top() - localsCount;
@@ -105,8 +128,23 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
   while (*instructionPointer != END_SECTION) {
     switch (instructionPointer->opCode()) {
       case OpCode::FUNCTION_CALL:
-        doFunctionCall(instructionPointer->immediate());
+        doFunctionCall(module->callTargets[instructionPointer->immediate()]);
         break;
+      case OpCode::TAIL_CALL: {
+        // Carry on in the callee, in this frame.
+        functionIndex = module->callTargets[instructionPointer->immediate()];
+        doTailCall(params, virtualMachine_->getParamCount(functionIndex));
+        if (callCompiled(functionIndex, result)) {
+          return result;
+        }
+        module = &virtualMachine_->functionModule(functionIndex);
+        localsCount = virtualMachine_->getLocalCount(functionIndex);
+        stack_.pushn(localsCount);
+        locals = stack_.top() - localsCount;
+        instructionPointer = virtualMachine_->getEntry(functionIndex);
+        programCounter_++;
+        continue;
+      }
       case OpCode::FUNCTION_RETURN: {
         auto result = stack_.pop();
         stack_.restore(params);
@@ -152,6 +190,31 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
       case OpCode::INT_PUSH_CONSTANT:
         doIntPushConstant(instructionPointer->immediate());
         break;
+      case OpCode::INT_PUSH_CONSTANT_WIDE:
+        doIntPushConstantWide(
+            module->module->integers[instructionPointer->immediate()]);
+        break;
+      case OpCode::INT_MOD:
+        doIntMod();
+        break;
+      case OpCode::INT_AND:
+        doIntAnd();
+        break;
+      case OpCode::INT_OR:
+        doIntOr();
+        break;
+      case OpCode::INT_XOR:
+        doIntXor();
+        break;
+      case OpCode::INT_SHL:
+        doIntShl();
+        break;
+      case OpCode::INT_SHR:
+        doIntShr();
+        break;
+      case OpCode::INT_NEG:
+        doIntNeg();
+        break;
       case OpCode::INT_NOT:
         doIntNot();
         break;
@@ -174,7 +237,7 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
         instructionPointer += doJmpLe(instructionPointer->immediate());
         break;
       case OpCode::STR_PUSH_CONSTANT:
-        doStrPushConstant(instructionPointer->immediate());
+        doStrPushConstant(module->strings[instructionPointer->immediate()]);
         break;
       case OpCode::NEW_OBJECT:
         doNewObject();
@@ -191,6 +254,68 @@ StackElement ExecutionContext::interpret(const std::size_t functionIndex) {
       case OpCode::SYSTEM_COLLECT:
         doSystemCollect();
         break;
+      case OpCode::NEW_INT_ARRAY:
+        doNewIntArray();
+        break;
+      case OpCode::INT_ARRAY_LOAD:
+        doIntArrayLoad();
+        break;
+      case OpCode::INT_ARRAY_STORE:
+        doIntArrayStore();
+        break;
+      case OpCode::ARRAY_LENGTH:
+        doArrayLength();
+        break;
+      case OpCode::DBL_PUSH_CONSTANT:
+        doDblPushConstant(
+            module->module->doubles[instructionPointer->immediate()]);
+        break;
+      case OpCode::DBL_ADD:
+        doDblAdd();
+        break;
+      case OpCode::DBL_SUB:
+        doDblSub();
+        break;
+      case OpCode::DBL_MUL:
+        doDblMul();
+        break;
+      case OpCode::DBL_DIV:
+        doDblDiv();
+        break;
+      case OpCode::DBL_JMP_EQ:
+        instructionPointer +=
+            doDblJmpEq(instructionPointer->immediate());
+        break;
+      case OpCode::DBL_JMP_NEQ:
+        instructionPointer +=
+            doDblJmpNeq(instructionPointer->immediate());
+        break;
+      case OpCode::DBL_JMP_GT:
+        instructionPointer +=
+            doDblJmpGt(instructionPointer->immediate());
+        break;
+      case OpCode::DBL_JMP_GE:
+        instructionPointer +=
+            doDblJmpGe(instructionPointer->immediate());
+        break;
+      case OpCode::DBL_JMP_LT:
+        instructionPointer +=
+            doDblJmpLt(instructionPointer->immediate());
+        break;
+      case OpCode::DBL_JMP_LE:
+        instructionPointer +=
+            doDblJmpLe(instructionPointer->immediate());
+        break;
+      case OpCode::INT_TO_DBL:
+        doIntToDbl();
+        break;
+      case OpCode::DBL_TO_INT:
+        doDblToInt();
+        break;
+      case OpCode::TABLE_SWITCH:
+        instructionPointer += doTableSwitch(
+            module->module->jumpTables[instructionPointer->immediate()]);
+        break;
       default:
         assert(false);
         break;
@@ -205,19 +330,59 @@ void ExecutionContext::push(StackElement value) { stack_.push(value); }
 
 StackElement ExecutionContext::pop() { return stack_.pop(); }
 
-void ExecutionContext::doFunctionCall(Immediate value) {
-  auto f = virtualMachine_->getFunction((std::size_t)value);
-  auto result = interpret(value);
+void ExecutionContext::doFunctionCall(std::size_t target) {
+  auto result = interpret(target);
   push(result);
 }
 
+void ExecutionContext::doTailCall(StackElement *params,
+                                  std::size_t argCount) {
+  auto args = stack_.top() - argCount;
+  std::copy(args, stack_.top(), params);
+  stack_.restore(params + argCount);
+}
+
 void ExecutionContext::doFunctionReturn(StackElement returnVal) {
   // TODO
 }
 
 void ExecutionContext::doPrimitiveCall(Immediate value) {
-  PrimitiveFunction *primitive = virtualMachine_->getPrimitive(value);
-  (*primitive)(this);
+  const Primitive &primitive = virtualMachine_->getPrimitive(value);
+  if (!primitive.isFast()) {
+    (*primitive.function)(this);
+    return;
+  }
+
+  const auto &params = primitive.signature.params;
+  Om::RawValue args[PrimitiveSignature::MAX_PARAMS];
+  for (std::size_t i = params.size(); i-- > 0;) {
+    auto arg = pop();
+    if (!hasType(*this, arg, params[i])) {
+      throw std::runtime_error("Bad argument to primitive " + primitive.name);
+    }
+    args[i] = arg.raw();
+  }
+
+  auto function = primitive.fastFunction;
+  Om::RawValue result = 0;
+  switch (params.size()) {
+    case 0:
+      result = function(this);
+      break;
+    case 1:
+      result = function(this, args[0]);
+      break;
+    case 2:
+      result = function(this, args[0], args[1]);
+      break;
+    case 3:
+      result = function(this, args[0], args[1], args[2]);
+      break;
+    case 4:
+      result = function(this, args[0], args[1], args[2], args[3]);
+      break;
+  }
+  push(Om::Value(Om::AS_RAW, result));
 }
 
 Immediate ExecutionContext::doJmp(Immediate offset) { return offset; }
@@ -270,6 +435,60 @@ void ExecutionContext::doIntPushConstant(Immediate value) {
   stack_.push({Om::AS_INT48, static_cast<std::int64_t>(value)});
 }
 
+void ExecutionContext::doIntPushConstantWide(std::int64_t value) {
+  stack_.push({Om::AS_INT48, value});
+}
+
+void ExecutionContext::doIntMod() {
+  auto right = stack_.pop().getInt48();
+  auto left = stack_.pop().getInt48();
+  if (right == 0) {
+    throw std::runtime_error("Integer modulo by zero");
+  }
+  push({Om::AS_INT48, left % right});
+}
+
+void ExecutionContext::doIntAnd() {
+  auto right = stack_.pop().getInt48();
+  auto left = stack_.pop().getInt48();
+  push({Om::AS_INT48, left & right});
+}
+
+void ExecutionContext::doIntOr() {
+  auto right = stack_.pop().getInt48();
+  auto left = stack_.pop().getInt48();
+  push({Om::AS_INT48, left | right});
+}
+
+void ExecutionContext::doIntXor() {
+  auto right = stack_.pop().getInt48();
+  auto left = stack_.pop().getInt48();
+  push({Om::AS_INT48, left ^ right});
+}
+
+void ExecutionContext::doIntShl() {
+  auto right = stack_.pop().getInt48();
+  auto left = stack_.pop().getInt48();
+  // Shift unsigned, since shifting a negative int left is undefined. The
+  // bits shifted past bit 47 are dropped when the result is boxed.
+  auto shifted = static_cast<std::uint64_t>(left) << (right & 63);
+  push({Om::AS_INT48, static_cast<std::int64_t>(shifted)});
+}
+
+void ExecutionContext::doIntShr() {
+  auto right = stack_.pop().getInt48();
+  auto left = stack_.pop().getInt48();
+  // The int48 is sign extended in 64 bits, so shifting it by 47 or more
+  // leaves 0 or -1, as for an int48 shifted by up to 63.
+  push({Om::AS_INT48, left >> (right & 63)});
+}
+
+void ExecutionContext::doIntNeg() {
+  auto x = stack_.pop().getInt48();
+  // Negating the least int48 gives 2^47, which wraps back to it when boxed.
+  push({Om::AS_INT48, -x});
+}
+
 void ExecutionContext::doIntNot() {
   auto x = stack_.pop();
   assert(x.isInt48());
@@ -303,9 +522,8 @@ Immediate ExecutionContext::doJmpGt(Immediate delta) {
       return delta;
     }
   } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft > strRight) {
+    auto &strings = virtualMachine_->strings();
+    if (strings.compare(left.getUint48(), right.getUint48()) > 0) {
       return delta;
     }
   } else {
@@ -325,9 +543,8 @@ Immediate ExecutionContext::doJmpGe(Immediate delta) {
       return delta;
     }
   } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft >= strRight) {
+    auto &strings = virtualMachine_->strings();
+    if (strings.compare(left.getUint48(), right.getUint48()) >= 0) {
       return delta;
     }
   } else {
@@ -347,9 +564,8 @@ Immediate ExecutionContext::doJmpLt(Immediate delta) {
       return delta;
     }
   } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft < strRight) {
+    auto &strings = virtualMachine_->strings();
+    if (strings.compare(left.getUint48(), right.getUint48()) < 0) {
       return delta;
     }
   } else {
@@ -369,9 +585,8 @@ Immediate ExecutionContext::doJmpLe(Immediate delta) {
       return delta;
     }
   } else if (right.isUint48() && left.isUint48()) {
-    const auto &strRight = virtualMachine_->getString(right.getUint48());
-    const auto &strLeft = virtualMachine_->getString(left.getUint48());
-    if (strLeft <= strRight) {
+    auto &strings = virtualMachine_->strings();
+    if (strings.compare(left.getUint48(), right.getUint48()) <= 0) {
       return delta;
     }
   } else {
@@ -382,12 +597,14 @@ Immediate ExecutionContext::doJmpLe(Immediate delta) {
 }
 
 // ( -- string )
-void ExecutionContext::doStrPushConstant(Immediate param) {
-  assert(param >= 0);
-  stack_.push({Om::AS_UINT48, static_cast<std::uint64_t>(param)});
+void ExecutionContext::doStrPushConstant(std::size_t index) {
+  stack_.push({Om::AS_UINT48, static_cast<std::uint64_t>(index)});
 }
 
 // ( -- object )
+// There is no inline bump-pointer fast path. One would read and advance
+// OMR's thread-local heap pointers and write an Om object header itself, and
+// b9 depends on neither layout, only on Om's allocation functions.
 void ExecutionContext::doNewObject() {
   auto ref = Om::allocateEmptyObject(*this);
   stack_.push(Om::Value{Om::AS_REF, ref});
@@ -396,7 +613,7 @@ void ExecutionContext::doNewObject() {
 // ( object -- value )
 void ExecutionContext::doPushFromObject(Om::Id slotId) {
   auto value = stack_.pop();
-  if (!value.isRef()) {
+  if (!isObject(value)) {
     throw std::runtime_error("Accessing non-object value as an object.");
   }
   auto obj = value.getRef<Om::Object>();
@@ -413,7 +630,7 @@ void ExecutionContext::doPushFromObject(Om::Id slotId) {
 
 // ( object value -- )
 void ExecutionContext::doPopIntoObject(Om::Id slotId) {
-  if (!stack_.peek().isRef()) {
+  if (!isObject(stack_.peek())) {
     throw std::runtime_error("Accessing non-object as an object");
   }
 
@@ -436,8 +653,200 @@ void ExecutionContext::doPopIntoObject(Om::Id slotId) {
   }
 
   auto val = pop();
-  Om::setValue(*this, object, descriptor, val);
-  // TODO: Write barrier the object on store.
+  // The object may outlive the run, and its strings with it.
+  virtualMachine_->keepString(val);
+  storeValue(*this, object, descriptor, val);
+}
+
+namespace {
+
+IntArray *toIntArray(Om::Value value) {
+  if (!isIntArray(value)) {
+    throw std::runtime_error("Accessing non-array value as an array.");
+  }
+  return value.getRef<IntArray>();
+}
+
+std::size_t toArrayIndex(IntArray *array, Om::Value index) {
+  if (!index.isInt48()) {
+    throw std::runtime_error("Array index is not an integer.");
+  }
+  auto i = index.getInt48();
+  if (i < 0 || static_cast<std::size_t>(i) >= intArrayLength(array)) {
+    throw std::out_of_range("Array index out of bounds.");
+  }
+  return i;
+}
+
+}  // namespace
+
+// ( length -- array )
+void ExecutionContext::doNewIntArray() {
+  auto length = stack_.pop();
+  if (!length.isInt48() || length.getInt48() < 0) {
+    throw std::runtime_error("Array length is not a non-negative integer.");
+  }
+  auto array = allocateIntArray(*this, length.getInt48());
+  stack_.push({Om::AS_REF, array});
+}
+
+// ( array index -- value )
+void ExecutionContext::doIntArrayLoad() {
+  auto index = stack_.pop();
+  auto array = toIntArray(stack_.pop());
+  auto value = intArrayData(array)[toArrayIndex(array, index)];
+  stack_.push({Om::AS_INT48, value});
+}
+
+// ( array index value -- )
+void ExecutionContext::doIntArrayStore() {
+  auto value = stack_.pop();
+  auto index = stack_.pop();
+  auto array = toIntArray(stack_.pop());
+  if (!value.isInt48()) {
+    throw std::runtime_error("Storing a non-integer into an int array.");
+  }
+  intArrayData(array)[toArrayIndex(array, index)] = value.getInt48();
+}
+
+// ( array -- length )
+void ExecutionContext::doArrayLength() {
+  auto array = toIntArray(stack_.pop());
+  auto length = static_cast<std::int64_t>(intArrayLength(array));
+  stack_.push({Om::AS_INT48, length});
+}
+
+namespace {
+
+double popDouble(OperandStack &stack) {
+  auto value = stack.pop();
+  if (!value.isDouble()) {
+    throw std::runtime_error("Double operation on a non-double value.");
+  }
+  return value.getDouble();
+}
+
+}  // namespace
+
+std::int64_t truncateDouble(double value) {
+  const double limit = 9223372036854775808.0;  // 2^63
+  if (!(value >= -limit && value < limit)) {
+    return std::numeric_limits<std::int64_t>::min();
+  }
+  return static_cast<std::int64_t>(value);
+}
+
+// ( -- double )
+void ExecutionContext::doDblPushConstant(double value) {
+  stack_.push({Om::AS_DOUBLE, value});
+}
+
+// ( left right -- result )
+void ExecutionContext::doDblAdd() {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  stack_.push({Om::AS_DOUBLE, left + right});
+}
+
+// ( left right -- result )
+void ExecutionContext::doDblSub() {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  stack_.push({Om::AS_DOUBLE, left - right});
+}
+
+// ( left right -- result )
+void ExecutionContext::doDblMul() {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  stack_.push({Om::AS_DOUBLE, left * right});
+}
+
+// ( left right -- result )
+void ExecutionContext::doDblDiv() {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  stack_.push({Om::AS_DOUBLE, left / right});
+}
+
+// ( left right -- )
+Immediate ExecutionContext::doDblJmpEq(Immediate delta) {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  return left == right ? delta : 0;
+}
+
+// ( left right -- )
+Immediate ExecutionContext::doDblJmpNeq(Immediate delta) {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  return left != right ? delta : 0;
+}
+
+// ( left right -- )
+Immediate ExecutionContext::doDblJmpGt(Immediate delta) {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  return left > right ? delta : 0;
+}
+
+// ( left right -- )
+Immediate ExecutionContext::doDblJmpGe(Immediate delta) {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  return left >= right ? delta : 0;
+}
+
+// ( left right -- )
+Immediate ExecutionContext::doDblJmpLt(Immediate delta) {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  return left < right ? delta : 0;
+}
+
+// ( left right -- )
+Immediate ExecutionContext::doDblJmpLe(Immediate delta) {
+  auto right = popDouble(stack_);
+  auto left = popDouble(stack_);
+  return left <= right ? delta : 0;
+}
+
+// ( number -- double )
+void ExecutionContext::doIntToDbl() {
+  auto value = stack_.pop();
+  if (value.isDouble()) {
+    stack_.push(value);
+  } else if (value.isInt48()) {
+    stack_.push({Om::AS_DOUBLE, static_cast<double>(value.getInt48())});
+  } else {
+    throw std::runtime_error("Converting a non-number to a double.");
+  }
+}
+
+// ( number -- integer )
+void ExecutionContext::doDblToInt() {
+  auto value = stack_.pop();
+  if (value.isDouble()) {
+    stack_.push({Om::AS_INT48, truncateDouble(value.getDouble())});
+  } else if (value.isInt48()) {
+    stack_.push(value);
+  } else {
+    throw std::runtime_error("Converting a non-number to an integer.");
+  }
+}
+
+// ( value -- )
+// A value that is not an integer matches no case.
+Immediate ExecutionContext::doTableSwitch(const JumpTable &table) {
+  auto value = stack_.pop();
+  if (!value.isInt48()) {
+    return table.defaultOffset;
+  }
+  auto index = value.getInt48() - table.low;
+  if (index < 0 || index >= static_cast<std::int64_t>(table.offsets.size())) {
+    return table.defaultOffset;
+  }
+  return table.offsets[index];
 }
 
 void ExecutionContext::doCallIndirect() {
@@ -445,7 +854,9 @@ void ExecutionContext::doCallIndirect() {
 }
 
 void ExecutionContext::doSystemCollect() {
-  std::cout << "SYSTEM COLLECT!!!" << std::endl;
+  if (cfg_->verbose) {
+    std::cout << "SYSTEM COLLECT!!!" << std::endl;
+  }
   OMR_GC_SystemCollect(omContext_.vmContext(), 0);
 }
 
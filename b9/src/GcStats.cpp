@@ -0,0 +1,206 @@
+#include <b9/GcStats.hpp>
+
+#include <GCExtensionsBase.hpp>
+#include <Heap.hpp>
+#include <mmomrhook.h>
+#include <omr.h>
+#include <omrhookable.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace b9 {
+
+constexpr std::size_t PauseHistogram::BUCKETS;
+
+void PauseHistogram::record(std::chrono::nanoseconds pause) {
+  auto micros = std::chrono::duration_cast<std::chrono::microseconds>(pause);
+  std::size_t bucket = 0;
+  for (auto us = micros.count(); us > 0 && bucket < BUCKETS - 1; us >>= 1) {
+    bucket++;
+  }
+  buckets_[bucket]++;
+  count_++;
+  total_ += pause;
+  max_ = std::max(max_, pause);
+}
+
+std::chrono::microseconds PauseHistogram::bucketLimit(
+    std::size_t bucket) const {
+  std::chrono::microseconds limit(std::int64_t(1) << bucket);
+  if (bucket == BUCKETS - 1) {
+    auto longest = std::chrono::duration_cast<std::chrono::microseconds>(max_);
+    limit = std::max(limit, longest + std::chrono::microseconds(1));
+  }
+  return limit;
+}
+
+std::chrono::microseconds PauseHistogram::percentile(double fraction) const {
+  if (count_ == 0) return std::chrono::microseconds(0);
+  auto rank = std::max<std::uint64_t>(1, std::ceil(fraction * count_));
+  std::uint64_t seen = 0;
+  for (std::size_t bucket = 0; bucket < BUCKETS; bucket++) {
+    seen += buckets_[bucket];
+    if (seen >= rank) return bucketLimit(bucket);
+  }
+  return bucketLimit(BUCKETS - 1);
+}
+
+double GcStats::allocationRate() const {
+  auto seconds = std::chrono::duration<double>(uptime).count();
+  return seconds > 0 ? allocatedBytes / seconds : 0;
+}
+
+namespace {
+
+double millis(std::chrono::nanoseconds time) {
+  return std::chrono::duration<double, std::milli>(time).count();
+}
+
+std::int64_t micros(std::chrono::nanoseconds time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+}
+
+}  // namespace
+
+std::ostream &operator<<(std::ostream &out, const GcStats &stats) {
+  auto &pauses = stats.pauses;
+  out << "GC collections: " << stats.globalCollections << " global, "
+      << stats.localCollections << " nursery" << std::endl
+      << "GC pauses:      " << pauses.count() << ", " << millis(pauses.total())
+      << " ms total, " << millis(pauses.max()) << " ms max, p50 < "
+      << pauses.percentile(0.5).count() << " us, p99 < "
+      << pauses.percentile(0.99).count() << " us" << std::endl
+      << "Heap:           " << stats.heapUsed << " of " << stats.heapSize
+      << " bytes used, " << stats.liveBytes << " live after the last GC"
+      << std::endl
+      << "Allocated:      " << stats.allocatedBytes << " bytes, "
+      << stats.allocationRate() << " bytes/s";
+  for (std::size_t bucket = 0; bucket < PauseHistogram::BUCKETS; bucket++) {
+    auto count = pauses.buckets()[bucket];
+    if (count != 0) {
+      out << std::endl
+          << "  < " << pauses.bucketLimit(bucket).count() << " us: " << count;
+    }
+  }
+  return out;
+}
+
+void writeJson(std::ostream &out, const GcStats &stats) {
+  auto &pauses = stats.pauses;
+  out << "{\"globalCollections\":" << stats.globalCollections
+      << ",\"localCollections\":" << stats.localCollections
+      << ",\"pauses\":{\"count\":" << pauses.count()
+      << ",\"total\":" << micros(pauses.total())
+      << ",\"max\":" << micros(pauses.max())
+      << ",\"p50\":" << pauses.percentile(0.5).count()
+      << ",\"p99\":" << pauses.percentile(0.99).count() << ",\"histogram\":[";
+  for (std::size_t bucket = 0; bucket < PauseHistogram::BUCKETS; bucket++) {
+    if (bucket != 0) out << ",";
+    out << "{\"limit\":" << pauses.bucketLimit(bucket).count()
+        << ",\"count\":" << pauses.buckets()[bucket] << "}";
+  }
+  out << "]},\"heapSize\":" << stats.heapSize
+      << ",\"heapUsed\":" << stats.heapUsed
+      << ",\"liveBytes\":" << stats.liveBytes
+      << ",\"allocatedBytes\":" << stats.allocatedBytes
+      << ",\"uptime\":" << micros(stats.uptime)
+      << ",\"allocationRate\":" << stats.allocationRate() << "}";
+}
+
+namespace {
+
+/// Nursery collections are local, and whole heap collections global.
+const std::uintptr_t GC_EVENTS[] = {
+    J9HOOK_MM_OMR_GLOBAL_GC_START, J9HOOK_MM_OMR_GLOBAL_GC_END,
+    J9HOOK_MM_OMR_LOCAL_GC_START, J9HOOK_MM_OMR_LOCAL_GC_END};
+
+void onCollection(J9HookInterface **hooks, std::uintptr_t event, void *data,
+                  void *monitor) {
+  auto self = static_cast<GcMonitor *>(monitor);
+  switch (event) {
+    case J9HOOK_MM_OMR_GLOBAL_GC_START:
+      self->collectionStarted(true);
+      break;
+    case J9HOOK_MM_OMR_LOCAL_GC_START:
+      self->collectionStarted(false);
+      break;
+    case J9HOOK_MM_OMR_GLOBAL_GC_END:
+    case J9HOOK_MM_OMR_LOCAL_GC_END:
+      self->collectionEnded();
+      break;
+  }
+}
+
+J9HookInterface **gcHooks(OMR_VM *vm) {
+  auto extensions = MM_GCExtensionsBase::getExtensions(vm);
+  return J9_HOOK_INTERFACE(extensions->omrHookInterface);
+}
+
+}  // namespace
+
+GcMonitor::GcMonitor(OMR_VM *vm) : vm_(vm), started_(Clock::now()) {
+  liveBytes_ = heapUsed();
+  auto hooks = gcHooks(vm_);
+  for (auto event : GC_EVENTS) {
+    (*hooks)->J9HookRegisterWithCallSite(hooks, event, onCollection,
+                                         OMR_GET_CALLSITE(), this);
+  }
+}
+
+GcMonitor::~GcMonitor() noexcept {
+  auto hooks = gcHooks(vm_);
+  for (auto event : GC_EVENTS) {
+    (*hooks)->J9HookUnregister(hooks, event, onCollection, this);
+  }
+}
+
+std::uint64_t GcMonitor::heapSize() const {
+  return MM_GCExtensionsBase::getExtensions(vm_)->heap->getActiveMemorySize();
+}
+
+std::uint64_t GcMonitor::heapUsed() const {
+  auto heap = MM_GCExtensionsBase::getExtensions(vm_)->heap;
+  return heap->getActiveMemorySize() - heap->getApproximateFreeMemorySize();
+}
+
+std::uint64_t GcMonitor::allocatedBytes() const {
+  auto used = heapUsed();
+  return allocatedBefore_ + (used > liveBytes_ ? used - liveBytes_ : 0);
+}
+
+void GcMonitor::collectionStarted(bool global) {
+  if (global) {
+    globalCollections_++;
+  } else {
+    localCollections_++;
+  }
+  if (depth_++ == 0) {
+    allocatedBefore_ = allocatedBytes();
+    collectionStarted_ = Clock::now();
+  }
+}
+
+void GcMonitor::collectionEnded() {
+  assert(depth_ > 0);
+  if (--depth_ == 0) {
+    pauses_.record(Clock::now() - collectionStarted_);
+    liveBytes_ = heapUsed();
+  }
+}
+
+GcStats GcMonitor::stats() const {
+  GcStats stats;
+  stats.globalCollections = globalCollections_;
+  stats.localCollections = localCollections_;
+  stats.pauses = pauses_;
+  stats.heapSize = heapSize();
+  stats.heapUsed = heapUsed();
+  stats.liveBytes = liveBytes_;
+  stats.allocatedBytes = allocatedBytes();
+  stats.uptime = Clock::now() - started_;
+  return stats;
+}
+
+}  // namespace b9
@@ -0,0 +1,229 @@
+#include <b9/HashMap.hpp>
+#include <b9/WriteBarrier.hpp>
+
+#include <OMR/Om/ArrayBufferOperations.hpp>
+#include <OMR/Om/RootRef.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace b9 {
+
+namespace {
+
+/// Mix the bits of a key, so that keys differing only in their high or low
+/// bits land in different groups. This is the finalizer of MurmurHash3.
+std::uint64_t hashKey(Om::RawValue key) {
+  std::uint64_t h = key;
+  h ^= h >> 33;
+  h *= 0xff51'afd7'ed55'8ccd;
+  h ^= h >> 33;
+  h *= 0xc4ce'b9fe'1a85'ec53;
+  h ^= h >> 33;
+  return h;
+}
+
+/// The control bytes of a group, compared against one byte at a time. Bit i
+/// of a match is set if control byte i matches.
+class Group {
+ public:
+  explicit Group(const std::uint8_t *control) : control_(control) {}
+
+#if defined(__SSE2__)
+  std::uint32_t match(std::uint8_t byte) const {
+    auto bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(control_));
+    auto same = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(byte)));
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(same));
+  }
+#else
+  std::uint32_t match(std::uint8_t byte) const {
+    std::uint32_t bits = 0;
+    for (std::size_t i = 0; i < HashTable::GROUP; i++) {
+      if (control_[i] == byte) bits |= std::uint32_t(1) << i;
+    }
+    return bits;
+  }
+#endif
+
+ private:
+  const std::uint8_t *control_;
+};
+
+/// Visits the groups of a table, starting from the hash's. The step grows by
+/// one group each time, which visits every group when there are a power of
+/// two of them.
+class Probe {
+ public:
+  Probe(std::uint64_t hash, std::size_t groups)
+      : mask_(groups - 1), group_((hash >> 7) & mask_) {}
+
+  std::size_t offset() const { return group_ * HashTable::GROUP; }
+
+  void next() {
+    step_++;
+    group_ = (group_ + step_) & mask_;
+  }
+
+ private:
+  std::size_t mask_;
+  std::size_t group_;
+  std::size_t step_ = 0;
+};
+
+std::uint8_t controlByte(std::uint64_t hash) { return hash & 0x7F; }
+
+}  // namespace
+
+constexpr std::size_t HashTable::GROUP;
+constexpr std::uint8_t HashTable::EMPTY;
+constexpr std::uint8_t HashTable::DELETED;
+
+std::size_t HashTable::bytes(std::size_t capacity) {
+  return sizeof(HashTable) + capacity + 2 * capacity * sizeof(Om::RawValue);
+}
+
+HashTable *HashTable::initialize(void *memory, std::size_t capacity) {
+  assert(capacity >= GROUP && (capacity & (capacity - 1)) == 0);
+  auto table = static_cast<HashTable *>(memory);
+  table->capacity_ = capacity;
+  table->size_ = 0;
+  table->deleted_ = 0;
+  std::fill_n(table->control(), capacity, EMPTY);
+  return table;
+}
+
+std::size_t HashTable::slotOf(Om::RawValue key, std::uint64_t hash) const {
+  auto byte = controlByte(hash);
+  for (Probe probe(hash, capacity_ / GROUP);; probe.next()) {
+    Group group(control() + probe.offset());
+    for (auto bits = group.match(byte); bits != 0; bits &= bits - 1) {
+      auto slot = probe.offset() + __builtin_ctz(bits);
+      if (keys()[slot] == key) return slot;
+    }
+    // Keys are put in the first free slot they probe, so no key is past an
+    // empty slot.
+    if (group.match(EMPTY) != 0) return NOT_FOUND;
+  }
+}
+
+const Om::RawValue *HashTable::find(Om::RawValue key) const {
+  auto slot = slotOf(key, hashKey(key));
+  return slot == NOT_FOUND ? nullptr : &values()[slot];
+}
+
+void HashTable::put(Om::RawValue key, Om::RawValue value) {
+  auto hash = hashKey(key);
+  auto slot = slotOf(key, hash);
+  if (slot != NOT_FOUND) {
+    values()[slot] = value;
+    return;
+  }
+
+  assert(hasRoom());
+  for (Probe probe(hash, capacity_ / GROUP);; probe.next()) {
+    Group group(control() + probe.offset());
+    auto bits = group.match(EMPTY) | group.match(DELETED);
+    if (bits != 0) {
+      slot = probe.offset() + __builtin_ctz(bits);
+      break;
+    }
+  }
+  if (control()[slot] == DELETED) deleted_--;
+  control()[slot] = controlByte(hash);
+  keys()[slot] = key;
+  values()[slot] = value;
+  size_++;
+}
+
+bool HashTable::erase(Om::RawValue key) {
+  auto slot = slotOf(key, hashKey(key));
+  if (slot == NOT_FOUND) return false;
+  control()[slot] = DELETED;
+  size_--;
+  deleted_++;
+  return true;
+}
+
+void HashTable::copyInto(HashTable &other) const {
+  forEach([&other](Om::RawValue key, Om::RawValue value) {
+    other.put(key, value);
+  });
+}
+
+namespace {
+
+Om::ArrayBuffer *allocateTable(Om::RunContext &cx, std::size_t capacity) {
+  auto buffer = Om::allocateArrayBuffer(cx, HashTable::bytes(capacity));
+  HashTable::initialize(buffer->data, capacity);
+  return buffer;
+}
+
+void setTable(Om::RunContext &cx, HashMap *map, Om::ArrayBuffer *table) {
+  Om::SlotDescriptor descriptor;
+  bool found = Om::lookupSlot(cx, map, HASH_MAP_TABLE_SLOT, descriptor);
+  assert(found);
+  storeValue(cx, map, descriptor, Om::Value(Om::AS_REF, table));
+}
+
+}  // namespace
+
+bool isHashMap(Om::RunContext &cx, Om::Value value) {
+  if (!isObject(value)) return false;
+  Om::SlotDescriptor descriptor;
+  return Om::lookupSlot(cx, value.getRef<Om::Object>(), HASH_MAP_TABLE_SLOT,
+                        descriptor);
+}
+
+HashMap *allocateHashMap(Om::RunContext &cx) {
+  static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
+
+  Om::RootRef<Om::Object> root(cx, Om::allocateEmptyObject(cx));
+  auto layout = Om::transitionLayout(cx, root, {{type, HASH_MAP_TABLE_SLOT}});
+  assert(layout != nullptr);
+
+  auto table = allocateTable(cx, HashTable::GROUP);
+  setTable(cx, root.get(), table);
+  return root.get();
+}
+
+HashTable &hashMapTable(Om::RunContext &cx, HashMap *map) {
+  Om::SlotDescriptor descriptor;
+  if (!Om::lookupSlot(cx, map, HASH_MAP_TABLE_SLOT, descriptor)) {
+    throw std::runtime_error("Accessing non-map value as a map.");
+  }
+  auto table = Om::getValue(cx, map, descriptor).getRef<Om::ArrayBuffer>();
+  return *reinterpret_cast<HashTable *>(table->data);
+}
+
+void hashMapPut(Om::RunContext &cx, HashMap *map, Om::Value key,
+                Om::Value value) {
+  if (!isHashMapKey(key)) {
+    throw std::runtime_error("Map keys must be ints or strings.");
+  }
+  if (!isHashMapValue(value)) {
+    throw std::runtime_error(
+        "Map values can't be objects, arrays or maps, since the GC does not "
+        "scan maps.");
+  }
+
+  auto *table = &hashMapTable(cx, map);
+  if (!table->hasRoom() && table->find(key.raw()) == nullptr) {
+    auto capacity = table->grownCapacity();
+    Om::RootRef<Om::Object> root(cx, map);
+    auto grown = allocateTable(cx, capacity);
+    map = root.get();
+    auto newTable = reinterpret_cast<HashTable *>(grown->data);
+    hashMapTable(cx, map).copyInto(*newTable);
+    setTable(cx, map, grown);
+    table = newTable;
+  }
+  table->put(key.raw(), value.raw());
+}
+
+}  // namespace b9
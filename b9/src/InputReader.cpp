@@ -0,0 +1,202 @@
+#include <b9/InputReader.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace b9 {
+
+constexpr std::size_t InputReader::CHUNK_SIZE;
+
+namespace {
+
+bool isDigit(int c) { return c >= '0' && c <= '9'; }
+
+bool isSpace(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+
+}  // namespace
+
+InputReader::InputReader(const std::string &path) {
+  if (path == "-") {
+    ownsFd_ = false;
+    open(STDIN_FILENO);
+    return;
+  }
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw InputException{"Cannot open " + path + ": " + std::strerror(errno)};
+  }
+  open(fd);
+}
+
+InputReader::InputReader(int fd) { open(fd); }
+
+InputReader::~InputReader() noexcept {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, size_);
+  }
+  if (ownsFd_ && fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void InputReader::open(int fd) {
+  fd_ = fd;
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    auto mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      mapping_ = mapping;
+      data_ = static_cast<const char *>(mapping);
+      size_ = info.st_size;
+      eof_ = true;
+      madvise(mapping_, size_, MADV_SEQUENTIAL);
+      advise();
+    }
+  }
+}
+
+bool InputReader::fill(std::size_t &keep) {
+  if (eof_) {
+    return false;
+  }
+
+  // Move what is kept to the front, and make room for another chunk.
+  if (keep > 0) {
+    std::memmove(buffer_.data(), buffer_.data() + keep, size_ - keep);
+    size_ -= keep;
+    position_ = position_ > keep ? position_ - keep : 0;
+    keep = 0;
+  }
+  if (buffer_.size() - size_ < CHUNK_SIZE) {
+    buffer_.resize(size_ + CHUNK_SIZE);
+  }
+  data_ = buffer_.data();
+
+  ssize_t count;
+  do {
+    count = read(fd_, buffer_.data() + size_, buffer_.size() - size_);
+  } while (count < 0 && errno == EINTR);
+  if (count < 0) {
+    throw InputException{std::string{"Cannot read input: "} +
+                         std::strerror(errno)};
+  }
+  if (count == 0) {
+    eof_ = true;
+    return false;
+  }
+  size_ += count;
+  return true;
+}
+
+void InputReader::advise() {
+  auto base = static_cast<char *>(mapping_);
+  while (advised_ < size_ && advised_ < position_ + CHUNK_SIZE) {
+    auto length = std::min(CHUNK_SIZE, size_ - advised_);
+    madvise(base + advised_, length, MADV_WILLNEED);
+    advised_ += length;
+  }
+  // The mapping is never written, so dropped pages are read back from the
+  // file if a record still points at them.
+  while (dropped_ + 2 * CHUNK_SIZE <= position_) {
+    madvise(base + dropped_, CHUNK_SIZE, MADV_DONTNEED);
+    dropped_ += CHUNK_SIZE;
+  }
+}
+
+bool InputReader::nextRecord(char delimiter) {
+  std::size_t start = position_;
+  std::size_t scanned = 0;
+  do {
+    if (start + scanned < size_) {
+      auto from = data_ + start + scanned;
+      auto found = static_cast<const char *>(
+          std::memchr(from, delimiter, size_ - start - scanned));
+      if (found != nullptr) {
+        record_ = start;
+        recordSize_ = found - (data_ + start);
+        position_ = start + recordSize_ + 1;
+        if (isMapped()) advise();
+        return true;
+      }
+    }
+    scanned = size_ - start;
+  } while (fill(start));
+
+  // The last record need not end with a delimiter.
+  record_ = start;
+  recordSize_ = size_ - start;
+  position_ = size_;
+  return recordSize_ != 0;
+}
+
+bool InputReader::readInt(std::int64_t &value) {
+  auto peek = [this]() -> int {
+    std::size_t keep = position_;
+    if (position_ == size_ && !fill(keep)) {
+      return -1;
+    }
+    return static_cast<unsigned char>(data_[position_]);
+  };
+
+  // A minus sign counts only right before the first digit.
+  bool negative = false;
+  int c;
+  while (!isDigit(c = peek())) {
+    if (c < 0) return false;
+    negative = c == '-';
+    position_++;
+  }
+
+  std::uint64_t result = 0;
+  while (isDigit(c = peek())) {
+    result = result * 10 + (c - '0');
+    position_++;
+  }
+  value = negative ? static_cast<std::int64_t>(0 - result)
+                   : static_cast<std::int64_t>(result);
+  if (isMapped()) advise();
+  return true;
+}
+
+std::size_t InputReader::readInts(std::int64_t *values, std::size_t count) {
+  std::size_t read = 0;
+  while (read < count && readInt(values[read])) {
+    read++;
+  }
+  return read;
+}
+
+bool InputReader::atEnd() {
+  std::size_t keep = position_;
+  return position_ == size_ && !fill(keep);
+}
+
+std::int64_t parseField(const char *record, std::size_t size,
+                        std::size_t field) {
+  const char *next = record;
+  const char *end = record + size;
+  for (std::size_t i = 0;; i++) {
+    while (next != end && isSpace(*next)) next++;
+    if (next == end) return 0;
+    if (i == field) break;
+    while (next != end && !isSpace(*next)) next++;
+  }
+
+  bool negative = *next == '-';
+  if (negative) next++;
+  if (next == end || !isDigit(*next)) return 0;
+  std::uint64_t result = 0;
+  while (next != end && isDigit(*next)) {
+    result = result * 10 + (*next++ - '0');
+  }
+  return negative ? static_cast<std::int64_t>(0 - result)
+                  : static_cast<std::int64_t>(result);
+}
+
+}  // namespace b9
@@ -0,0 +1,41 @@
+#include <b9/MappedFile.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <system_error>
+
+namespace b9 {
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), path);
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    size_ = info.st_size;
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  int error = errno;
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    throw std::system_error(error, std::generic_category(), path);
+  }
+}
+
+MappedFile::~MappedFile() noexcept {
+  if (size_ != 0) {
+    munmap(data_, size_);
+  }
+}
+
+void MappedFile::advise(int advice) const {
+  if (size_ != 0) {
+    madvise(data_, size_, advice);
+  }
+}
+
+}  // namespace b9
@@ -1,6 +1,7 @@
 #include "b9/compiler/MethodBuilder.hpp"
 #include "b9/ExecutionContext.hpp"
 #include "b9/VirtualMachine.hpp"
+#include "b9/compiler/ArrayBounds.hpp"
 #include "b9/compiler/Compiler.hpp"
 #include "b9/instructions.hpp"
 
@@ -10,6 +11,8 @@
 #include <ilgen/VirtualMachineRegister.hpp>
 #include <ilgen/VirtualMachineRegisterInStruct.hpp>
 
+#include <algorithm>
+
 extern "C" {
 
 void trace(b9::FunctionDef *function, b9::Instruction *instruction) {
@@ -39,11 +42,13 @@ MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
       functionIndex_(functionIndex) {
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
 
+  functionSymbols_.resize(virtualMachine_.getFunctionCount());
+
   /// TODO: The __LINE__/__FILE__ stuff is 100% bogus, this is about as bad.
   DefineLine("<unknown");
   DefineFile(function->name.c_str());
 
-  DefineName(function->name.c_str());
+  DefineName(functionSymbol(functionIndex));
 
   DefineReturnType(globalTypes().stackElement);
 
@@ -56,6 +61,22 @@ MethodBuilder::MethodBuilder(VirtualMachine &virtualMachine,
   AllLocalsHaveBeenDefined();
 }
 
+namespace {
+
+/// A boxed value's tag is the bits above its 48 bit payload.
+constexpr std::int32_t BOX_TAG_SHIFT = 48;
+
+std::int64_t boxTag(Om::Value value) { return value.raw() >> BOX_TAG_SHIFT; }
+
+const std::int64_t INT48_TAG = boxTag(Om::Value(Om::AS_INT48, 0));
+const std::int64_t UINT48_TAG = boxTag(Om::Value(Om::AS_UINT48, 0));
+const std::int64_t REF_TAG =
+    boxTag(Om::Value(Om::AS_REF, static_cast<Om::Cell *>(nullptr)));
+const std::int64_t PTR_TAG =
+    boxTag(Om::Value(Om::AS_PTR, static_cast<void *>(nullptr)));
+
+}  // namespace
+
 static const std::string PARAM_STRING = "param";
 static const std::string LOCAL_STRING = "local";
 
@@ -98,6 +119,12 @@ void MethodBuilder::defineLocals() {
   // Address of the current stack top
   DefineLocal("stackTop", globalTypes().stackElementPtr);
 
+  // The case a TABLE_SWITCH takes
+  DefineLocal("switchIndex", Int32);
+
+  // The result of a compiled call, once any tail call it ended in is done
+  DefineLocal("callResult", globalTypes().stackElement);
+
   locals_.resize(function->nlocals);
 
   for (std::size_t i = 0; i < function->nlocals; i++) {
@@ -106,12 +133,23 @@ void MethodBuilder::defineLocals() {
   }
 }
 
+/// Function names are only unique within a module, so compiled functions are
+/// known to the JIT by their name and VM function index.
+const char *MethodBuilder::functionSymbol(std::size_t functionIndex) {
+  std::string &symbol = functionSymbols_[functionIndex];
+  if (symbol.empty()) {
+    symbol = virtualMachine_.getFunction(functionIndex)->name + "#" +
+             std::to_string(functionIndex);
+  }
+  return symbol.c_str();
+}
+
 void MethodBuilder::defineFunctions() {
   int functionIndex = 0;
   while (functionIndex < virtualMachine_.getFunctionCount()) {
     if (virtualMachine_.getJitAddress(functionIndex) != nullptr) {
       auto function = virtualMachine_.getFunction(functionIndex);
-      auto name = function->name.c_str();
+      auto name = functionSymbol(functionIndex);
       DefineFunction(name, (char *)__FILE__, name,
                      (void *)virtualMachine_.getJitAddress(functionIndex),
                      Int64, function->nparams, globalTypes().stackElement,
@@ -123,12 +161,62 @@ void MethodBuilder::defineFunctions() {
     functionIndex++;
   }
 
+  primitiveSymbols_.resize(virtualMachine_.getPrimitiveCount());
+  for (std::size_t i = 0; i < primitiveSymbols_.size(); i++) {
+    const auto &primitive = virtualMachine_.getPrimitive(i);
+    if (!primitive.isFast()) continue;
+    auto &symbol = primitiveSymbols_[i];
+    symbol = "primitive:" + primitive.name;
+    DefineFunction(symbol.c_str(), (char *)__FILE__, symbol.c_str(),
+                   (void *)primitive.fastFunction, Int64,
+                   primitive.signature.params.size() + 1,
+                   globalTypes().executionContextPtr,
+                   globalTypes().stackElement, globalTypes().stackElement,
+                   globalTypes().stackElement, globalTypes().stackElement);
+  }
+
   DefineFunction((char *)"interpret", (char *)__FILE__, "interpret",
                  (void *)&interpret, Int64, 2,
                  globalTypes().executionContextPtr, globalTypes().size);
+  DefineFunction((char *)"resume_tail_call", (char *)__FILE__,
+                 "resume_tail_call", (void *)&resume_tail_call, Int64, 1,
+                 globalTypes().executionContextPtr);
   DefineFunction((char *)"primitive_call", (char *)__FILE__, "primitive_call",
                  (void *)&primitive_call, NoType, 2,
                  globalTypes().executionContextPtr, Int32);
+  DefineFunction((char *)"has_primitive_type", (char *)__FILE__,
+                 "has_primitive_type", (void *)&has_primitive_type, Int32, 3,
+                 globalTypes().executionContextPtr, Int32,
+                 globalTypes().stackElement);
+  DefineFunction((char *)"primitive_arg_error", (char *)__FILE__,
+                 "primitive_arg_error", (void *)&primitive_arg_error, NoType,
+                 3, globalTypes().executionContextPtr, Int32, Int32);
+  DefineFunction((char *)"new_object", (char *)__FILE__, "new_object",
+                 (void *)&new_object, Int64, 1,
+                 globalTypes().executionContextPtr);
+  DefineFunction((char *)"pop_into_object", (char *)__FILE__,
+                 "pop_into_object", (void *)&pop_into_object, NoType, 2,
+                 globalTypes().executionContextPtr, Int32);
+  DefineFunction((char *)"new_int_array", (char *)__FILE__, "new_int_array",
+                 (void *)&new_int_array, Int64, 2,
+                 globalTypes().executionContextPtr, Int64);
+  DefineFunction((char *)"is_int_array", (char *)__FILE__, "is_int_array",
+                 (void *)&is_int_array, Int32, 1, globalTypes().stackElement);
+  DefineFunction((char *)"int_mod_by_zero", (char *)__FILE__,
+                 "int_mod_by_zero", (void *)&int_mod_by_zero, NoType, 1,
+                 Int64);
+  DefineFunction((char *)"is_int48", (char *)__FILE__, "is_int48",
+                 (void *)&is_int48, Int32, 1, globalTypes().stackElement);
+  DefineFunction((char *)"array_type_error", (char *)__FILE__,
+                 "array_type_error", (void *)&array_type_error, NoType, 1,
+                 globalTypes().stackElement);
+  DefineFunction((char *)"array_index_error", (char *)__FILE__,
+                 "array_index_error", (void *)&array_index_error, NoType, 2,
+                 Int64, Int64);
+  DefineFunction((char *)"int_to_double", (char *)__FILE__, "int_to_double",
+                 (void *)&int_to_double, Int64, 1, globalTypes().stackElement);
+  DefineFunction((char *)"double_to_int", (char *)__FILE__, "double_to_int",
+                 (void *)&double_to_int, Int64, 1, globalTypes().stackElement);
   DefineFunction((char *)"trace", (char *)__FILE__, "trace", (void *)&trace,
                  NoType, 2, globalTypes().addressPtr, globalTypes().addressPtr);
   DefineFunction((char *)"print_stack", (char *)__FILE__, "print_stack",
@@ -147,6 +235,7 @@ bool MethodBuilder::inlineProgramIntoBuilder(
   bool success = true;
   maxInlineDepth_--;
   const FunctionDef *function = virtualMachine_.getFunction(functionIndex);
+  const LinkedModule &module = virtualMachine_.functionModule(functionIndex);
   const Instruction *program = function->instructions.data();
 
   // Create a BytecodeBuilder for each Bytecode
@@ -187,7 +276,7 @@ bool MethodBuilder::inlineProgramIntoBuilder(
 
   for (std::size_t index = GetNextBytecodeFromWorklist(); index != -1;
        index = GetNextBytecodeFromWorklist()) {
-    ok = generateILForBytecode(function, builderTable, index,
+    ok = generateILForBytecode(function, module, builderTable, index,
                                jumpToBuilderForInlinedReturn);
     if (!ok) break;
   }
@@ -261,7 +350,7 @@ void MethodBuilder::storeParam(TR::IlBuilder *b, std::size_t index,
 }
 
 bool MethodBuilder::generateILForBytecode(
-    const FunctionDef *function,
+    const FunctionDef *function, const LinkedModule &module,
     std::vector<TR::BytecodeBuilder *> bytecodeBuilderTable,
     std::size_t instructionIndex,
     TR::BytecodeBuilder *jumpToBuilderForInlinedReturn) {
@@ -325,14 +414,9 @@ bool MethodBuilder::generateILForBytecode(
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
       break;
-    case OpCode::FUNCTION_RETURN: {
-      auto result = popValue(builder);
-      TR::IlValue *stack = builder->StructFieldInstanceAddress(
-          "b9::ExecutionContext", "stack_", builder->Load("executionContext"));
-      builder->StoreIndirect("b9::OperandStack", "top_", stack,
-                             builder->Load("stackBase"));
-      builder->Return(result);
-    } break;
+    case OpCode::FUNCTION_RETURN:
+      handle_bc_function_return(builder);
+      break;
     case OpCode::DUPLICATE: {
       auto x = popValue(builder);
       pushValue(builder, x);
@@ -389,6 +473,27 @@ bool MethodBuilder::generateILForBytecode(
     case OpCode::INT_NOT:
       handle_bc_not(builder, nextBytecodeBuilder);
       break;
+    case OpCode::INT_MOD:
+      handle_bc_mod(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_AND:
+      handle_bc_and(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_OR:
+      handle_bc_or(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_XOR:
+      handle_bc_xor(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_SHL:
+      handle_bc_shl(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_SHR:
+      handle_bc_shr(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_NEG:
+      handle_bc_neg(builder, nextBytecodeBuilder);
+      break;
     case OpCode::INT_PUSH_CONSTANT: {
       int constvalue = instruction.immediate();
       /// TODO: box/unbox here.
@@ -396,26 +501,99 @@ bool MethodBuilder::generateILForBytecode(
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
+    case OpCode::INT_PUSH_CONSTANT_WIDE: {
+      auto constvalue = module.module->integers[instruction.immediate()];
+      pushInt48(builder, builder->ConstInt64(constvalue));
+      if (nextBytecodeBuilder)
+        builder->AddFallThroughBuilder(nextBytecodeBuilder);
+    } break;
     case OpCode::STR_PUSH_CONSTANT: {
-      int index = instruction.immediate();
+      std::size_t index = module.strings[instruction.immediate()];
       /// TODO: Box/unbox here.
       pushUint48(builder, builder->ConstInt64(index));
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
     case OpCode::PRIMITIVE_CALL: {
-      state(builder)->Commit(builder);
-      TR::IlValue *result =
-          builder->Call("primitive_call", 2, builder->Load("executionContext"),
-                        builder->ConstInt32(instruction.immediate()));
-      state(builder)->Reload(builder);
+      if (virtualMachine_.getPrimitive(instruction.immediate()).isFast()) {
+        bool discarded = instructionIndex + 1 < program.size() &&
+                         program[instructionIndex + 1].opCode() == OpCode::DROP;
+        fastPrimitiveCall(builder, instruction.immediate(), discarded);
+      } else {
+        state(builder)->Commit(builder);
+        builder->Call("primitive_call", 2, builder->Load("executionContext"),
+                      builder->ConstInt32(instruction.immediate()));
+        state(builder)->Reload(builder);
+      }
       if (nextBytecodeBuilder)
         builder->AddFallThroughBuilder(nextBytecodeBuilder);
     } break;
     case OpCode::FUNCTION_CALL: {
       handle_bc_function_call(builder, nextBytecodeBuilder,
-                              instruction.immediate());
+                              module.callTargets[instruction.immediate()]);
+    } break;
+    case OpCode::TAIL_CALL:
+      handle_bc_tail_call(builder, bytecodeBuilderTable,
+                          module.callTargets[instruction.immediate()]);
+      break;
+    case OpCode::NEW_OBJECT:
+      handle_bc_new_object(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::POP_INTO_OBJECT:
+      handle_bc_pop_into_object(builder, nextBytecodeBuilder,
+                                instruction.immediate());
+      break;
+    case OpCode::NEW_INT_ARRAY:
+      handle_bc_new_int_array(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_ARRAY_LOAD: {
+      bool inBounds = inBoundsAccesses(function, module)[instructionIndex];
+      handle_bc_int_array_load(builder, nextBytecodeBuilder, inBounds);
+    } break;
+    case OpCode::INT_ARRAY_STORE: {
+      bool inBounds = inBoundsAccesses(function, module)[instructionIndex];
+      handle_bc_int_array_store(builder, nextBytecodeBuilder, inBounds);
     } break;
+    case OpCode::ARRAY_LENGTH:
+      handle_bc_array_length(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::DBL_PUSH_CONSTANT:
+      handle_bc_dbl_push_constant(
+          builder, nextBytecodeBuilder,
+          module.module->doubles[instruction.immediate()]);
+      break;
+    case OpCode::DBL_ADD:
+      handle_bc_dbl_add(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::DBL_SUB:
+      handle_bc_dbl_sub(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::DBL_MUL:
+      handle_bc_dbl_mul(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::DBL_DIV:
+      handle_bc_dbl_div(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::DBL_JMP_EQ:
+    case OpCode::DBL_JMP_NEQ:
+    case OpCode::DBL_JMP_GT:
+    case OpCode::DBL_JMP_GE:
+    case OpCode::DBL_JMP_LT:
+    case OpCode::DBL_JMP_LE:
+      handle_bc_dbl_jmp(builder, bytecodeBuilderTable, program,
+                        instructionIndex, nextBytecodeBuilder);
+      break;
+    case OpCode::INT_TO_DBL:
+      handle_bc_int_to_dbl(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::DBL_TO_INT:
+      handle_bc_dbl_to_int(builder, nextBytecodeBuilder);
+      break;
+    case OpCode::TABLE_SWITCH:
+      handle_bc_table_switch(
+          builder, bytecodeBuilderTable, instructionIndex,
+          module.module->jumpTables[instruction.immediate()]);
+      break;
     default:
       if (cfg_.debug) {
         std::cout << "Cannot handle unknown bytecode: returning" << std::endl;
@@ -429,7 +607,7 @@ bool MethodBuilder::generateILForBytecode(
 
 void MethodBuilder::interpreterCall(TR::BytecodeBuilder *b,
                                     std::size_t target) {
-  const auto &callee = virtualMachine_.module()->functions[target];
+  const auto &callee = *virtualMachine_.getFunction(target);
 
   if (cfg_.verbose) {
     std::cerr << "interpreterCall: " << callee.name << std::endl;
@@ -444,7 +622,7 @@ void MethodBuilder::interpreterCall(TR::BytecodeBuilder *b,
 }
 
 void MethodBuilder::directCall(TR::BytecodeBuilder *b, std::size_t target) {
-  const auto &callee = virtualMachine_.module()->functions[target];
+  const auto &callee = *virtualMachine_.getFunction(target);
 
   if (cfg_.verbose) {
     std::cout << "directCall: " << callee.name << std::endl;
@@ -453,15 +631,16 @@ void MethodBuilder::directCall(TR::BytecodeBuilder *b, std::size_t target) {
   assert(virtualMachine_.getJitAddress(target) || target == functionIndex_);
 
   state(b)->Commit(b);
-  auto result = b->Call(callee.name.c_str(), 2, b->Load("executionContext"),
+  auto result = b->Call(functionSymbol(target), 2, b->Load("executionContext"),
                         b->ConstInt64(target));
+  result = finishTailCall(b, result);
   state(b)->adjust(b, -callee.nparams);
   state(b)->Reload(b);
   state(b)->pushValue(b, result);
 }
 
 void MethodBuilder::passParamCall(TR::BytecodeBuilder *b, std::size_t target) {
-  const auto &callee = virtualMachine_.module()->functions[target];
+  const auto &callee = *virtualMachine_.getFunction(target);
 
   if (cfg_.verbose) {
     std::cout << "passParamCall: " << callee.name << std::endl;
@@ -478,10 +657,131 @@ void MethodBuilder::passParamCall(TR::BytecodeBuilder *b, std::size_t target) {
   }
   params.at(0) = b->Load("executionContext");
 
-  auto result = b->Call(callee.name.c_str(), params.size(), params.data());
+  auto result = b->Call(functionSymbol(target), params.size(), params.data());
+  state(b)->pushValue(b, finishTailCall(b, result));
+}
+
+TR::IlValue *MethodBuilder::finishTailCall(TR::IlBuilder *b,
+                                           TR::IlValue *result) {
+  b->Store("callResult", result);
+  TR::IlBuilder *pending = nullptr;
+  b->IfThen(&pending, b->EqualTo(result, b->ConstInt64(tailCallPending())));
+  auto resumed = pending->Call("resume_tail_call", 1,
+                               pending->Load("executionContext"));
+  pending->Store("callResult", resumed);
+  return b->Load("callResult");
+}
+
+void MethodBuilder::fastPrimitiveCall(TR::BytecodeBuilder *b,
+                                      std::size_t index,
+                                      bool resultDiscarded) {
+  const auto &signature = virtualMachine_.getPrimitive(index).signature;
+
+  std::vector<TR::IlValue *> params(signature.params.size() + 1);
+  for (std::size_t i = signature.params.size(); i >= 1; --i) {
+    params.at(i) = state(b)->popValue(b);
+  }
+  params.at(0) = b->Load("executionContext");
+
+  // Compiled code cannot unwind, so an argument of the wrong type is fatal,
+  // where the interpreter would throw. The checks come first, so a dropped
+  // call still fails the way the interpreter does.
+  for (std::size_t i = 0; i < signature.params.size(); i++) {
+    auto type = signature.params[i];
+    if (type == PrimitiveType::VALUE) continue;
+    auto ok = hasPrimitiveType(b, params.at(0), params.at(i + 1), type);
+    TR::IlBuilder *bad = nullptr;
+    b->IfThen(&bad, b->EqualTo(ok, b->ConstInt32(0)));
+    bad->Call("primitive_arg_error", 3, params.at(0), b->ConstInt32(index),
+              b->ConstInt32(i));
+  }
+
+  // A pure call whose result is dropped does nothing.
+  if (signature.pure && resultDiscarded) {
+    state(b)->pushValue(b, b->ConstInt64(0));
+    return;
+  }
+
+  // Only a GC can observe the VM stack during the call.
+  if (signature.allocates) state(b)->Commit(b);
+  auto result = b->Call(primitiveSymbols_[index].c_str(), params.size(),
+                        params.data());
+  if (signature.allocates) state(b)->Reload(b);
   state(b)->pushValue(b, result);
 }
 
+TR::IlValue *MethodBuilder::hasPrimitiveType(TR::IlBuilder *b,
+                                             TR::IlValue *context,
+                                             TR::IlValue *value,
+                                             PrimitiveType type) {
+  auto tag = b->UnsignedShiftR(value, b->ConstInt32(BOX_TAG_SHIFT));
+  auto is = [&](std::int64_t expected) {
+    return b->EqualTo(tag, b->ConstInt64(expected));
+  };
+  auto isNot = [&](std::int64_t expected) {
+    return b->NotEqualTo(tag, b->ConstInt64(expected));
+  };
+  switch (type) {
+    case PrimitiveType::INT:
+      return is(INT48_TAG);
+    case PrimitiveType::STRING:
+      return is(UINT48_TAG);
+    case PrimitiveType::REF:
+      return is(REF_TAG);
+    case PrimitiveType::MAP_KEY:
+      return b->Or(is(INT48_TAG), is(UINT48_TAG));
+    case PrimitiveType::MAP_VALUE:
+      return b->And(isNot(REF_TAG), isNot(PTR_TAG));
+    default:
+      return b->Call("has_primitive_type", 3, context,
+                     b->ConstInt32(static_cast<std::int32_t>(type)), value);
+  }
+}
+
+const std::vector<bool> &MethodBuilder::inBoundsAccesses(
+    const FunctionDef *function, const LinkedModule &module) {
+  auto found = inBoundsAccesses_.find(function);
+  if (found == inBoundsAccesses_.end()) {
+    auto inBounds = findInBoundsAccesses(function->instructions,
+                                         module.module->jumpTables);
+    found = inBoundsAccesses_.emplace(function, std::move(inBounds)).first;
+  }
+  return found->second;
+}
+
+TR::IlValue *MethodBuilder::toIntArray(TR::IlBuilder *b, TR::IlValue *value,
+                                       bool checked) {
+  if (checked) {
+    TR::IlBuilder *notArray = nullptr;
+    b->IfThen(&notArray, b->EqualTo(b->Call("is_int_array", 1, value),
+                                    b->ConstInt32(0)));
+    notArray->Call("array_type_error", 1, value);
+  }
+  return OMR::Om::ValueBuilder::getRef(b, value);
+}
+
+TR::IlValue *MethodBuilder::intArrayLength(TR::IlBuilder *b,
+                                           TR::IlValue *array) {
+  auto size = b->LoadAt(globalTypes().int64Ptr,
+                        b->Add(array, b->ConstInt64(IntArrayOffset::SIZE)));
+  return b->UnsignedShiftR(size, b->ConstInt32(3));
+}
+
+TR::IlValue *MethodBuilder::intArrayElement(TR::IlBuilder *b,
+                                            TR::IlValue *array,
+                                            TR::IlValue *index,
+                                            bool inBounds) {
+  if (!inBounds) {
+    // A negative index compares as a huge unsigned one.
+    auto length = intArrayLength(b, array);
+    TR::IlBuilder *outOfBounds = nullptr;
+    b->IfThen(&outOfBounds, b->UnsignedGreaterOrEqualTo(index, length));
+    outOfBounds->Call("array_index_error", 2, index, length);
+  }
+  auto data = b->Add(array, b->ConstInt64(IntArrayOffset::DATA));
+  return b->IndexAt(globalTypes().int64Ptr, data, index);
+}
+
 void MethodBuilder::handle_bc_function_call(TR::BytecodeBuilder *builder,
                                             TR::BytecodeBuilder *nextBuilder,
                                             std::size_t target) {
@@ -501,6 +801,63 @@ void MethodBuilder::handle_bc_function_call(TR::BytecodeBuilder *builder,
   if (nextBuilder) builder->AddFallThroughBuilder(nextBuilder);
 }
 
+void MethodBuilder::handle_bc_tail_call(
+    TR::BytecodeBuilder *builder,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+    std::size_t target) {
+  if (target != functionIndex_ || cfg_.debug) {
+    // The callee runs after this function returns, from its caller's
+    // trampoline, so a chain of tail calls takes no native stack. Its
+    // arguments replace this function's, as in the interpreter.
+    const auto &callee = *virtualMachine_.getFunction(target);
+    std::vector<TR::IlValue *> args(callee.nparams);
+    for (std::size_t i = args.size(); i-- > 0;) {
+      args[i] = popValue(builder);
+    }
+    TR::IlValue *base = builder->Load("stackBase");
+    for (std::size_t i = 0; i < args.size(); i++) {
+      builder->StoreAt(builder->IndexAt(globalTypes().stackElementPtr, base,
+                                        builder->ConstInt32(i)),
+                       args[i]);
+    }
+    TR::IlValue *context = builder->Load("executionContext");
+    TR::IlValue *stack = builder->StructFieldInstanceAddress(
+        "b9::ExecutionContext", "stack_", context);
+    builder->StoreIndirect(
+        "b9::OperandStack", "top_", stack,
+        builder->IndexAt(globalTypes().stackElementPtr, base,
+                         builder->ConstInt32(args.size())));
+    builder->StoreIndirect("b9::ExecutionContext", "tailCallTarget_",
+                           context, builder->ConstInt64(target));
+    builder->Return(builder->ConstInt64(tailCallPending()));
+    return;
+  }
+
+  // A call to this function starts it again, with the arguments as its
+  // parameters and its locals cleared, as the interpreter does.
+  const auto &function = *virtualMachine_.getFunction(target);
+  std::vector<TR::IlValue *> args(function.nparams);
+  for (std::size_t i = args.size(); i-- > 0;) {
+    args[i] = popValue(builder);
+  }
+  for (std::size_t i = 0; i < args.size(); i++) {
+    storeParam(builder, i, args[i]);
+  }
+  for (std::size_t i = 0; i < function.nlocals; i++) {
+    storeLocal(builder, i, builder->ConstInt64(0));
+  }
+  builder->Goto(bytecodeBuilderTable[0]);
+}
+
+void MethodBuilder::handle_bc_function_return(TR::BytecodeBuilder *builder) {
+  auto result = popValue(builder);
+  TR::IlValue *stack = builder->StructFieldInstanceAddress(
+      "b9::ExecutionContext", "stack_", builder->Load("executionContext"));
+  builder->StoreIndirect("b9::OperandStack", "top_", stack,
+                         builder->Load("stackBase"));
+  builder->Return(result);
+}
+
 /*************************************************
  * GENERATE CODE FOR BYTECODES
  *************************************************/
@@ -665,6 +1022,294 @@ void MethodBuilder::handle_bc_not(TR::BytecodeBuilder *builder,
   builder->AddFallThroughBuilder(nextBuilder);
 }
 
+void MethodBuilder::handle_bc_mod(TR::BytecodeBuilder *builder,
+                                  TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popInt48(builder);
+  TR::IlValue *left = popInt48(builder);
+
+  // Compiled code cannot unwind, so a zero divisor is fatal, where the
+  // interpreter throws.
+  TR::IlBuilder *byZero = nullptr;
+  builder->IfThen(&byZero, builder->EqualTo(right, builder->ConstInt64(0)));
+  byZero->Call("int_mod_by_zero", 1, left);
+
+  pushInt48(builder, builder->Rem(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_and(TR::BytecodeBuilder *builder,
+                                  TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popInt48(builder);
+  TR::IlValue *left = popInt48(builder);
+
+  pushInt48(builder, builder->And(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_or(TR::BytecodeBuilder *builder,
+                                 TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popInt48(builder);
+  TR::IlValue *left = popInt48(builder);
+
+  pushInt48(builder, builder->Or(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_xor(TR::BytecodeBuilder *builder,
+                                  TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popInt48(builder);
+  TR::IlValue *left = popInt48(builder);
+
+  pushInt48(builder, builder->Xor(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_shl(TR::BytecodeBuilder *builder,
+                                  TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popInt48(builder);
+  TR::IlValue *left = popInt48(builder);
+
+  // Take the count modulo 64, as the interpreter does.
+  TR::IlValue *count =
+      builder->ConvertTo(Int32, builder->And(right, builder->ConstInt64(63)));
+
+  pushInt48(builder, builder->ShiftL(left, count));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_shr(TR::BytecodeBuilder *builder,
+                                  TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popInt48(builder);
+  TR::IlValue *left = popInt48(builder);
+
+  // Take the count modulo 64, as the interpreter does.
+  TR::IlValue *count =
+      builder->ConvertTo(Int32, builder->And(right, builder->ConstInt64(63)));
+
+  pushInt48(builder, builder->ShiftR(left, count));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_neg(TR::BytecodeBuilder *builder,
+                                  TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *value = popInt48(builder);
+
+  pushInt48(builder, builder->Sub(builder->ConstInt64(0), value));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_new_object(TR::BytecodeBuilder *builder,
+                                         TR::BytecodeBuilder *nextBuilder) {
+  // Like the interpreter, this allocates through Om, with no inline fast
+  // path. Allocating may collect, so the GC has to see the operand stack.
+  state(builder)->Commit(builder);
+  auto object =
+      builder->Call("new_object", 1, builder->Load("executionContext"));
+  state(builder)->Reload(builder);
+  pushValue(builder, object);
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_pop_into_object(TR::BytecodeBuilder *builder,
+                                              TR::BytecodeBuilder *nextBuilder,
+                                              Immediate slotId) {
+  // The store may transition the object's layout, which allocates, so the
+  // object and value stay on the stack until the store is done.
+  state(builder)->Commit(builder);
+  builder->Call("pop_into_object", 2, builder->Load("executionContext"),
+                builder->ConstInt32(slotId));
+  state(builder)->adjust(builder, -2);
+  state(builder)->Reload(builder);
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_new_int_array(TR::BytecodeBuilder *builder,
+                                            TR::BytecodeBuilder *nextBuilder) {
+  auto length = popInt48(builder);
+  state(builder)->Commit(builder);
+  auto array = builder->Call("new_int_array", 2,
+                             builder->Load("executionContext"), length);
+  state(builder)->Reload(builder);
+  pushValue(builder, array);
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_int_array_load(TR::BytecodeBuilder *builder,
+                                             TR::BytecodeBuilder *nextBuilder,
+                                             bool inBounds) {
+  auto index = popInt48(builder);
+  auto array = toIntArray(builder, popValue(builder), !inBounds);
+  auto element = intArrayElement(builder, array, index, inBounds);
+  pushInt48(builder, builder->LoadAt(globalTypes().int64Ptr, element));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_int_array_store(TR::BytecodeBuilder *builder,
+                                              TR::BytecodeBuilder *nextBuilder,
+                                              bool inBounds) {
+  auto value = popInt48(builder);
+  auto index = popInt48(builder);
+  auto array = toIntArray(builder, popValue(builder), !inBounds);
+  auto element = intArrayElement(builder, array, index, inBounds);
+  builder->StoreAt(element, value);
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_array_length(TR::BytecodeBuilder *builder,
+                                           TR::BytecodeBuilder *nextBuilder) {
+  auto array = toIntArray(builder, popValue(builder));
+  pushInt48(builder, intArrayLength(builder, array));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_dbl_push_constant(
+    TR::BytecodeBuilder *builder, TR::BytecodeBuilder *nextBuilder,
+    double value) {
+  pushDouble(builder, builder->ConstDouble(value));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_dbl_add(TR::BytecodeBuilder *builder,
+                                      TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popDouble(builder);
+  TR::IlValue *left = popDouble(builder);
+
+  pushDouble(builder, builder->Add(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_dbl_sub(TR::BytecodeBuilder *builder,
+                                      TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popDouble(builder);
+  TR::IlValue *left = popDouble(builder);
+
+  pushDouble(builder, builder->Sub(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_dbl_mul(TR::BytecodeBuilder *builder,
+                                      TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popDouble(builder);
+  TR::IlValue *left = popDouble(builder);
+
+  pushDouble(builder, builder->Mul(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_dbl_div(TR::BytecodeBuilder *builder,
+                                      TR::BytecodeBuilder *nextBuilder) {
+  TR::IlValue *right = popDouble(builder);
+  TR::IlValue *left = popDouble(builder);
+
+  pushDouble(builder, builder->Div(left, right));
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_dbl_jmp(
+    TR::BytecodeBuilder *builder,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+    const std::vector<Instruction> &program, long bytecodeIndex,
+    TR::BytecodeBuilder *nextBuilder) {
+  Instruction instruction = program[bytecodeIndex];
+  int delta = instruction.immediate() + 1;
+  int next_bc_index = bytecodeIndex + delta;
+  TR::BytecodeBuilder *jumpTo = bytecodeBuilderTable[next_bc_index];
+
+  TR::IlValue *right = popDouble(builder);
+  TR::IlValue *left = popDouble(builder);
+
+  switch (instruction.opCode()) {
+    case OpCode::DBL_JMP_EQ:
+      builder->IfCmpEqual(jumpTo, left, right);
+      break;
+    case OpCode::DBL_JMP_NEQ:
+      builder->IfCmpNotEqual(jumpTo, left, right);
+      break;
+    case OpCode::DBL_JMP_GT:
+      builder->IfCmpGreaterThan(jumpTo, left, right);
+      break;
+    case OpCode::DBL_JMP_GE:
+      builder->IfCmpGreaterOrEqual(jumpTo, left, right);
+      break;
+    case OpCode::DBL_JMP_LT:
+      builder->IfCmpLessThan(jumpTo, left, right);
+      break;
+    case OpCode::DBL_JMP_LE:
+      builder->IfCmpLessOrEqual(jumpTo, left, right);
+      break;
+    default:
+      assert(false);
+      break;
+  }
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+/// Values outside the table are sent to the default with two compares, and
+/// the rest index a native jump table.
+void MethodBuilder::handle_bc_table_switch(
+    TR::BytecodeBuilder *builder,
+    const std::vector<TR::BytecodeBuilder *> &bytecodeBuilderTable,
+    long bytecodeIndex, const JumpTable &table) {
+  auto target = [&](std::int32_t offset) {
+    return bytecodeBuilderTable[bytecodeIndex + offset + 1];
+  };
+  TR::BytecodeBuilder *defaultBuilder = target(table.defaultOffset);
+
+  TR::IlValue *value = popValue(builder);
+  if (table.offsets.empty()) {
+    builder->Goto(defaultBuilder);
+    return;
+  }
+  // A value that is not an integer matches no case.
+  builder->IfCmpEqualZero(defaultBuilder, builder->Call("is_int48", 1, value));
+  value = OMR::Om::ValueBuilder::getInt48(builder, value);
+  std::int64_t high = std::int64_t(table.low) + table.offsets.size() - 1;
+  builder->IfCmpLessThan(defaultBuilder, value, builder->ConstInt64(table.low));
+  builder->IfCmpGreaterThan(defaultBuilder, value, builder->ConstInt64(high));
+  TR::IlValue *index = builder->Sub(value, builder->ConstInt64(table.low));
+  builder->Store("switchIndex", builder->ConvertTo(Int32, index));
+
+  // Each case is a plain builder that goes to the bytecode's builder, so the
+  // VM state is handed to the targets here.
+  std::vector<TR::IlBuilder::JBCase *> cases;
+  for (std::size_t i = 0; i < table.offsets.size(); i++) {
+    TR::BytecodeBuilder *destination = target(table.offsets[i]);
+    builder->AddSuccessorBuilder(&destination);
+    TR::IlBuilder *caseBuilder = nullptr;
+    cases.push_back(builder->MakeCase(i, &caseBuilder, false));
+    caseBuilder->Goto(destination);
+  }
+  TR::IlBuilder *unreachable = nullptr;
+  builder->Switch("switchIndex", &unreachable, cases.size(), cases.data());
+  unreachable->Goto(defaultBuilder);
+}
+
+/// Values of unknown type are converted by a call, since only the runtime
+/// can tell ints and doubles apart.
+void MethodBuilder::handle_bc_int_to_dbl(TR::BytecodeBuilder *builder,
+                                         TR::BytecodeBuilder *nextBuilder) {
+  auto value = popValue(builder);
+  auto known = knownDouble(value);
+  if (known) {
+    pushDouble(builder, known);
+  } else {
+    pushValue(builder, builder->Call("int_to_double", 1, value));
+  }
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
+void MethodBuilder::handle_bc_dbl_to_int(TR::BytecodeBuilder *builder,
+                                         TR::BytecodeBuilder *nextBuilder) {
+  auto value = popValue(builder);
+  auto known = knownDouble(value);
+  if (known) {
+    pushInt48(builder, builder->ConvertTo(Int64, known));
+  } else {
+    pushValue(builder, builder->Call("double_to_int", 1, value));
+  }
+  builder->AddFallThroughBuilder(nextBuilder);
+}
+
 void MethodBuilder::drop(TR::BytecodeBuilder *builder, std::size_t n) {
   for (std::size_t i = 0; i < n; i++) popValue(builder);
 }
@@ -700,4 +1345,28 @@ TR::IlValue *MethodBuilder::popUint48(TR::BytecodeBuilder *builder) {
   return OMR::Om::ValueBuilder::getUint48(builder, popValue(builder));
 }
 
+void MethodBuilder::pushDouble(TR::BytecodeBuilder *builder,
+                               TR::IlValue *value) {
+  auto boxed = OMR::Om::ValueBuilder::fromDouble(builder, value);
+  unboxedDoubles_[boxed] = value;
+  pushValue(builder, boxed);
+}
+
+TR::IlValue *MethodBuilder::popDouble(TR::BytecodeBuilder *builder) {
+  auto value = popValue(builder);
+  auto known = knownDouble(value);
+  if (known) {
+    return known;
+  }
+  return OMR::Om::ValueBuilder::getDouble(builder, value);
+}
+
+/// The model state pops the very IlValue that was pushed, until it is
+/// committed and reloaded. The active state always reloads from the stack,
+/// so nothing is known.
+TR::IlValue *MethodBuilder::knownDouble(TR::IlValue *value) {
+  auto found = unboxedDoubles_.find(value);
+  return found == unboxedDoubles_.end() ? nullptr : found->second;
+}
+
 }  // namespace b9
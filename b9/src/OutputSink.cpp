@@ -0,0 +1,136 @@
+#include <b9/OutputSink.hpp>
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <system_error>
+
+namespace b9 {
+
+namespace {
+
+#if defined(IOV_MAX)
+constexpr std::size_t MAX_PIECES = IOV_MAX;
+#else
+constexpr std::size_t MAX_PIECES = 1024;
+#endif
+
+}  // namespace
+
+constexpr std::size_t OutputBuffer::FLUSH_THRESHOLD;
+
+void FdOutputSink::write(const struct iovec *pieces, std::size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Keep output written through std::cout and stdio in order with ours.
+  if (fd_ == STDOUT_FILENO) {
+    std::cout.flush();
+    std::fflush(stdout);
+  }
+
+  std::vector<struct iovec> remaining(pieces, pieces + count);
+  auto next = remaining.data();
+  auto end = remaining.data() + remaining.size();
+  while (next != end) {
+    auto batch = std::min<std::size_t>(end - next, MAX_PIECES);
+    auto written = ::writev(fd_, next, batch);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      throw std::system_error(errno, std::generic_category(), "writev");
+    }
+    // Skip what was written, resuming partway through a piece if needed.
+    while (next != end && static_cast<std::size_t>(written) >= next->iov_len) {
+      written -= next->iov_len;
+      next++;
+    }
+    if (next != end) {
+      next->iov_base = static_cast<char *>(next->iov_base) + written;
+      next->iov_len -= written;
+    }
+  }
+}
+
+void StringOutputSink::write(const struct iovec *pieces, std::size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::size_t i = 0; i < count; i++) {
+    output_.append(static_cast<const char *>(pieces[i].iov_base),
+                   pieces[i].iov_len);
+  }
+}
+
+std::string StringOutputSink::str() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return output_;
+}
+
+void StringOutputSink::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  output_.clear();
+}
+
+OutputBuffer::~OutputBuffer() noexcept {
+  try {
+    flush();
+  } catch (const std::system_error &) {
+    // Nowhere left to report it.
+  }
+}
+
+void OutputBuffer::redirect(OutputSink &sink) {
+  flush();
+  sink_ = &sink;
+}
+
+void OutputBuffer::appendStable(const char *data, std::size_t size) {
+  if (size == 0) return;
+  pieces_.push_back({data, 0, size});
+  added(size);
+}
+
+void OutputBuffer::append(const char *data, std::size_t size) {
+  if (size == 0) return;
+  auto offset = text_.size();
+  text_.append(data, size);
+  // Extend the last piece when it is the text just before this.
+  if (!pieces_.empty() && pieces_.back().data == nullptr &&
+      pieces_.back().offset + pieces_.back().size == offset) {
+    pieces_.back().size += size;
+  } else {
+    pieces_.push_back({nullptr, offset, size});
+  }
+  added(size);
+}
+
+void OutputBuffer::added(std::size_t size) {
+  size_ += size;
+  if (size_ >= FLUSH_THRESHOLD || pieces_.size() >= MAX_PIECES) {
+    flush();
+  }
+}
+
+void OutputBuffer::flush() {
+  if (pieces_.empty()) return;
+
+  std::vector<struct iovec> iovecs;
+  iovecs.reserve(pieces_.size());
+  for (const auto &piece : pieces_) {
+    auto data = piece.data ? piece.data : text_.data() + piece.offset;
+    iovecs.push_back({const_cast<char *>(data), piece.size});
+  }
+  pieces_.clear();
+  size_ = 0;
+
+  // Clear the text after writing, since the iovecs point into it.
+  try {
+    sink_->write(iovecs.data(), iovecs.size());
+  } catch (...) {
+    text_.clear();
+    throw;
+  }
+  text_.clear();
+}
+
+}  // namespace b9
@@ -0,0 +1,108 @@
+#include <b9/StringTable.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+namespace b9 {
+
+constexpr std::uint32_t InternedString::UNRANKED;
+
+namespace {
+
+constexpr std::size_t NOT_FOUND = SIZE_MAX;
+
+}  // namespace
+
+std::size_t StringTable::find(const std::string &string,
+                              std::size_t hash) const {
+  auto matches = index_.equal_range(hash);
+  for (auto it = matches.first; it != matches.second; ++it) {
+    if (strings_[it->second].string == string) {
+      return it->second;
+    }
+  }
+  return NOT_FOUND;
+}
+
+std::size_t StringTable::add(const std::string &string, std::size_t hash,
+                             bool permanent) {
+  std::size_t id;
+  if (free_.empty()) {
+    id = strings_.size();
+    strings_.push_back({string, hash, InternedString::UNRANKED, permanent});
+  } else {
+    id = free_.back();
+    free_.pop_back();
+    strings_[id] = {string, hash, InternedString::UNRANKED, permanent};
+  }
+  index_.emplace(hash, id);
+  if (permanent) {
+    unranked_.push_back(id);
+  } else {
+    temporaries_.push_back(id);
+  }
+  return id;
+}
+
+std::size_t StringTable::intern(const std::string &string) {
+  auto hash = std::hash<std::string>{}(string);
+  auto id = find(string, hash);
+  if (id == NOT_FOUND) {
+    return add(string, hash, true);
+  }
+  keep(id);
+  return id;
+}
+
+std::size_t StringTable::internTemporary(const std::string &string) {
+  auto hash = std::hash<std::string>{}(string);
+  auto id = find(string, hash);
+  return id == NOT_FOUND ? add(string, hash, false) : id;
+}
+
+void StringTable::keep(std::size_t id) {
+  auto &string = strings_[id];
+  if (!string.permanent) {
+    string.permanent = true;
+    unranked_.push_back(id);
+  }
+}
+
+void StringTable::releaseTemporaries() {
+  for (auto id : temporaries_) {
+    auto &string = strings_[id];
+    if (string.permanent) continue;
+    auto matches = index_.equal_range(string.hash);
+    for (auto it = matches.first; it != matches.second; ++it) {
+      if (it->second == id) {
+        index_.erase(it);
+        break;
+      }
+    }
+    std::string().swap(string.string);
+    free_.push_back(id);
+  }
+  temporaries_.clear();
+}
+
+void StringTable::rank() {
+  if (unranked_.empty()) {
+    return;
+  }
+  auto less = [this](std::size_t a, std::size_t b) {
+    return strings_[a].string < strings_[b].string;
+  };
+  std::sort(unranked_.begin(), unranked_.end(), less);
+  std::vector<std::size_t> merged;
+  merged.reserve(ranked_.size() + unranked_.size());
+  std::merge(ranked_.begin(), ranked_.end(), unranked_.begin(),
+             unranked_.end(), std::back_inserter(merged), less);
+  ranked_ = std::move(merged);
+  unranked_.clear();
+  for (std::size_t i = 0; i < ranked_.size(); i++) {
+    strings_[ranked_[i]].rank = static_cast<std::uint32_t>(i);
+  }
+}
+
+}  // namespace b9
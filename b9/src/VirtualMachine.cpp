@@ -9,25 +9,218 @@
 #include <OMR/Om/ShapeOperations.hpp>
 #include <OMR/Om/Value.hpp>
 
+#include <omr.h>
 #include <omrgc.h>
 #include <Jit.hpp>
 
+#include <errno.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <unordered_map>
 
 namespace b9 {
 
-constexpr PrimitiveFunction *const VirtualMachine::primitives_[3];
+namespace {
+
+/// The primitives every VM starts with, in PRIMITIVE_CALL order. compile.js
+/// knows them by these names.
+const std::pair<const char *, PrimitiveFunction *> builtinPrimitives[] = {
+    {"print_string", b9_prim_print_string},
+    {"print_number", b9_prim_print_number},
+    {"print_stack", b9_prim_print_stack},
+    {"string_concat", b9_prim_string_concat},
+    {"string_substring", b9_prim_string_substring},
+    {"string_length", b9_prim_string_length},
+    {"int_to_string", b9_prim_int_to_string},
+    {"builder_new", b9_prim_builder_new},
+    {"builder_append", b9_prim_builder_append},
+    {"builder_to_string", b9_prim_builder_to_string},
+    {"flush_output", b9_prim_flush_output},
+    {"input_open", b9_prim_input_open},
+    {"input_close", b9_prim_input_close},
+    {"input_next_line", b9_prim_input_next_line},
+    {"input_next_record", b9_prim_input_next_record},
+    {"input_record_string", b9_prim_input_record_string},
+    {"input_record_byte", b9_prim_input_record_byte},
+    {"input_record_find", b9_prim_input_record_find},
+    {"input_record_int", b9_prim_input_record_int},
+    {"input_read_int", b9_prim_input_read_int},
+    {"input_at_end", b9_prim_input_at_end},
+};
+
+/// The bulk int array primitives, registered after the builtins. They take
+/// arrays and ints, return an int, and never allocate.
+void registerArrayPrimitives(VirtualMachine &vm) {
+  const auto ARRAY = PrimitiveType::INT_ARRAY;
+  const auto INT = PrimitiveType::INT;
+  auto add = [&vm](const char *name, void *function,
+                   std::vector<PrimitiveType> params, bool pure) {
+    PrimitiveSignature signature;
+    signature.params = std::move(params);
+    signature.result = INT;
+    signature.pure = pure;
+    signature.allocates = false;
+    vm.registerPrimitive(name,
+                         reinterpret_cast<FastPrimitiveFunction>(function),
+                         std::move(signature));
+  };
+  add("array_sum", (void *)b9_prim_array_sum, {ARRAY}, true);
+  add("array_min", (void *)b9_prim_array_min, {ARRAY}, true);
+  add("array_max", (void *)b9_prim_array_max, {ARRAY}, true);
+  add("array_fill", (void *)b9_prim_array_fill, {ARRAY, INT}, false);
+  add("array_copy", (void *)b9_prim_array_copy, {ARRAY, ARRAY}, false);
+  add("array_compare", (void *)b9_prim_array_compare, {ARRAY, ARRAY}, true);
+  add("array_find", (void *)b9_prim_array_find, {ARRAY, INT}, true);
+  add("array_prefix_sum", (void *)b9_prim_array_prefix_sum, {ARRAY}, false);
+  add("array_add_scalar", (void *)b9_prim_array_add_scalar, {ARRAY, INT},
+      false);
+  add("array_mul_scalar", (void *)b9_prim_array_mul_scalar, {ARRAY, INT},
+      false);
+  add("array_add", (void *)b9_prim_array_add, {ARRAY, ARRAY}, false);
+  add("array_mul", (void *)b9_prim_array_mul, {ARRAY, ARRAY}, false);
+}
+
+/// The hash map primitives, registered after the array primitives. Only
+/// map_new and map_put allocate.
+void registerMapPrimitives(VirtualMachine &vm) {
+  const auto MAP = PrimitiveType::MAP;
+  const auto VALUE = PrimitiveType::VALUE;
+  auto add = [&vm](const char *name, void *function,
+                   std::vector<PrimitiveType> params, PrimitiveType result,
+                   bool pure, bool allocates) {
+    PrimitiveSignature signature;
+    signature.params = std::move(params);
+    signature.result = result;
+    signature.pure = pure;
+    signature.allocates = allocates;
+    vm.registerPrimitive(name,
+                         reinterpret_cast<FastPrimitiveFunction>(function),
+                         std::move(signature));
+  };
+  const auto INT = PrimitiveType::INT;
+  const auto KEY = PrimitiveType::MAP_KEY;
+  const auto MAP_VALUE = PrimitiveType::MAP_VALUE;
+  add("map_new", (void *)b9_prim_map_new, {}, MAP, false, true);
+  add("map_get", (void *)b9_prim_map_get, {MAP, VALUE}, VALUE, true, false);
+  add("map_has", (void *)b9_prim_map_has, {MAP, VALUE}, INT, true, false);
+  add("map_put", (void *)b9_prim_map_put, {MAP, KEY, MAP_VALUE}, INT, false,
+      true);
+  add("map_delete", (void *)b9_prim_map_delete, {MAP, VALUE}, INT, false,
+      false);
+  add("map_size", (void *)b9_prim_map_size, {MAP}, INT, true, false);
+}
+
+/// Releases the string builders and temporary strings of a run when it ends,
+/// however it ends.
+class RunCleanup {
+ public:
+  explicit RunCleanup(VirtualMachine &vm) : vm_(vm) {}
+
+  ~RunCleanup() noexcept {
+    vm_.releaseStringBuilders();
+    vm_.strings().releaseTemporaries();
+  }
+
+ private:
+  VirtualMachine &vm_;
+};
+
+/// OMR's GC startup reads its options from the OMR_GC_OPTIONS environment
+/// variable, when the memory system is created, and takes no options
+/// otherwise. This sets the variable while it lives, which is until the
+/// memory system it hands the runtime to has been made, then puts back what
+/// was there, so the options leak into neither later VMs nor child
+/// processes. VMs made at the same time take turns.
+class GcOptionsScope {
+ public:
+  explicit GcOptionsScope(const Config &cfg) : lock_(mutex()) {
+    if (auto previous = getenv(VARIABLE)) {
+      hadPrevious_ = true;
+      previous_ = previous;
+    }
+    if (setenv(VARIABLE, gcOptions(cfg).c_str(), 1) != 0) {
+      throw std::system_error(errno, std::generic_category(),
+                              "Failed to set the GC options");
+    }
+  }
+
+  ~GcOptionsScope() noexcept {
+    if (hadPrevious_) {
+      setenv(VARIABLE, previous_.c_str(), 1);
+    } else {
+      unsetenv(VARIABLE);
+    }
+  }
+
+  GcOptionsScope(const GcOptionsScope &) = delete;
+
+  GcOptionsScope &operator=(const GcOptionsScope &) = delete;
+
+  /// Pass the runtime through, to create the memory system with.
+  Om::ProcessRuntime &runtime(Om::ProcessRuntime &runtime) const {
+    return runtime;
+  }
+
+ private:
+  static constexpr const char *VARIABLE = "OMR_GC_OPTIONS";
+
+  static std::mutex &mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  std::unique_lock<std::mutex> lock_;
+  bool hadPrevious_ = false;
+  std::string previous_;
+};
+
+}  // namespace
+
+std::string gcOptions(const Config &cfg) {
+  std::stringstream options;
+  options << "-Xgcpolicy:" << toString(cfg.gcPolicy);
+  if (cfg.initialHeapSize != 0) {
+    options << " -Xms" << cfg.initialHeapSize;
+  }
+  if (cfg.maxHeapSize != 0) {
+    options << " -Xmx" << cfg.maxHeapSize;
+  }
+  if (cfg.gcPolicy == GcPolicy::GENCON && cfg.nurserySize != 0) {
+    options << " -Xmn" << cfg.nurserySize;
+  }
+  options << " -Xminf" << cfg.minHeapFree << " -Xmaxf" << cfg.maxHeapFree;
+  return options.str();
+}
 
 VirtualMachine::VirtualMachine(Om::ProcessRuntime &runtime, const Config &cfg)
-    : cfg_{cfg}, memoryManager_(runtime), compiler_{nullptr} {
-  if (cfg_.verbose) std::cout << "VM initializing..." << std::endl;
+    : cfg_{cfg},
+      // The options are put back at the end of the full expression, once
+      // the memory system exists.
+      memoryManager_(GcOptionsScope(cfg).runtime(runtime)),
+      compiler_{nullptr},
+      output_{std::make_shared<FdOutputSink>(STDOUT_FILENO)} {
+  if (cfg_.verbose) {
+    std::cout << "VM initializing..." << std::endl
+              << "GC options: " << gcOptions(cfg_) << std::endl;
+  }
+
+  for (const auto &builtin : builtinPrimitives) {
+    registerPrimitive(builtin.first, builtin.second);
+  }
+  registerArrayPrimitives(*this);
+  registerMapPrimitives(*this);
+
+  gcMonitor_ =
+      std::make_unique<GcMonitor>(rootContext().omContext().vmContext()->_vm);
 
   if (cfg_.jit) {
     auto ok = initializeJit();
@@ -40,39 +233,524 @@ VirtualMachine::VirtualMachine(Om::ProcessRuntime &runtime, const Config &cfg)
 }
 
 VirtualMachine::~VirtualMachine() noexcept {
+  if (compilerThread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex_);
+      stopCompiler_ = true;
+    }
+    queueCondition_.notify_all();
+    compilerThread_.join();
+  }
   if (cfg_.jit) {
     shutdownJit();
   }
 }
 
 void VirtualMachine::load(std::shared_ptr<const Module> module) {
+  std::lock_guard<std::mutex> lock(compileMutex_);
+
+  auto linked = std::make_unique<LinkedModule>();
+  linked->module = module;
+
+  const auto base = getFunctionCount();
+  const auto count = module->functionCount();
+
+  linked->callTargets.reserve(count + module->imports.size());
+  for (std::size_t i = 0; i < count; i++) {
+    linked->callTargets.push_back(base + i);
+  }
+  for (const auto &name : module->imports) {
+    linked->callTargets.push_back(resolveImport(name));
+  }
+  linkExports(*linked);
+  linked->code = CodeArena{*module, std::vector<bool>(count, true)};
+
+  // Linking succeeded, add the module to the VM.
+  for (std::size_t i = 0; i < count; i++) {
+    functionTable_.push_back({linked.get(), i});
+  }
+  linked->strings = internStrings(*module);
+  strings_.rank();
+  modules_.push_back(std::move(linked));
   module_ = module;
-  compiledFunctions_.reserve(getFunctionCount());
 }
 
-/// OpCode Interpreter
+std::size_t VirtualMachine::resolveImport(const std::string &name) {
+  for (auto it = modules_.rbegin(); it != modules_.rend(); ++it) {
+    auto match = (*it)->exports.find(name);
+    if (match != (*it)->exports.end()) {
+      return match->second;
+    }
+  }
+  throw LinkException{"Unresolved import: " + name};
+}
 
-JitFunction VirtualMachine::getJitAddress(std::size_t functionIndex) {
-  if (functionIndex >= compiledFunctions_.size()) {
-    return nullptr;
+/// Index the module's functions and exports by name, once its call targets
+/// are known.
+void VirtualMachine::linkExports(LinkedModule &linked) {
+  const Module &module = *linked.module;
+
+  // Indexed modules carry a name index of their own.
+  if (!module.loader) {
+    const auto count = module.functionCount();
+    linked.functionIndex.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+      linked.functionIndex.emplace(module.functions[i].name,
+                                   linked.callTargets[i]);
+    }
+  }
+
+  for (const auto &name : module.exports) {
+    try {
+      linked.exports.emplace(
+          name, linked.callTargets[module.getFunctionIndex(name)]);
+    } catch (const FunctionNotFoundException &) {
+      throw LinkException{"Exported function not defined: " + name};
+    }
   }
-  return compiledFunctions_[functionIndex];
 }
 
-void VirtualMachine::setJitAddress(std::size_t functionIndex,
-                                   JitFunction value) {
-  compiledFunctions_[functionIndex] = value;
+namespace {
+
+/// A builder handle is its slot in the low bits, and the slot's generation
+/// above. Generations start at 1, so handles stay clear of small integers,
+/// and wrap before the handle outgrows an int48.
+constexpr std::int64_t BUILDER_SLOT_BITS = 24;
+constexpr std::int64_t BUILDER_SLOT_MASK = (1 << BUILDER_SLOT_BITS) - 1;
+constexpr std::int64_t MAX_BUILDER_GENERATION =
+    (std::int64_t(1) << (46 - BUILDER_SLOT_BITS)) - 1;
+
+}  // namespace
+
+std::int64_t VirtualMachine::newStringBuilder() {
+  std::size_t slot;
+  if (!freeStringBuilders_.empty()) {
+    slot = freeStringBuilders_.back();
+    freeStringBuilders_.pop_back();
+  } else if (stringBuilders_.size() <= BUILDER_SLOT_MASK) {
+    slot = stringBuilders_.size();
+    stringBuilders_.emplace_back();
+  } else {
+    throw std::runtime_error{"Too many string builders"};
+  }
+  auto &builder = stringBuilders_[slot];
+  builder.live = true;
+  return (builder.generation << BUILDER_SLOT_BITS) | std::int64_t(slot);
 }
 
-PrimitiveFunction *VirtualMachine::getPrimitive(std::size_t index) {
-  return primitives_[index];
+std::string &VirtualMachine::stringBuilder(std::int64_t handle) {
+  auto slot = std::size_t(handle & BUILDER_SLOT_MASK);
+  if (handle < 0 || slot >= stringBuilders_.size() ||
+      !stringBuilders_[slot].live ||
+      stringBuilders_[slot].generation != handle >> BUILDER_SLOT_BITS) {
+    throw std::runtime_error{"Not a string builder"};
+  }
+  return stringBuilders_[slot].buffer;
 }
 
-const FunctionDef *VirtualMachine::getFunction(std::size_t index) {
-  return &module_->functions[index];
+std::size_t VirtualMachine::finishStringBuilder(std::int64_t handle) {
+  auto string = strings_.internTemporary(stringBuilder(handle));
+  releaseStringBuilder(std::size_t(handle & BUILDER_SLOT_MASK));
+  return string;
+}
+
+void VirtualMachine::releaseStringBuilders() {
+  for (std::size_t slot = 0; slot < stringBuilders_.size(); slot++) {
+    if (stringBuilders_[slot].live) {
+      releaseStringBuilder(slot);
+    }
+  }
+}
+
+void VirtualMachine::releaseStringBuilder(std::size_t slot) {
+  auto &builder = stringBuilders_[slot];
+  // Keep the buffer's capacity for the slot's next builder.
+  builder.buffer.clear();
+  builder.live = false;
+  builder.generation = builder.generation == MAX_BUILDER_GENERATION
+                           ? 1
+                           : builder.generation + 1;
+  freeStringBuilders_.push_back(slot);
+}
+
+std::size_t VirtualMachine::openInput(const std::string &path) {
+  inputs_.push_back(std::make_unique<InputReader>(path));
+  return inputs_.size() - 1;
+}
+
+InputReader &VirtualMachine::input(std::size_t id) {
+  if (id >= inputs_.size() || inputs_[id] == nullptr) {
+    throw InputException{"Not an open input"};
+  }
+  return *inputs_[id];
+}
+
+void VirtualMachine::closeInput(std::size_t id) {
+  input(id);
+  inputs_[id] = nullptr;
+}
+
+std::vector<std::size_t> VirtualMachine::internStrings(const Module &module) {
+  std::vector<std::size_t> ids;
+  ids.reserve(module.strings.size());
+  for (const auto &string : module.strings) {
+    ids.push_back(strings_.intern(string));
+  }
+  return ids;
+}
+
+namespace {
+
+/// Marks a function that needs a new VM index.
+constexpr std::size_t NEW_FUNCTION = static_cast<std::size_t>(-1);
+
+/// 64 bit FNV-1a.
+class Hasher {
+ public:
+  void add(const void *data, std::size_t size) {
+    auto bytes = static_cast<const std::uint8_t *>(data);
+    for (std::size_t i = 0; i < size; i++) {
+      hash_ ^= bytes[i];
+      hash_ *= 0x0000'0100'0000'01b3;
+    }
+  }
+
+  void add(std::uint64_t value) { add(&value, sizeof(value)); }
+
+  void add(const std::string &string) {
+    add(string.size());
+    add(string.data(), string.size());
+  }
+
+  std::uint64_t value() const { return hash_; }
+
+ private:
+  std::uint64_t hash_ = 0xcbf2'9ce4'8422'2325;
+};
+
+/// Hash the bytecode of a function. Function, string and double immediates
+/// are hashed by the name or constant they refer to, so the hash does not
+/// change when other functions or constants are added to the module.
+std::uint64_t hashFunction(const Module &module, const FunctionDef &function) {
+  const auto count = module.functionCount();
+  Hasher hasher;
+  hasher.add(function.nparams);
+  hasher.add(function.nlocals);
+  for (auto instruction : function.instructions) {
+    const std::size_t immediate = instruction.immediate();
+    hasher.add(static_cast<std::uint64_t>(instruction.opCode()));
+    if (isFunctionCall(instruction.opCode()) &&
+        immediate < count + module.imports.size()) {
+      if (immediate < count) {
+        hasher.add(module.getFunction(immediate).name);
+      } else {
+        hasher.add(1);  // an import may share a name with a local function
+        hasher.add(module.imports[immediate - count]);
+      }
+    } else if (instruction.opCode() == OpCode::STR_PUSH_CONSTANT &&
+               immediate < module.strings.size()) {
+      hasher.add(module.strings[immediate]);
+    } else if (instruction.opCode() == OpCode::DBL_PUSH_CONSTANT &&
+               immediate < module.doubles.size()) {
+      hasher.add(&module.doubles[immediate], sizeof(double));
+    } else if (instruction.opCode() == OpCode::INT_PUSH_CONSTANT_WIDE &&
+               immediate < module.integers.size()) {
+      hasher.add(static_cast<std::uint64_t>(module.integers[immediate]));
+    } else if (instruction.opCode() == OpCode::TABLE_SWITCH &&
+               immediate < module.jumpTables.size()) {
+      auto &table = module.jumpTables[immediate];
+      hasher.add(static_cast<std::uint64_t>(table.low));
+      hasher.add(static_cast<std::uint64_t>(table.defaultOffset));
+      hasher.add(table.offsets.data(),
+                 table.offsets.size() * sizeof(std::int32_t));
+    } else {
+      hasher.add(static_cast<std::uint64_t>(immediate));
+    }
+  }
+  return hasher.value();
+}
+
+}  // namespace
+
+/// Decide which functions of a module being relinked keep their VM index.
+/// `slots` holds the index each function had before, or NEW_FUNCTION. A
+/// function keeps its index only while every call it makes still reaches the
+/// function it reached before, so this repeats until nothing changes.
+void VirtualMachine::retainUnchanged(const Module &module,
+                                     const std::vector<std::size_t> &imports,
+                                     std::vector<std::size_t> &slots) {
+  const auto count = slots.size();
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (std::size_t i = 0; i < count; i++) {
+      if (slots[i] == NEW_FUNCTION) continue;
+      const auto &previous = *functionTable_.module[slots[i]];
+      const auto &before = *functionTable_.definition[slots[i]];
+      const auto &after = module.getFunction(i);
+      bool same = before.instructions.size() == after.instructions.size();
+      for (std::size_t j = 0; same && j < after.instructions.size(); j++) {
+        if (!isFunctionCall(after.instructions[j].opCode())) continue;
+        const std::size_t callee = after.instructions[j].immediate();
+        std::size_t target = NEW_FUNCTION;
+        if (callee < count) {
+          target = slots[callee];
+        } else if (callee - count < imports.size()) {
+          target = imports[callee - count];
+        }
+        same = target != NEW_FUNCTION &&
+               target ==
+                   previous.callTargets[before.instructions[j].immediate()];
+      }
+      if (!same) {
+        slots[i] = NEW_FUNCTION;
+        changed = true;
+      }
+    }
+  }
+}
+
+void VirtualMachine::reload(const std::shared_ptr<const Module> &oldVersion,
+                            std::shared_ptr<const Module> newVersion) {
+  std::lock_guard<std::mutex> lock(compileMutex_);
+
+  std::size_t position = 0;
+  while (position < modules_.size() &&
+         modules_[position]->module != oldVersion) {
+    position++;
+  }
+  if (position == modules_.size()) {
+    throw LinkException{"Reloading a module that is not loaded"};
+  }
+  const bool latest = module_ == oldVersion;
+
+  // Relink into a staging area first, so a failure leaves the VM untouched.
+  // Modules loaded after the reloaded one are relinked too, since their
+  // imports may now resolve to different functions.
+  std::vector<const LinkedModule *> linked;
+  for (const auto &module : modules_) {
+    linked.push_back(module.get());
+  }
+  std::vector<std::pair<std::size_t, std::unique_ptr<LinkedModule>>> relinked;
+  std::vector<FunctionSlot> added;
+
+  auto resolve = [&](const std::string &name, std::size_t end) {
+    while (end-- > 0) {
+      auto match = linked[end]->exports.find(name);
+      if (match != linked[end]->exports.end()) {
+        return match->second;
+      }
+    }
+    throw LinkException{"Unresolved import: " + name};
+  };
+
+  for (std::size_t m = position; m < modules_.size(); m++) {
+    const LinkedModule &current = *modules_[m];
+    auto module = m == position ? newVersion : current.module;
+    const auto count = module->functionCount();
+
+    std::vector<std::size_t> imports;
+    for (const auto &name : module->imports) {
+      imports.push_back(resolve(name, m));
+    }
+
+    std::vector<std::size_t> slots(count, NEW_FUNCTION);
+    if (m == position) {
+      // Match functions by name, and keep those with the same bytecode.
+      const Module &previous = *current.module;
+      std::unordered_map<std::string, std::size_t> previousIndex;
+      for (std::size_t i = 0; i < previous.functionCount(); i++) {
+        previousIndex.emplace(previous.getFunction(i).name, i);
+      }
+      for (std::size_t i = 0; i < count; i++) {
+        const auto &function = module->getFunction(i);
+        auto match = previousIndex.find(function.name);
+        if (match != previousIndex.end() &&
+            hashFunction(previous, previous.getFunction(match->second)) ==
+                hashFunction(*module, function)) {
+          slots[i] = current.callTargets[match->second];
+        }
+      }
+    } else {
+      slots.assign(current.callTargets.begin(),
+                   current.callTargets.begin() + count);
+    }
+    retainUnchanged(*module, imports, slots);
+
+    auto next = std::make_unique<LinkedModule>();
+    next->module = module;
+    next->strings = m == position ? internStrings(*module) : current.strings;
+    std::vector<bool> isNew(count, false);
+    for (std::size_t i = 0; i < count; i++) {
+      if (slots[i] == NEW_FUNCTION) {
+        slots[i] = getFunctionCount() + added.size();
+        added.push_back({next.get(), i});
+        isNew[i] = true;
+      }
+    }
+    next->callTargets = std::move(slots);
+    next->callTargets.insert(next->callTargets.end(), imports.begin(),
+                             imports.end());
+
+    if (m != position && next->callTargets == current.callTargets) {
+      continue;
+    }
+    linkExports(*next);
+    next->code = CodeArena{*module, isNew};
+    linked[m] = next.get();
+    relinked.emplace_back(m, std::move(next));
+  }
+
+  // Linking succeeded. Superseded modules are retired rather than freed,
+  // since their functions may still be running or be kept by the new
+  // version.
+  for (const auto &slot : added) {
+    functionTable_.push_back(slot);
+  }
+  strings_.rank();
+  for (auto &entry : relinked) {
+    retiredModules_.push_back(std::move(modules_[entry.first]));
+    modules_[entry.first] = std::move(entry.second);
+  }
+  if (latest) {
+    module_ = newVersion;
+  }
+
+  if (cfg_.verbose) {
+    std::cout << "Reloaded module, " << added.size()
+              << " functions changed" << std::endl;
+  }
+
+  if (cfg_.jit) {
+    for (std::size_t i = getFunctionCount() - added.size();
+         i < getFunctionCount(); i++) {
+      compileInBackground(i);
+    }
+  }
+}
+
+void VirtualMachine::compileInBackground(std::size_t functionIndex) {
+  assert(cfg_.jit);
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    compileQueue_.push_back(functionIndex);
+    if (!compilerThread_.joinable()) {
+      compilerThread_ = std::thread{[this] { backgroundCompileLoop(); }};
+    }
+  }
+  queueCondition_.notify_all();
+}
+
+void VirtualMachine::backgroundCompileLoop() {
+  std::unique_lock<std::mutex> queueLock(queueMutex_);
+  while (true) {
+    queueCondition_.wait(queueLock, [this] {
+      return stopCompiler_ || !compileQueue_.empty();
+    });
+    if (stopCompiler_) return;
+
+    auto functionIndex = compileQueue_.front();
+    compileQueue_.pop_front();
+    compilesInProgress_++;
+    queueLock.unlock();
+
+    JitFunction code = nullptr;
+    {
+      std::lock_guard<std::mutex> compileLock(compileMutex_);
+      if (functionTable_.jitAddress[functionIndex] == nullptr) {
+        code = compile(functionIndex);
+      }
+    }
+
+    queueLock.lock();
+    finishedCode_.emplace_back(functionIndex, code);
+    compilesInProgress_--;
+    finishedCodeReady_.store(true, std::memory_order_release);
+    queueCondition_.notify_all();
+  }
+}
+
+void VirtualMachine::installBackgroundCode(bool wait) {
+  std::unique_lock<std::mutex> compileLock(compileMutex_, std::defer_lock);
+  if (wait) {
+    compileLock.lock();
+  } else if (!compileLock.try_lock()) {
+    return;
+  }
+
+  std::vector<std::pair<std::size_t, JitFunction>> finished;
+  {
+    std::lock_guard<std::mutex> queueLock(queueMutex_);
+    finished.swap(finishedCode_);
+    finishedCodeReady_.store(false, std::memory_order_relaxed);
+  }
+  for (const auto &entry : finished) {
+    if (entry.second != nullptr) {
+      functionTable_.jitAddress[entry.first] = entry.second;
+    }
+  }
+}
+
+void VirtualMachine::finishBackgroundCompilation() {
+  {
+    std::unique_lock<std::mutex> queueLock(queueMutex_);
+    queueCondition_.wait(queueLock, [this] {
+      return compileQueue_.empty() && compilesInProgress_ == 0;
+    });
+  }
+  installBackgroundCode(true);
+}
+
+/// OpCode Interpreter
+
+void VirtualMachine::FunctionTable::push_back(const FunctionSlot &slot) {
+  const auto &function = slot.module->module->getFunction(slot.index);
+  module.push_back(slot.module);
+  definition.push_back(&function);
+  entry.push_back(slot.module->code.entry(slot.index));
+  nparams.push_back(function.nparams);
+  nlocals.push_back(function.nlocals);
+  jitAddress.push_back(nullptr);
+}
+
+std::size_t VirtualMachine::registerPrimitive(const std::string &name,
+                                              PrimitiveFunction *function) {
+  Primitive primitive;
+  primitive.name = name;
+  primitive.function = function;
+  return addPrimitive(std::move(primitive));
+}
+
+std::size_t VirtualMachine::registerPrimitive(const std::string &name,
+                                              FastPrimitiveFunction function,
+                                              PrimitiveSignature signature) {
+  if (signature.params.size() > PrimitiveSignature::MAX_PARAMS) {
+    throw std::invalid_argument{"Too many parameters for primitive " + name};
+  }
+  Primitive primitive;
+  primitive.name = name;
+  primitive.fastFunction = function;
+  primitive.signature = std::move(signature);
+  return addPrimitive(std::move(primitive));
+}
+
+std::size_t VirtualMachine::addPrimitive(Primitive primitive) {
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  auto index = primitives_.size();
+  if (!primitiveIndex_.emplace(primitive.name, index).second) {
+    throw std::invalid_argument{"Primitive already registered: " +
+                                primitive.name};
+  }
+  primitives_.push_back(std::move(primitive));
+  return index;
 }
 
 JitFunction VirtualMachine::generateCode(const std::size_t functionIndex) {
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  return compile(functionIndex);
+}
+
+JitFunction VirtualMachine::compile(const std::size_t functionIndex) {
   try {
     return compiler_->generateCode(functionIndex);
   } catch (const CompilationException &e) {
@@ -83,39 +761,92 @@ JitFunction VirtualMachine::generateCode(const std::size_t functionIndex) {
   }
 }
 
-const std::string &VirtualMachine::getString(int index) {
-  return module_->strings[index];
+void VirtualMachine::setOutput(std::shared_ptr<OutputSink> sink) {
+  if (rootContext_ != nullptr) {
+    rootContext_->output().redirect(*sink);
+  }
+  output_ = std::move(sink);
 }
 
-std::size_t VirtualMachine::getFunctionCount() {
-  return module_->functions.size();
+ExecutionContext &VirtualMachine::rootContext() {
+  if (rootContext_ == nullptr) {
+    rootContext_ = std::make_unique<ExecutionContext>(*this, cfg_);
+    rootContext_->omContext().userMarkingFns().push_back(
+        [this](Om::MarkingVisitor &visitor) {
+          for (auto &value : roots_) {
+            visitor.edge(nullptr, Om::ValueSlotHandle(&value));
+          }
+        });
+  }
+  return *rootContext_;
 }
 
 void VirtualMachine::generateAllCode() {
   assert(cfg_.jit);
-  auto functionIndex = 0;  // 0 index for <script>
+  std::lock_guard<std::mutex> lock(compileMutex_);
+  std::size_t functionIndex = 0;  // 0 index for <script>
 
+  // Functions of previously loaded modules are only compiled once.
   while (functionIndex < getFunctionCount()) {
-    if (cfg_.debug)
-      std::cout << "\nJitting function: " << getFunction(functionIndex)->name
-                << " of index: " << functionIndex << std::endl;
-    auto func = compiler_->generateCode(functionIndex);
-    compiledFunctions_.push_back(func);
+    if (functionTable_.jitAddress[functionIndex] == nullptr) {
+      if (cfg_.debug)
+        std::cout << "\nJitting function: " << getFunction(functionIndex)->name
+                  << " of index: " << functionIndex << std::endl;
+      functionTable_.jitAddress[functionIndex] =
+          compiler_->generateCode(functionIndex);
+    }
     ++functionIndex;
   }
 }
 
+std::size_t VirtualMachine::getFunctionIndex(const std::string &name) {
+  for (auto it = modules_.rbegin(); it != modules_.rend(); ++it) {
+    const LinkedModule &linked = **it;
+    if (linked.module->loader) {
+      std::size_t index;
+      if (linked.module->loader->findFunction(name, index)) {
+        return linked.callTargets[index];
+      }
+    } else {
+      auto match = linked.functionIndex.find(name);
+      if (match != linked.functionIndex.end()) {
+        return match->second;
+      }
+    }
+  }
+  throw FunctionNotFoundException{name};
+}
+
+FunctionHandle VirtualMachine::getFunctionHandle(const std::string &name) {
+  auto index = getFunctionIndex(name);
+  return {index, getFunction(index)};
+}
+
 StackElement VirtualMachine::run(const std::string &name,
                                  const std::vector<StackElement> &usrArgs) {
-  return run(module_->getFunctionIndex(name), usrArgs);
+  return run(getFunctionHandle(name), usrArgs);
 }
 
 StackElement VirtualMachine::run(const std::size_t functionIndex,
                                  const std::vector<StackElement> &usrArgs) {
-  auto function = getFunction(functionIndex);
+  return run(FunctionHandle{functionIndex, getFunction(functionIndex)},
+             usrArgs);
+}
+
+StackElement VirtualMachine::run(FunctionHandle handle,
+                                 const std::vector<StackElement> &usrArgs) {
+  auto functionIndex = handle.index;
+  auto function = handle.function;
   auto paramsCount = function->nparams;
 
-  ExecutionContext *executionContext = new ExecutionContext(*this, cfg_);
+  if (finishedCodeReady_.load(std::memory_order_acquire)) {
+    installBackgroundCode(false);
+  }
+
+  // Declared before the context, so the strings are released after the
+  // context's output, which may point into them, is flushed.
+  RunCleanup cleanup(*this);
+  auto executionContext = std::make_unique<ExecutionContext>(*this, cfg_);
 
   if (cfg_.verbose) {
     std::cout << "+++++++++++++++++++++++" << std::endl;
@@ -138,7 +869,19 @@ StackElement VirtualMachine::run(const std::size_t functionIndex,
     executionContext->push(arg);
   }
 
-  StackElement result = executionContext->interpret(functionIndex);
+  StackElement result;
+  try {
+    result = executionContext->interpret(functionIndex);
+  } catch (...) {
+    // Keep what was printed before the failure, but report the failure.
+    try {
+      executionContext->flushOutput();
+    } catch (const std::system_error &) {
+    }
+    throw;
+  }
+  keepString(result);
+  executionContext->flushOutput();
 
   return result;
 }
@@ -156,9 +899,112 @@ Om::RawValue interpret(ExecutionContext *context,
   return (Om::RawValue)context->interpret(functionIndex);
 }
 
+// A compiled call whose callee ended in a tail call finishes it here, where
+// the tail calls that follow reuse one frame.
+Om::RawValue resume_tail_call(ExecutionContext *context) {
+  return context->resumeTailCall().raw();
+}
+
 // For primitive calls
 void primitive_call(ExecutionContext *context, Immediate value) {
   context->doPrimitiveCall(value);
 }
 
+// Compiled fast primitive calls check the types that need a cell's map here.
+// The others are checked inline.
+std::int32_t has_primitive_type(ExecutionContext *context, std::int32_t type,
+                                Om::RawValue value) {
+  return hasType(context->omContext(), Om::Value(Om::AS_RAW, value),
+                 static_cast<PrimitiveType>(type));
+}
+
+void primitive_arg_error(ExecutionContext *context, Immediate index,
+                         std::int32_t param) {
+  const auto &primitive = context->virtualMachine()->getPrimitive(index);
+  std::cerr << "Bad argument " << param << " to primitive " << primitive.name
+            << std::endl;
+  std::abort();
+}
+
+// Compiled NEW_OBJECTs allocate through Om, like the interpreter.
+Om::RawValue new_object(ExecutionContext *context) {
+  return Om::Value{Om::AS_REF, Om::allocateEmptyObject(*context)}.raw();
+}
+
+// Compiled code stores into objects the way the interpreter does, so that
+// the store is write barriered. Compiled code cannot unwind, so bad objects
+// are fatal.
+void pop_into_object(ExecutionContext *context, Immediate slotId) {
+  try {
+    context->doPopIntoObject(Om::Id(slotId));
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << std::endl;
+    std::abort();
+  }
+}
+
+// For int arrays. Compiled code cannot unwind, so bad arrays are fatal.
+Om::RawValue new_int_array(ExecutionContext *context, std::int64_t length) {
+  if (length < 0) {
+    std::cerr << "Array length is not a non-negative integer: " << length
+              << std::endl;
+    std::abort();
+  }
+  auto array = allocateIntArray(context->omContext(), length);
+  return Om::Value(Om::AS_REF, array).raw();
+}
+
+// Compiled code cannot read a cell's map, so it asks here whether a value
+// is an int array.
+std::int32_t is_int_array(Om::RawValue value) {
+  return isIntArray(Om::Value(Om::AS_RAW, value));
+}
+
+void int_mod_by_zero(std::int64_t dividend) {
+  std::cerr << "Integer modulo by zero: " << dividend << " % 0" << std::endl;
+  std::abort();
+}
+
+// A switch on a value that is not an integer takes its default.
+std::int32_t is_int48(Om::RawValue value) {
+  return Om::Value(Om::AS_RAW, value).isInt48();
+}
+
+void array_type_error(Om::RawValue value) {
+  std::cerr << "Accessing non-array value as an array: "
+            << Om::Value(Om::AS_RAW, value) << std::endl;
+  std::abort();
+}
+
+void array_index_error(std::int64_t index, std::int64_t length) {
+  std::cerr << "Array index out of bounds: " << index << " (length " << length
+            << ")" << std::endl;
+  std::abort();
+}
+
+// For conversions of values whose type compiled code does not know.
+Om::RawValue int_to_double(Om::RawValue raw) {
+  Om::Value value(Om::AS_RAW, raw);
+  if (value.isDouble()) {
+    return raw;
+  }
+  if (!value.isInt48()) {
+    std::cerr << "Converting a non-number to a double." << std::endl;
+    std::abort();
+  }
+  return Om::Value(Om::AS_DOUBLE, double(value.getInt48())).raw();
+}
+
+Om::RawValue double_to_int(Om::RawValue raw) {
+  Om::Value value(Om::AS_RAW, raw);
+  if (value.isInt48()) {
+    return raw;
+  }
+  if (!value.isDouble()) {
+    std::cerr << "Converting a non-number to an integer." << std::endl;
+    std::abort();
+  }
+  return Om::Value(Om::AS_INT48, truncateDouble(value.getDouble())).raw();
+}
+
 }  // extern "C"
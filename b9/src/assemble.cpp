@@ -1,21 +1,284 @@
+#include <b9/assemble.hpp>
 #include <b9/instructions.hpp>
+#include <b9/serialize.hpp>
 
+#include <cctype>
 #include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace b9 {
 
-void assembleStringTable(std::istream &in, std::ostream &out) {}
+namespace {
 
-void assembleInstruction(std::istream &in, std::ostream &out) {}
+/// Opcodes by the name b9disasm prints for them.
+const std::unordered_map<std::string, OpCode> &opCodeNames() {
+  static const auto names = [] {
+    std::unordered_map<std::string, OpCode> names;
+    for (unsigned raw = 0; raw <= 0xFF; raw++) {
+      auto opCode = static_cast<OpCode>(raw);
+      std::string name = toString(opCode);
+      if (name != "UNKNOWN_BYTECODE") {
+        names.emplace(name, opCode);
+      }
+    }
+    return names;
+  }();
+  return names;
+}
 
-void assembleFunctionData(std::istream &in, std::ostream &out) {}
+/// Reads tokens straight from the stream buffer. Nothing is read ahead, so
+/// the stream is left just after the last expression read.
+class Lexer {
+ public:
+  explicit Lexer(std::istream &in) : in_(*in.rdbuf()) {}
 
-void assembleFunction(std::istream &in, std::ostream &out) {}
+  [[noreturn]] void error(const std::string &message) {
+    throw AssemblerException{"line " + std::to_string(line_) + ": " +
+                             message};
+  }
 
-void assemble(std::istream &in, std::ostream &out) {}
+  /// The next character after whitespace and comments, or EOF.
+  int peek() {
+    skipSpace();
+    return in_.sgetc();
+  }
+
+  void expect(char c) {
+    if (peek() != c) {
+      error(std::string{"expected '"} + c + "'");
+    }
+    in_.sbumpc();
+  }
+
+  /// A bare word, such as `function` or an opcode name.
+  std::string readSymbol() {
+    skipSpace();
+    std::string symbol;
+    int c = in_.sgetc();
+    while (c != EOF && (std::isalnum(c) || c == '_')) {
+      symbol += static_cast<char>(c);
+      c = in_.snextc();
+    }
+    if (symbol.empty()) {
+      error("expected a name");
+    }
+    return symbol;
+  }
+
+  /// A decimal integer whose magnitude is at most limit.
+  std::int64_t readInteger(std::int64_t limit = 0xFFFF'FFFF) {
+    skipSpace();
+    bool negative = false;
+    int c = in_.sgetc();
+    if (c == '-') {
+      negative = true;
+      c = in_.snextc();
+    }
+    if (c == EOF || !std::isdigit(c)) {
+      error("expected an integer");
+    }
+    std::int64_t value = 0;
+    while (c != EOF && std::isdigit(c)) {
+      if (value > (limit - (c - '0')) / 10) {
+        error("integer out of range");
+      }
+      value = value * 10 + (c - '0');
+      c = in_.snextc();
+    }
+    return negative ? -value : value;
+  }
+
+  /// A floating point number, in any form strtod accepts.
+  double readDouble() {
+    skipSpace();
+    std::string text;
+    int c = in_.sgetc();
+    while (c != EOF && (std::isalnum(c) || c == '.' || c == '-' || c == '+')) {
+      text += static_cast<char>(c);
+      c = in_.snextc();
+    }
+    char *end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0') {
+      error("expected a number");
+    }
+    return value;
+  }
+
+  /// A double quoted string. Supports the escapes \" \\ \n and \t.
+  std::string readString() {
+    expect('"');
+    std::string string;
+    int c = in_.sbumpc();
+    while (c != '"') {
+      if (c == EOF) {
+        error("unterminated string");
+      }
+      if (c == '\n') {
+        line_++;
+      } else if (c == '\\') {
+        switch (c = in_.sbumpc()) {
+          case 'n':
+            c = '\n';
+            break;
+          case 't':
+            c = '\t';
+            break;
+          case '"':
+          case '\\':
+            break;
+          default:
+            error("unknown escape in string");
+        }
+      }
+      string += static_cast<char>(c);
+      c = in_.sbumpc();
+    }
+    return string;
+  }
+
+ private:
+  void skipSpace() {
+    int c = in_.sgetc();
+    while (c != EOF) {
+      if (c == ';') {
+        while (c != EOF && c != '\n') c = in_.snextc();
+      } else if (std::isspace(c)) {
+        if (c == '\n') line_++;
+        c = in_.snextc();
+      } else {
+        break;
+      }
+    }
+  }
+
+  std::streambuf &in_;
+  std::size_t line_ = 1;
+};
+
+Instruction readInstruction(Lexer &lexer) {
+  // b9disasm prefixes every instruction with its index.
+  if (lexer.peek() != '(') {
+    lexer.readInteger();
+  }
+  lexer.expect('(');
+  auto name = lexer.readSymbol();
+  auto match = opCodeNames().find(name);
+  if (match == opCodeNames().end()) {
+    lexer.error("unknown opcode " + name);
+  }
+  std::int64_t immediate = 0;
+  if (lexer.peek() != ')') {
+    immediate = lexer.readInteger();
+    if (immediate < -0x80'0000 || immediate > 0x7F'FFFF) {
+      lexer.error("immediate does not fit in 24 bits");
+    }
+  }
+  lexer.expect(')');
+  return {match->second, static_cast<Immediate>(immediate)};
+}
+
+std::uint32_t readCount(Lexer &lexer) {
+  auto value = lexer.readInteger();
+  if (value < 0) {
+    lexer.error("expected a count");
+  }
+  return static_cast<std::uint32_t>(value);
+}
+
+/// Read the rest of a jump table expression, after the keyword.
+JumpTable readJumpTable(Lexer &lexer) {
+  const std::int64_t limit = std::numeric_limits<std::int32_t>::max();
+  JumpTable table;
+  table.low = lexer.readInteger(limit);
+  table.defaultOffset = lexer.readInteger(limit);
+  while (lexer.peek() != ')') {
+    if (lexer.peek() == EOF) {
+      lexer.error("unterminated jump table");
+    }
+    table.offsets.push_back(lexer.readInteger(limit));
+  }
+  return table;
+}
+
+/// Read the rest of a function expression, after the keyword.
+FunctionDef readFunction(Lexer &lexer) {
+  FunctionDef function;
+  function.name = lexer.readString();
+  function.nparams = readCount(lexer);
+  function.nlocals = readCount(lexer);
+  while (lexer.peek() != ')') {
+    if (lexer.peek() == EOF) {
+      lexer.error("unterminated function " + function.name);
+    }
+    function.instructions.push_back(readInstruction(lexer));
+  }
+  lexer.expect(')');
+  if (function.instructions.empty() ||
+      function.instructions.back() != END_SECTION) {
+    function.instructions.push_back(END_SECTION);
+  }
+  return function;
+}
+
+}  // namespace
+
+Instruction assembleInstruction(std::istream &in) {
+  Lexer lexer{in};
+  return readInstruction(lexer);
+}
+
+FunctionDef assembleFunction(std::istream &in) {
+  Lexer lexer{in};
+  lexer.expect('(');
+  if (lexer.readSymbol() != "function") {
+    lexer.error("expected a function");
+  }
+  return readFunction(lexer);
+}
+
+std::shared_ptr<Module> assembleModule(std::istream &in) {
+  auto module = std::make_shared<Module>();
+  Lexer lexer{in};
+  while (lexer.peek() != EOF) {
+    lexer.expect('(');
+    auto keyword = lexer.readSymbol();
+    if (keyword == "function") {
+      module->functions.push_back(readFunction(lexer));
+      continue;
+    }
+    if (keyword == "string") {
+      module->strings.push_back(lexer.readString());
+    } else if (keyword == "double") {
+      module->doubles.push_back(lexer.readDouble());
+    } else if (keyword == "integer") {
+      auto value = lexer.readInteger(-INT48_MIN);
+      if (value > INT48_MAX) {
+        lexer.error("integer does not fit in 48 bits");
+      }
+      module->integers.push_back(value);
+    } else if (keyword == "jump_table") {
+      module->jumpTables.push_back(readJumpTable(lexer));
+    } else if (keyword == "import") {
+      module->imports.push_back(lexer.readString());
+    } else if (keyword == "export") {
+      module->exports.push_back(lexer.readString());
+    } else {
+      lexer.error("unknown expression " + keyword);
+    }
+    lexer.expect(')');
+  }
+  return module;
+}
+
+void assemble(std::istream &in, std::ostream &out) {
+  serialize(out, *assembleModule(in));
+}
 
 }  // namespace b9
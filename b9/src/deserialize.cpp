@@ -2,9 +2,11 @@
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <system_error>
 #include <vector>
 
 #include <b9/Module.hpp>
+#include <b9/binaryformat.hpp>
 #include <b9/deserialize.hpp>
 #include <b9/instructions.hpp>
 
@@ -22,6 +24,40 @@ void readStringSection(std::istream &in, std::vector<std::string> &strings) {
   }
 }
 
+void readIntegerSection(std::istream &in,
+                        std::vector<std::int64_t> &integers) {
+  auto start = integers.size();
+  readNumberSection(in, integers);
+  for (auto i = start; i < integers.size(); i++) {
+    if (integers[i] < INT48_MIN || integers[i] > INT48_MAX) {
+      throw DeserializeException{"Integer constant does not fit in 48 bits"};
+    }
+  }
+}
+
+void readJumpTableSection(std::istream &in, std::vector<JumpTable> &tables) {
+  uint32_t tableCount;
+  if (!readNumber(in, tableCount)) {
+    throw DeserializeException{"Error reading jump table count"};
+  }
+  for (uint32_t i = 0; i < tableCount; i++) {
+    JumpTable table;
+    uint32_t offsetCount;
+    bool ok = readNumber(in, table.low) &&
+              readNumber(in, table.defaultOffset) &&
+              readNumber(in, offsetCount);
+    for (uint32_t j = 0; ok && j < offsetCount; j++) {
+      std::int32_t offset;
+      ok = readNumber(in, offset);
+      table.offsets.push_back(offset);
+    }
+    if (!ok) {
+      throw DeserializeException{"Error reading jump table"};
+    }
+    tables.push_back(std::move(table));
+  }
+}
+
 bool readInstructions(std::istream &in,
                       std::vector<Instruction> &instructions) {
   do {
@@ -67,12 +103,26 @@ void readSection(std::istream &in, std::shared_ptr<Module> &module) {
   if (!readNumber(in, sectionCode)) {
     throw DeserializeException{"Error reading section code"};
   }
+  readSectionBody(in, sectionCode, module);
+}
 
-  switch (sectionCode) {
-    case 1:
+void readSectionBody(std::istream &in, std::uint32_t sectionCode,
+                     std::shared_ptr<Module> &module) {
+  switch (SectionCode(sectionCode)) {
+    case SectionCode::FUNCTION:
       return readFunctionSection(in, module->functions);
-    case 2:
+    case SectionCode::STRING:
       return readStringSection(in, module->strings);
+    case SectionCode::IMPORT:
+      return readStringSection(in, module->imports);
+    case SectionCode::EXPORT:
+      return readStringSection(in, module->exports);
+    case SectionCode::DOUBLE:
+      return readNumberSection(in, module->doubles);
+    case SectionCode::INTEGER:
+      return readIntegerSection(in, module->integers);
+    case SectionCode::JUMP_TABLE:
+      return readJumpTableSection(in, module->jumpTables);
     default:
       throw DeserializeException{"Invalid Section Code"};
   }
@@ -83,23 +133,336 @@ void readHeader(std::istream &in) {
     throw DeserializeException{"Empty Input File"};
   }
 
-  const char magic[] = {'b', '9', 'm', 'o', 'd', 'u', 'l', 'e'};
-  const std::size_t bytes = sizeof(magic);
+  const std::size_t bytes = sizeof(MODULE_MAGIC);
 
   char buffer[bytes];
   bool ok = readBytes(in, buffer, bytes);
-  if (!ok || strncmp(magic, buffer, bytes) != 0) {
+  if (!ok || strncmp(MODULE_MAGIC, buffer, bytes) != 0) {
+    throw DeserializeException{"Corrupt Header"};
+  }
+}
+
+ModuleImage::ModuleImage(std::vector<char> data)
+    : buffer_(std::move(data)), data_(buffer_.data()), size_(buffer_.size()) {
+  readTableOfContents();
+}
+
+ModuleImage::ModuleImage(std::unique_ptr<const MappedFile> file)
+    : file_(std::move(file)), data_(file_->data()), size_(file_->size()) {
+  readTableOfContents();
+}
+
+ModuleImage::~ModuleImage() noexcept {
+  for (std::size_t i = 0; i < functionCount_; i++) {
+    delete materialized_[i].load(std::memory_order_relaxed);
+  }
+}
+
+void ModuleImage::readTableOfContents() {
+  ModuleHeader header;
+  if (size_ < sizeof(header)) {
+    throw DeserializeException{"Corrupt Header"};
+  }
+  std::memcpy(&header, data_, sizeof(header));
+  if (strncmp(MODULE_MAGIC, header.magic, sizeof(MODULE_MAGIC)) != 0 ||
+      header.tag != MODULE_INDEX_TAG) {
     throw DeserializeException{"Corrupt Header"};
   }
+  if (header.version != MODULE_FORMAT_VERSION) {
+    throw DeserializeException{"Unsupported module version"};
+  }
+
+  const std::uint64_t tocEnd =
+      sizeof(header) + std::uint64_t(header.sectionCount) * sizeof(SectionEntry);
+  if (tocEnd > size_) {
+    throw DeserializeException{"Error reading table of contents"};
+  }
+  sections_.resize(header.sectionCount);
+  std::memcpy(sections_.data(), data_ + sizeof(header),
+              sections_.size() * sizeof(SectionEntry));
+
+  for (const auto &section : sections_) {
+    if (section.offset > size_ || section.size > size_ - section.offset) {
+      throw DeserializeException{"Section out of bounds"};
+    }
+  }
+
+  functionTable_ = findSection(SectionCode::FUNCTION_TABLE);
+  nameIndex_ = findSection(SectionCode::NAME_INDEX);
+  nameData_ = findSection(SectionCode::NAME_DATA);
+  code_ = findSection(SectionCode::CODE);
+  if (!functionTable_ || !nameIndex_ || !nameData_ || !code_) {
+    throw DeserializeException{"Missing section"};
+  }
+
+  functionCount_ = functionTable_->size / sizeof(FunctionEntry);
+  if (functionTable_->size % sizeof(FunctionEntry) != 0) {
+    throw DeserializeException{"Corrupt function table"};
+  }
+
+  if (nameIndex_->size < sizeof(bucketCount_)) {
+    throw DeserializeException{"Corrupt name index"};
+  }
+  std::memcpy(&bucketCount_, data_ + nameIndex_->offset,
+              sizeof(bucketCount_));
+  if ((bucketCount_ & (bucketCount_ - 1)) != 0 ||
+      nameIndex_->size <
+          sizeof(bucketCount_) + std::uint64_t(bucketCount_) * 4) {
+    throw DeserializeException{"Corrupt name index"};
+  }
+
+  materialized_.reset(new std::atomic<const FunctionDef *>[functionCount_]);
+  for (std::size_t i = 0; i < functionCount_; i++) {
+    materialized_[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+const SectionEntry *ModuleImage::findSection(SectionCode code) const {
+  for (const auto &section : sections_) {
+    if (section.code == static_cast<std::uint32_t>(code)) {
+      return &section;
+    }
+  }
+  return nullptr;
+}
+
+FunctionEntry ModuleImage::functionEntry(std::size_t index) const {
+  FunctionEntry entry;
+  std::memcpy(&entry,
+              data_ + functionTable_->offset +
+                  index * sizeof(FunctionEntry),
+              sizeof(entry));
+  return entry;
+}
+
+std::uint32_t ModuleImage::bucket(std::uint32_t index) const {
+  std::uint32_t value;
+  std::memcpy(&value,
+              data_ + nameIndex_->offset + sizeof(bucketCount_) +
+                  index * sizeof(value),
+              sizeof(value));
+  return value;
+}
+
+const FunctionDef &ModuleImage::getFunction(std::size_t index) {
+  if (index >= functionCount_) {
+    throw FunctionNotFoundException{"Function index out of range"};
+  }
+
+  auto &slot = materialized_[index];
+  if (auto function = slot.load(std::memory_order_acquire)) {
+    return *function;
+  }
+
+  // Threads that race to build a function each build it, and the first to
+  // finish publishes its copy.
+  auto function = readFunction(index);
+  const FunctionDef *published = nullptr;
+  if (slot.compare_exchange_strong(published, function.get(),
+                                   std::memory_order_acq_rel,
+                                   std::memory_order_acquire)) {
+    return *function.release();
+  }
+  return *published;
+}
+
+std::unique_ptr<FunctionDef> ModuleImage::readFunction(
+    std::size_t index) const {
+  const FunctionEntry entry = functionEntry(index);
+  const std::uint64_t codeBytes =
+      std::uint64_t(entry.codeSize) * sizeof(RawInstruction);
+  if (std::uint64_t(entry.nameOffset) + entry.nameSize > nameData_->size ||
+      entry.codeOffset < code_->offset ||
+      entry.codeOffset + codeBytes > code_->offset + code_->size) {
+    throw DeserializeException{"Corrupt function entry"};
+  }
+
+  auto def = std::make_unique<FunctionDef>();
+  def->name.assign(data_ + nameData_->offset + entry.nameOffset,
+                   entry.nameSize);
+  def->nparams = entry.nparams;
+  def->nlocals = entry.nlocals;
+  def->instructions.resize(entry.codeSize);
+  std::memcpy(def->instructions.data(), data_ + entry.codeOffset,
+              codeBytes);
+
+  if (entry.codeSize != 0 && def->instructions.back() != END_SECTION) {
+    throw DeserializeException{"Error reading instructions"};
+  }
+  return def;
+}
+
+bool ModuleImage::findFunction(const std::string &name,
+                               std::size_t &index) const {
+  if (bucketCount_ == 0) {
+    return false;
+  }
+  const std::uint32_t hash = hashName(name.data(), name.size());
+  const char *names = data_ + nameData_->offset;
+
+  for (std::uint32_t i = 0; i < bucketCount_; i++) {
+    std::uint32_t value = bucket((hash + i) & (bucketCount_ - 1));
+    if (value == EMPTY_BUCKET) {
+      return false;
+    }
+    if (value > functionCount_) {
+      throw DeserializeException{"Corrupt name index"};
+    }
+    const FunctionEntry entry = functionEntry(value - 1);
+    if (entry.nameHash == hash && entry.nameSize == name.size() &&
+        std::uint64_t(entry.nameOffset) + entry.nameSize <= nameData_->size &&
+        name.compare(0, name.size(), names + entry.nameOffset,
+                     entry.nameSize) == 0) {
+      index = value - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ModuleImage::readStrings(std::vector<std::string> &strings,
+                              SectionCode code) const {
+  const SectionEntry *section = findSection(code);
+  if (!section) {
+    return;
+  }
+  MemoryBuffer buffer(data_ + section->offset, section->size);
+  std::istream in(&buffer);
+  readStringSection(in, strings);
+}
+
+template <typename Number>
+void ModuleImage::readNumbers(std::vector<Number> &numbers,
+                              SectionCode code) const {
+  const SectionEntry *section = findSection(code);
+  if (!section) {
+    return;
+  }
+  MemoryBuffer buffer(data_ + section->offset, section->size);
+  std::istream in(&buffer);
+  readNumberSection(in, numbers);
+}
+
+void ModuleImage::readIntegers(std::vector<std::int64_t> &integers) const {
+  const SectionEntry *section = findSection(SectionCode::INTEGER);
+  if (!section) {
+    return;
+  }
+  MemoryBuffer buffer(data_ + section->offset, section->size);
+  std::istream in(&buffer);
+  readIntegerSection(in, integers);
+}
+
+void ModuleImage::readJumpTables(std::vector<JumpTable> &tables) const {
+  const SectionEntry *section = findSection(SectionCode::JUMP_TABLE);
+  if (!section) {
+    return;
+  }
+  MemoryBuffer buffer(data_ + section->offset, section->size);
+  std::istream in(&buffer);
+  readJumpTableSection(in, tables);
+}
+
+std::size_t ModuleImage::materializedCount() const {
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < functionCount_; i++) {
+    if (materialized_[i].load(std::memory_order_acquire)) count++;
+  }
+  return count;
+}
+
+namespace {
+
+/// Read the constants of an indexed module, and leave its functions to the
+/// image.
+void useImage(std::shared_ptr<ModuleImage> image,
+              std::shared_ptr<Module> &module) {
+  image->readStrings(module->strings);
+  image->readStrings(module->imports, SectionCode::IMPORT);
+  image->readStrings(module->exports, SectionCode::EXPORT);
+  image->readNumbers(module->doubles, SectionCode::DOUBLE);
+  image->readIntegers(module->integers);
+  image->readJumpTables(module->jumpTables);
+  module->loader = std::move(image);
+}
+
+}  // namespace
+
+void readIndexedModule(std::istream &in, std::shared_ptr<Module> &module) {
+  std::vector<char> data(MODULE_MAGIC, MODULE_MAGIC + sizeof(MODULE_MAGIC));
+  data.resize(data.size() + sizeof(MODULE_INDEX_TAG));
+  std::memcpy(&data[sizeof(MODULE_MAGIC)], &MODULE_INDEX_TAG,
+              sizeof(MODULE_INDEX_TAG));
+
+  // A stream that can seek is read in one go. Others are read in chunks.
+  auto start = in.tellg();
+  if (start != std::istream::pos_type(-1) &&
+      in.seekg(0, std::ios_base::end)) {
+    auto rest = static_cast<long>(in.tellg() - start);
+    in.seekg(start);
+    auto header = data.size();
+    data.resize(header + rest);
+    if (!readBytes(in, data.data() + header, rest)) {
+      throw DeserializeException{"Error reading module"};
+    }
+  } else {
+    in.clear();
+    char buffer[64 * 1024];
+    do {
+      in.read(buffer, sizeof(buffer));
+      data.insert(data.end(), buffer, buffer + in.gcount());
+    } while (in.good());
+  }
+
+  useImage(std::make_shared<ModuleImage>(std::move(data)), module);
 }
 
 std::shared_ptr<Module> deserialize(std::istream &in) {
   auto module = std::make_shared<Module>();
   readHeader(in);
+  if (in.peek() == std::istream::traits_type::eof()) {
+    return module;
+  }
+
+  uint32_t sectionCode;
+  if (!readNumber(in, sectionCode)) {
+    throw DeserializeException{"Error reading section code"};
+  }
+  if (sectionCode == MODULE_INDEX_TAG) {
+    readIndexedModule(in, module);
+    return module;
+  }
+
+  readSectionBody(in, sectionCode, module);
   while (in.peek() != std::istream::traits_type::eof()) {
     readSection(in, module);
   }
   return module;
 }
 
+std::shared_ptr<Module> deserializeFile(const std::string &path) {
+  std::unique_ptr<const MappedFile> file;
+  try {
+    file = std::make_unique<const MappedFile>(path);
+  } catch (const std::system_error &e) {
+    throw DeserializeException{std::string("Cannot map module ") + e.what()};
+  }
+
+  ModuleHeader header;
+  if (file->size() >= sizeof(header)) {
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (strncmp(MODULE_MAGIC, header.magic, sizeof(MODULE_MAGIC)) == 0 &&
+        header.tag == MODULE_INDEX_TAG) {
+      auto module = std::make_shared<Module>();
+      useImage(std::make_shared<ModuleImage>(std::move(file)), module);
+      return module;
+    }
+  }
+
+  // A sequential module is read in one pass, straight from the mapping.
+  MemoryBuffer buffer(file->data(), file->size());
+  std::istream in(&buffer);
+  return deserialize(in);
+}
+
 }  // namespace b9
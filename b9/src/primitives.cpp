@@ -1,29 +1,456 @@
+#include <b9/ArrayKernels.hpp>
 #include <b9/ExecutionContext.hpp>
+#include <b9/HashMap.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 
 using namespace b9;
 
 /// ( number -- 0 )
 extern "C" void b9_prim_print_number(ExecutionContext *context) {
   auto number = context->pop();
-  assert(number.isInt48());
-  std::cout << number << std::endl;
+  assert(number.isInt48() || number.isDouble());
+  context->output().print(number);
+  context->output().append("\n", 1);
   context->push(Om::Value(Om::AS_INT48, 0));
 }
 
 /// ( string -- 0 )
+/// Strings live at least until the run ends, and the run's output is flushed
+/// by then, so they are written out without being copied.
 extern "C" void b9_prim_print_string(ExecutionContext *context) {
   auto value = context->pop();
   assert(value.isUint48());
-  auto string = context->virtualMachine()->getString(value.getUint48());
-  std::cout << string << std::endl;
+  auto &string = context->virtualMachine()->getString(value.getUint48());
+  context->output().appendStable(string.data(), string.size());
+  context->output().append("\n", 1);
   context->push({Om::AS_INT48, 0});
 }
 
 extern "C" void b9_prim_print_stack(ExecutionContext *context) {
-  std::cout << "----------stack begin\n";
-  printStack(std::cout, context->stack());
-  std::cout << "----------stack end" << std::endl;
+  std::ostringstream out;
+  out << "----------stack begin\n";
+  printStack(out, context->stack());
+  out << "----------stack end\n";
+  context->output().append(out.str());
   context->push(Om::Value(Om::AS_INT48, 0));
 }
+
+/// ( -- 0 )
+/// Write out everything the context has printed so far.
+extern "C" void b9_prim_flush_output(ExecutionContext *context) {
+  context->flushOutput();
+  context->push(Om::Value(Om::AS_INT48, 0));
+}
+
+namespace {
+
+const std::string &popString(ExecutionContext *context) {
+  auto value = context->pop();
+  if (!value.isUint48()) {
+    throw std::runtime_error("Expected a string");
+  }
+  return context->virtualMachine()->getString(value.getUint48());
+}
+
+std::int64_t popInt(ExecutionContext *context) {
+  auto value = context->pop();
+  if (!value.isInt48()) {
+    throw std::runtime_error("Expected an integer");
+  }
+  return value.getInt48();
+}
+
+void pushString(ExecutionContext *context, std::size_t id) {
+  context->push({Om::AS_UINT48, static_cast<std::uint64_t>(id)});
+}
+
+}  // namespace
+
+/// ( left right -- string )
+extern "C" void b9_prim_string_concat(ExecutionContext *context) {
+  const auto &right = popString(context);
+  const auto &left = popString(context);
+  std::string result;
+  result.reserve(left.size() + right.size());
+  result.append(left).append(right);
+  auto &strings = context->virtualMachine()->strings();
+  pushString(context, strings.internTemporary(result));
+}
+
+/// ( string start length -- string )
+/// Like JavaScript's substr: the range is clamped to the string.
+extern "C" void b9_prim_string_substring(ExecutionContext *context) {
+  auto length = popInt(context);
+  auto start = popInt(context);
+  const auto &string = popString(context);
+  const auto size = static_cast<std::int64_t>(string.size());
+  start = std::min(std::max<std::int64_t>(start, 0), size);
+  length = std::min(std::max<std::int64_t>(length, 0), size - start);
+  auto &strings = context->virtualMachine()->strings();
+  pushString(context, strings.internTemporary(string.substr(start, length)));
+}
+
+/// ( string -- length )
+extern "C" void b9_prim_string_length(ExecutionContext *context) {
+  auto length = popString(context).size();
+  context->push({Om::AS_INT48, static_cast<std::int64_t>(length)});
+}
+
+/// ( number -- string )
+extern "C" void b9_prim_int_to_string(ExecutionContext *context) {
+  auto number = popInt(context);
+  auto &strings = context->virtualMachine()->strings();
+  pushString(context, strings.internTemporary(std::to_string(number)));
+}
+
+/// ( -- builder )
+/// Builders collect pieces in one growable buffer, and intern the result only
+/// when it is asked for.
+extern "C" void b9_prim_builder_new(ExecutionContext *context) {
+  auto handle = context->virtualMachine()->newStringBuilder();
+  context->push({Om::AS_INT48, handle});
+}
+
+/// ( builder piece -- builder )
+/// The piece is a string or a number.
+extern "C" void b9_prim_builder_append(ExecutionContext *context) {
+  auto piece = context->pop();
+  auto builder = context->pop();
+  if (!builder.isInt48()) {
+    throw std::runtime_error("Expected a string builder");
+  }
+  auto vm = context->virtualMachine();
+  auto &buffer = vm->stringBuilder(builder.getInt48());
+  if (piece.isUint48()) {
+    buffer.append(vm->getString(piece.getUint48()));
+  } else if (piece.isInt48()) {
+    buffer.append(std::to_string(piece.getInt48()));
+  } else {
+    throw std::runtime_error("Appending a non-string to a string builder");
+  }
+  context->push(builder);
+}
+
+/// ( builder -- string )
+/// Releases the builder.
+extern "C" void b9_prim_builder_to_string(ExecutionContext *context) {
+  auto builder = popInt(context);
+  pushString(context, context->virtualMachine()->finishStringBuilder(builder));
+}
+
+namespace {
+
+InputReader &popInput(ExecutionContext *context) {
+  return context->virtualMachine()->input(popInt(context));
+}
+
+void pushInt(ExecutionContext *context, std::int64_t value) {
+  context->push({Om::AS_INT48, value});
+}
+
+/// Push the length of the record the reader advanced to, or -1 at the end.
+void pushRecordSize(ExecutionContext *context, InputReader &input, bool found) {
+  pushInt(context, found ? static_cast<std::int64_t>(input.recordSize()) : -1);
+}
+
+}  // namespace
+
+/// ( path -- input )
+/// The path "-" is standard input. Pushes -1 if the file cannot be opened.
+/// Regular files are mapped, and records are read in place.
+extern "C" void b9_prim_input_open(ExecutionContext *context) {
+  const auto &path = popString(context);
+  try {
+    pushInt(context, context->virtualMachine()->openInput(path));
+  } catch (const InputException &) {
+    pushInt(context, -1);
+  }
+}
+
+/// ( input -- 0 )
+extern "C" void b9_prim_input_close(ExecutionContext *context) {
+  context->virtualMachine()->closeInput(popInt(context));
+  pushInt(context, 0);
+}
+
+/// ( input -- length )
+/// Advance to the next line. Pushes -1 at the end of input.
+extern "C" void b9_prim_input_next_line(ExecutionContext *context) {
+  auto &input = popInput(context);
+  pushRecordSize(context, input, input.nextRecord('\n'));
+}
+
+/// ( input delimiter -- length )
+/// Advance to the next record ending in the delimiter, a byte.
+extern "C" void b9_prim_input_next_record(ExecutionContext *context) {
+  auto delimiter = static_cast<char>(popInt(context));
+  auto &input = popInput(context);
+  pushRecordSize(context, input, input.nextRecord(delimiter));
+}
+
+/// ( input -- string )
+/// Intern the current record. The other record primitives work on the input
+/// without copying it.
+extern "C" void b9_prim_input_record_string(ExecutionContext *context) {
+  auto &input = popInput(context);
+  auto &strings = context->virtualMachine()->strings();
+  pushString(context,
+             strings.internTemporary({input.record(), input.recordSize()}));
+}
+
+/// ( input index -- byte )
+/// Pushes -1 past the end of the record.
+extern "C" void b9_prim_input_record_byte(ExecutionContext *context) {
+  auto index = popInt(context);
+  auto &input = popInput(context);
+  if (index < 0 || static_cast<std::size_t>(index) >= input.recordSize()) {
+    pushInt(context, -1);
+    return;
+  }
+  pushInt(context, static_cast<unsigned char>(input.record()[index]));
+}
+
+/// ( input string -- offset )
+/// Find a string in the current record. Pushes -1 if it is not there.
+extern "C" void b9_prim_input_record_find(ExecutionContext *context) {
+  const auto &string = popString(context);
+  auto &input = popInput(context);
+  auto found = static_cast<const char *>(memmem(
+      input.record(), input.recordSize(), string.data(), string.size()));
+  pushInt(context, found ? found - input.record() : -1);
+}
+
+/// ( input field -- number )
+/// Parse a whitespace separated field of the current record, counting from
+/// 0. Pushes 0 when the field is missing or not a number.
+extern "C" void b9_prim_input_record_int(ExecutionContext *context) {
+  auto field = popInt(context);
+  auto &input = popInput(context);
+  if (field < 0) {
+    pushInt(context, 0);
+    return;
+  }
+  pushInt(context, parseField(input.record(), input.recordSize(), field));
+}
+
+/// ( input -- number )
+/// Read the next integer, skipping anything that is not part of one. Pushes
+/// 0 at the end of input, which input_at_end tells apart.
+extern "C" void b9_prim_input_read_int(ExecutionContext *context) {
+  auto &input = popInput(context);
+  std::int64_t value = 0;
+  input.readInt(value);
+  pushInt(context, value);
+}
+
+/// ( input -- flag )
+extern "C" void b9_prim_input_at_end(ExecutionContext *context) {
+  pushInt(context, popInput(context).atEnd() ? 1 : 0);
+}
+
+//
+// Bulk int array operations. These are fast primitives, so compiled code
+// calls them directly, and they run on the vector kernels the CPU supports.
+//
+
+namespace {
+
+// The signatures declare the arguments' types, which are checked before the
+// call.
+
+IntArray *toArray(Om::RawValue value) {
+  assert(isIntArray(Om::Value(Om::AS_RAW, value)));
+  return Om::Value(Om::AS_RAW, value).getRef<IntArray>();
+}
+
+std::int64_t toInt(Om::RawValue value) {
+  assert(Om::Value(Om::AS_RAW, value).isInt48());
+  return Om::Value(Om::AS_RAW, value).getInt48();
+}
+
+Om::RawValue fromInt(std::int64_t value) {
+  return Om::Value(Om::AS_INT48, value).raw();
+}
+
+}  // namespace
+
+/// ( array -- sum )
+extern "C" Om::RawValue b9_prim_array_sum(ExecutionContext *context,
+                                          Om::RawValue array) {
+  auto a = toArray(array);
+  return fromInt(arrayKernels().sum(intArrayData(a), intArrayLength(a)));
+}
+
+/// ( array -- min ) An empty array's min is 0.
+extern "C" Om::RawValue b9_prim_array_min(ExecutionContext *context,
+                                          Om::RawValue array) {
+  auto a = toArray(array);
+  return fromInt(arrayKernels().min(intArrayData(a), intArrayLength(a)));
+}
+
+/// ( array -- max ) An empty array's max is 0.
+extern "C" Om::RawValue b9_prim_array_max(ExecutionContext *context,
+                                          Om::RawValue array) {
+  auto a = toArray(array);
+  return fromInt(arrayKernels().max(intArrayData(a), intArrayLength(a)));
+}
+
+/// ( array value -- 0 )
+extern "C" Om::RawValue b9_prim_array_fill(ExecutionContext *context,
+                                           Om::RawValue array,
+                                           Om::RawValue value) {
+  auto a = toArray(array);
+  arrayKernels().fill(intArrayData(a), intArrayLength(a), toInt(value));
+  return fromInt(0);
+}
+
+/// ( to from -- count ) Copy as many elements as both arrays have.
+extern "C" Om::RawValue b9_prim_array_copy(ExecutionContext *context,
+                                           Om::RawValue to, Om::RawValue from) {
+  auto a = toArray(to);
+  auto b = toArray(from);
+  auto count = std::min(intArrayLength(a), intArrayLength(b));
+  arrayKernels().copy(intArrayData(a), intArrayData(b), count);
+  return fromInt(count);
+}
+
+/// ( left right -- order ) -1, 0 or 1, comparing the arrays element by
+/// element. An array that runs out first is the lesser.
+extern "C" Om::RawValue b9_prim_array_compare(ExecutionContext *context,
+                                              Om::RawValue left,
+                                              Om::RawValue right) {
+  auto a = toArray(left);
+  auto b = toArray(right);
+  auto aLength = intArrayLength(a);
+  auto bLength = intArrayLength(b);
+  int order = arrayKernels().compare(intArrayData(a), intArrayData(b),
+                                     std::min(aLength, bLength));
+  if (order == 0 && aLength != bLength) {
+    order = aLength < bLength ? -1 : 1;
+  }
+  return fromInt(order);
+}
+
+/// ( array value -- index ) The first index of value, or -1.
+extern "C" Om::RawValue b9_prim_array_find(ExecutionContext *context,
+                                           Om::RawValue array,
+                                           Om::RawValue value) {
+  auto a = toArray(array);
+  return fromInt(
+      arrayKernels().find(intArrayData(a), intArrayLength(a), toInt(value)));
+}
+
+/// ( array -- total ) Replace each element with the sum of it and those
+/// before it.
+extern "C" Om::RawValue b9_prim_array_prefix_sum(ExecutionContext *context,
+                                                 Om::RawValue array) {
+  auto a = toArray(array);
+  return fromInt(arrayKernels().prefixSum(intArrayData(a), intArrayLength(a)));
+}
+
+/// ( array value -- 0 ) Add value to every element.
+extern "C" Om::RawValue b9_prim_array_add_scalar(ExecutionContext *context,
+                                                 Om::RawValue array,
+                                                 Om::RawValue value) {
+  auto a = toArray(array);
+  arrayKernels().addScalar(intArrayData(a), intArrayLength(a), toInt(value));
+  return fromInt(0);
+}
+
+/// ( array value -- 0 ) Multiply every element by value.
+extern "C" Om::RawValue b9_prim_array_mul_scalar(ExecutionContext *context,
+                                                 Om::RawValue array,
+                                                 Om::RawValue value) {
+  auto a = toArray(array);
+  arrayKernels().mulScalar(intArrayData(a), intArrayLength(a), toInt(value));
+  return fromInt(0);
+}
+
+/// ( to from -- 0 ) Add each element of from to that of to, for as many
+/// elements as both arrays have.
+extern "C" Om::RawValue b9_prim_array_add(ExecutionContext *context,
+                                          Om::RawValue to, Om::RawValue from) {
+  auto a = toArray(to);
+  auto b = toArray(from);
+  auto count = std::min(intArrayLength(a), intArrayLength(b));
+  arrayKernels().add(intArrayData(a), intArrayData(b), count);
+  return fromInt(0);
+}
+
+/// ( to from -- 0 ) Multiply each element of to by that of from, for as many
+/// elements as both arrays have.
+extern "C" Om::RawValue b9_prim_array_mul(ExecutionContext *context,
+                                          Om::RawValue to, Om::RawValue from) {
+  auto a = toArray(to);
+  auto b = toArray(from);
+  auto count = std::min(intArrayLength(a), intArrayLength(b));
+  arrayKernels().mul(intArrayData(a), intArrayData(b), count);
+  return fromInt(0);
+}
+
+//
+// Hash maps. These are fast primitives too, so compiled code calls them
+// directly. A missing key reads as 0. The signatures check that maps are
+// maps, and that what map_put stores can go in one, so nothing here throws.
+//
+
+namespace {
+
+HashMap *toMap(Om::RawValue value) {
+  assert(Om::Value(Om::AS_RAW, value).isRef());
+  return Om::Value(Om::AS_RAW, value).getRef<HashMap>();
+}
+
+}  // namespace
+
+/// ( -- map )
+extern "C" Om::RawValue b9_prim_map_new(ExecutionContext *context) {
+  return Om::Value(Om::AS_REF, allocateHashMap(*context)).raw();
+}
+
+/// ( map key -- value )
+extern "C" Om::RawValue b9_prim_map_get(ExecutionContext *context,
+                                        Om::RawValue map, Om::RawValue key) {
+  auto value = hashMapTable(*context, toMap(map)).find(key);
+  return value ? *value : fromInt(0);
+}
+
+/// ( map key -- flag )
+extern "C" Om::RawValue b9_prim_map_has(ExecutionContext *context,
+                                        Om::RawValue map, Om::RawValue key) {
+  auto value = hashMapTable(*context, toMap(map)).find(key);
+  return fromInt(value ? 1 : 0);
+}
+
+/// ( map key value -- 0 )
+extern "C" Om::RawValue b9_prim_map_put(ExecutionContext *context,
+                                        Om::RawValue map, Om::RawValue key,
+                                        Om::RawValue value) {
+  // The map may outlive the run, and its strings with it.
+  auto vm = context->virtualMachine();
+  vm->keepString(Om::Value(Om::AS_RAW, key));
+  vm->keepString(Om::Value(Om::AS_RAW, value));
+  hashMapPut(*context, toMap(map), Om::Value(Om::AS_RAW, key),
+             Om::Value(Om::AS_RAW, value));
+  return fromInt(0);
+}
+
+/// ( map key -- flag ) 1 if the key was removed, 0 if it was absent.
+extern "C" Om::RawValue b9_prim_map_delete(ExecutionContext *context,
+                                           Om::RawValue map, Om::RawValue key) {
+  return fromInt(hashMapTable(*context, toMap(map)).erase(key) ? 1 : 0);
+}
+
+/// ( map -- size )
+extern "C" Om::RawValue b9_prim_map_size(ExecutionContext *context,
+                                         Om::RawValue map) {
+  return fromInt(hashMapTable(*context, toMap(map)).size());
+}
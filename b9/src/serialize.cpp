@@ -1,10 +1,13 @@
 #include <string.h>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <vector>
 
 #include <b9/Module.hpp>
+#include <b9/binaryformat.hpp>
 #include <b9/instructions.hpp>
 #include <b9/serialize.hpp>
 
@@ -21,6 +24,26 @@ void writeStringSection(std::ostream &out,
   }
 }
 
+void writeJumpTableSection(std::ostream &out,
+                           const std::vector<JumpTable> &tables) {
+  uint32_t tableCount = tables.size();
+  if (!writeNumber(out, tableCount)) {
+    throw SerializeException("Error writing jump table section");
+  }
+  for (auto &table : tables) {
+    uint32_t offsetCount = table.offsets.size();
+    bool ok = writeNumber(out, table.low) &&
+              writeNumber(out, table.defaultOffset) &&
+              writeNumber(out, offsetCount);
+    for (auto offset : table.offsets) {
+      ok = ok && writeNumber(out, offset);
+    }
+    if (!ok) {
+      throw SerializeException("Error writing jump table");
+    }
+  }
+}
+
 bool writeInstructions(std::ostream &out,
                        const std::vector<Instruction> &instructions) {
   for (auto instruction : instructions) {
@@ -59,12 +82,20 @@ void writeFunctionSection(std::ostream &out,
 }
 
 void writeSections(std::ostream &out, const Module &module) {
-  if (module.functions.size() != 0) {
+  if (module.functionCount() != 0) {
     uint32_t sectionCode = 1;
     if (!writeNumber(out, sectionCode)) {
       throw SerializeException("Error writing function section code");
     }
-    writeFunctionSection(out, module.functions);
+    if (module.loader) {
+      std::vector<FunctionDef> functions;
+      for (std::size_t i = 0; i < module.functionCount(); i++) {
+        functions.push_back(module.getFunction(i));
+      }
+      writeFunctionSection(out, functions);
+    } else {
+      writeFunctionSection(out, module.functions);
+    }
   }
 
   if (module.strings.size() != 0) {
@@ -74,20 +105,212 @@ void writeSections(std::ostream &out, const Module &module) {
     }
     writeStringSection(out, module.strings);
   }
+
+  if (module.imports.size() != 0) {
+    uint32_t sectionCode = 3;
+    if (!writeNumber(out, sectionCode)) {
+      throw SerializeException("Error writing import section code");
+    }
+    writeStringSection(out, module.imports);
+  }
+
+  if (module.exports.size() != 0) {
+    uint32_t sectionCode = 4;
+    if (!writeNumber(out, sectionCode)) {
+      throw SerializeException("Error writing export section code");
+    }
+    writeStringSection(out, module.exports);
+  }
+
+  if (module.doubles.size() != 0) {
+    uint32_t sectionCode = 5;
+    if (!writeNumber(out, sectionCode)) {
+      throw SerializeException("Error writing double section code");
+    }
+    writeNumberSection(out, module.doubles);
+  }
+
+  if (module.integers.size() != 0) {
+    uint32_t sectionCode = 6;
+    if (!writeNumber(out, sectionCode)) {
+      throw SerializeException("Error writing integer section code");
+    }
+    writeNumberSection(out, module.integers);
+  }
+
+  if (module.jumpTables.size() != 0) {
+    uint32_t sectionCode = 7;
+    if (!writeNumber(out, sectionCode)) {
+      throw SerializeException("Error writing jump table section code");
+    }
+    writeJumpTableSection(out, module.jumpTables);
+  }
 }
 
 void writeHeader(std::ostream &out) {
-  const char header[] = {'b', '9', 'm', 'o', 'd', 'u', 'l', 'e'};
-  uint32_t length = 8;
-  out.write(header, length);
+  out.write(MODULE_MAGIC, sizeof(MODULE_MAGIC));
   if (!out.good()) {
     throw SerializeException("Error writing header");
   }
 }
 
-void serialize(std::ostream &out, const Module &module) {
+namespace {
+
+/// A section of an indexed module, laid out before anything is written.
+struct SectionLayout {
+  SectionCode code;
+  std::uint64_t alignment;
+  std::string data;
+  std::uint64_t offset;
+};
+
+template <typename T>
+void appendBytes(std::string &data, const T *values, std::size_t count) {
+  data.append(reinterpret_cast<const char *>(values), sizeof(T) * count);
+}
+
+std::uint32_t bucketCountFor(std::size_t functionCount) {
+  if (functionCount == 0) {
+    return 0;
+  }
+  std::uint32_t count = 1;
+  while (count < functionCount * 2) {
+    count <<= 1;
+  }
+  return count;
+}
+
+}  // namespace
+
+void writeIndexedModule(std::ostream &out, const Module &module) {
+  const std::size_t functionCount = module.functionCount();
+
+  // Function table, names, and code. Code offsets are relative to the start of
+  // the code section until the section is placed.
+  std::vector<FunctionEntry> table(functionCount);
+  std::string names;
+  std::string code;
+
+  for (std::size_t i = 0; i < functionCount; i++) {
+    const FunctionDef &function = module.getFunction(i);
+    FunctionEntry &entry = table[i];
+    entry.nameOffset = names.size();
+    entry.nameSize = function.name.size();
+    entry.nparams = function.nparams;
+    entry.nlocals = function.nlocals;
+    entry.codeOffset = code.size();
+    entry.codeSize = function.instructions.size();
+    entry.nameHash = hashName(function.name.data(), function.name.size());
+    names += function.name;
+    appendBytes(code, function.instructions.data(),
+                function.instructions.size());
+    code.resize(alignUp(code.size(), CODE_ALIGNMENT), '\0');
+  }
+
+  // Name index
+  std::uint32_t bucketCount = bucketCountFor(functionCount);
+  std::vector<std::uint32_t> buckets(bucketCount, EMPTY_BUCKET);
+  for (std::size_t i = 0; i < functionCount; i++) {
+    std::uint32_t bucket = table[i].nameHash & (bucketCount - 1);
+    while (buckets[bucket] != EMPTY_BUCKET) {
+      bucket = (bucket + 1) & (bucketCount - 1);
+    }
+    buckets[bucket] = i + 1;
+  }
+  std::string index;
+  appendBytes(index, &bucketCount, 1);
+  appendBytes(index, buckets.data(), buckets.size());
+
+  std::stringstream strings(std::ios::out | std::ios::binary);
+  writeStringSection(strings, module.strings);
+
+  std::stringstream imports(std::ios::out | std::ios::binary);
+  writeStringSection(imports, module.imports);
+
+  std::stringstream exports(std::ios::out | std::ios::binary);
+  writeStringSection(exports, module.exports);
+
+  std::stringstream doubles(std::ios::out | std::ios::binary);
+  writeNumberSection(doubles, module.doubles);
+
+  std::stringstream integers(std::ios::out | std::ios::binary);
+  writeNumberSection(integers, module.integers);
+
+  std::stringstream jumpTables(std::ios::out | std::ios::binary);
+  writeJumpTableSection(jumpTables, module.jumpTables);
+
+  std::vector<SectionLayout> sections;
+  sections.push_back({SectionCode::FUNCTION_TABLE, 8, "", 0});
+  appendBytes(sections.back().data, table.data(), table.size());
+  sections.push_back({SectionCode::NAME_INDEX, 8, std::move(index), 0});
+  sections.push_back({SectionCode::NAME_DATA, 1, std::move(names), 0});
+  sections.push_back({SectionCode::STRING, 8, strings.str(), 0});
+  sections.push_back({SectionCode::IMPORT, 8, imports.str(), 0});
+  sections.push_back({SectionCode::EXPORT, 8, exports.str(), 0});
+  sections.push_back({SectionCode::DOUBLE, 8, doubles.str(), 0});
+  sections.push_back({SectionCode::INTEGER, 8, integers.str(), 0});
+  sections.push_back({SectionCode::JUMP_TABLE, 8, jumpTables.str(), 0});
+  sections.push_back({SectionCode::CODE, CODE_ALIGNMENT, std::move(code), 0});
+
+  // Place the sections
+  std::uint64_t offset =
+      sizeof(ModuleHeader) + sizeof(SectionEntry) * sections.size();
+  for (auto &section : sections) {
+    section.offset = alignUp(offset, section.alignment);
+    offset = section.offset + section.data.size();
+  }
+
+  // Now that the code section is placed, make the code offsets absolute.
+  auto &tableSection = sections.front();
+  auto &codeSection = sections.back();
+  for (auto &entry : table) {
+    entry.codeOffset += codeSection.offset;
+  }
+  tableSection.data.clear();
+  appendBytes(tableSection.data, table.data(), table.size());
+
+  // Write everything out
+  ModuleHeader header;
+  std::memcpy(header.magic, MODULE_MAGIC, sizeof(header.magic));
+  header.tag = MODULE_INDEX_TAG;
+  header.version = MODULE_FORMAT_VERSION;
+  header.sectionCount = sections.size();
+  header.reserved = 0;
+  if (!writeNumber(out, header)) {
+    throw SerializeException("Error writing header");
+  }
+
+  for (const auto &section : sections) {
+    SectionEntry entry;
+    entry.code = static_cast<std::uint32_t>(section.code);
+    entry.reserved = 0;
+    entry.offset = section.offset;
+    entry.size = section.data.size();
+    if (!writeNumber(out, entry)) {
+      throw SerializeException("Error writing table of contents");
+    }
+  }
+
+  std::uint64_t position =
+      sizeof(ModuleHeader) + sizeof(SectionEntry) * sections.size();
+  for (const auto &section : sections) {
+    std::string padding(section.offset - position, '\0');
+    out.write(padding.data(), padding.size());
+    out.write(section.data.data(), section.data.size());
+    if (!out.good()) {
+      throw SerializeException("Error writing section");
+    }
+    position = section.offset + section.data.size();
+  }
+}
+
+void serializeV1(std::ostream &out, const Module &module) {
   writeHeader(out);
   writeSections(out, module);
 }
 
+void serialize(std::ostream &out, const Module &module) {
+  writeIndexedModule(out, module);
+}
+
 }  // namespace b9
@@ -0,0 +1,439 @@
+#include <b9/ExecutionContext.hpp>
+#include <b9/HashMap.hpp>
+#include <b9/IntArray.hpp>
+#include <b9/MappedFile.hpp>
+#include <b9/WriteBarrier.hpp>
+#include <b9/deserialize.hpp>
+#include <b9/serialize.hpp>
+#include <b9/snapshot.hpp>
+
+#include <OMR/Om/ObjectOperations.hpp>
+#include <OMR/Om/RootRef.hpp>
+#include <OMR/Om/ShapeOperations.hpp>
+#include <OMR/Om/Value.hpp>
+
+#include <sys/mman.h>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+namespace b9 {
+
+namespace {
+
+/// How a value is encoded in a snapshot.
+enum class ValueKind : std::uint8_t {
+  INT48 = 0,   //< The payload is the integer
+  STRING = 1,  //< The payload indexes the snapshot's strings
+  OBJECT = 2,  //< The payload indexes the snapshot's cells
+  RAW = 3,     //< The payload is the raw value
+};
+
+/// What a cell of the snapshot's heap is.
+enum class CellKind : std::uint8_t {
+  OBJECT = 0,     //< Followed by its slots
+  INT_ARRAY = 1,  //< Followed by its elements
+  HASH_MAP = 2,   //< Followed by its entries. The table is not a cell.
+};
+
+CellKind kindOf(Om::RunContext &cx, Om::Value cell) {
+  if (isIntArray(cell)) return CellKind::INT_ARRAY;
+  if (isHashMap(cx, cell)) return CellKind::HASH_MAP;
+  return CellKind::OBJECT;
+}
+
+struct ValueRecord {
+  ValueKind kind;
+  std::uint64_t payload;
+};
+
+struct SlotRecord {
+  std::uint32_t id;
+  ValueRecord value;
+};
+
+struct EntryRecord {
+  ValueRecord key;
+  ValueRecord value;
+};
+
+/// Slots are only ever added by POP_INTO_OBJECT, so its immediates name every
+/// slot an object of this VM can have.
+std::vector<std::uint32_t> slotIds(VirtualMachine &vm) {
+  std::set<std::uint32_t> ids;
+  for (std::size_t i = 0; i < vm.getFunctionCount(); i++) {
+    for (auto instruction : vm.getFunction(i)->instructions) {
+      if (instruction.opCode() == OpCode::POP_INTO_OBJECT) {
+        ids.insert(instruction.immediate());
+      }
+    }
+  }
+  return {ids.begin(), ids.end()};
+}
+
+void writeValue(std::ostream &out, const ValueRecord &value) {
+  writeNumber(out, static_cast<std::uint8_t>(value.kind));
+  writeNumber(out, value.payload);
+}
+
+/// Walks the heap breadth first from the root, numbering cells and strings as
+/// they are found.
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(VirtualMachine &vm)
+      : vm_(vm), context_(vm.rootContext()), ids_(slotIds(vm)) {}
+
+  void write(std::ostream &out, Om::Value root) {
+    out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    writeNumber(out, SNAPSHOT_VERSION);
+
+    writeNumber(out, static_cast<std::uint32_t>(vm_.modules().size()));
+    for (auto &linked : vm_.modules()) {
+      std::stringstream module;
+      serialize(module, *linked->module);
+      auto bytes = module.str();
+      writeNumber(out, static_cast<std::uint64_t>(bytes.size()));
+      out.write(bytes.data(), bytes.size());
+    }
+
+    // Nothing allocates while walking the heap, so cells cannot move.
+    auto rootRecord = encode(root);
+    std::vector<CellKind> kinds;
+    std::vector<std::vector<SlotRecord>> objects;
+    std::vector<std::vector<EntryRecord>> maps;
+    for (std::size_t i = 0; i < cells_.size(); i++) {
+      kinds.push_back(kindOf(context_, cells_[i]));
+      objects.emplace_back();
+      maps.emplace_back();
+      if (kinds[i] == CellKind::OBJECT) {
+        objects[i] = slots(cells_[i].getRef<Om::Object>());
+      } else if (kinds[i] == CellKind::HASH_MAP) {
+        maps[i] = entries(cells_[i].getRef<HashMap>());
+      }
+    }
+
+    writeNumber(out, static_cast<std::uint32_t>(strings_.size()));
+    for (auto string : strings_) {
+      writeString(out, vm_.getString(string));
+    }
+
+    // The kinds and sizes come first, so every cell can be allocated before
+    // any is filled in.
+    writeNumber(out, static_cast<std::uint32_t>(cells_.size()));
+    for (std::size_t i = 0; i < cells_.size(); i++) {
+      writeNumber(out, static_cast<std::uint8_t>(kinds[i]));
+      if (kinds[i] == CellKind::INT_ARRAY) {
+        auto length = intArrayLength(cells_[i].getRef<IntArray>());
+        writeNumber(out, static_cast<std::uint64_t>(length));
+      }
+    }
+
+    for (std::size_t i = 0; i < cells_.size(); i++) {
+      switch (kinds[i]) {
+        case CellKind::OBJECT:
+          writeNumber(out, static_cast<std::uint32_t>(objects[i].size()));
+          for (auto &slot : objects[i]) {
+            writeNumber(out, slot.id);
+            writeValue(out, slot.value);
+          }
+          break;
+        case CellKind::INT_ARRAY: {
+          auto array = cells_[i].getRef<IntArray>();
+          out.write(reinterpret_cast<const char *>(intArrayData(array)),
+                    intArrayLength(array) * sizeof(std::int64_t));
+        } break;
+        case CellKind::HASH_MAP:
+          writeNumber(out, static_cast<std::uint32_t>(maps[i].size()));
+          for (auto &entry : maps[i]) {
+            writeValue(out, entry.key);
+            writeValue(out, entry.value);
+          }
+          break;
+      }
+    }
+
+    writeValue(out, rootRecord);
+    if (!out.good()) {
+      throw SnapshotException{"Failed to write snapshot"};
+    }
+  }
+
+ private:
+  std::vector<SlotRecord> slots(Om::Object *object) {
+    std::vector<SlotRecord> slots;
+    for (auto id : ids_) {
+      Om::SlotDescriptor descriptor;
+      if (Om::lookupSlot(context_, object, Om::Id(id), descriptor)) {
+        auto value = Om::getValue(context_, object, descriptor);
+        slots.push_back({id, encode(value)});
+      }
+    }
+    return slots;
+  }
+
+  /// Keys and values are never references, but string keys and values are
+  /// renumbered like any other string.
+  std::vector<EntryRecord> entries(HashMap *map) {
+    std::vector<EntryRecord> entries;
+    hashMapTable(context_, map).forEach(
+        [this, &entries](Om::RawValue key, Om::RawValue value) {
+          entries.push_back({encode(Om::Value(Om::AS_RAW, key)),
+                             encode(Om::Value(Om::AS_RAW, value))});
+        });
+    return entries;
+  }
+
+  ValueRecord encode(Om::Value value) {
+    if (value.isInt48()) {
+      return {ValueKind::INT48, static_cast<std::uint64_t>(value.getInt48())};
+    }
+    if (value.isUint48() && value.getUint48() < vm_.getStringCount()) {
+      auto string = value.getUint48();
+      auto found = stringIndex_.find(string);
+      if (found == stringIndex_.end()) {
+        found = stringIndex_.emplace(string, strings_.size()).first;
+        strings_.push_back(string);
+      }
+      return {ValueKind::STRING, found->second};
+    }
+    if (value.isRef()) {
+      auto found = cellIndex_.find(value.raw());
+      if (found == cellIndex_.end()) {
+        found = cellIndex_.emplace(value.raw(), cells_.size()).first;
+        cells_.push_back(value);
+      }
+      return {ValueKind::OBJECT, found->second};
+    }
+    return {ValueKind::RAW, value.raw()};
+  }
+
+  VirtualMachine &vm_;
+  ExecutionContext &context_;
+  std::vector<std::uint32_t> ids_;
+  std::vector<Om::Value> cells_;
+  std::unordered_map<Om::RawValue, std::size_t> cellIndex_;
+  std::vector<std::size_t> strings_;
+  std::unordered_map<std::size_t, std::size_t> stringIndex_;
+};
+
+/// Reads the snapshot in place, out of a block of memory.
+class Cursor {
+ public:
+  Cursor(const char *data, std::size_t size) : next_(data), end_(data + size) {}
+
+  const char *take(std::size_t bytes) {
+    if (static_cast<std::size_t>(end_ - next_) < bytes) {
+      throw SnapshotException{"Snapshot is truncated"};
+    }
+    auto taken = next_;
+    next_ += bytes;
+    return taken;
+  }
+
+  template <typename Number>
+  Number read() {
+    Number number;
+    std::memcpy(&number, take(sizeof(Number)), sizeof(Number));
+    return number;
+  }
+
+  std::size_t remaining() const { return end_ - next_; }
+
+  ValueRecord readValue() {
+    auto kind = read<std::uint8_t>();
+    if (kind > static_cast<std::uint8_t>(ValueKind::RAW)) {
+      throw SnapshotException{"Bad value kind in snapshot"};
+    }
+    return {static_cast<ValueKind>(kind), read<std::uint64_t>()};
+  }
+
+ private:
+  const char *next_;
+  const char *end_;
+};
+
+class SnapshotReader {
+ public:
+  explicit SnapshotReader(VirtualMachine &vm)
+      : vm_(vm), context_(vm.rootContext()) {}
+
+  Om::Value read(const char *data, std::size_t size) {
+    if (!vm_.modules().empty()) {
+      throw SnapshotException{"Snapshots restore into an empty VM"};
+    }
+    Cursor in(data, size);
+    if (std::memcmp(in.take(sizeof(SNAPSHOT_MAGIC)), SNAPSHOT_MAGIC,
+                    sizeof(SNAPSHOT_MAGIC)) != 0) {
+      throw SnapshotException{"Bad magic number in snapshot"};
+    }
+    if (in.read<std::uint32_t>() != SNAPSHOT_VERSION) {
+      throw SnapshotException{"Unsupported snapshot version"};
+    }
+
+    auto moduleCount = in.read<std::uint32_t>();
+    for (std::uint32_t i = 0; i < moduleCount; i++) {
+      auto bytes = in.read<std::uint64_t>();
+      MemoryBuffer buffer(in.take(bytes), bytes);
+      std::istream module(&buffer);
+      vm_.load(deserialize(module));
+    }
+
+    readStrings(in);
+
+    // Allocate every cell up front, so slots can refer to any of them. The
+    // cells stay in the VM's roots while they are filled in.
+    auto &roots = vm_.roots();
+    auto cellCount = in.read<std::uint32_t>();
+    base_ = roots.size();
+    roots.reserve(base_ + cellCount + 1);
+    for (std::uint32_t i = 0; i < cellCount; i++) {
+      roots.push_back(allocate(in));
+    }
+
+    for (std::uint32_t i = 0; i < cellCount; i++) {
+      fill(in, base_ + i);
+    }
+
+    auto root = decode(in.readValue());
+    roots.resize(base_);
+    roots.push_back(root);
+    return root;
+  }
+
+ private:
+  /// Map the snapshot's strings onto the VM's, interning those that no
+  /// module defines.
+  void readStrings(Cursor &in) {
+    auto count = in.read<std::uint32_t>();
+    for (std::uint32_t i = 0; i < count; i++) {
+      auto length = in.read<std::uint32_t>();
+      strings_.push_back(vm_.strings().intern({in.take(length), length}));
+    }
+    vm_.strings().rank();
+  }
+
+  Om::Value allocate(Cursor &in) {
+    auto kind = static_cast<CellKind>(in.read<std::uint8_t>());
+    kinds_.push_back(kind);
+    switch (kind) {
+      case CellKind::OBJECT:
+        return {Om::AS_REF, Om::allocateEmptyObject(context_)};
+      case CellKind::INT_ARRAY: {
+        auto length = in.read<std::uint64_t>();
+        // Don't allocate more than the snapshot can fill.
+        if (length > in.remaining() / sizeof(std::int64_t)) {
+          throw SnapshotException{"Snapshot is truncated"};
+        }
+        return {Om::AS_REF, allocateIntArray(context_, length)};
+      }
+      case CellKind::HASH_MAP:
+        return {Om::AS_REF, allocateHashMap(context_)};
+      default:
+        throw SnapshotException{"Bad cell kind in snapshot"};
+    }
+  }
+
+  void fill(Cursor &in, std::size_t root) {
+    if (kinds_[root - base_] == CellKind::INT_ARRAY) {
+      auto array = vm_.roots()[root].getRef<IntArray>();
+      auto bytes = intArrayLength(array) * sizeof(std::int64_t);
+      std::memcpy(intArrayData(array), in.take(bytes), bytes);
+      return;
+    }
+    if (kinds_[root - base_] == CellKind::HASH_MAP) {
+      auto entryCount = in.read<std::uint32_t>();
+      for (std::uint32_t i = 0; i < entryCount; i++) {
+        auto key = decode(in.readValue());
+        auto value = decode(in.readValue());
+        if (!isHashMapKey(key) || !isHashMapValue(value)) {
+          throw SnapshotException{"Bad map entry in snapshot"};
+        }
+        // Reload the map, which may have moved when the last put grew it.
+        auto map = vm_.roots()[root].getRef<HashMap>();
+        hashMapPut(context_, map, key, value);
+      }
+      return;
+    }
+    auto slotCount = in.read<std::uint32_t>();
+    for (std::uint32_t i = 0; i < slotCount; i++) {
+      auto id = Om::Id(in.read<std::uint32_t>());
+      auto value = in.readValue();
+      store(root, id, value);
+    }
+  }
+
+  Om::Value decode(const ValueRecord &value) {
+    switch (value.kind) {
+      case ValueKind::INT48:
+        return {Om::AS_INT48, static_cast<std::int64_t>(value.payload)};
+      case ValueKind::STRING:
+        if (value.payload >= strings_.size()) {
+          throw SnapshotException{"Bad string index in snapshot"};
+        }
+        return {Om::AS_UINT48, strings_[value.payload]};
+      case ValueKind::OBJECT:
+        if (base_ + value.payload >= vm_.roots().size()) {
+          throw SnapshotException{"Bad cell index in snapshot"};
+        }
+        return vm_.roots()[base_ + value.payload];
+      default:
+        return {Om::AS_RAW, value.payload};
+    }
+  }
+
+  /// Set a slot the way POP_INTO_OBJECT does, transitioning the object to a
+  /// new layout when the slot is missing. Objects with the same slots end up
+  /// sharing a layout again.
+  void store(std::size_t root, Om::Id id, const ValueRecord &value) {
+    auto object = vm_.roots()[root].getRef<Om::Object>();
+    Om::SlotDescriptor descriptor;
+    if (!Om::lookupSlot(context_, object, id, descriptor)) {
+      static constexpr Om::SlotType type(Om::Id(0), Om::CoreType::VALUE);
+      Om::RootRef<Om::Object> ref(context_, object);
+      Om::transitionLayout(context_, ref, {{type, id}});
+      object = ref.get();
+      Om::lookupSlot(context_, object, id, descriptor);
+    }
+    // Decode after the transition, which may have moved the objects.
+    storeValue(context_, object, descriptor, decode(value));
+  }
+
+  VirtualMachine &vm_;
+  ExecutionContext &context_;
+  std::vector<std::size_t> strings_;
+  std::vector<CellKind> kinds_;
+  std::size_t base_ = 0;
+};
+
+}  // namespace
+
+void writeSnapshot(std::ostream &out, VirtualMachine &vm, Om::Value root) {
+  SnapshotWriter{vm}.write(out, root);
+}
+
+Om::Value readSnapshot(std::istream &in, VirtualMachine &vm) {
+  std::vector<char> data;
+  char buffer[64 * 1024];
+  do {
+    in.read(buffer, sizeof(buffer));
+    data.insert(data.end(), buffer, buffer + in.gcount());
+  } while (in.good());
+  return SnapshotReader{vm}.read(data.data(), data.size());
+}
+
+Om::Value readSnapshotFile(const std::string &path, VirtualMachine &vm) {
+  std::unique_ptr<MappedFile> file;
+  try {
+    file = std::make_unique<MappedFile>(path);
+  } catch (const std::system_error &e) {
+    throw SnapshotException{std::string("Cannot map snapshot ") + e.what()};
+  }
+  file->advise(MADV_SEQUENTIAL);
+  return SnapshotReader{vm}.read(file->data(), file->size());
+}
+
+}  // namespace b9
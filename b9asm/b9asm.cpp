@@ -1,8 +1,88 @@
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <vector>
 
 #include <b9/Module.hpp>
 #include <b9/assemble.hpp>
+#include <b9/serialize.hpp>
 
 using namespace b9;
 
-extern "C" int main(int argc, char** argv) { return 0; }
+static const char* usage =
+    "Usage: b9asm [<option>...] [<assembly>]\n"
+    "   Or: b9asm -help\n"
+    "Assemble base9 assembly, from a file or stdin, into a binary module.\n"
+    "Options:\n"
+    "  -o <module>: Write the module to a file instead of stdout\n"
+    "  -v1:         Write the sequential (version 1) format\n";
+
+extern "C" int main(int argc, char** argv) {
+  const char* inputName = nullptr;
+  const char* outputName = nullptr;
+  bool version1 = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-help") == 0) {
+      std::cout << usage;
+      return 0;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputName = argv[++i];
+    } else if (strcmp(argv[i], "-v1") == 0) {
+      version1 = true;
+    } else if (argv[i][0] != '-' && inputName == nullptr) {
+      inputName = argv[i];
+    } else {
+      std::cerr << usage;
+      return 1;
+    }
+  }
+
+  // Read large inputs in large blocks.
+  std::vector<char> buffer(1 << 20);
+  std::ifstream infile;
+  std::streambuf* inbuffer = std::cin.rdbuf();
+  if (inputName != nullptr) {
+    infile.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    infile.open(inputName, std::ios::in | std::ios::binary);
+    if (!infile) {
+      std::cerr << "b9asm: cannot open " << inputName << std::endl;
+      return 1;
+    }
+    inbuffer = infile.rdbuf();
+  }
+  std::istream in(inbuffer);
+
+  std::shared_ptr<Module> module;
+  try {
+    module = assembleModule(in);
+  } catch (const AssemblerException& e) {
+    std::cerr << "b9asm: " << (inputName ? inputName : "<stdin>") << ": "
+              << e.what() << std::endl;
+    return 1;
+  }
+
+  std::ofstream outfile;
+  std::ostream* out = &std::cout;
+  if (outputName != nullptr) {
+    outfile.open(outputName, std::ios::out | std::ios::binary);
+    if (!outfile) {
+      std::cerr << "b9asm: cannot open " << outputName << std::endl;
+      return 1;
+    }
+    out = &outfile;
+  }
+
+  try {
+    if (version1) {
+      serializeV1(*out, *module);
+    } else {
+      serialize(*out, *module);
+    }
+  } catch (const SerializeException& e) {
+    std::cerr << "b9asm: " << e.what() << std::endl;
+    return 1;
+  }
+  out->flush();
+  return out->good() ? 0 : 1;
+}
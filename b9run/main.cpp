@@ -1,29 +1,52 @@
 #include <b9/ExecutionContext.hpp>
 #include <b9/compiler/Compiler.hpp>
 #include <b9/deserialize.hpp>
+#include <b9/snapshot.hpp>
 
 #include <OMR/Om/Context.inl.hpp>
 #include <OMR/Om/MemorySystem.hpp>
 #include <OMR/Om/RootRef.hpp>
 #include <OMR/Om/Runtime.hpp>
 
+#include <fcntl.h>
 #include <strings.h>
+#include <unistd.h>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <system_error>
 
 /// B9run's usage string. Printed when run with -help.
 static const char* usage =
     "Usage: b9run [<option>...] [--] <module> [<arg>...]\n"
+    "   Or: b9run [<option>...] -restore <snapshot> [--] [<arg>...]\n"
     "   Or: b9run -help\n"
     "Jit Options:\n"
     "  -jit:          Enable the jit\n"
     "  -directcall:   make direct jit to jit calls\n"
     "  -passparam:    Pass arguments in CPU registers\n"
     "  -lazyvmstate:  Only update the VM state as needed\n"
+    "GC Options:\n"
+    "  -gcpolicy <p>: Collect with optthruput (default), optavgpause or\n"
+    "                 gencon\n"
+    "  -Xms<size>:    Set the initial heap size, as <n>[k|m|g]\n"
+    "  -Xmx<size>:    Set the maximum heap size\n"
+    "  -Xmn<size>:    Set gencon's nursery size\n"
+    "  -Xminf<f>:     Expand the heap when less than <f> is free after a GC\n"
+    "                 (default: 0.3)\n"
+    "  -Xmaxf<f>:     Shrink the heap when more than <f> is free after a GC\n"
+    "                 (default: 0.6)\n"
+    "  -gcstats:      Print GC statistics after the run\n"
+    "  -gcjson <f>:   Write GC statistics to the file <f>, as JSON\n"
     "Run Options:\n"
+    "  -lib <module>: Load a library module before the main module\n"
+    "  -function <f>: Run the function <f> (default: <script>)\n"
+    "  -snapshot <s>: Write the modules and the result's heap to <s>\n"
+    "  -restore <s>:  Restore a snapshot, and pass its root to the function\n"
+    "  -output <f>:   Write the program's output to the file <f>\n"
     "  -inline <n>:   Set the jit's max inline depth (default: 0)\n"
     "  -debug:        Enable debug code\n"
     "  -verbose:      Run with verbose printing\n"
@@ -34,12 +57,26 @@ struct RunConfig {
   b9::Config b9;
   const char* moduleName = "";
   const char* mainFunction = "<script>";
+  const char* snapshotName = nullptr;
+  const char* restoreName = nullptr;
+  const char* outputName = nullptr;
+  const char* gcJsonName = nullptr;
+  bool gcStats = false;
+  std::vector<const char*> libraries;
   bool verbose = false;
-  std::vector<b9::StackElement> usrArgs;
+  std::vector<const char*> usrArgs;
 };
 
 std::ostream& operator<<(std::ostream& out, const RunConfig& cfg) {
-  out << "Module:       " << cfg.moduleName << std::endl;
+  if (cfg.restoreName != nullptr) {
+    out << "Restore:      " << cfg.restoreName << std::endl;
+  } else {
+    out << "Module:       " << cfg.moduleName << std::endl;
+  }
+
+  for (const auto& library : cfg.libraries) {
+    out << "Library:      " << library << std::endl;
+  }
 
   out << "Arguments:    [ ";
   for (const auto& arg : cfg.usrArgs) {
@@ -51,6 +88,44 @@ std::ostream& operator<<(std::ostream& out, const RunConfig& cfg) {
   return out;
 }
 
+/// Parse a size in bytes, with an optional k, m or g suffix.
+static bool parseSize(const char* text, std::size_t& size) {
+  char* end = nullptr;
+  errno = 0;
+  auto value = std::strtoull(text, &end, 10);
+  if (end == text || errno != 0) {
+    return false;
+  }
+  switch (*end) {
+    case 'g':
+    case 'G':
+      value <<= 10;
+      // fall through
+    case 'm':
+    case 'M':
+      value <<= 10;
+      // fall through
+    case 'k':
+    case 'K':
+      value <<= 10;
+      end++;
+      break;
+  }
+  size = value;
+  return *end == '\0';
+}
+
+/// Parse a fraction of the heap, from 0 to 1.
+static bool parseFraction(const char* text, double& fraction) {
+  char* end = nullptr;
+  auto value = std::strtod(text, &end);
+  if (end == text || *end != '\0' || !(value >= 0 && value <= 1)) {
+    return false;
+  }
+  fraction = value;
+  return true;
+}
+
 /// Parse CLI arguments and set up the config.
 static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
   std::size_t i = 1;
@@ -61,6 +136,20 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
     if (strcasecmp(arg, "-help") == 0) {
       std::cout << usage << std::endl;
       exit(EXIT_SUCCESS);
+    } else if (strcasecmp(arg, "-lib") == 0) {
+      cfg.libraries.push_back(argv[++i]);
+    } else if (strcasecmp(arg, "-function") == 0) {
+      cfg.mainFunction = argv[++i];
+    } else if (strcasecmp(arg, "-snapshot") == 0) {
+      cfg.snapshotName = argv[++i];
+    } else if (strcasecmp(arg, "-restore") == 0) {
+      cfg.restoreName = argv[++i];
+    } else if (strcasecmp(arg, "-output") == 0) {
+      cfg.outputName = argv[++i];
+    } else if (strcasecmp(arg, "-gcstats") == 0) {
+      cfg.gcStats = true;
+    } else if (strcasecmp(arg, "-gcjson") == 0) {
+      cfg.gcJsonName = argv[++i];
     } else if (strcasecmp(arg, "-inline") == 0) {
       cfg.b9.maxInlineDepth = atoi(argv[++i]);
     } else if (strcasecmp(arg, "-verbose") == 0) {
@@ -76,6 +165,37 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
       cfg.b9.passParam = true;
     } else if (strcasecmp(arg, "-lazyvmstate") == 0) {
       cfg.b9.lazyVmState = true;
+    } else if (strcasecmp(arg, "-gcpolicy") == 0) {
+      if (++i == argc || !b9::parseGcPolicy(argv[i], cfg.b9.gcPolicy)) {
+        std::cerr << "-gcpolicy requires optthruput, optavgpause or gencon"
+                  << std::endl;
+        return false;
+      }
+    } else if (strncmp(arg, "-Xmn", 4) == 0) {
+      if (!parseSize(arg + 4, cfg.b9.nurserySize)) {
+        std::cerr << "Bad nursery size: " << arg << std::endl;
+        return false;
+      }
+    } else if (strncmp(arg, "-Xms", 4) == 0) {
+      if (!parseSize(arg + 4, cfg.b9.initialHeapSize)) {
+        std::cerr << "Bad initial heap size: " << arg << std::endl;
+        return false;
+      }
+    } else if (strncmp(arg, "-Xmx", 4) == 0) {
+      if (!parseSize(arg + 4, cfg.b9.maxHeapSize)) {
+        std::cerr << "Bad maximum heap size: " << arg << std::endl;
+        return false;
+      }
+    } else if (strncmp(arg, "-Xminf", 6) == 0) {
+      if (!parseFraction(arg + 6, cfg.b9.minHeapFree)) {
+        std::cerr << "Bad minimum free fraction: " << arg << std::endl;
+        return false;
+      }
+    } else if (strncmp(arg, "-Xmaxf", 6) == 0) {
+      if (!parseFraction(arg + 6, cfg.b9.maxHeapFree)) {
+        std::cerr << "Bad maximum free fraction: " << arg << std::endl;
+        return false;
+      }
     } else if (strcmp(arg, "--") == 0) {
       i++;
       break;
@@ -87,17 +207,19 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
     }
   }
 
-  // check for user defined module
-  if (i < argc) {
-    cfg.moduleName = argv[i++];
-  } else {
-    std::cerr << "No module name given to b9run" << std::endl;
-    return false;
+  // check for user defined module, unless a snapshot provides the modules
+  if (cfg.restoreName == nullptr) {
+    if (i < argc) {
+      cfg.moduleName = argv[i++];
+    } else {
+      std::cerr << "No module name given to b9run" << std::endl;
+      return false;
+    }
   }
 
   // check for user defined arguments
   for (; i < argc; i++) {
-    cfg.usrArgs.push_back(Om::Value(Om::AS_INT48, std::atoi(argv[i])));
+    cfg.usrArgs.push_back(argv[i]);
   }
 
   // check that dependent options are enabled
@@ -109,6 +231,20 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
     std::cerr << "-passparam requires -directcall" << std::endl;
     return false;
   }
+  if (cfg.b9.nurserySize != 0 && cfg.b9.gcPolicy != b9::GcPolicy::GENCON) {
+    std::cerr << "-Xmn requires -gcpolicy gencon" << std::endl;
+    return false;
+  }
+  if (cfg.b9.maxHeapSize != 0 &&
+      (cfg.b9.initialHeapSize > cfg.b9.maxHeapSize ||
+       cfg.b9.nurserySize >= cfg.b9.maxHeapSize)) {
+    std::cerr << "-Xms and -Xmn must fit in -Xmx" << std::endl;
+    return false;
+  }
+  if (cfg.b9.minHeapFree > cfg.b9.maxHeapFree) {
+    std::cerr << "-Xminf must not be more than -Xmaxf" << std::endl;
+    return false;
+  }
   if (cfg.b9.lazyVmState && !cfg.b9.passParam) {
     std::cerr << "-lazyvmstate requires -passparam" << std::endl;
     return false;
@@ -117,20 +253,79 @@ static bool parseArguments(RunConfig& cfg, const int argc, char* argv[]) {
   return true;
 }
 
+/// Integer arguments are passed as numbers, and anything else, such as a file
+/// name for the input primitives, as a string.
+static b9::StackElement argument(b9::VirtualMachine& vm, const char* arg) {
+  char* end;
+  errno = 0;
+  auto number = std::strtoll(arg, &end, 10);
+  if (*arg != '\0' && *end == '\0' && errno == 0) {
+    return {Om::AS_INT48, number};
+  }
+  return {Om::AS_UINT48, vm.strings().intern(arg)};
+}
+
+/// Closes the file when it goes out of scope.
+struct FileDescriptor {
+  int fd = -1;
+
+  ~FileDescriptor() {
+    if (fd >= 0) close(fd);
+  }
+};
+
 static void run(Om::ProcessRuntime& runtime, const RunConfig& cfg) {
+  // Opened first, so it is closed after the VM has written everything.
+  FileDescriptor output;
+  if (cfg.outputName != nullptr) {
+    output.fd = open(cfg.outputName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output.fd < 0) {
+      throw std::system_error(errno, std::generic_category(), cfg.outputName);
+    }
+  }
+
   b9::VirtualMachine vm{runtime, cfg.b9};
+  if (output.fd >= 0) {
+    vm.setOutput(std::make_shared<b9::FdOutputSink>(output.fd));
+  }
 
-  std::ifstream file(cfg.moduleName, std::ios_base::in | std::ios_base::binary);
-  auto module = b9::deserialize(file);
-  vm.load(module);
+  std::vector<b9::StackElement> usrArgs;
+  if (cfg.restoreName != nullptr) {
+    auto root = b9::readSnapshotFile(cfg.restoreName, vm);
+    usrArgs.push_back(root);
+  } else {
+    for (const auto& library : cfg.libraries) {
+      vm.load(b9::deserializeFile(library));
+    }
+    vm.load(b9::deserializeFile(cfg.moduleName));
+  }
+
+  for (const auto& arg : cfg.usrArgs) {
+    usrArgs.push_back(argument(vm, arg));
+  }
 
   if (cfg.b9.jit) {
     vm.generateAllCode();
   }
 
-  size_t functionIndex = module->getFunctionIndex(cfg.mainFunction);
-  auto result = vm.run(functionIndex, cfg.usrArgs);
+  auto result = vm.run(cfg.mainFunction, usrArgs);
   std::cout << std::endl << "=> " << result << std::endl;
+
+  if (cfg.snapshotName != nullptr) {
+    std::ofstream out(cfg.snapshotName,
+                      std::ios_base::out | std::ios_base::binary);
+    b9::writeSnapshot(out, vm, result);
+  }
+
+  auto stats = vm.gcStats();
+  if (cfg.gcStats) {
+    std::cerr << stats << std::endl;
+  }
+  if (cfg.gcJsonName != nullptr) {
+    std::ofstream out(cfg.gcJsonName);
+    b9::writeJson(out, stats);
+    out << std::endl;
+  }
 }
 
 int main(int argc, char* argv[]) {
@@ -151,15 +346,27 @@ int main(int argc, char* argv[]) {
   } catch (const b9::DeserializeException& e) {
     std::cerr << "Failed to load module: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::LinkException& e) {
+    std::cerr << "Failed to link module: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   } catch (const b9::FunctionNotFoundException& e) {
     std::cerr << "Failed to find function: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
   } catch (const b9::BadFunctionCallException& e) {
     std::cerr << "Failed to call function " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::SnapshotException& e) {
+    std::cerr << "Failed to snapshot: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   } catch (const b9::CompilationException& e) {
     std::cerr << "Failed to compile function: " << e.what() << std::endl;
     exit(EXIT_FAILURE);
+  } catch (const b9::InputException& e) {
+    std::cerr << "Failed to read input: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
+  } catch (const std::system_error& e) {
+    std::cerr << "Failed to write output: " << e.what() << std::endl;
+    exit(EXIT_FAILURE);
   }
 
   exit(EXIT_SUCCESS);
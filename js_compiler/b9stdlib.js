@@ -9,3 +9,151 @@ function b9PrintNumber(a) {
 function b9PrintStack(a) {
     b9_primitive("print_stack", a);
 }
+
+function b9StringConcat(a, b) {
+    return b9_primitive("string_concat", a, b);
+}
+
+function b9Substring(s, start, length) {
+    return b9_primitive("string_substring", s, start, length);
+}
+
+function b9StringLength(s) {
+    return b9_primitive("string_length", s);
+}
+
+function b9IntToString(n) {
+    return b9_primitive("int_to_string", n);
+}
+
+function b9NewBuilder() {
+    return b9_primitive("builder_new");
+}
+
+function b9BuilderAppend(builder, piece) {
+    return b9_primitive("builder_append", builder, piece);
+}
+
+function b9BuilderToString(builder) {
+    return b9_primitive("builder_to_string", builder);
+}
+
+function b9FlushOutput() {
+    b9_primitive("flush_output");
+}
+
+function b9OpenInput(path) {
+    return b9_primitive("input_open", path);
+}
+
+function b9CloseInput(input) {
+    b9_primitive("input_close", input);
+}
+
+function b9NextLine(input) {
+    return b9_primitive("input_next_line", input);
+}
+
+function b9NextRecord(input, delimiter) {
+    return b9_primitive("input_next_record", input, delimiter);
+}
+
+function b9RecordString(input) {
+    return b9_primitive("input_record_string", input);
+}
+
+function b9RecordByte(input, index) {
+    return b9_primitive("input_record_byte", input, index);
+}
+
+function b9RecordFind(input, string) {
+    return b9_primitive("input_record_find", input, string);
+}
+
+function b9RecordInt(input, field) {
+    return b9_primitive("input_record_int", input, field);
+}
+
+function b9ReadInt(input) {
+    return b9_primitive("input_read_int", input);
+}
+
+function b9InputAtEnd(input) {
+    return b9_primitive("input_at_end", input);
+}
+
+function b9ArraySum(array) {
+    return b9_primitive("array_sum", array);
+}
+
+function b9ArrayMin(array) {
+    return b9_primitive("array_min", array);
+}
+
+function b9ArrayMax(array) {
+    return b9_primitive("array_max", array);
+}
+
+function b9ArrayFill(array, value) {
+    return b9_primitive("array_fill", array, value);
+}
+
+function b9ArrayCopy(to, from) {
+    return b9_primitive("array_copy", to, from);
+}
+
+function b9ArrayCompare(left, right) {
+    return b9_primitive("array_compare", left, right);
+}
+
+function b9ArrayFind(array, value) {
+    return b9_primitive("array_find", array, value);
+}
+
+function b9ArrayPrefixSum(array) {
+    return b9_primitive("array_prefix_sum", array);
+}
+
+function b9ArrayAddScalar(array, value) {
+    return b9_primitive("array_add_scalar", array, value);
+}
+
+function b9ArrayMulScalar(array, value) {
+    return b9_primitive("array_mul_scalar", array, value);
+}
+
+function b9ArrayAdd(to, from) {
+    return b9_primitive("array_add", to, from);
+}
+
+function b9ArrayMul(to, from) {
+    return b9_primitive("array_mul", to, from);
+}
+
+/// Maps take int or string keys, and int, string or double values. The GC
+/// does not scan a map's table, so putting an object, an array or another map
+/// in a map fails. To group records by key, map each key to an int, such as an
+/// index into int arrays that hold the groups' totals.
+function b9MapNew() {
+    return b9_primitive("map_new");
+}
+
+function b9MapGet(map, key) {
+    return b9_primitive("map_get", map, key);
+}
+
+function b9MapHas(map, key) {
+    return b9_primitive("map_has", map, key);
+}
+
+function b9MapPut(map, key, value) {
+    return b9_primitive("map_put", map, key, value);
+}
+
+function b9MapDelete(map, key) {
+    return b9_primitive("map_delete", map, key);
+}
+
+function b9MapSize(map) {
+    return b9_primitive("map_size", map);
+}
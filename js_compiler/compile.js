@@ -20,6 +20,12 @@ function outputUInt32(out, value) {
 	fs.writeSync(out, buf, 0, 4);
 }
 
+function outputInt32(out, value) {
+	var buf = Buffer.alloc(4);
+	buf.writeInt32LE(value, 0);
+	fs.writeSync(out, buf, 0, 4);
+}
+
 function outputString(out, string) {
 	outputUInt32(out, string.length);
 	fs.writeSync(out, string);
@@ -28,7 +34,43 @@ function outputString(out, string) {
 var PrimitiveCode = Object.freeze({
 	"print_string": 0,
 	"print_number": 1,
-	"print_stack": 2
+	"print_stack": 2,
+	"string_concat": 3,
+	"string_substring": 4,
+	"string_length": 5,
+	"int_to_string": 6,
+	"builder_new": 7,
+	"builder_append": 8,
+	"builder_to_string": 9,
+	"flush_output": 10,
+	"input_open": 11,
+	"input_close": 12,
+	"input_next_line": 13,
+	"input_next_record": 14,
+	"input_record_string": 15,
+	"input_record_byte": 16,
+	"input_record_find": 17,
+	"input_record_int": 18,
+	"input_read_int": 19,
+	"input_at_end": 20,
+	"array_sum": 21,
+	"array_min": 22,
+	"array_max": 23,
+	"array_fill": 24,
+	"array_copy": 25,
+	"array_compare": 26,
+	"array_find": 27,
+	"array_prefix_sum": 28,
+	"array_add_scalar": 29,
+	"array_mul_scalar": 30,
+	"array_add": 31,
+	"array_mul": 32,
+	"map_new": 33,
+	"map_get": 34,
+	"map_has": 35,
+	"map_put": 36,
+	"map_delete": 37,
+	"map_size": 38
 });
 
 var OperatorCode = Object.freeze({
@@ -56,6 +98,33 @@ var OperatorCode = Object.freeze({
 	"JMP_LT": 21,
 	"JMP_LE": 22,
 	"STR_PUSH_CONSTANT": 23,
+	"INT_PUSH_CONSTANT_WIDE": 24,
+	"INT_MOD": 25,
+	"INT_AND": 26,
+	"INT_OR": 27,
+	"INT_XOR": 28,
+	"INT_SHL": 29,
+	"INT_SHR": 30,
+	"INT_NEG": 31,
+	"NEW_INT_ARRAY": 48,
+	"INT_ARRAY_LOAD": 49,
+	"INT_ARRAY_STORE": 50,
+	"ARRAY_LENGTH": 51,
+	"DBL_PUSH_CONSTANT": 64,
+	"DBL_ADD": 65,
+	"DBL_SUB": 66,
+	"DBL_MUL": 67,
+	"DBL_DIV": 68,
+	"DBL_JMP_EQ": 69,
+	"DBL_JMP_NEQ": 70,
+	"DBL_JMP_GT": 71,
+	"DBL_JMP_GE": 72,
+	"DBL_JMP_LT": 73,
+	"DBL_JMP_LE": 74,
+	"INT_TO_DBL": 75,
+	"DBL_TO_INT": 76,
+	"TABLE_SWITCH": 80,
+	"TAIL_CALL": 81,
 });
 
 /// Binary comparison operators converted to jump instructions
@@ -68,15 +137,74 @@ JumpOperator = Object.freeze({
 	">": "JMP_GT"
 });
 
-/// Map binary comparison operators to jump instructions that invert the condition.
-/// as an example, the if statement handler will use this table to invert a comparison, and jump over the if-true block.
-var NegJumpOperator = Object.freeze({
-	"==": "JMP_NEQ",
-	"!=": "JMP_EQ",
-	"<=": "JMP_GT",
-	">=": "JMP_LT",
-	"<": "JMP_GE",
-	">": "JMP_LE"
+/// Map each conditional jump to the jump taken when the condition is false.
+/// As an example, the if statement handler will use this table to invert a comparison, and jump over the if-true block.
+/// Ordered double comparisons are all false when an operand is NaN, so they have no inverse here; see emitJumpUnless.
+var InvertedJump = Object.freeze({
+	"JMP_EQ": "JMP_NEQ",
+	"JMP_NEQ": "JMP_EQ",
+	"JMP_GT": "JMP_LE",
+	"JMP_GE": "JMP_LT",
+	"JMP_LT": "JMP_GE",
+	"JMP_LE": "JMP_GT",
+	"DBL_JMP_EQ": "DBL_JMP_NEQ",
+	"DBL_JMP_NEQ": "DBL_JMP_EQ"
+});
+
+/// Evaluate a conditional jump on constant operands.
+var JumpCondition = Object.freeze({
+	"JMP_EQ": function (a, b) { return a == b; },
+	"JMP_NEQ": function (a, b) { return a != b; },
+	"JMP_GT": function (a, b) { return a > b; },
+	"JMP_GE": function (a, b) { return a >= b; },
+	"JMP_LT": function (a, b) { return a < b; },
+	"JMP_LE": function (a, b) { return a <= b; },
+	"DBL_JMP_EQ": function (a, b) { return a == b; },
+	"DBL_JMP_NEQ": function (a, b) { return a != b; },
+	"DBL_JMP_GT": function (a, b) { return a > b; },
+	"DBL_JMP_GE": function (a, b) { return a >= b; },
+	"DBL_JMP_LT": function (a, b) { return a < b; },
+	"DBL_JMP_LE": function (a, b) { return a <= b; }
+});
+
+/// Evaluate an integer operator on constant operands, as the VM would.
+/// Returns undefined when the operation can't be folded.
+var IntegerOperation = Object.freeze({
+	"INT_ADD": function (a, b) { return a + b; },
+	"INT_SUB": function (a, b) { return a - b; },
+	"INT_MUL": function (a, b) { return a * b; },
+	"INT_DIV": function (a, b) { return b == 0 ? undefined : Math.trunc(a / b); },
+	"INT_MOD": function (a, b) { return b == 0 ? undefined : a % b; },
+	// Constants fit in 24 bits, so JavaScript's 32-bit bitwise operators are exact.
+	"INT_AND": function (a, b) { return a & b; },
+	"INT_OR": function (a, b) { return a | b; },
+	"INT_XOR": function (a, b) { return a ^ b; },
+	// Shifts are done on int48s, with the count taken modulo 64.
+	"INT_SHL": function (a, b) { return (b & 63) < 24 ? a * Math.pow(2, b & 63) : undefined; },
+	"INT_SHR": function (a, b) { return Math.floor(a / Math.pow(2, b & 63)); }
+});
+
+/// Map binary arithmetic operators to b9 operator codes.
+var ArithmeticOperator = Object.freeze({
+	"+": "INT_ADD",
+	"-": "INT_SUB",
+	"*": "INT_MUL",
+	"/": "INT_DIV",
+	"%": "INT_MOD",
+	"&": "INT_AND",
+	"|": "INT_OR",
+	"^": "INT_XOR",
+	"<<": "INT_SHL",
+	">>": "INT_SHR"
+});
+
+/// The double version of each integer operator. An operation is done on doubles
+/// when either operand is a double. The others only take ints.
+var DoubleOperator = Object.freeze({
+	"INT_ADD": "DBL_ADD",
+	"INT_SUB": "DBL_SUB",
+	"INT_MUL": "DBL_MUL",
+	"INT_DIV": "DBL_DIV"
 });
 
 /// Map a++ style operators to b9 operator codes.
@@ -95,17 +223,26 @@ var Instruction = function (operator, operand) {
 	this.output = function (out) {
 		var encoded = (OperatorCode[this.operator] << 24);
 		if (this.operand) {
+			if (this.operand < -0x800000 || this.operand > 0x7FFFFF) {
+				throw "Operand does not fit in 24 bits: " + this.operator + " " + this.operand;
+			}
 			encoded |= this.operand & 0x00FFFFFF;
 		}
 		encoded &= 0xFFFFFFFF;
 		outputUInt32(out, encoded);
 	}
+
+	/// Whether the function returns after this instruction.
+	this.returns = function () {
+		return this.operator == "FUNCTION_RETURN" || this.operator == "TAIL_CALL";
+	}
 };
 
 var SymbolTable = function () {
 
 	this.next = 0; 
 	this.map = Object.create(null);  
+	this.symbols = [];
 
 	/// Look up a symbol without interning.
 	this.lookup = function (symbol) {
@@ -119,16 +256,18 @@ var SymbolTable = function () {
 			id = this.next;
 			this.next += 1;
 			this.map[symbol] = id;
+			this.symbols.push(symbol);
 		}
 		return id;
 	}
 
-	/// callback(name, id)
+	/// callback(name, id), in id order. Iterating the map would visit
+	/// integer-like names, such as the string "9", first.
 	this.forEach = function (callback) {
 		var me = this;
-		for (symbol in this.map) {
+		this.symbols.forEach(function (symbol) {
 			callback(symbol, me.map[symbol]);
-		}
+		});
 	}
 }
 
@@ -142,6 +281,7 @@ function FunctionEntry(globalContext) {
 	this.parameterTable = new SymbolTable();
 	this.localTable = new SymbolTable();
 	this.functionTable = {};
+	this.importTable = {};
 
 	this.defineParameter = function (symbol) {
 		return this.parameterTable.get(symbol);
@@ -157,6 +297,11 @@ function FunctionEntry(globalContext) {
 		return this.localTable.get(symbol);
 	}
 
+	/// Imports are numbered separately, and resolved to call targets when the module is resolved.
+	this.defineImport = function (symbol, importIndex) {
+		this.importTable[symbol] = importIndex;
+	}
+
 	this.lookup = function (symbol) {
 
 		var id = undefined;
@@ -175,6 +320,11 @@ function FunctionEntry(globalContext) {
 		if (id !== undefined) {
 			return { type: "function", id: id };
 		}
+
+		id = this.importTable[symbol];
+		if (id !== undefined) {
+			return { type: "import", id: id };
+		}
 		return undefined;
 	}
 };
@@ -244,6 +394,8 @@ function FunctionDefinition(outer, name) {
 	this.locals = new SymbolTable();
 	this.labels = new LabelTable();
 	this.instructions = [];
+	this.nlocals = undefined; // computed by the optimizer
+	this.breakLabels = []; // the exit labels of the enclosing loops and switches
 
 	/// Resolve the label to a relative offset.
 	this.resolveLabel = function (label, fromIndex) {
@@ -265,9 +417,36 @@ function FunctionDefinition(outer, name) {
 				case "JMP_GE":
 				case "JMP_LT":
 				case "JMP_LE":
+				case "DBL_JMP_EQ":
+				case "DBL_JMP_NEQ":
+				case "DBL_JMP_GT":
+				case "DBL_JMP_GE":
+				case "DBL_JMP_LT":
+				case "DBL_JMP_LE":
 					// the label id is stuffed in the operand.
 					// translate the label to a relative offset.
 					instruction.operand = this.resolveLabel(instruction.operand, index);
+					break;
+				case "TABLE_SWITCH":
+					// the operand is the switch, with labels. It becomes a jump table.
+					var me = this;
+					var jumpSwitch = instruction.operand;
+					instruction.operand = module.jumpTables.length;
+					module.jumpTables.push({
+						low: jumpSwitch.low,
+						defaultOffset: this.resolveLabel(jumpSwitch.defaultLabel, index),
+						offsets: jumpSwitch.labels.map(function (label) {
+							return me.resolveLabel(label, index);
+						})
+					});
+					break;
+				case "FUNCTION_CALL":
+				case "TAIL_CALL":
+					// imported functions are numbered after the module's own functions.
+					if (typeof instruction.operand == "object") {
+						instruction.operand = module.functions.length + instruction.operand.importIndex;
+					}
+					break;
 			}
 		}
 	}
@@ -275,7 +454,7 @@ function FunctionDefinition(outer, name) {
 	this.output = function (out) {
 		// note that name and index are output by the module.
 		outputUInt32(out, this.params.next);
-		outputUInt32(out, this.locals.next);
+		outputUInt32(out, this.nlocals !== undefined ? this.nlocals : this.locals.next);
 		this.instructions.forEach(function (instruction) {
 			instruction.output(out);
 		})
@@ -309,8 +488,35 @@ function FunctionDefinition(outer, name) {
 
 function Module() {
 	this.resolved = false;
+	this.optimize = true;
 	this.functions = [];
 	this.strings = new SymbolTable();
+	this.doubles = [];
+	this.doubleIds = {};
+	this.integers = [];
+	this.integerIds = {};
+	this.jumpTables = []; // filled in as functions are resolved
+	this.imports = [];
+	this.exports = [];
+
+	/// The constant pool index of a double, added if it isn't there yet.
+	this.doubleIndex = function (value) {
+		var key = Object.is(value, -0) ? "-0" : String(value);
+		if (this.doubleIds[key] === undefined) {
+			this.doubleIds[key] = this.doubles.length;
+			this.doubles.push(value);
+		}
+		return this.doubleIds[key];
+	}
+
+	/// The constant pool index of an integer too wide for an operand.
+	this.integerIndex = function (value) {
+		if (this.integerIds[value] === undefined) {
+			this.integerIds[value] = this.integers.length;
+			this.integers.push(value);
+		}
+		return this.integerIds[value];
+	}
 
 	/// After the module has been entirely built up, resolve any undefined references.
 	this.resolve = function () {
@@ -319,6 +525,9 @@ function Module() {
 			if (!body) {
 				throw "Undefined function reference: " + name;
 			}
+			if (me.optimize) {
+				new Optimizer(body).run();
+			}
 			body.resolve(me);
 		});
 		this.resolved = true;
@@ -332,6 +541,21 @@ function Module() {
 		this.outputHeader(out);
 		this.outputFunctionSection(out);
 		this.outputStringSection(out);
+		if (this.imports.length != 0) {
+			this.outputNameSection(out, 3, this.imports);
+		}
+		if (this.exports.length != 0) {
+			this.outputNameSection(out, 4, this.exports);
+		}
+		if (this.doubles.length != 0) {
+			this.outputDoubleSection(out);
+		}
+		if (this.integers.length != 0) {
+			this.outputIntegerSection(out);
+		}
+		if (this.jumpTables.length != 0) {
+			this.outputJumpTableSection(out);
+		}
 	}
 
 	//
@@ -362,6 +586,385 @@ function Module() {
 			outputString(out, string);
 		});
 	}
+
+	this.outputDoubleSection = function (out) {
+		outputUInt32(out, 5); // the section code.
+		outputUInt32(out, this.doubles.length);
+		this.doubles.forEach(function (value) {
+			var buf = Buffer.alloc(8);
+			buf.writeDoubleLE(value, 0);
+			fs.writeSync(out, buf, 0, 8);
+		});
+	}
+
+	this.outputIntegerSection = function (out) {
+		outputUInt32(out, 6); // the section code.
+		outputUInt32(out, this.integers.length);
+		this.integers.forEach(function (value) {
+			var buf = Buffer.alloc(8);
+			buf.writeIntLE(value, 0, 6);
+			buf.writeInt16LE(value < 0 ? -1 : 0, 6);
+			fs.writeSync(out, buf, 0, 8);
+		});
+	}
+
+	this.outputJumpTableSection = function (out) {
+		outputUInt32(out, 7); // the section code.
+		outputUInt32(out, this.jumpTables.length);
+		this.jumpTables.forEach(function (table) {
+			outputInt32(out, table.low);
+			outputInt32(out, table.defaultOffset);
+			outputUInt32(out, table.offsets.length);
+			table.offsets.forEach(function (offset) {
+				outputInt32(out, offset);
+			});
+		});
+	}
+
+	/// The import and export sections are lists of function names.
+	this.outputNameSection = function (out, sectionCode, names) {
+		outputUInt32(out, sectionCode);
+		outputUInt32(out, names.length);
+		names.forEach(function (name) {
+			outputString(out, name);
+		});
+	}
+};
+
+/// Optimizes the code of a function, before its labels are resolved. Jump operands are still label ids.
+/// The instructions are worked on as a list with the labels placed in it, so that rewriting the list
+/// keeps every label in front of the instruction it marks. A pattern is only rewritten when no label
+/// falls inside it, since code can be entered at a label.
+function Optimizer(func) {
+	this.func = func;
+	this.code = [];
+
+	/// The label pseudo-instruction.
+	var LABEL = "LABEL";
+
+	/// Instructions that push a value without side effects.
+	var PurePush = Object.freeze({
+		"INT_PUSH_CONSTANT": true,
+		"STR_PUSH_CONSTANT": true,
+		"INT_PUSH_CONSTANT_WIDE": true,
+		"DBL_PUSH_CONSTANT": true,
+		"PUSH_FROM_LOCAL": true,
+		"PUSH_FROM_PARAM": true
+	});
+
+	/// The largest constant an instruction operand can hold.
+	var MAX_IMMEDIATE = 0x7FFFFF;
+	var MIN_IMMEDIATE = -0x800000;
+
+	this.run = function () {
+		this.build();
+		var changed = true;
+		while (changed) {
+			changed = false;
+			changed = this.foldConstants() || changed;
+			changed = this.foldBranches() || changed;
+			changed = this.threadJumps() || changed;
+			changed = this.removeUnreachable() || changed;
+			changed = this.removeUnusedLabels() || changed;
+			changed = this.removeDeadStores() || changed;
+			changed = this.removeDeadValues() || changed;
+		}
+		this.renumberLocals();
+		this.rebuild();
+	}
+
+	/// Merge the label table into the instruction list.
+	this.build = function () {
+		var labelsAt = [];
+		this.func.labels.table.forEach(function (index, label) {
+			if (index !== undefined) {
+				(labelsAt[index] = labelsAt[index] || []).push(label);
+			}
+		});
+		var code = this.code;
+		var place = function (index) {
+			(labelsAt[index] || []).forEach(function (label) {
+				code.push(new Instruction(LABEL, label));
+			});
+		};
+		this.func.instructions.forEach(function (instruction, index) {
+			place(index);
+			code.push(instruction);
+		});
+		place(this.func.instructions.length);
+	}
+
+	/// Split the list back into instructions and label positions.
+	this.rebuild = function () {
+		var func = this.func;
+		func.instructions = [];
+		this.code.forEach(function (instruction) {
+			if (instruction.operator == LABEL) {
+				func.labels.place(instruction.operand, func.instructions.length);
+			} else {
+				func.instructions.push(instruction);
+			}
+		});
+	}
+
+	this.isJump = function (instruction) {
+		return instruction.operator == "JMP" || JumpCondition[instruction.operator] !== undefined;
+	}
+
+	/// The labels an instruction can jump to.
+	this.jumpLabels = function (instruction) {
+		if (this.isJump(instruction)) {
+			return [instruction.operand];
+		}
+		if (instruction.operator == "TABLE_SWITCH") {
+			return instruction.operand.labels.concat([instruction.operand.defaultLabel]);
+		}
+		return [];
+	}
+
+	this.isConstant = function (instruction) {
+		return instruction && instruction.operator == "INT_PUSH_CONSTANT";
+	}
+
+	/// The value of an INT_PUSH_CONSTANT. Unset operands are zero.
+	this.constant = function (instruction) {
+		return instruction.operand || 0;
+	}
+
+	/// Replace count instructions at index with the replacements.
+	this.replace = function (index, count, replacements) {
+		Array.prototype.splice.apply(this.code, [index, count].concat(replacements));
+	}
+
+	/// The index of the first instruction after a label.
+	this.target = function (label) {
+		for (var i = 0; i < this.code.length; i++) {
+			if (this.code[i].operator == LABEL && this.code[i].operand == label) {
+				while (this.code[i].operator == LABEL) {
+					i++;
+				}
+				return i;
+			}
+		}
+		throw "Jump to unplaced label " + label;
+	}
+
+	/// `c1 c2 op` becomes the result, `c !` and `c neg` become constants, and `x 0 +` becomes `x`.
+	this.foldConstants = function () {
+		var changed = false;
+		var code = this.code;
+		for (var i = 0; i < code.length; i++) {
+			var a = code[i], b = code[i + 1], op = code[i + 2];
+			if (this.isConstant(a) && this.isConstant(b) && op && IntegerOperation[op.operator]) {
+				var value = IntegerOperation[op.operator](this.constant(a), this.constant(b));
+				if (value !== undefined && value >= MIN_IMMEDIATE && value <= MAX_IMMEDIATE) {
+					this.replace(i, 3, [new Instruction("INT_PUSH_CONSTANT", value)]);
+					changed = true;
+					i = Math.max(i - 2, -1);
+					continue;
+				}
+			}
+			if (this.isConstant(a) && b && b.operator == "INT_NOT") {
+				this.replace(i, 2, [new Instruction("INT_PUSH_CONSTANT", this.constant(a) == 0 ? 1 : 0)]);
+				changed = true;
+				i = Math.max(i - 2, -1);
+				continue;
+			}
+			if (this.isConstant(a) && b && b.operator == "INT_NEG" && 0 - this.constant(a) <= MAX_IMMEDIATE) {
+				this.replace(i, 2, [new Instruction("INT_PUSH_CONSTANT", 0 - this.constant(a))]);
+				changed = true;
+				i = Math.max(i - 2, -1);
+				continue;
+			}
+			if (this.isConstant(a) && b) {
+				var c = this.constant(a);
+				var identity = (c == 0 && (b.operator == "INT_ADD" || b.operator == "INT_SUB" ||
+						b.operator == "INT_OR" || b.operator == "INT_XOR" ||
+						b.operator == "INT_SHL" || b.operator == "INT_SHR")) ||
+					(c == 1 && (b.operator == "INT_MUL" || b.operator == "INT_DIV"));
+				if (identity) {
+					this.replace(i, 2, []);
+					changed = true;
+					i = Math.max(i - 3, -1);
+				}
+			}
+		}
+		return changed;
+	}
+
+	/// A conditional jump on two constants is either always or never taken, and a
+	/// switch on a constant always takes the same case.
+	this.foldBranches = function () {
+		var changed = false;
+		var code = this.code;
+		for (var i = 0; i + 2 < code.length; i++) {
+			var a = code[i], b = code[i + 1], jump = code[i + 2];
+			if (this.isConstant(a) && this.isConstant(b) && JumpCondition[jump.operator]) {
+				var taken = JumpCondition[jump.operator](this.constant(a), this.constant(b));
+				this.replace(i, 3, taken ? [new Instruction("JMP", jump.operand)] : []);
+				changed = true;
+			}
+			if (this.isConstant(a) && b.operator == "TABLE_SWITCH") {
+				var jumpSwitch = b.operand;
+				var label = jumpSwitch.labels[this.constant(a) - jumpSwitch.low];
+				this.replace(i, 2, [new Instruction("JMP", label !== undefined ? label : jumpSwitch.defaultLabel)]);
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	/// Retarget jumps to unconditional jumps, remove jumps to the next instruction,
+	/// and turn `jcc L; jmp M; L:` into `j!cc M; L:`.
+	this.threadJumps = function () {
+		var changed = false;
+		var code = this.code;
+		for (var i = 0; i < code.length; i++) {
+			var jump = code[i];
+			if (!this.isJump(jump)) {
+				continue;
+			}
+
+			// Follow the chain, stopping at a cycle.
+			var seen = {};
+			var target = this.target(jump.operand);
+			seen[jump.operand] = true;
+			while (code[target].operator == "JMP" && !seen[code[target].operand]) {
+				jump.operand = code[target].operand;
+				seen[jump.operand] = true;
+				target = this.target(jump.operand);
+				changed = true;
+			}
+
+			var next = i + 1;
+			while (next < code.length && code[next].operator == LABEL) {
+				next++;
+			}
+			if (target == next) {
+				// Conditional jumps still have to pop their operands.
+				this.replace(i, 1, jump.operator == "JMP" ? [] : [new Instruction("DROP"), new Instruction("DROP")]);
+				changed = true;
+				continue;
+			}
+
+			var following = code[i + 1];
+			// Only jumps with an exact inverse can be flipped.
+			if (InvertedJump[jump.operator] && following && following.operator == "JMP" &&
+				code[i + 2] && code[i + 2].operator == LABEL && this.target(jump.operand) == this.target(code[i + 2].operand)) {
+				jump.operator = InvertedJump[jump.operator];
+				jump.operand = following.operand;
+				this.replace(i + 1, 1, []);
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	/// Remove instructions that can't be reached from the start of the function.
+	this.removeUnreachable = function () {
+		var code = this.code;
+		var reachable = [];
+		var work = [0];
+		var labelIndex = {};
+		code.forEach(function (instruction, index) {
+			if (instruction.operator == LABEL) {
+				labelIndex[instruction.operand] = index;
+			}
+		});
+		while (work.length != 0) {
+			var i = work.pop();
+			while (i < code.length && !reachable[i]) {
+				reachable[i] = true;
+				var instruction = code[i];
+				this.jumpLabels(instruction).forEach(function (label) {
+					work.push(labelIndex[label]);
+				});
+				if (instruction.operator == "JMP" || instruction.operator == "TABLE_SWITCH" ||
+					instruction.returns()) {
+					break;
+				}
+				i++;
+			}
+		}
+		var kept = code.filter(function (instruction, index) {
+			return reachable[index] || instruction.operator == "END_SECTION";
+		});
+		var changed = kept.length != code.length;
+		this.code = kept;
+		return changed;
+	}
+
+	this.removeUnusedLabels = function () {
+		var used = {};
+		var me = this;
+		this.code.forEach(function (instruction) {
+			me.jumpLabels(instruction).forEach(function (label) {
+				used[label] = true;
+			});
+		});
+		var kept = this.code.filter(function (instruction) {
+			return instruction.operator != LABEL || used[instruction.operand];
+		});
+		var changed = kept.length != this.code.length;
+		this.code = kept;
+		return changed;
+	}
+
+	/// A local that is never read doesn't need to be stored.
+	this.removeDeadStores = function () {
+		var read = {};
+		this.code.forEach(function (instruction) {
+			if (instruction.operator == "PUSH_FROM_LOCAL") {
+				read[instruction.operand || 0] = true;
+			}
+		});
+		var changed = false;
+		this.code.forEach(function (instruction) {
+			if (instruction.operator == "POP_INTO_LOCAL" && !read[instruction.operand || 0]) {
+				instruction.operator = "DROP";
+				instruction.operand = undefined;
+				changed = true;
+			}
+		});
+		return changed;
+	}
+
+	/// Remove values that are pushed only to be dropped: `push; drop`, `dup; drop`,
+	/// and `dup; pop_into_x; drop`, which is `pop_into_x`.
+	this.removeDeadValues = function () {
+		var changed = false;
+		var code = this.code;
+		for (var i = 0; i + 1 < code.length; i++) {
+			var a = code[i], b = code[i + 1], c = code[i + 2];
+			if (b.operator == "DROP" && (PurePush[a.operator] || a.operator == "DUPLICATE")) {
+				this.replace(i, 2, []);
+			} else if (a.operator == "DUPLICATE" && c && c.operator == "DROP" &&
+				(b.operator == "POP_INTO_LOCAL" || b.operator == "POP_INTO_PARAM")) {
+				this.replace(i, 3, [b]);
+			} else {
+				continue;
+			}
+			changed = true;
+			i = Math.max(i - 2, -1);
+		}
+		return changed;
+	}
+
+	/// Number the locals that are still used densely, and size the frame to fit.
+	this.renumberLocals = function () {
+		var numbering = {};
+		var next = 0;
+		this.code.forEach(function (instruction) {
+			if (instruction.operator == "PUSH_FROM_LOCAL" || instruction.operator == "POP_INTO_LOCAL") {
+				var local = instruction.operand || 0;
+				if (numbering[local] === undefined) {
+					numbering[local] = next++;
+				}
+				instruction.operand = numbering[local];
+			}
+		});
+		this.func.nlocals = next;
+	}
 };
 
 function FirstPassCodeGen() {
@@ -370,12 +973,16 @@ function FirstPassCodeGen() {
 	this.functionContext = new FunctionContext(this.globalContext);
 	this.module = undefined;
 	this.func = undefined;
+	this.doubleVars = {};     // by function name, the variables that hold doubles
+	this.doubleReturns = {};  // the functions that return doubles
 
 	this.compile = function (syntax) {
 		this.module = new Module();
 		var func = new FunctionDefinition(null, "<script>", 0); // top level
 		this.module.functions.push(func);
 		this.augmentAST(syntax);
+		this.inferDoubles(syntax);
+		func.doubleVars = this.doubleVars[func.name];
 		this.functionContext.enterFunction(syntax.functionEntry);
 		this.handleBody(func, syntax.body);
 		func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 0));
@@ -404,6 +1011,20 @@ function FirstPassCodeGen() {
 			var node = work.todo.shift();
 
 			switch (node.type) {
+				case "ImportDeclaration":
+					var module = this.module;
+					node.specifiers.forEach(function (specifier) {
+						func.defineImport(specifier.local.name, module.imports.length);
+						module.imports.push(specifier.imported.name);
+					});
+					break;
+				case "ExportNamedDeclaration":
+					if (!node.declaration || node.declaration.type != "FunctionDeclaration") {
+						throw new Error("Only function declarations can be exported");
+					}
+					this.module.exports.push(node.declaration.id.name);
+					work.todo.unshift(node.declaration);
+					break;
 				case "ForStatement":
 					node.init.functionEntry = func;
 					if (node.init.type == "VariableDeclaration"){
@@ -416,6 +1037,13 @@ function FirstPassCodeGen() {
 					work = { todo: Object.assign([], node.body), func: func};
 					stack.push(work);
 					break;
+				case "SwitchStatement":
+					work = { todo: [], func: func };
+					node.cases.forEach(function (c) {
+						work.todo = work.todo.concat(c.consequent);
+					});
+					stack.push(work);
+					break;
 				case "WhileStatement":
 					node.body.functionEntry = func;
 					work = { todo: Object.assign([], node.body), func: func};
@@ -485,7 +1113,17 @@ function FirstPassCodeGen() {
 
 	this.emitPushConstant = function (func, constant) {
 		if (this.isNumber(constant)) {
-			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", constant));
+			if (constant < -0x800000000000 || constant > 0x7FFFFFFFFFFF) {
+				throw "Integer constant out of range: " + constant;
+			}
+			if (constant < -0x800000 || constant > 0x7FFFFF) {
+				// Too wide for an operand, so it goes in the constant pool.
+				var index = this.module.integerIndex(constant);
+				func.instructions.push(new Instruction("INT_PUSH_CONSTANT_WIDE", index));
+			}
+			else {
+				func.instructions.push(new Instruction("INT_PUSH_CONSTANT", constant));
+			}
 		}
 		else if (this.isString(constant)) {
 			var id = this.module.strings.get(constant);
@@ -539,11 +1177,18 @@ function FirstPassCodeGen() {
 			inner.params.get(param.name);
 		});
 		inner.nparams = declaration.params.length;
+		inner.doubleVars = this.doubleVars[inner.name];
+		inner.returnsDouble = this.doubleReturns[inner.name] === true;
+		this.emitParamConversions(inner, declaration.params);
 		this.handle(inner, declaration.body);
 
 		/// this discards the result of the last expression
-		if (inner.instructions[inner.instructions.length - 1].operator != "FUNCTION_RETURN") {
-			inner.instructions.push(new Instruction("INT_PUSH_CONSTANT", 0));
+		if (!inner.lastInstruction().returns()) {
+			if (inner.returnsDouble) {
+				this.emitPushDouble(inner, 0);
+			} else {
+				inner.instructions.push(new Instruction("INT_PUSH_CONSTANT", 0));
+			}
 			inner.instructions.push(new Instruction("FUNCTION_RETURN", 0));
 		}
 
@@ -556,20 +1201,26 @@ function FirstPassCodeGen() {
 			"+=": "INT_ADD",
 			"-=": "INT_SUB",
 			"/=": "INT_DIV",
-			"*=": "INT_MUL"
+			"*=": "INT_MUL",
+			"%=": "INT_MOD",
+			"&=": "INT_AND",
+			"|=": "INT_OR",
+			"^=": "INT_XOR",
+			"<<=": "INT_SHL",
+			">>=": "INT_SHR"
 		});
 
 		if (expression.left.type == "Identifier") {
 			var operator = AssignmentOperatorCode[expression.operator];
 			if (operator) {
-				this.handle(func, expression.left); // extra left
-				this.handle(func, expression.right);
-				func.instructions.push(new Instruction(operator, 0));
+				this.emitArithmetic(func, operator, expression.left, expression.right); // extra left
 			} else {
 				expression.right.needResult = true;
-				this.handle(func, expression.right);
+				this.emitValue(func, expression.right, this.isDoubleVar(func, expression.left.name));
+			}
+			if (!expression.discardResult) {
+				func.instructions.push(new Instruction("DUPLICATE"));
 			}
-			func.instructions.push(new Instruction("DUPLICATE"));
 			this.emitPopIntoVar(func, expression.left.name);
 
 			if (expression.isParameter == true) {
@@ -577,7 +1228,27 @@ function FirstPassCodeGen() {
 			}
 			return;
 		}
+		if (this.isElement(expression.left)) {
+			var operator = AssignmentOperatorCode[expression.operator];
+			this.handle(func, expression.left.object);
+			this.handle(func, expression.left.property);
+			if (operator) {
+				this.emitReloadElement(func, expression.left);
+				this.handle(func, expression.right);
+				func.instructions.push(new Instruction(operator, 0));
+			} else {
+				this.handle(func, expression.right);
+			}
+			func.instructions.push(new Instruction("INT_ARRAY_STORE"));
+			if (!expression.discardResult) {
+				this.emitReloadElement(func, expression.left);
+			}
+			return;
+		}
 		this.handle(func, expression.right);
+		if (expression.discardResult) {
+			func.instructions.push(new Instruction("DROP"));
+		}
 	};
 
 	this.handleVariableDeclaration = function (func, declaration) {
@@ -587,15 +1258,30 @@ function FirstPassCodeGen() {
 
 	this.handleVariableDeclarator = function (func, declarator) {
 		var id = func.locals.get(declarator.id.name);
+		var isDouble = this.isDoubleVar(func, declarator.id.name);
 		if (declarator.init) {
-			this.handle(func, declarator.init);
+			this.emitValue(func, declarator.init, isDouble);
+			this.emitPopIntoVar(func, declarator.id.name);
+		} else if (isDouble) {
+			this.emitPushDouble(func, 0);
 			this.emitPopIntoVar(func, declarator.id.name);
 		}
 	};
 
 	this.handleExpressionStatement = function (func, statement) {
-		this.handle(func, statement.expression);
-		func.instructions.push(new Instruction("DROP"));
+		this.emitDiscarded(func, statement.expression);
+	};
+
+	/// Evaluate an expression for its side effects. Assignments and updates don't
+	/// keep their result, rather than pushing it only to drop it.
+	this.emitDiscarded = function (func, expression) {
+		if (expression.type == "AssignmentExpression" || expression.type == "UpdateExpression") {
+			expression.discardResult = true;
+			this.handle(func, expression);
+		} else {
+			this.handle(func, expression);
+			func.instructions.push(new Instruction("DROP"));
+		}
 	};
 
 	// Iterate expressions array
@@ -615,8 +1301,19 @@ function FirstPassCodeGen() {
 	};
 
 	this.handleUnaryExpression = function (func, decl) {
+		if (decl.operator == "-" && this.isDoubleLiteral(decl.argument)) {
+			this.emitPushDouble(func, - decl.argument.value);
+			return;
+		}
+		if (decl.operator == "-" && this.isDouble(func, decl.argument)) {
+			// -x is x * -1, so that -0 comes out right.
+			this.handle(func, decl.argument);
+			this.emitPushDouble(func, -1);
+			func.instructions.push(new Instruction("DBL_MUL"));
+			return;
+		}
 		if (decl.operator == "-" && decl.argument.type == "Literal") {
-			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", - decl.argument.value));
+			this.emitPushConstant(func, - decl.argument.value);
 			// this.currentFunction.updateStackCount(1);
 			return;
 		}
@@ -625,10 +1322,14 @@ function FirstPassCodeGen() {
 			return;
 		}
 		if (decl.operator == "-") {
-			this.pushconstant(0);
-			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 0));
 			this.handle(func, decl.argument);
-			func.instructions.push(new Instruction("INT_SUB"));
+			func.instructions.push(new Instruction("INT_NEG"));
+			return;
+		}
+		if (decl.operator == "~") {
+			this.handle(func, decl.argument);
+			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", -1));
+			func.instructions.push(new Instruction("INT_XOR"));
 			return;
 		}
 		if (decl.operator == "!") {
@@ -641,19 +1342,9 @@ function FirstPassCodeGen() {
 
 
 	this.handleBinaryExpression = function (func, decl) {
-		this.handle(func, decl.left);
-		this.handle(func, decl.right);
-		if (decl.operator == "-") {
-			func.instructions.push(new Instruction("INT_SUB"));
-		}
-		else if (decl.operator == "+") {
-			func.instructions.push(new Instruction("INT_ADD"));
-		}
-		else if (decl.operator == "*") {
-			func.instructions.push(new Instruction("INT_MUL"));
-		}
-		else if (decl.operator == "/") {
-			func.instructions.push(new Instruction("INT_DIV"));
+		var operator = ArithmeticOperator[decl.operator];
+		if (operator) {
+			this.emitArithmetic(func, operator, decl.left, decl.right);
 		}
 		else {
 			// TODO: Support comparison operators.
@@ -669,34 +1360,104 @@ function FirstPassCodeGen() {
 	}
 
 	this.handleUpdateExpression = function (func, expression) {
+		if (this.isElement(expression.argument)) {
+			this.emitUpdateElement(func, expression);
+			return;
+		}
 		if (expression.argument.type != "Identifier") {
 			throw Error("Invalid target of update expression");
 		}
 
 		this.emitPushFromVar(func, expression.argument.name);
 		// postfix operator leaves the original value on the stack
-		if (!expression.prefix) {
+		if (!expression.prefix && !expression.discardResult) {
 			func.instructions.push(new Instruction("DUPLICATE"));
 		}
-		func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 1));
-		func.instructions.push(new Instruction(UpdateOperator[expression.operator]));
+		if (this.isDoubleVar(func, expression.argument.name)) {
+			this.emitPushDouble(func, 1);
+			func.instructions.push(new Instruction(DoubleOperator[UpdateOperator[expression.operator]]));
+		} else {
+			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 1));
+			func.instructions.push(new Instruction(UpdateOperator[expression.operator]));
+		}
 		// prefix leaves the new value on the stack.
-		if (expression.prefix) {
-			func.instructions.push(new Instruction("DUP"));
+		if (expression.prefix && !expression.discardResult) {
+			func.instructions.push(new Instruction("DUPLICATE"));
 		}
 		this.emitPopIntoVar(func, expression.argument.name);
 	};
 
+	/// `a[i] op= 1`. The result is the element read back, undone for postfix.
+	this.emitUpdateElement = function (func, expression) {
+		var element = expression.argument;
+		var operator = UpdateOperator[expression.operator];
+		this.handle(func, element.object);
+		this.handle(func, element.property);
+		this.emitReloadElement(func, element);
+		func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 1));
+		func.instructions.push(new Instruction(operator));
+		func.instructions.push(new Instruction("INT_ARRAY_STORE"));
+		if (!expression.discardResult) {
+			this.emitReloadElement(func, element);
+			if (!expression.prefix) {
+				func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 1));
+				func.instructions.push(new Instruction(operator == "INT_ADD" ? "INT_SUB" : "INT_ADD"));
+			}
+		}
+	};
+
+	/// An array element, `a[i]`.
+	this.isElement = function (node) {
+		return node.type == "MemberExpression" && node.computed;
+	};
+
+	/// Read an element again. The array and index are evaluated twice, so they must
+	/// be free of side effects.
+	this.emitReloadElement = function (func, element) {
+		[element.object, element.property].forEach(function (node) {
+			if (node.type != "Identifier" && node.type != "Literal") {
+				throw Error("Array and index must be variables or constants here");
+			}
+		});
+		this.handle(func, element.object);
+		this.handle(func, element.property);
+		func.instructions.push(new Instruction("INT_ARRAY_LOAD"));
+	};
+
+	/// `a[i]` loads an element, and `a.length` is the length of an array.
+	this.handleMemberExpression = function (func, expression) {
+		this.handle(func, expression.object);
+		if (expression.computed) {
+			this.handle(func, expression.property);
+			func.instructions.push(new Instruction("INT_ARRAY_LOAD"));
+		} else if (expression.property.name == "length") {
+			func.instructions.push(new Instruction("ARRAY_LENGTH"));
+		} else {
+			throw Error("Unsupported property: " + expression.property.name);
+		}
+	};
+
+	/// `new Array(n)` is an int array of n zeros.
+	this.handleNewExpression = function (func, expression) {
+		if (expression.callee.type != "Identifier" || expression.callee.name != "Array" ||
+			expression.arguments.length != 1) {
+			throw Error("Only new Array(length) is supported");
+		}
+		this.handle(func, expression.arguments[0]);
+		func.instructions.push(new Instruction("NEW_INT_ARRAY"));
+	};
+
 	this.handleForStatement = function (func, statement) {
 		this.handle(func, statement.init);
 		var testLabel = func.labels.create();
 		var exitLabel = func.labels.create();
 		func.placeLabel(testLabel);
-		var comparator = this.emitTest(func, statement.test);
-		func.instructions.push(new Instruction(NegJumpOperator[comparator], exitLabel));
+		var jump = this.emitTest(func, statement.test);
+		this.emitJumpUnless(func, jump, exitLabel);
+		func.breakLabels.push(exitLabel);
 		this.handle(func, statement.body);
-		this.handle(func, statement.update);
-		func.instructions.push(new Instruction("DROP"));
+		func.breakLabels.pop();
+		this.emitDiscarded(func, statement.update);
 		func.instructions.push(new Instruction("JMP", testLabel));
 		func.placeLabel(exitLabel);
 	};
@@ -704,6 +1465,12 @@ function FirstPassCodeGen() {
 	this.handleCallExpression = function (func, expression) {
 		// Set up arguments for call
 
+		if (this.isMathTrunc(expression.callee) && expression.arguments.length == 1) {
+			this.handle(func, expression.arguments[0]);
+			func.instructions.push(new Instruction("DBL_TO_INT"));
+			return;
+		}
+
 		if (expression.callee.type != "Identifier") {
 			throw "Only handles named functions";
 		}
@@ -722,8 +1489,15 @@ function FirstPassCodeGen() {
 	}
 
 	this.handleReturnStatement = function (func, decl) {
+		if (decl.argument && this.isTailCall(func, decl.argument)) {
+			this.emitFunctionCall(func, decl.argument, true);
+			return;
+		}
 		if (decl.argument) {
-			this.handle(func, decl.argument);
+			this.emitValue(func, decl.argument, func.returnsDouble);
+		}
+		else if (func.returnsDouble) {
+			this.emitPushDouble(func, 0);
 		}
 		else {
 			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 0));
@@ -732,17 +1506,43 @@ function FirstPassCodeGen() {
 		func.instructions.push(new Instruction("FUNCTION_RETURN"));
 	};
 
-	this.emitFunctionCall = function (func, expression) {
+	/// A call whose result is returned as it is can reuse the caller's frame.
+	/// Primitives are called differently, and results that need converting to
+	/// a double still have work to do after the call.
+	this.isTailCall = function (func, expression) {
+		if (expression.type != "CallExpression" || expression.callee.type != "Identifier" ||
+			expression.callee.name == "b9_primitive") {
+			return false;
+		}
 		var symbol = this.functionContext.lookup(expression.callee.name);
-		if (symbol.type != "function") throw Error("Target not a direct function call: " + JSON.stringify(symbol));
+		return symbol !== undefined && (symbol.type == "function" || symbol.type == "import") &&
+			this.isDouble(func, expression) == (func.returnsDouble === true);
+	}
+
+	this.emitFunctionCall = function (func, expression, tail) {
+		var symbol = this.functionContext.lookup(expression.callee.name);
+		var target = undefined;
+		if (symbol.type == "function") {
+			target = symbol.id;
+		} else if (symbol.type == "import") {
+			// resolved to a function index when the module is resolved.
+			target = { importIndex: symbol.id };
+		} else {
+			throw Error("Target not a direct function call: " + JSON.stringify(symbol));
+		}
 		this.handleBody(func, expression.arguments);
-		func.instructions.push(new Instruction("FUNCTION_CALL", symbol.id));
+		func.instructions.push(new Instruction(tail ? "TAIL_CALL" : "FUNCTION_CALL", target));
 	}
 
 	this.emitPrimitiveCall = function (func, expression) {
 		/// The first argument is a "phantom" argument that tells us the primitive code.
-		/// It's not compiled as an expression.
-		var code = PrimitiveCode[expression.arguments[0].value];
+		/// It's not compiled as an expression. Primitives registered by the embedder
+		/// are called by their index.
+		var primitive = expression.arguments[0].value;
+		var code = typeof primitive == "number" ? primitive : PrimitiveCode[primitive];
+		if (code === undefined) {
+			throw "Unknown primitive: " + primitive;
+		}
 
 		var params = expression.arguments.slice(1);
 		params.forEach(function (element) {
@@ -753,6 +1553,180 @@ function FirstPassCodeGen() {
 		return true;
 	};
 
+	/* DOUBLES */
+
+	/// Numbers are ints unless they are known to be doubles: literals written with
+	/// a point or exponent, variables that hold doubles, calls to functions that
+	/// return them, and arithmetic with a double operand. Anything else, such as an
+	/// array element, is taken to be an int. Add 0.0 to use one as a double.
+	this.isDouble = function (func, node) {
+		switch (node.type) {
+			case "Literal":
+				return this.isDoubleLiteral(node);
+			case "Identifier":
+				return this.isDoubleVar(func, node.name);
+			case "BinaryExpression":
+				return DoubleOperator[ArithmeticOperator[node.operator]] !== undefined &&
+					(this.isDouble(func, node.left) || this.isDouble(func, node.right));
+			case "UnaryExpression":
+				return (node.operator == "-" || node.operator == "+") && this.isDouble(func, node.argument);
+			case "CallExpression":
+				return node.callee.type == "Identifier" && this.doubleReturns[node.callee.name] === true;
+			case "AssignmentExpression":
+			case "UpdateExpression":
+				var target = node.left || node.argument;
+				return target.type == "Identifier" && this.isDoubleVar(func, target.name);
+			default:
+				return false;
+		}
+	}
+
+	this.isDoubleLiteral = function (node) {
+		return node.type == "Literal" && typeof node.value == "number" &&
+			(node.value % 1 != 0 || (!/^0[xXoObB]/.test(node.raw) && /[.eE]/.test(node.raw)));
+	}
+
+	this.isDoubleVar = function (func, name) {
+		return func.doubleVars !== undefined && func.doubleVars[name] === true;
+	}
+
+	this.isMathTrunc = function (callee) {
+		return callee.type == "MemberExpression" && !callee.computed &&
+			callee.object.type == "Identifier" && callee.object.name == "Math" &&
+			callee.property.name == "trunc";
+	}
+
+	/// Find the variables that hold doubles and the functions that return them, across
+	/// the whole program. A variable assigned a double anywhere always holds one, as does
+	/// a parameter passed one by any call, and a function returning a double anywhere
+	/// always returns one. This is repeated until nothing changes.
+	this.inferDoubles = function (syntax) {
+		var functions = {};
+		var collect = function (name, params, body) {
+			var info = { params: params, assignments: [], returns: [], calls: [] };
+			functions[name] = info;
+			var visit = function (node) {
+				if (!node || typeof node.type != "string") {
+					return;
+				}
+				switch (node.type) {
+					case "FunctionDeclaration":
+						collect(node.id.name, node.params, node.body);
+						return;
+					case "VariableDeclarator":
+						if (node.init) {
+							info.assignments.push({ name: node.id.name, value: node.init });
+						}
+						break;
+					case "AssignmentExpression":
+						if (node.left.type == "Identifier") {
+							info.assignments.push({ name: node.left.name, value: node.right });
+						}
+						break;
+					case "ReturnStatement":
+						if (node.argument) {
+							info.returns.push(node.argument);
+						}
+						break;
+					case "CallExpression":
+						if (node.callee.type == "Identifier") {
+							info.calls.push(node);
+						}
+						break;
+				}
+				Object.keys(node).forEach(function (key) {
+					var child = node[key];
+					if (Array.isArray(child)) {
+						child.forEach(visit);
+					} else if (child && typeof child == "object") {
+						visit(child);
+					}
+				});
+			};
+			visit(body);
+		};
+		collect("<script>", [], { type: "Program", body: syntax.body });
+
+		var me = this;
+		var changed = true;
+		var mark = function (vars, name) {
+			if (!vars[name]) {
+				vars[name] = true;
+				changed = true;
+			}
+		};
+		Object.keys(functions).forEach(function (name) {
+			me.doubleVars[name] = {};
+		});
+		while (changed) {
+			changed = false;
+			Object.keys(functions).forEach(function (name) {
+				var info = functions[name];
+				var func = { doubleVars: me.doubleVars[name] };
+				info.assignments.forEach(function (assignment) {
+					if (me.isDouble(func, assignment.value)) {
+						mark(func.doubleVars, assignment.name);
+					}
+				});
+				info.returns.forEach(function (value) {
+					if (me.isDouble(func, value)) {
+						mark(me.doubleReturns, name);
+					}
+				});
+				info.calls.forEach(function (call) {
+					var callee = functions[call.callee.name];
+					if (!callee) {
+						return;
+					}
+					call.arguments.forEach(function (argument, i) {
+						if (i < callee.params.length && me.isDouble(func, argument)) {
+							mark(me.doubleVars[call.callee.name], callee.params[i].name);
+						}
+					});
+				});
+			});
+		}
+	}
+
+	/// Callers may pass ints to a parameter that holds doubles.
+	this.emitParamConversions = function (func, params) {
+		var me = this;
+		params.forEach(function (param) {
+			if (me.isDoubleVar(func, param.name)) {
+				me.emitPushFromVar(func, param.name);
+				func.instructions.push(new Instruction("INT_TO_DBL"));
+				me.emitPopIntoVar(func, param.name);
+			}
+		});
+	}
+
+	this.emitPushDouble = function (func, value) {
+		func.instructions.push(new Instruction("DBL_PUSH_CONSTANT", this.module.doubleIndex(value)));
+	}
+
+	/// Push an expression, converted to a double when asked for one.
+	this.emitValue = function (func, node, asDouble) {
+		if (asDouble && node.type == "Literal" && this.isNumber(node.value)) {
+			this.emitPushDouble(func, node.value);
+			return;
+		}
+		this.handle(func, node);
+		if (asDouble && !this.isDouble(func, node)) {
+			func.instructions.push(new Instruction("INT_TO_DBL"));
+		}
+	}
+
+	/// `left op right`, on doubles if either is a double.
+	this.emitArithmetic = function (func, operator, left, right) {
+		var isDouble = this.isDouble(func, left) || this.isDouble(func, right);
+		if (isDouble && DoubleOperator[operator] === undefined) {
+			throw "Operator " + operator + " needs int operands";
+		}
+		this.emitValue(func, left, isDouble);
+		this.emitValue(func, right, isDouble);
+		func.instructions.push(new Instruction(isDouble ? DoubleOperator[operator] : operator));
+	}
+
 	/* HANDLE JUMPS AND LABELS */
 
 	this.isNumber = function isNumber(num) {
@@ -774,7 +1748,11 @@ function FirstPassCodeGen() {
 	};
 
 	this.handleLiteral = function (func, literal) {
-		this.emitPushConstant(func, literal.value);
+		if (this.isDoubleLiteral(literal)) {
+			this.emitPushDouble(func, literal.value);
+		} else {
+			this.emitPushConstant(func, literal.value);
+		}
 	}
 
 	this.handleIdentifier = function (func, identifier) {
@@ -782,35 +1760,53 @@ function FirstPassCodeGen() {
 	};
 
 	/// Emit a test statement.
-	/// The test statement returns the comparator 
+	/// Returns the jump to take when the test is true.
 	this.emitTest = function (func, test) {
-		var op = undefined;
-		if (test.type == "BinaryExpression") {
+		if (test.type == "BinaryExpression" && JumpOperator[test.operator]) {
 			// Binary expressions compile to specialized JMP operations
+			if (this.isDouble(func, test.left) || this.isDouble(func, test.right)) {
+				this.emitValue(func, test.left, true);
+				this.emitValue(func, test.right, true);
+				return "DBL_" + JumpOperator[test.operator];
+			}
 			this.handle(func, test.left);
 			this.handle(func, test.right);
-			op = test.operator;
-		} else {
-			// Unary expressions always compile to a comparison with false.
-			this.handle(func, test.body);
-			func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 0));
-			op = "==";
+			return JumpOperator[test.operator];
+		}
+		// Other expressions compile to a comparison with false.
+		this.handle(func, test);
+		if (this.isDouble(func, test)) {
+			this.emitPushDouble(func, 0);
+			return "DBL_JMP_NEQ";
 		}
-		return op;
+		func.instructions.push(new Instruction("INT_PUSH_CONSTANT", 0));
+		return "JMP_NEQ";
 	}
 
+	/// Emit a jump to label, taken when the test's jump would not be.
+	/// Jumps without an exact inverse jump over the jump to label instead.
+	this.emitJumpUnless = function (func, jump, label) {
+		if (InvertedJump[jump]) {
+			func.instructions.push(new Instruction(InvertedJump[jump], label));
+			return;
+		}
+		var takenLabel = func.labels.create();
+		func.instructions.push(new Instruction(jump, takenLabel));
+		func.instructions.push(new Instruction("JMP", label));
+		func.placeLabel(takenLabel);
+	};
+
 	this.handleIfStatement = function (func, statement) {
+		if (this.emitIfChain(func, statement)) {
+			return;
+		}
 		var alternateLabel = func.labels.create();
 		var endLabel = func.labels.create();
-		var comparator = this.emitTest(func, statement.test);
-		if (statement.alternate) {
-			func.instructions.push(new Instruction(NegJumpOperator[comparator], alternateLabel));
-		} else {
-			func.instructions.push(new Instruction(NegJumpOperator[comparator], endLabel));
-		}
+		var jump = this.emitTest(func, statement.test);
+		this.emitJumpUnless(func, jump, statement.alternate ? alternateLabel : endLabel);
 		this.handle(func, statement.consequent);
 		if (statement.alternate) {
-			if (func.lastInstruction().operator != "RETURN") {
+			if (!func.lastInstruction().returns()) {
 				func.instructions.push(new Instruction("JMP", endLabel));
 			}
 			func.placeLabel(alternateLabel);
@@ -821,47 +1817,226 @@ function FirstPassCodeGen() {
 
 	this.handleEmptyStatement = function (func, statement) { };
 
+	/// Imports are bound when the AST is augmented, and emit no code.
+	this.handleImportDeclaration = function (func, declaration) { };
+
+	this.handleExportNamedDeclaration = function (func, declaration) {
+		this.handle(func, declaration.declaration);
+	};
+
 	this.handleWhileStatement = function (func, statement) {
 		var bodyLabel = func.createLabel();
 		var testLabel = func.createLabel();
+		var exitLabel = func.createLabel();
 		func.instructions.push(new Instruction("JMP", testLabel));
 		func.placeLabel(bodyLabel);
+		func.breakLabels.push(exitLabel);
 		this.handle(func, statement.body);
+		func.breakLabels.pop();
 		func.placeLabel(testLabel);
-		var comparator = this.emitTest(func, statement.test);
-		func.instructions.push(new Instruction(JumpOperator[comparator], bodyLabel));
+		func.instructions.push(new Instruction(this.emitTest(func, statement.test), bodyLabel));
+		func.placeLabel(exitLabel);
+	};
+
+	this.handleBreakStatement = function (func, statement) {
+		if (statement.label) {
+			throw "Labeled break is not supported";
+		}
+		if (func.breakLabels.length == 0) {
+			throw "break outside of a loop or switch";
+		}
+		func.instructions.push(new Instruction("JMP", func.breakLabels[func.breakLabels.length - 1]));
+	};
+
+	/* SWITCHES */
+
+	/// A switch on at least this many cases uses a jump table, if the table is dense enough.
+	var MIN_TABLE_CASES = 4;
+
+	/// The int value of a case test, or undefined if it isn't an int literal.
+	this.caseValue = function (test) {
+		var negative = test.type == "UnaryExpression" && test.operator == "-";
+		var literal = negative ? test.argument : test;
+		if (literal.type != "Literal" || !Number.isInteger(literal.value) || this.isDoubleLiteral(literal)) {
+			return undefined;
+		}
+		var value = negative ? -literal.value : literal.value;
+		return value >= -0x80000000 && value <= 0x7FFFFFFF ? value : undefined;
+	}
+
+	/// Whether case values are many enough, and dense enough, for a jump table. At
+	/// least half of the table has to be cases.
+	this.fitsTable = function (values) {
+		var allInts = values.every(function (value) { return value !== undefined; });
+		if (!allInts || values.length < MIN_TABLE_CASES) {
+			return false;
+		}
+		var size = Math.max.apply(null, values) - Math.min.apply(null, values) + 1;
+		return size <= 2 * values.length;
+	}
+
+	/// Pop an int and jump to the label of the case it equals, or to the default label.
+	/// The first of several equal values wins.
+	this.emitTableSwitch = function (func, values, labels, defaultLabel) {
+		var low = Math.min.apply(null, values);
+		var size = Math.max.apply(null, values) - low + 1;
+		var tableLabels = [];
+		for (var i = 0; i < size; i++) {
+			tableLabels.push(defaultLabel);
+		}
+		for (var i = values.length - 1; i >= 0; i--) {
+			tableLabels[values[i] - low] = labels[i];
+		}
+		func.instructions.push(new Instruction("TABLE_SWITCH",
+			{ low: low, labels: tableLabels, defaultLabel: defaultLabel }));
+	}
+
+	/// Dense int cases use a jump table. Otherwise each case is compared in turn,
+	/// with the value kept on the stack until a case matches.
+	this.handleSwitchStatement = function (func, statement) {
+		var me = this;
+		if (this.isDouble(func, statement.discriminant)) {
+			throw "switch on a double is not supported";
+		}
+		var endLabel = func.createLabel();
+		var defaultLabel = endLabel;
+		var values = [], valueLabels = [], tests = [];
+		var labels = statement.cases.map(function (c) {
+			var label = func.createLabel();
+			if (!c.test) {
+				defaultLabel = label;
+			} else {
+				tests.push(c.test);
+				values.push(me.caseValue(c.test));
+				valueLabels.push(label);
+			}
+			return label;
+		});
+
+		this.handle(func, statement.discriminant);
+		if (this.fitsTable(values)) {
+			this.emitTableSwitch(func, values, valueLabels, defaultLabel);
+		} else {
+			var matchLabels = tests.map(function (test) {
+				var matchLabel = func.createLabel();
+				func.instructions.push(new Instruction("DUPLICATE"));
+				me.handle(func, test);
+				func.instructions.push(new Instruction("JMP_EQ", matchLabel));
+				return matchLabel;
+			});
+			func.instructions.push(new Instruction("DROP"));
+			func.instructions.push(new Instruction("JMP", defaultLabel));
+			matchLabels.forEach(function (matchLabel, i) {
+				func.placeLabel(matchLabel);
+				func.instructions.push(new Instruction("DROP"));
+				func.instructions.push(new Instruction("JMP", valueLabels[i]));
+			});
+		}
+
+		func.breakLabels.push(endLabel);
+		statement.cases.forEach(function (c, i) {
+			func.placeLabel(labels[i]);
+			me.handleBody(func, c.consequent);
+		});
+		func.breakLabels.pop();
+		func.placeLabel(endLabel);
 	};
+
+	/// The cases of `if (x == c1) ... else if (x == c2) ... else ...`, for an int
+	/// variable x and int constants, as { name, values, consequents, alternate }.
+	/// Returns undefined if the statement isn't such a chain.
+	this.ifChain = function (func, statement) {
+		var chain = { name: undefined, values: [], consequents: [], alternate: null };
+		for (var s = statement; s; s = s.alternate) {
+			if (s.type != "IfStatement") {
+				chain.alternate = s;
+				break;
+			}
+			var test = s.test;
+			if (test.type != "BinaryExpression" || test.operator != "==") {
+				return undefined;
+			}
+			var variable = test.left.type == "Identifier" ? test.left : test.right;
+			var value = this.caseValue(variable == test.left ? test.right : test.left);
+			if (variable.type != "Identifier" || value === undefined ||
+				(chain.name !== undefined && variable.name != chain.name)) {
+				return undefined;
+			}
+			chain.name = variable.name;
+			chain.values.push(value);
+			chain.consequents.push(s.consequent);
+		}
+		if (this.isDoubleVar(func, chain.name)) {
+			return undefined;
+		}
+		return chain;
+	}
+
+	/// A long enough, dense if-chain on one variable is done as a switch. The
+	/// variable is read once, rather than once per test.
+	this.emitIfChain = function (func, statement) {
+		var chain = this.ifChain(func, statement);
+		if (!chain || !this.fitsTable(chain.values)) {
+			return false;
+		}
+		var endLabel = func.createLabel();
+		var alternateLabel = chain.alternate ? func.createLabel() : endLabel;
+		var labels = chain.values.map(function () { return func.createLabel(); });
+		this.emitPushFromVar(func, chain.name);
+		this.emitTableSwitch(func, chain.values, labels, alternateLabel);
+		var me = this;
+		chain.consequents.forEach(function (consequent, i) {
+			func.placeLabel(labels[i]);
+			me.handle(func, consequent);
+			if (!func.lastInstruction().returns()) {
+				func.instructions.push(new Instruction("JMP", endLabel));
+			}
+		});
+		if (chain.alternate) {
+			func.placeLabel(alternateLabel);
+			this.handle(func, chain.alternate);
+		}
+		func.placeLabel(endLabel);
+		return true;
+	}
 };
 
 /// Compile and output a complete module.
 /// Compilation happens in 3 phases:
 ///  1. Parse -- translate a JS program to a syntax tree.
 ///  2. Compile -- first pass compilation of the program to a module.
-///  3. resolve -- final stage of linking up unresolved reference in the input program.
-function compile(code, output) {
-	var syntax = esprima.parse(code);
+///  3. resolve -- optimize each function, and link up unresolved references in the input program.
+function compile(code, output, optimize) {
+	var syntax = esprima.parse(code, { sourceType: "module" });
 	var compiler = new FirstPassCodeGen();
 	var module = compiler.compile(syntax);
+	module.optimize = optimize;
 	module.resolve();
 	module.output(output);
 	return true;
 };
 
 function main() {
-	if (process.argv.length != 4) {
-		console.error("Usage: node.js compile.js <infile> <outfile>");
+	var args = process.argv.slice(2);
+	var optimize = true;
+	if (args[0] == "-O0") {
+		optimize = false;
+		args.shift();
+	}
+	if (args.length != 2) {
+		console.error("Usage: node.js compile.js [-O0] <infile> <outfile>");
 		process.exit(1);
 	}
 
-	inputPath = process.argv[2];
-	outputPath = process.argv[3];
+	inputPath = args[0];
+	outputPath = args[1];
 
 	var code = fs.readFileSync(__dirname + "/b9stdlib.js", 'utf-8');
 	code += fs.readFileSync(inputPath, 'utf-8');
 
 
 	output = fs.openSync(outputPath, "w");
-	compile(code, output);
+	compile(code, output, optimize);
 };
 
 main();
@@ -1,10 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <b9/ArrayKernels.hpp>
 #include <b9/ExecutionContext.hpp>
+#include <b9/HashMap.hpp>
+#include <b9/compiler/ArrayBounds.hpp>
 #include <b9/deserialize.hpp>
+#include <b9/snapshot.hpp>
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <sstream>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -40,7 +47,20 @@ const std::vector<const char*> TEST_NAMES = {
   "test_string_return_string",
   "test_while",
   "test_for_never_run_body",
-  "test_for_sum"
+  "test_for_sum",
+  "test_constant_folding",
+  "test_compound_assignment",
+  "test_while_constant",
+  "test_string_building",
+  "test_int_array",
+  "test_array_primitives",
+  "test_double",
+  "test_double_nan",
+  "test_wide_constant",
+  "test_bitwise",
+  "test_switch",
+  "test_tail_call",
+  "test_hash_map"
 };
 // clang-format on
 
@@ -53,10 +73,7 @@ class InterpreterTest : public ::testing::Test {
   virtual void SetUp() {
     auto moduleName = getenv("B9_TEST_MODULE");
     ASSERT_NE(moduleName, nullptr);
-
-    std::ifstream file(moduleName, std::ios_base::in | std::ios_base::binary);
-
-    module_ = b9::deserialize(file);
+    module_ = b9::deserializeFile(moduleName);
   }
 };
 
@@ -175,6 +192,170 @@ TEST(MyTest, haveAVariable) {
   EXPECT_EQ(r, Value(AS_INT48, 0xdead));
 }
 
+TEST(MyTest, functionHandle) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  for (int n = 0; n < 100; n++) {
+    std::vector<Instruction> i = {{OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::INT_PUSH_CONSTANT, n},
+                                  {OpCode::INT_ADD},
+                                  {OpCode::FUNCTION_RETURN},
+                                  END_SECTION};
+    m->functions.push_back(
+        b9::FunctionDef{"add_" + std::to_string(n), i, 1, 0});
+  }
+  vm.load(m);
+
+  EXPECT_EQ(vm.getFunctionIndex("add_42"), 42);
+  EXPECT_THROW(vm.getFunctionIndex("add_100"), FunctionNotFoundException);
+
+  auto handle = vm.getFunctionHandle("add_7");
+  EXPECT_EQ(handle.index, 7);
+  for (int n = 0; n < 10; n++) {
+    EXPECT_EQ(vm.run(handle, {{AS_INT48, n}}), Value(AS_INT48, n + 7));
+  }
+  EXPECT_EQ(vm.run("add_99", {{AS_INT48, 1}}), Value(AS_INT48, 100));
+}
+
+TEST(LinkTest, callImportedFunction) {
+  Config cfg;
+  b9::VirtualMachine vm{runtime, cfg};
+
+  auto lib = std::make_shared<Module>();
+  std::vector<Instruction> add = {{OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::PUSH_FROM_PARAM, 1},
+                                  {OpCode::INT_ADD},
+                                  {OpCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  std::vector<Instruction> greeting = {{OpCode::STR_PUSH_CONSTANT, 1},
+                                       {OpCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  lib->functions.push_back(b9::FunctionDef{"add", add, 2, 0});
+  lib->functions.push_back(b9::FunctionDef{"greeting", greeting, 0, 0});
+  lib->strings = {"unused", "hello"};
+  lib->exports = {"add", "greeting"};
+  vm.load(lib);
+
+  auto app = std::make_shared<Module>();
+  std::vector<Instruction> main = {{OpCode::INT_PUSH_CONSTANT, 40},
+                                   {OpCode::INT_PUSH_CONSTANT, 2},
+                                   {OpCode::FUNCTION_CALL, 1},  // import 0
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  app->functions.push_back(b9::FunctionDef{"main", main, 0, 0});
+  app->strings = {"hello"};
+  app->imports = {"add", "greeting"};
+  vm.load(app);
+
+  EXPECT_EQ(vm.getFunctionCount(), 3);
+  EXPECT_EQ(vm.getStringCount(), 2);  // "hello" is interned once
+  EXPECT_EQ(vm.run("main", {}), Value(AS_INT48, 42));
+  EXPECT_EQ(vm.run("add", {{AS_INT48, 1}, {AS_INT48, 2}}), Value(AS_INT48, 3));
+
+  auto string = vm.run("greeting", {});
+  ASSERT_TRUE(string.isUint48());
+  EXPECT_EQ(vm.getString(string.getUint48()), "hello");
+}
+
+TEST(LinkTest, unresolvedImport) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  m->imports = {"missing"};
+  EXPECT_THROW(vm.load(m), LinkException);
+
+  auto m2 = std::make_shared<Module>();
+  m2->exports = {"missing"};
+  EXPECT_THROW(vm.load(m2), LinkException);
+}
+
+std::shared_ptr<Module> makeReloadModule(Immediate answer) {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> main = {{OpCode::FUNCTION_CALL, 1},
+                                   {OpCode::INT_PUSH_CONSTANT, 1},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  std::vector<Instruction> answerFn = {{OpCode::INT_PUSH_CONSTANT, answer},
+                                       {OpCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  std::vector<Instruction> name = {{OpCode::STR_PUSH_CONSTANT, 0},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", main, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"answer", answerFn, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"name", name, 0, 0});
+  m->strings = {"b9"};
+  m->exports = {"answer"};
+  return m;
+}
+
+TEST(ReloadTest, keepUnchangedFunctions) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto v1 = makeReloadModule(41);
+  vm.load(v1);
+  auto oldMain = vm.getFunctionHandle("main");
+  auto name = vm.getFunctionIndex("name");
+  EXPECT_EQ(vm.run("main", {}), Value(AS_INT48, 42));
+
+  vm.reload(v1, makeReloadModule(99));
+  EXPECT_EQ(vm.run("main", {}), Value(AS_INT48, 100));
+  EXPECT_EQ(vm.run("answer", {}), Value(AS_INT48, 99));
+
+  // main calls a changed function, so it moved. name did not.
+  EXPECT_NE(vm.getFunctionIndex("main"), oldMain.index);
+  EXPECT_EQ(vm.getFunctionIndex("name"), name);
+  EXPECT_EQ(vm.getFunctionCount(), 5);
+
+  // Old handles keep running the old version.
+  EXPECT_EQ(vm.run(oldMain, {}), Value(AS_INT48, 42));
+
+  auto string = vm.run("name", {});
+  EXPECT_EQ(vm.getString(string.getUint48()), "b9");
+}
+
+TEST(ReloadTest, relinkImporters) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto lib = makeReloadModule(1);
+  vm.load(lib);
+
+  auto app = std::make_shared<Module>();
+  std::vector<Instruction> main = {{OpCode::FUNCTION_CALL, 1},  // import 0
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  app->functions.push_back(b9::FunctionDef{"run", main, 0, 0});
+  app->imports = {"answer"};
+  vm.load(app);
+  EXPECT_EQ(vm.run("run", {}), Value(AS_INT48, 1));
+
+  vm.reload(lib, makeReloadModule(2));
+  EXPECT_EQ(vm.run("run", {}), Value(AS_INT48, 2));
+  EXPECT_EQ(vm.module(), app);
+
+  auto broken = std::make_shared<Module>(*makeReloadModule(3));
+  broken->exports.clear();
+  EXPECT_THROW(vm.reload(lib, broken), LinkException);  // lib was replaced
+  EXPECT_THROW(vm.reload(vm.modules()[0]->module, broken), LinkException);
+  EXPECT_EQ(vm.run("run", {}), Value(AS_INT48, 2));
+}
+
+TEST(ReloadTest, compileChangedFunctionsInBackground) {
+  Config cfg;
+  cfg.jit = true;
+  b9::VirtualMachine vm{runtime, cfg};
+  auto v1 = makeReloadModule(41);
+  vm.load(v1);
+  vm.generateAllCode();
+  auto name = vm.getFunctionIndex("name");
+  auto nameCode = vm.getJitAddress(name);
+  ASSERT_NE(nameCode, nullptr);
+
+  vm.reload(v1, makeReloadModule(1));
+  vm.finishBackgroundCompilation();
+  EXPECT_EQ(vm.getJitAddress(name), nameCode);
+  EXPECT_NE(vm.getJitAddress(vm.getFunctionIndex("main")), nullptr);
+  EXPECT_EQ(vm.run("main", {}), Value(AS_INT48, 2));
+}
+
 TEST(ObjectTest, allocateSomething) {
   b9::VirtualMachine vm{runtime, {}};
   auto m = std::make_shared<Module>();
@@ -197,5 +378,1173 @@ TEST(ObjectTest, allocateSomething) {
   EXPECT_EQ(r, Value(AS_INT48, 0));
 }
 
+TEST(ObjectTest, allocateMany) {
+  // distinct(n) allocates n pairs of objects, and returns the number left
+  // when a pair is the same object: 0 if every object was new.
+  std::vector<Instruction> distinct = {{OpCode::PUSH_FROM_PARAM, 0},
+                                       {OpCode::INT_PUSH_CONSTANT, 0},
+                                       {OpCode::JMP_LE, 8},
+                                       {OpCode::NEW_OBJECT},
+                                       {OpCode::NEW_OBJECT},
+                                       {OpCode::JMP_EQ, 5},
+                                       {OpCode::PUSH_FROM_PARAM, 0},
+                                       {OpCode::INT_PUSH_CONSTANT, 1},
+                                       {OpCode::INT_SUB},
+                                       {OpCode::POP_INTO_PARAM, 0},
+                                       {OpCode::JMP, -11},
+                                       {OpCode::PUSH_FROM_PARAM, 0},
+                                       {OpCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"distinct", distinct, 1, 0});
+    vm.load(m);
+    if (jit) {
+      vm.generateAllCode();
+      EXPECT_NE(vm.getJitAddress(0), nullptr);
+    }
+    auto pairs = 320;
+    EXPECT_EQ(vm.run("distinct", {{AS_INT48, std::int64_t(pairs)}}),
+              Value(AS_INT48, 0));
+  }
+}
+
+TEST(ObjectTest, storeYoungIntoOld) {
+  // link(outer, inner) stores inner into outer, in compiled code if the JIT
+  // is on.
+  std::vector<Instruction> link = {{OpCode::PUSH_FROM_PARAM, 1},
+                                   {OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::POP_INTO_OBJECT, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 0},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  // The outer object survives two collections before inner is allocated, and
+  // after the store it is all that keeps inner alive.
+  std::vector<Instruction> main = {{OpCode::NEW_OBJECT},
+                                   {OpCode::POP_INTO_LOCAL, 0},
+                                   {OpCode::SYSTEM_COLLECT},
+                                   {OpCode::SYSTEM_COLLECT},
+                                   {OpCode::NEW_OBJECT},
+                                   {OpCode::POP_INTO_LOCAL, 1},
+                                   {OpCode::INT_PUSH_CONSTANT, 7},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::POP_INTO_OBJECT, 1},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_LOCAL, 1},
+                                   {OpCode::FUNCTION_CALL, 0},
+                                   {OpCode::POP_INTO_LOCAL, 1},
+                                   {OpCode::SYSTEM_COLLECT},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_OBJECT, 0},
+                                   {OpCode::PUSH_FROM_OBJECT, 1},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  for (auto policy : {GcPolicy::OPTTHRUPUT, GcPolicy::GENCON}) {
+    for (bool jit : {false, true}) {
+      Config cfg;
+      cfg.jit = jit;
+      cfg.gcPolicy = policy;
+      b9::VirtualMachine vm{runtime, cfg};
+      auto m = std::make_shared<Module>();
+      m->functions.push_back(b9::FunctionDef{"link", link, 2, 0});
+      m->functions.push_back(b9::FunctionDef{"main", main, 0, 2});
+      vm.load(m);
+      if (jit) {
+        vm.generateAllCode();
+        EXPECT_NE(vm.getJitAddress(0), nullptr);
+      }
+      EXPECT_EQ(vm.run("main", {}), Value(AS_INT48, 7));
+    }
+  }
+}
+
+TEST(GcConfigTest, passOptionsToOmr) {
+  Config cfg;
+  EXPECT_EQ(gcOptions(cfg), "-Xgcpolicy:optthruput -Xminf0.3 -Xmaxf0.6");
+
+  cfg.gcPolicy = GcPolicy::GENCON;
+  cfg.initialHeapSize = 4 << 20;
+  cfg.maxHeapSize = 64 << 20;
+  cfg.nurserySize = 1 << 20;
+  cfg.minHeapFree = 0.1;
+  cfg.maxHeapFree = 0.5;
+  EXPECT_EQ(gcOptions(cfg),
+            "-Xgcpolicy:gencon -Xms4194304 -Xmx67108864 -Xmn1048576 "
+            "-Xminf0.1 -Xmaxf0.5");
+
+  // The nursery size only applies to gencon.
+  cfg.gcPolicy = GcPolicy::OPTAVGPAUSE;
+  EXPECT_EQ(gcOptions(cfg),
+            "-Xgcpolicy:optavgpause -Xms4194304 -Xmx67108864 -Xminf0.1 "
+            "-Xmaxf0.5");
+
+  GcPolicy policy;
+  EXPECT_TRUE(parseGcPolicy("gencon", policy));
+  EXPECT_EQ(policy, GcPolicy::GENCON);
+  EXPECT_FALSE(parseGcPolicy("balanced", policy));
+}
+
+TEST(GcConfigTest, restoreEnvironment) {
+  Config cfg;
+  cfg.gcPolicy = GcPolicy::GENCON;
+  cfg.nurserySize = 1 << 20;
+
+  unsetenv("OMR_GC_OPTIONS");
+  { b9::VirtualMachine vm{runtime, cfg}; }
+  EXPECT_EQ(getenv("OMR_GC_OPTIONS"), nullptr);
+
+  setenv("OMR_GC_OPTIONS", "-Xgcpolicy:optthruput", 1);
+  { b9::VirtualMachine vm{runtime, cfg}; }
+  EXPECT_STREQ(getenv("OMR_GC_OPTIONS"), "-Xgcpolicy:optthruput");
+  unsetenv("OMR_GC_OPTIONS");
+}
+
+TEST(GcStatsTest, countCollections) {
+  std::vector<Instruction> collect = {{OpCode::NEW_OBJECT},
+                                      {OpCode::DROP},
+                                      {OpCode::SYSTEM_COLLECT},
+                                      {OpCode::SYSTEM_COLLECT},
+                                      {OpCode::INT_PUSH_CONSTANT, 0},
+                                      {OpCode::FUNCTION_RETURN},
+                                      END_SECTION};
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"collect", collect, 0, 0});
+  vm.load(m);
+  auto before = vm.gcStats();
+  vm.run("collect", {});
+  auto after = vm.gcStats();
+  EXPECT_EQ(after.globalCollections, before.globalCollections + 2);
+  EXPECT_EQ(after.pauses.count(), before.pauses.count() + 2);
+  EXPECT_GT(after.allocatedBytes, before.allocatedBytes);
+  EXPECT_LE(after.liveBytes, after.heapSize);
+}
+
+TEST(GcStatsTest, pauseHistogram) {
+  using std::chrono::microseconds;
+  PauseHistogram histogram;
+  EXPECT_EQ(histogram.percentile(0.5), microseconds(0));
+  for (auto us : {0, 1, 3, 3, 100}) {
+    histogram.record(microseconds(us));
+  }
+  EXPECT_EQ(histogram.count(), 5);
+  EXPECT_EQ(histogram.total(), microseconds(107));
+  EXPECT_EQ(histogram.max(), microseconds(100));
+  EXPECT_EQ(histogram.buckets()[0], 1);  // under 1us
+  EXPECT_EQ(histogram.buckets()[1], 1);  // [1, 2)
+  EXPECT_EQ(histogram.buckets()[2], 2);  // [2, 4)
+  EXPECT_EQ(histogram.buckets()[7], 1);  // [64, 128)
+  EXPECT_EQ(histogram.percentile(0.5), microseconds(4));
+  EXPECT_EQ(histogram.percentile(1), microseconds(128));
+
+  // The last bucket is bounded by the longest pause.
+  histogram.record(std::chrono::hours(1));
+  EXPECT_EQ(histogram.buckets()[PauseHistogram::BUCKETS - 1], 1);
+  EXPECT_EQ(histogram.percentile(1),
+            std::chrono::hours(1) + microseconds(1));
+}
+
+extern "C" Om::RawValue addInts(ExecutionContext *context, Om::RawValue a,
+                                Om::RawValue b) {
+  return Value(AS_INT48, Value(AS_RAW, a).getInt48() +
+                             Value(AS_RAW, b).getInt48())
+      .raw();
+}
+
+std::shared_ptr<Module> makePrimitiveModule(Immediate primitive) {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> main = {{OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 2},
+                                   {OpCode::PRIMITIVE_CALL, primitive},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", main, 1, 0});
+  return m;
+}
+
+TEST(PrimitiveTest, registerFastPrimitive) {
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    EXPECT_EQ(vm.getPrimitiveIndex("print_string"), 0);
+
+    PrimitiveSignature signature;
+    signature.params = {PrimitiveType::INT, PrimitiveType::INT};
+    signature.result = PrimitiveType::INT;
+    signature.pure = true;
+    signature.allocates = false;
+    auto index = vm.registerPrimitive(
+        "add_ints", reinterpret_cast<FastPrimitiveFunction>(addInts),
+        signature);
+    EXPECT_EQ(vm.getPrimitiveIndex("add_ints"), index);
+    EXPECT_TRUE(vm.getPrimitive(index).isFast());
+    EXPECT_THROW(vm.registerPrimitive("add_ints", b9_prim_print_number),
+                 std::invalid_argument);
+
+    vm.load(makePrimitiveModule(index));
+    if (jit) vm.generateAllCode();
+    EXPECT_EQ(vm.run("main", {{AS_INT48, 40}}), Value(AS_INT48, 42));
+    if (jit) {
+      EXPECT_DEATH(vm.run("main", {{AS_UINT48, 0}}), "add_ints");
+    } else {
+      EXPECT_THROW(vm.run("main", {{AS_UINT48, 0}}), std::runtime_error);
+    }
+  }
+}
+
+std::shared_ptr<StringOutputSink> testSink;
+std::string seenOutput;
+
+/// ( -- 0 ) Record what has reached the test sink so far.
+extern "C" void recordOutput(ExecutionContext *context) {
+  seenOutput = testSink->str();
+  context->push({AS_INT48, 0});
+}
+
+TEST(OutputTest, bufferAndFlush) {
+  b9::VirtualMachine vm{runtime, {}};
+  testSink = std::make_shared<StringOutputSink>();
+  vm.setOutput(testSink);
+  Immediate record = vm.registerPrimitive("record_output", recordOutput);
+  Immediate flush = vm.getPrimitiveIndex("flush_output");
+
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> main = {{OpCode::STR_PUSH_CONSTANT, 0},
+                                   {OpCode::PRIMITIVE_CALL, 0},
+                                   {OpCode::DROP},
+                                   {OpCode::INT_PUSH_CONSTANT, 7},
+                                   {OpCode::PRIMITIVE_CALL, 1},
+                                   {OpCode::DROP},
+                                   {OpCode::PRIMITIVE_CALL, record},
+                                   {OpCode::DROP},
+                                   {OpCode::PRIMITIVE_CALL, flush},
+                                   {OpCode::DROP},
+                                   {OpCode::PRIMITIVE_CALL, record},
+                                   {OpCode::DROP},
+                                   {OpCode::STR_PUSH_CONSTANT, 1},
+                                   {OpCode::PRIMITIVE_CALL, 0},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->strings = {"hello", "bye"};
+  m->functions.push_back(b9::FunctionDef{"main", main, 0, 0});
+  vm.load(m);
+
+  // Output is held until the flush, and the rest is written by run.
+  seenOutput = "";
+  vm.run("main", {});
+  EXPECT_EQ(seenOutput, "hello\n7\n");
+  EXPECT_EQ(testSink->str(), "hello\n7\nbye\n");
+  testSink = nullptr;
+}
+
+TEST(OutputTest, flushAtThreshold) {
+  StringOutputSink sink;
+  OutputBuffer buffer(sink);
+  const std::string stable = "stable";
+  buffer.appendStable(stable.data(), stable.size());
+  buffer.print(42);
+  EXPECT_EQ(buffer.pending(), 8);
+  EXPECT_EQ(sink.str(), "");
+  buffer.append(std::string(OutputBuffer::FLUSH_THRESHOLD, 'x'));
+  EXPECT_EQ(buffer.pending(), 0);
+  EXPECT_EQ(sink.str().substr(0, 9), "stable42x");
+  EXPECT_EQ(sink.str().size(), OutputBuffer::FLUSH_THRESHOLD + 8);
+}
+
+TEST(StringTableTest, internAndCompare) {
+  StringTable strings;
+  auto b = strings.intern("b");
+  auto a = strings.intern("a");
+  EXPECT_EQ(strings.intern("b"), b);
+  EXPECT_EQ(strings.size(), 2);
+  EXPECT_EQ(strings.get(a).length(), 1);
+  EXPECT_EQ(strings.get(a).hash, std::hash<std::string>{}("a"));
+
+  EXPECT_LT(strings.compare(a, b), 0);  // unranked, compared by content
+  strings.rank();
+  EXPECT_EQ(strings.get(a).rank, 0);
+  EXPECT_EQ(strings.get(b).rank, 1);
+  EXPECT_GT(strings.compare(b, a), 0);
+  EXPECT_EQ(strings.compare(a, a), 0);
+
+  auto c = strings.intern("aa");
+  EXPECT_EQ(strings.get(c).rank, InternedString::UNRANKED);
+  EXPECT_LT(strings.compare(a, c), 0);
+  EXPECT_LT(strings.compare(c, b), 0);
+}
+
+TEST(StringTableTest, releaseTemporaries) {
+  StringTable strings;
+  auto constant = strings.intern("constant");
+  auto temporary = strings.internTemporary("temporary");
+  auto kept = strings.internTemporary("kept");
+  EXPECT_EQ(strings.internTemporary("constant"), constant);
+  EXPECT_EQ(strings.internTemporary("temporary"), temporary);
+  strings.keep(kept);
+
+  strings.releaseTemporaries();
+  EXPECT_EQ(strings.get(kept).string, "kept");
+  EXPECT_EQ(strings.internTemporary("kept"), kept);
+  EXPECT_EQ(strings.internTemporary("other"), temporary);  // reused
+  EXPECT_EQ(strings.size(), 3);
+
+  // Only permanent strings are ranked, new ones merged into the order.
+  strings.rank();
+  EXPECT_EQ(strings.get(constant).rank, 0);
+  EXPECT_EQ(strings.get(kept).rank, 1);
+  EXPECT_EQ(strings.get(temporary).rank, InternedString::UNRANKED);
+  auto b = strings.intern("b");
+  strings.rank();
+  EXPECT_EQ(strings.get(b).rank, 0);
+  EXPECT_EQ(strings.get(constant).rank, 1);
+  EXPECT_EQ(strings.get(kept).rank, 2);
+}
+
+TEST(StringTableTest, releaseRunStrings) {
+  b9::VirtualMachine vm{runtime, {}};
+  Immediate toString = vm.getPrimitiveIndex("int_to_string");
+  // Make n strings, and return "-1".
+  std::vector<Instruction> strings = {{OpCode::PUSH_FROM_PARAM, 0},
+                                      {OpCode::INT_PUSH_CONSTANT, 0},
+                                      {OpCode::JMP_LE, 8},
+                                      {OpCode::PUSH_FROM_PARAM, 0},
+                                      {OpCode::PRIMITIVE_CALL, toString},
+                                      {OpCode::DROP},
+                                      {OpCode::PUSH_FROM_PARAM, 0},
+                                      {OpCode::INT_PUSH_CONSTANT, 1},
+                                      {OpCode::INT_SUB},
+                                      {OpCode::POP_INTO_PARAM, 0},
+                                      {OpCode::JMP, -11},
+                                      {OpCode::INT_PUSH_CONSTANT, -1},
+                                      {OpCode::PRIMITIVE_CALL, toString},
+                                      {OpCode::FUNCTION_RETURN},
+                                      END_SECTION};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"strings", strings, 1, 0});
+  vm.load(m);
+
+  auto result = vm.run("strings", {{AS_INT48, 100}});
+  EXPECT_EQ(vm.getString(result.getUint48()), "-1");
+  auto count = vm.getStringCount();
+  vm.run("strings", {{AS_INT48, 100}});
+  EXPECT_EQ(vm.getStringCount(), count);
+  EXPECT_EQ(vm.getString(result.getUint48()), "-1");
+}
+
+TEST(StringTableTest, stringBuilderHandles) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto first = vm.newStringBuilder();
+  vm.stringBuilder(first).append("a");
+  EXPECT_EQ(vm.getString(vm.finishStringBuilder(first)), "a");
+
+  // The next builder reuses the slot, but not the handle.
+  auto second = vm.newStringBuilder();
+  EXPECT_NE(second, first);
+  EXPECT_THROW(vm.stringBuilder(first), std::runtime_error);
+  EXPECT_THROW(vm.finishStringBuilder(first), std::runtime_error);
+  EXPECT_THROW(vm.stringBuilder(0), std::runtime_error);
+  EXPECT_THROW(vm.stringBuilder(-second), std::runtime_error);
+
+  // Unfinished builders are released.
+  vm.releaseStringBuilders();
+  EXPECT_THROW(vm.stringBuilder(second), std::runtime_error);
+}
+
+TEST(StringTableTest, compareAcrossModules) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto lib = std::make_shared<Module>();
+  std::vector<Instruction> name = {{OpCode::STR_PUSH_CONSTANT, 1},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  lib->functions.push_back(b9::FunctionDef{"name", name, 0, 0});
+  lib->strings = {"alpha", "beta"};
+  lib->exports = {"name"};
+  vm.load(lib);
+
+  // Both compare the imported "beta" with a constant of their own, and
+  // return 1 when the branch is taken.
+  auto app = std::make_shared<Module>();
+  auto compare = [](OpCode jump, Immediate string) {
+    return std::vector<Instruction>{{OpCode::FUNCTION_CALL, 2},  // import 0
+                                    {OpCode::STR_PUSH_CONSTANT, string},
+                                    {jump, 2},
+                                    {OpCode::INT_PUSH_CONSTANT, 0},
+                                    {OpCode::FUNCTION_RETURN},
+                                    {OpCode::INT_PUSH_CONSTANT, 1},
+                                    {OpCode::FUNCTION_RETURN},
+                                    END_SECTION};
+  };
+  app->functions.push_back(
+      b9::FunctionDef{"same", compare(OpCode::JMP_EQ, 0), 0, 0});
+  app->functions.push_back(
+      b9::FunctionDef{"after", compare(OpCode::JMP_GT, 1), 0, 0});
+  app->strings = {"beta", "alpha"};
+  app->imports = {"name"};
+  vm.load(app);
+
+  EXPECT_EQ(vm.getStringCount(), 2);
+  EXPECT_EQ(vm.run("same", {}), Value(AS_INT48, 1));
+  EXPECT_EQ(vm.run("after", {}), Value(AS_INT48, 1));
+}
+
+TEST(CodeArenaTest, layoutByCallGraph) {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> leaf = {{OpCode::INT_PUSH_CONSTANT, 1},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  std::vector<Instruction> main = {{OpCode::FUNCTION_CALL, 3},
+                                   {OpCode::FUNCTION_CALL, 2},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", main, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"unused", leaf, 1, 2});
+  m->functions.push_back(b9::FunctionDef{"second", leaf, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"first", leaf, 0, 0});
+
+  CodeArena arena{*m, {true, true, true, true}};
+  EXPECT_EQ(arena.size(), 5 + 3 * 3);
+  auto base = arena.entry(0);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(base) % CodeArena::ALIGNMENT, 0);
+  EXPECT_EQ(arena.entry(3), base + 5);
+  EXPECT_EQ(arena.entry(2), base + 8);
+  EXPECT_EQ(arena.entry(1), base + 11);
+
+  CodeArena partial{*m, {false, false, true, false}};
+  EXPECT_EQ(partial.size(), 3);
+  EXPECT_EQ(partial.entry(0), nullptr);
+  EXPECT_NE(partial.entry(2), nullptr);
+
+  b9::VirtualMachine vm{runtime, {}};
+  vm.load(m);
+  EXPECT_EQ(vm.getParamCount(1), 1);
+  EXPECT_EQ(vm.getLocalCount(1), 2);
+  EXPECT_EQ(vm.getEntry(0)[0], Instruction(OpCode::FUNCTION_CALL, 3));
+  EXPECT_EQ(vm.run("main", {}), Value(AS_INT48, 2));
+}
+
+std::shared_ptr<Module> makeSnapshotModule() {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> build = {
+      {OpCode::NEW_OBJECT},            // outer = {}
+      {OpCode::POP_INTO_LOCAL, 0},     //
+      {OpCode::NEW_OBJECT},            // inner = {}
+      {OpCode::POP_INTO_LOCAL, 1},     //
+      {OpCode::INT_PUSH_CONSTANT, 7},  // inner.2 = 7
+      {OpCode::PUSH_FROM_LOCAL, 1},    //
+      {OpCode::POP_INTO_OBJECT, 2},    //
+      {OpCode::PUSH_FROM_LOCAL, 1},    // outer.0 = inner
+      {OpCode::PUSH_FROM_LOCAL, 0},    //
+      {OpCode::POP_INTO_OBJECT, 0},    //
+      {OpCode::STR_PUSH_CONSTANT, 0},  // outer.1 = "snap"
+      {OpCode::PUSH_FROM_LOCAL, 0},    //
+      {OpCode::POP_INTO_OBJECT, 1},    //
+      {OpCode::PUSH_FROM_LOCAL, 0},    // inner.3 = outer
+      {OpCode::PUSH_FROM_LOCAL, 1},    //
+      {OpCode::POP_INTO_OBJECT, 3},    //
+      {OpCode::PUSH_FROM_LOCAL, 0},    // return outer
+      {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  std::vector<Instruction> value = {
+      {OpCode::PUSH_FROM_PARAM, 0},   // outer.0.3.0.2
+      {OpCode::PUSH_FROM_OBJECT, 0},  //
+      {OpCode::PUSH_FROM_OBJECT, 3},  //
+      {OpCode::PUSH_FROM_OBJECT, 0},  //
+      {OpCode::PUSH_FROM_OBJECT, 2},  //
+      {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  std::vector<Instruction> name = {{OpCode::PUSH_FROM_PARAM, 0},  // outer.1
+                                   {OpCode::PUSH_FROM_OBJECT, 1},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"build", build, 0, 2});
+  m->functions.push_back(b9::FunctionDef{"value", value, 1, 0});
+  m->functions.push_back(b9::FunctionDef{"name", name, 1, 0});
+  m->strings = {"snap"};
+  return m;
+}
+
+TEST(SnapshotTest, restoreHeap) {
+  std::stringstream snapshot;
+  {
+    b9::VirtualMachine vm{runtime, {}};
+    vm.load(makeSnapshotModule());
+    writeSnapshot(snapshot, vm, vm.run("build", {}));
+  }
+
+  b9::VirtualMachine vm{runtime, {}};
+  auto root = readSnapshot(snapshot, vm);
+  EXPECT_EQ(vm.run("value", {root}), Value(AS_INT48, 7));
+  auto name = vm.run("name", {root});
+  EXPECT_EQ(vm.getString(name.getUint48()), "snap");
+
+  std::stringstream again(snapshot.str());
+  EXPECT_THROW(readSnapshot(again, vm), SnapshotException);
+}
+
+TEST(SnapshotTest, restoreMappedFile) {
+  const char *path = "b9test.snapshot";
+  {
+    b9::VirtualMachine vm{runtime, {}};
+    vm.load(makeSnapshotModule());
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    writeSnapshot(out, vm, vm.run("build", {}));
+  }
+
+  b9::VirtualMachine vm{runtime, {}};
+  auto root = readSnapshotFile(path, vm);
+  std::remove(path);
+  EXPECT_EQ(vm.run("value", {root}), Value(AS_INT48, 7));
+
+  b9::VirtualMachine empty{runtime, {}};
+  EXPECT_THROW(readSnapshotFile(path, empty), SnapshotException);
+}
+
+TEST(SnapshotTest, restoreArray) {
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> build = {
+      {OpCode::NEW_OBJECT},            // holder = {}
+      {OpCode::POP_INTO_LOCAL, 0},     //
+      {OpCode::INT_PUSH_CONSTANT, 3},  // holder.0 = new int[3]
+      {OpCode::NEW_INT_ARRAY},         //
+      {OpCode::PUSH_FROM_LOCAL, 0},    //
+      {OpCode::POP_INTO_OBJECT, 0},    //
+      {OpCode::PUSH_FROM_LOCAL, 0},    // holder.0[1] = 9
+      {OpCode::PUSH_FROM_OBJECT, 0},   //
+      {OpCode::INT_PUSH_CONSTANT, 1},  //
+      {OpCode::INT_PUSH_CONSTANT, 9},  //
+      {OpCode::INT_ARRAY_STORE},       //
+      {OpCode::PUSH_FROM_LOCAL, 0},    // return holder
+      {OpCode::FUNCTION_RETURN},
+      END_SECTION};
+  std::vector<Instruction> element = {{OpCode::PUSH_FROM_PARAM, 0},
+                                      {OpCode::PUSH_FROM_OBJECT, 0},
+                                      {OpCode::PUSH_FROM_PARAM, 1},
+                                      {OpCode::INT_ARRAY_LOAD},
+                                      {OpCode::FUNCTION_RETURN},
+                                      END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"build", build, 0, 1});
+  m->functions.push_back(b9::FunctionDef{"element", element, 2, 0});
+
+  std::stringstream snapshot;
+  {
+    b9::VirtualMachine vm{runtime, {}};
+    vm.load(m);
+    writeSnapshot(snapshot, vm, vm.run("build", {}));
+  }
+
+  b9::VirtualMachine vm{runtime, {}};
+  auto root = readSnapshot(snapshot, vm);
+  EXPECT_EQ(vm.run("element", {root, {AS_INT48, 0}}), Value(AS_INT48, 0));
+  EXPECT_EQ(vm.run("element", {root, {AS_INT48, 1}}), Value(AS_INT48, 9));
+  EXPECT_THROW(vm.run("element", {root, {AS_INT48, 3}}), std::out_of_range);
+}
+
+TEST(SnapshotTest, restoreMap) {
+  std::stringstream snapshot;
+  auto m = std::make_shared<Module>();
+  {
+    b9::VirtualMachine vm{runtime, {}};
+    Immediate mapNew = vm.getPrimitiveIndex("map_new");
+    Immediate mapPut = vm.getPrimitiveIndex("map_put");
+    std::vector<Instruction> build = {
+        {OpCode::PRIMITIVE_CALL, mapNew},  // map = map_new()
+        {OpCode::POP_INTO_LOCAL, 0},       //
+        {OpCode::PUSH_FROM_LOCAL, 0},      // map["key"] = 5
+        {OpCode::STR_PUSH_CONSTANT, 0},    //
+        {OpCode::INT_PUSH_CONSTANT, 5},    //
+        {OpCode::PRIMITIVE_CALL, mapPut},  //
+        {OpCode::DROP},                    //
+        {OpCode::PUSH_FROM_LOCAL, 0},      // map[7] = "value"
+        {OpCode::INT_PUSH_CONSTANT, 7},    //
+        {OpCode::STR_PUSH_CONSTANT, 1},    //
+        {OpCode::PRIMITIVE_CALL, mapPut},  //
+        {OpCode::DROP},                    //
+        {OpCode::PUSH_FROM_LOCAL, 0},      // return map
+        {OpCode::FUNCTION_RETURN},
+        END_SECTION};
+    m->functions.push_back(b9::FunctionDef{"build", build, 0, 1});
+    m->strings = {"key", "value"};
+    vm.load(m);
+    writeSnapshot(snapshot, vm, vm.run("build", {}));
+  }
+
+  b9::VirtualMachine vm{runtime, {}};
+  auto root = readSnapshot(snapshot, vm);
+  auto &table = hashMapTable(vm.rootContext(), root.getRef<HashMap>());
+  EXPECT_EQ(table.size(), 2);
+  auto key = vm.strings().intern("key");
+  ASSERT_NE(table.find(Value(AS_UINT48, key).raw()), nullptr);
+  EXPECT_EQ(*table.find(Value(AS_UINT48, key).raw()), Value(AS_INT48, 5).raw());
+  auto value = table.find(Value(AS_INT48, 7).raw());
+  ASSERT_NE(value, nullptr);
+  EXPECT_EQ(vm.getString(Value(AS_RAW, *value).getUint48()), "value");
+}
+
+TEST(InputTest, readMappedFile) {
+  const char *path = "b9test.input";
+  {
+    std::ofstream out(path);
+    out << "a 1 -2\n\nx-3 y 40\nlast 7";
+  }
+  InputReader input(path);
+  std::remove(path);
+  EXPECT_TRUE(input.isMapped());
+
+  ASSERT_TRUE(input.nextRecord());
+  EXPECT_EQ(std::string(input.record(), input.recordSize()), "a 1 -2");
+  EXPECT_EQ(parseField(input.record(), input.recordSize(), 2), -2);
+  EXPECT_EQ(parseField(input.record(), input.recordSize(), 0), 0);
+  ASSERT_TRUE(input.nextRecord());
+  EXPECT_EQ(input.recordSize(), 0);
+
+  std::int64_t values[4];
+  ASSERT_EQ(input.readInts(values, 4), 3);
+  EXPECT_EQ(values[0], -3);
+  EXPECT_EQ(values[1], 40);
+  EXPECT_EQ(values[2], 7);
+  EXPECT_TRUE(input.atEnd());
+  EXPECT_FALSE(input.nextRecord());
+}
+
+TEST(InputTest, readPipe) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  const std::string data = "one,two,three";
+  ASSERT_EQ(write(fds[1], data.data(), data.size()), data.size());
+  close(fds[1]);
+
+  InputReader input(fds[0]);
+  EXPECT_FALSE(input.isMapped());
+  std::vector<std::string> records;
+  while (input.nextRecord(',')) {
+    records.emplace_back(input.record(), input.recordSize());
+  }
+  EXPECT_EQ(records, (std::vector<std::string>{"one", "two", "three"}));
+  EXPECT_TRUE(input.atEnd());
+}
+
+TEST(InputTest, inputPrimitives) {
+  const char *path = "b9test.input";
+  {
+    std::ofstream out(path);
+    out << "a 5 b\n-3 x\n";
+  }
+  b9::VirtualMachine vm{runtime, {}};
+  Immediate open = vm.getPrimitiveIndex("input_open");
+  Immediate nextLine = vm.getPrimitiveIndex("input_next_line");
+  Immediate recordInt = vm.getPrimitiveIndex("input_record_int");
+  Immediate readInt = vm.getPrimitiveIndex("input_read_int");
+
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> main = {{OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::PRIMITIVE_CALL, open},
+                                   {OpCode::POP_INTO_LOCAL, 0},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::PRIMITIVE_CALL, nextLine},
+                                   {OpCode::DROP},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 1},
+                                   {OpCode::PRIMITIVE_CALL, recordInt},
+                                   {OpCode::PUSH_FROM_LOCAL, 0},
+                                   {OpCode::PRIMITIVE_CALL, readInt},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"main", main, 1, 1});
+  vm.load(m);
+
+  Value file(AS_UINT48, vm.strings().intern(path));
+  EXPECT_EQ(vm.run("main", {file}), Value(AS_INT48, 2));
+  std::remove(path);
+}
+
+// Fill a[i] = i for an array of n, and return a[n - 1].
+const std::vector<Instruction> FILL_ARRAY = {
+    {OpCode::PUSH_FROM_PARAM, 0}, {OpCode::NEW_INT_ARRAY},
+    {OpCode::POP_INTO_LOCAL, 0},  {OpCode::INT_PUSH_CONSTANT, 0},
+    {OpCode::POP_INTO_LOCAL, 1},  {OpCode::PUSH_FROM_LOCAL, 1},
+    {OpCode::PUSH_FROM_LOCAL, 0}, {OpCode::ARRAY_LENGTH},
+    {OpCode::JMP_GE, 9},          {OpCode::PUSH_FROM_LOCAL, 0},
+    {OpCode::PUSH_FROM_LOCAL, 1}, {OpCode::PUSH_FROM_LOCAL, 1},
+    {OpCode::INT_ARRAY_STORE},    {OpCode::PUSH_FROM_LOCAL, 1},
+    {OpCode::INT_PUSH_CONSTANT, 1}, {OpCode::INT_ADD},
+    {OpCode::POP_INTO_LOCAL, 1},  {OpCode::JMP, -13},
+    {OpCode::PUSH_FROM_LOCAL, 0}, {OpCode::PUSH_FROM_PARAM, 0},
+    {OpCode::INT_PUSH_CONSTANT, 1}, {OpCode::INT_SUB},
+    {OpCode::INT_ARRAY_LOAD},     {OpCode::FUNCTION_RETURN},
+    END_SECTION};
+
+TEST(ArrayTest, fillArray) {
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"fill", FILL_ARRAY, 1, 2});
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    EXPECT_EQ(vm.run("fill", {{AS_INT48, 10}}), Value(AS_INT48, 9));
+  }
+}
+
+TEST(ArrayTest, indexOutOfBounds) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"fill", FILL_ARRAY, 1, 2});
+  vm.load(m);
+  EXPECT_THROW(vm.run("fill", {{AS_INT48, 0}}), std::out_of_range);
+}
+
+TEST(ArrayTest, objectsAreNotArrays) {
+  std::vector<Instruction> objectLength = {{OpCode::NEW_OBJECT},
+                                           {OpCode::ARRAY_LENGTH},
+                                           {OpCode::FUNCTION_RETURN},
+                                           END_SECTION};
+  std::vector<Instruction> arrayField = {{OpCode::INT_PUSH_CONSTANT, 1},
+                                         {OpCode::NEW_INT_ARRAY},
+                                         {OpCode::PUSH_FROM_OBJECT, 0},
+                                         {OpCode::FUNCTION_RETURN},
+                                         END_SECTION};
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  m->functions.push_back(b9::FunctionDef{"objectLength", objectLength, 0, 0});
+  m->functions.push_back(b9::FunctionDef{"arrayField", arrayField, 0, 0});
+  vm.load(m);
+  EXPECT_THROW(vm.run("objectLength", {}), std::runtime_error);
+  EXPECT_THROW(vm.run("arrayField", {}), std::runtime_error);
+}
+
+TEST(ArrayTest, primitivesTakeArrays) {
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    Immediate fill = vm.getPrimitiveIndex("array_fill");
+    std::vector<Instruction> fillObject = {{OpCode::NEW_OBJECT},
+                                           {OpCode::INT_PUSH_CONSTANT, 0},
+                                           {OpCode::PRIMITIVE_CALL, fill},
+                                           {OpCode::FUNCTION_RETURN},
+                                           END_SECTION};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"fillObject", fillObject, 0, 0});
+    vm.load(m);
+    if (jit) {
+      vm.generateAllCode();
+      EXPECT_DEATH(vm.run("fillObject", {}), "array_fill");
+    } else {
+      EXPECT_THROW(vm.run("fillObject", {}), std::runtime_error);
+    }
+  }
+}
+
+TEST(ArrayTest, boundsCheckElimination) {
+  auto inBounds = findInBoundsAccesses(FILL_ARRAY);
+  ASSERT_EQ(inBounds.size(), FILL_ARRAY.size());
+  EXPECT_TRUE(inBounds[12]);   // a[i] = i, in the loop
+  EXPECT_FALSE(inBounds[22]);  // a[n - 1], after it
+
+  // Without the initial i = 0, i might be negative.
+  auto program = FILL_ARRAY;
+  program[3] = {OpCode::PUSH_FROM_PARAM, 0};
+  EXPECT_FALSE(findInBoundsAccesses(program)[12]);
+}
+
+TEST(ArrayTest, kernelsAgree) {
+  auto kernels = supportedArrayKernels();
+  const auto &scalar = *kernels.back();
+  EXPECT_STREQ(scalar.name, "scalar");
+
+  // Odd lengths exercise the scalar tails, and large values the wrapping.
+  std::mt19937_64 random(9);
+  auto element = [&random]() {
+    return static_cast<std::int64_t>(random() >> 16) - (std::int64_t(1) << 47);
+  };
+  for (std::size_t length : {0, 1, 3, 4, 7, 16, 33}) {
+    std::vector<std::int64_t> a(length), b(length);
+    for (auto &x : a) x = element();
+    for (auto &x : b) x = element();
+    auto value = element();
+    if (length > 0) value = a[length / 2];
+    auto same = a;
+    if (length > 0) same.back()++;
+
+    for (auto k : kernels) {
+      SCOPED_TRACE(k->name);
+      EXPECT_EQ(k->sum(a.data(), length), scalar.sum(a.data(), length));
+      EXPECT_EQ(k->min(a.data(), length), scalar.min(a.data(), length));
+      EXPECT_EQ(k->max(a.data(), length), scalar.max(a.data(), length));
+      EXPECT_EQ(k->find(a.data(), length, value),
+                scalar.find(a.data(), length, value));
+      EXPECT_EQ(k->compare(a.data(), same.data(), length),
+                scalar.compare(a.data(), same.data(), length));
+
+      auto x = a, y = a;
+      EXPECT_EQ(k->prefixSum(x.data(), length),
+                scalar.prefixSum(y.data(), length));
+      EXPECT_EQ(x, y);
+      x = a, y = a;
+      k->mulScalar(x.data(), length, value);
+      scalar.mulScalar(y.data(), length, value);
+      EXPECT_EQ(x, y);
+      x = a, y = a;
+      k->add(x.data(), b.data(), length);
+      scalar.add(y.data(), b.data(), length);
+      EXPECT_EQ(x, y);
+      x = a, y = a;
+      k->mul(x.data(), b.data(), length);
+      scalar.mul(y.data(), b.data(), length);
+      EXPECT_EQ(x, y);
+    }
+  }
+}
+
+// principal * rate / 100, truncated, or -1 if under 1.5.
+const std::vector<Instruction> INTEREST = {
+    {OpCode::PUSH_FROM_PARAM, 0},   {OpCode::INT_TO_DBL},
+    {OpCode::PUSH_FROM_PARAM, 1},   {OpCode::DBL_MUL},
+    {OpCode::DBL_PUSH_CONSTANT, 0}, {OpCode::DBL_DIV},
+    {OpCode::POP_INTO_LOCAL, 0},    {OpCode::PUSH_FROM_LOCAL, 0},
+    {OpCode::DBL_PUSH_CONSTANT, 1}, {OpCode::DBL_JMP_LT, 3},
+    {OpCode::PUSH_FROM_LOCAL, 0},   {OpCode::DBL_TO_INT},
+    {OpCode::FUNCTION_RETURN},      {OpCode::INT_PUSH_CONSTANT, -1},
+    {OpCode::FUNCTION_RETURN},      END_SECTION};
+
+TEST(DoubleTest, interest) {
+  struct Mode {
+    bool jit, directCall, passParam, lazyVmState;
+  };
+  for (auto mode : {Mode{false, false, false, false},
+                    Mode{true, false, false, false},
+                    Mode{true, true, true, true}}) {
+    Config cfg;
+    cfg.jit = mode.jit;
+    cfg.directCall = mode.directCall;
+    cfg.passParam = mode.passParam;
+    cfg.lazyVmState = mode.lazyVmState;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"interest", INTEREST, 2, 1});
+    m->doubles = {100.0, 1.5};
+    vm.load(m);
+    if (mode.jit) vm.generateAllCode();
+    EXPECT_EQ(vm.run("interest", {{AS_INT48, 250}, {AS_DOUBLE, 2.5}}),
+              Value(AS_INT48, 6));
+    EXPECT_EQ(vm.run("interest", {{AS_INT48, 250}, {AS_DOUBLE, 0.5}}),
+              Value(AS_INT48, -1));
+    EXPECT_EQ(vm.run("interest", {{AS_INT48, -999}, {AS_DOUBLE, 10.0}}),
+              Value(AS_INT48, -1));
+  }
+}
+
+TEST(DoubleTest, conversions) {
+  b9::VirtualMachine vm{runtime, {}};
+  auto m = std::make_shared<Module>();
+  std::vector<Instruction> toInt = {{OpCode::PUSH_FROM_PARAM, 0},
+                                    {OpCode::DBL_TO_INT},
+                                    {OpCode::FUNCTION_RETURN},
+                                    END_SECTION};
+  std::vector<Instruction> toDouble = {{OpCode::PUSH_FROM_PARAM, 0},
+                                       {OpCode::INT_TO_DBL},
+                                       {OpCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  m->functions.push_back(b9::FunctionDef{"toInt", toInt, 1, 0});
+  m->functions.push_back(b9::FunctionDef{"toDouble", toDouble, 1, 0});
+  vm.load(m);
+  EXPECT_EQ(vm.run("toInt", {{AS_DOUBLE, -7.9}}), Value(AS_INT48, -7));
+  EXPECT_EQ(vm.run("toInt", {{AS_INT48, 12}}), Value(AS_INT48, 12));
+  EXPECT_EQ(vm.run("toDouble", {{AS_INT48, 3}}), Value(AS_DOUBLE, 3.0));
+  EXPECT_EQ(vm.run("toDouble", {{AS_DOUBLE, 0.25}}), Value(AS_DOUBLE, 0.25));
+}
+
+TEST(WideConstantTest, pushesFullInt48) {
+  std::vector<Instruction> code = {{OpCode::INT_PUSH_CONSTANT_WIDE, 0},
+                                   {OpCode::INT_PUSH_CONSTANT_WIDE, 1},
+                                   {OpCode::INT_ADD},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"wide", code, 0, 0});
+    m->integers = {0x7FFF'0000'0000, -0x1234'5678};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    EXPECT_EQ(vm.run("wide", {}),
+              Value(AS_INT48, 0x7FFF'0000'0000 - 0x1234'5678));
+  }
+}
+
+TEST(IntegerTest, int48Semantics) {
+  auto binary = [](OpCode op) {
+    return std::vector<Instruction>{{OpCode::PUSH_FROM_PARAM, 0},
+                                    {OpCode::PUSH_FROM_PARAM, 1},
+                                    {op},
+                                    {OpCode::FUNCTION_RETURN},
+                                    END_SECTION};
+  };
+  std::vector<Instruction> neg = {{OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::INT_NEG},
+                                  {OpCode::FUNCTION_RETURN},
+                                  END_SECTION};
+  const std::int64_t MIN = -0x8000'0000'0000;
+  const std::int64_t MAX = 0x7FFF'FFFF'FFFF;
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"mod", binary(OpCode::INT_MOD), 2});
+    m->functions.push_back(b9::FunctionDef{"and", binary(OpCode::INT_AND), 2});
+    m->functions.push_back(b9::FunctionDef{"or", binary(OpCode::INT_OR), 2});
+    m->functions.push_back(b9::FunctionDef{"xor", binary(OpCode::INT_XOR), 2});
+    m->functions.push_back(b9::FunctionDef{"shl", binary(OpCode::INT_SHL), 2});
+    m->functions.push_back(b9::FunctionDef{"shr", binary(OpCode::INT_SHR), 2});
+    m->functions.push_back(b9::FunctionDef{"neg", neg, 1});
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    auto run = [&](const char *name, std::int64_t a, std::int64_t b) {
+      return vm.run(name, {{AS_INT48, a}, {AS_INT48, b}}).getInt48();
+    };
+    EXPECT_EQ(run("mod", 17, 5), 2);
+    EXPECT_EQ(run("mod", -17, 5), -2);
+    EXPECT_EQ(run("mod", 17, -5), 2);
+    EXPECT_EQ(run("mod", MIN, -1), 0);
+    if (jit) {
+      EXPECT_DEATH(run("mod", 17, 0), "modulo by zero");
+    } else {
+      EXPECT_THROW(run("mod", 17, 0), std::runtime_error);
+    }
+    EXPECT_EQ(run("and", -1, 0xF0F0), 0xF0F0);
+    EXPECT_EQ(run("or", 0x0F, 0xF0), 0xFF);
+    EXPECT_EQ(run("xor", MIN, -1), MAX);
+    EXPECT_EQ(run("shl", 1, 46), 0x4000'0000'0000);
+    EXPECT_EQ(run("shl", 1, 47), MIN);
+    EXPECT_EQ(run("shl", 3, 48), 0);
+    EXPECT_EQ(run("shl", 1, 65), 2);
+    EXPECT_EQ(run("shr", MIN, 47), -1);
+    EXPECT_EQ(run("shr", -16, 2), -4);
+    EXPECT_EQ(run("shr", MAX, 46), 1);
+    EXPECT_EQ(run("shr", MAX, 47), 0);
+    EXPECT_EQ(run("shr", MIN, 63), -1);
+    EXPECT_EQ(run("shr", MIN, -1), -1);
+    EXPECT_EQ(run("shr", 5, 64), 5);
+    EXPECT_EQ(vm.run("neg", {{AS_INT48, 42}}), Value(AS_INT48, -42));
+    EXPECT_EQ(vm.run("neg", {{AS_INT48, 0}}), Value(AS_INT48, 0));
+    EXPECT_EQ(vm.run("neg", {{AS_INT48, MAX}}), Value(AS_INT48, MIN + 1));
+    EXPECT_EQ(vm.run("neg", {{AS_INT48, MIN + 1}}), Value(AS_INT48, MAX));
+    EXPECT_EQ(vm.run("neg", {{AS_INT48, MIN}}), Value(AS_INT48, MIN));
+  }
+}
+
+TEST(TableSwitchTest, jumpsToCaseOrDefault) {
+  // Returns 10 + x for x in [-1, 1], and 0 otherwise.
+  std::vector<Instruction> code = {{OpCode::PUSH_FROM_PARAM, 0},
+                                   {OpCode::TABLE_SWITCH, 0},
+                                   {OpCode::INT_PUSH_CONSTANT, 9},
+                                   {OpCode::FUNCTION_RETURN},
+                                   {OpCode::INT_PUSH_CONSTANT, 10},
+                                   {OpCode::FUNCTION_RETURN},
+                                   {OpCode::INT_PUSH_CONSTANT, 11},
+                                   {OpCode::FUNCTION_RETURN},
+                                   {OpCode::INT_PUSH_CONSTANT, 0},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"classify", code, 1});
+    m->jumpTables = {{-1, 6, {0, 2, 4}}};
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    auto run = [&](std::int64_t x) {
+      return vm.run("classify", {{AS_INT48, x}}).getInt48();
+    };
+    EXPECT_EQ(run(-1), 9);
+    EXPECT_EQ(run(0), 10);
+    EXPECT_EQ(run(1), 11);
+    EXPECT_EQ(run(2), 0);
+    EXPECT_EQ(run(-2), 0);
+    EXPECT_EQ(run(0x7FFF'FFFF'FFFF), 0);
+
+    // Only an integer matches a case.
+    auto zero = vm.strings().intern("0");
+    EXPECT_EQ(vm.run("classify", {{AS_UINT48, zero}}), Value(AS_INT48, 0));
+    EXPECT_EQ(vm.run("classify", {{AS_DOUBLE, 0.0}}), Value(AS_INT48, 0));
+  }
+}
+
+TEST(TailCallTest, runsInConstantStack) {
+  // sum(n, total) returns total + n + ... + 1, calling itself n times.
+  std::vector<Instruction> sum = {{OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::INT_PUSH_CONSTANT, 0},
+                                  {OpCode::JMP_NEQ, 2},
+                                  {OpCode::PUSH_FROM_PARAM, 1},
+                                  {OpCode::FUNCTION_RETURN},
+                                  {OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::INT_PUSH_CONSTANT, 1},
+                                  {OpCode::INT_SUB},
+                                  {OpCode::PUSH_FROM_PARAM, 1},
+                                  {OpCode::PUSH_FROM_PARAM, 0},
+                                  {OpCode::INT_ADD},
+                                  {OpCode::TAIL_CALL, 0},
+                                  END_SECTION};
+  // start(n) has a local, and a frame the size of neither callee's.
+  std::vector<Instruction> start = {{OpCode::PUSH_FROM_PARAM, 0},
+                                    {OpCode::POP_INTO_LOCAL, 0},
+                                    {OpCode::PUSH_FROM_LOCAL, 0},
+                                    {OpCode::INT_PUSH_CONSTANT, 0},
+                                    {OpCode::TAIL_CALL, 0},
+                                    END_SECTION};
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"sum", sum, 2, 0});
+    m->functions.push_back(b9::FunctionDef{"start", start, 1, 1});
+    vm.load(m);
+    if (jit) vm.generateAllCode();
+    EXPECT_EQ(vm.run("start", {{AS_INT48, 10000}}),
+              Value(AS_INT48, 50005000));
+    EXPECT_EQ(vm.run("sum", {{AS_INT48, 3}, {AS_INT48, 4}}),
+              Value(AS_INT48, 10));
+  }
+}
+
+TEST(TailCallTest, mutualRecursionRunsInConstantStack) {
+  // isEven(n) and isOdd(n) tail call each other n times.
+  auto parity = [](std::int32_t zero, std::int32_t other) {
+    return std::vector<Instruction>{{OpCode::PUSH_FROM_PARAM, 0},
+                                    {OpCode::INT_PUSH_CONSTANT, 0},
+                                    {OpCode::JMP_NEQ, 2},
+                                    {OpCode::INT_PUSH_CONSTANT, zero},
+                                    {OpCode::FUNCTION_RETURN},
+                                    {OpCode::PUSH_FROM_PARAM, 0},
+                                    {OpCode::INT_PUSH_CONSTANT, 1},
+                                    {OpCode::INT_SUB},
+                                    {OpCode::TAIL_CALL, other},
+                                    END_SECTION};
+  };
+  // A compiled caller finishes the tail calls its callee starts.
+  std::vector<Instruction> start = {{OpCode::PUSH_FROM_PARAM, 0},
+                                    {OpCode::FUNCTION_CALL, 0},
+                                    {OpCode::INT_PUSH_CONSTANT, 10},
+                                    {OpCode::INT_ADD},
+                                    {OpCode::FUNCTION_RETURN},
+                                    END_SECTION};
+  struct Mode {
+    bool jit, directCall, passParam, lazyVmState;
+  };
+  for (auto mode : {Mode{false, false, false, false},
+                    Mode{true, false, false, false},
+                    Mode{true, true, false, false},
+                    Mode{true, true, true, true}}) {
+    Config cfg;
+    cfg.jit = mode.jit;
+    cfg.directCall = mode.directCall;
+    cfg.passParam = mode.passParam;
+    cfg.lazyVmState = mode.lazyVmState;
+    b9::VirtualMachine vm{runtime, cfg};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"isEven", parity(1, 1), 1, 0});
+    m->functions.push_back(b9::FunctionDef{"isOdd", parity(0, 0), 1, 0});
+    m->functions.push_back(b9::FunctionDef{"start", start, 1, 0});
+    vm.load(m);
+    if (mode.jit) vm.generateAllCode();
+    EXPECT_EQ(vm.run("isEven", {{AS_INT48, 1000000}}), Value(AS_INT48, 1));
+    EXPECT_EQ(vm.run("isOdd", {{AS_INT48, 1000000}}), Value(AS_INT48, 0));
+    EXPECT_EQ(vm.run("start", {{AS_INT48, 1000001}}), Value(AS_INT48, 10));
+  }
+}
+
+TEST(HashTableTest, growsAndReusesDeletedSlots) {
+  std::vector<std::uint64_t> memory;
+  auto allocate = [&memory](std::size_t capacity) {
+    memory.resize(HashTable::bytes(capacity) / sizeof(std::uint64_t) + 1);
+    return HashTable::initialize(memory.data(), capacity);
+  };
+  auto put = [&](HashTable *&table, Value key, std::int64_t value) {
+    if (!table->hasRoom() && !table->find(key.raw())) {
+      std::vector<std::uint64_t> old = memory;
+      auto from = reinterpret_cast<HashTable *>(old.data());
+      table = allocate(from->grownCapacity());
+      from->copyInto(*table);
+    }
+    table->put(key.raw(), Value(AS_INT48, value).raw());
+  };
+  auto get = [](HashTable *table, Value key) {
+    auto value = table->find(key.raw());
+    return value ? Value(AS_RAW, *value).getInt48() : -1;
+  };
+
+  auto table = allocate(HashTable::GROUP);
+  for (std::int64_t i = 0; i < 10000; i++) {
+    put(table, Value(AS_INT48, i * 7919), i);
+  }
+  EXPECT_EQ(table->size(), 10000);
+  EXPECT_EQ(get(table, Value(AS_INT48, 7919 * 4321)), 4321);
+  EXPECT_EQ(get(table, Value(AS_INT48, 1)), -1);
+
+  // An int and a string with the same number are different keys.
+  put(table, Value(AS_UINT48, 7919), -5);
+  EXPECT_EQ(get(table, Value(AS_UINT48, 7919)), -5);
+  EXPECT_EQ(get(table, Value(AS_INT48, 7919)), 1);
+
+  // Churn through deletes without growing.
+  auto capacity = table->capacity();
+  for (std::int64_t i = 0; i < 100000; i++) {
+    auto key = Value(AS_INT48, -1 - i);
+    put(table, key, i);
+    EXPECT_TRUE(table->erase(key.raw()));
+    EXPECT_FALSE(table->erase(key.raw()));
+  }
+  EXPECT_EQ(table->capacity(), capacity);
+  EXPECT_EQ(table->size(), 10001);
+  EXPECT_EQ(get(table, Value(AS_INT48, 7919 * 9999)), 9999);
+}
+
+TEST(HashMapTest, primitivesTakeMaps) {
+  for (bool jit : {false, true}) {
+    Config cfg;
+    cfg.jit = jit;
+    b9::VirtualMachine vm{runtime, cfg};
+    Immediate mapNew = vm.getPrimitiveIndex("map_new");
+    Immediate mapSize = vm.getPrimitiveIndex("map_size");
+    Immediate mapPut = vm.getPrimitiveIndex("map_put");
+    std::vector<Instruction> arraySize = {{OpCode::INT_PUSH_CONSTANT, 1},
+                                          {OpCode::NEW_INT_ARRAY},
+                                          {OpCode::PRIMITIVE_CALL, mapSize},
+                                          {OpCode::FUNCTION_RETURN},
+                                          END_SECTION};
+    std::vector<Instruction> putObject = {{OpCode::PRIMITIVE_CALL, mapNew},
+                                          {OpCode::INT_PUSH_CONSTANT, 1},
+                                          {OpCode::NEW_OBJECT},
+                                          {OpCode::PRIMITIVE_CALL, mapPut},
+                                          {OpCode::FUNCTION_RETURN},
+                                          END_SECTION};
+    auto m = std::make_shared<Module>();
+    m->functions.push_back(b9::FunctionDef{"arraySize", arraySize, 0, 0});
+    m->functions.push_back(b9::FunctionDef{"putObject", putObject, 0, 0});
+    vm.load(m);
+    if (jit) {
+      vm.generateAllCode();
+      EXPECT_DEATH(vm.run("arraySize", {}), "map_size");
+      EXPECT_DEATH(vm.run("putObject", {}), "map_put");
+    } else {
+      EXPECT_THROW(vm.run("arraySize", {}), std::runtime_error);
+      EXPECT_THROW(vm.run("putObject", {}), std::runtime_error);
+    }
+  }
+}
+
 }  // namespace test
 }  // namespace b9
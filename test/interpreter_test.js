@@ -263,4 +263,456 @@ function test_for_sum() {
     return 1;
 }
 
+function test_constant_folding() {
+    var a = 2 * 3 + 4 - (10 / 3);
+    var unused = 5;
+    if (a != 7) {
+        return 0;
+    }
+    if (1 > 2) {
+        return 0;
+    }
+    return 1;
+}
+
+function test_compound_assignment() {
+    var a = 0;
+    a++;
+    ++a;
+    a += 3;
+    a -= 1;
+    var b = a++;
+    var c = ++a;
+    if (a != 6) {
+        return 0;
+    }
+    if (b != 4) {
+        return 0;
+    }
+    if (c != 6) {
+        return 0;
+    }
+    return 1;
+}
+
+function test_while_constant() {
+    var i = 0;
+    while (0) {
+        return 0;
+    }
+    while (1) {
+        i += 2;
+        if (i >= 10) {
+            return 1;
+        }
+    }
+}
+
+function test_string_building() {
+    var s = b9StringConcat("b", "9");
+    if (s != "b9") {
+        return 0;
+    }
+    if (b9Substring("base9", 2, 10) != "se9") {
+        return 0;
+    }
+    if (b9StringLength(s) != 2) {
+        return 0;
+    }
+    var b = b9NewBuilder();
+    b = b9BuilderAppend(b, "n=");
+    b = b9BuilderAppend(b, 40 + 2);
+    b = b9BuilderAppend(b, b9IntToString(-1));
+    if (b9BuilderToString(b) != "n=42-1") {
+        return 0;
+    }
+    return 1;
+}
+
+function test_int_array() {
+    var a = new Array(5);
+    for (var i = 0; i < a.length; i++) {
+        a[i] = i * i;
+    }
+    a[1] += 10;
+    a[2]++;
+    var sum = 0;
+    for (var j = 0; j < a.length; j++) {
+        sum += a[j];
+    }
+    if (sum != 41) {
+        return 0;
+    }
+    if (a[1] != 11) {
+        return 0;
+    }
+    return 1;
+}
+
+function test_array_primitives() {
+    var a = new Array(10);
+    b9ArrayFill(a, 2);
+    b9ArrayPrefixSum(a);
+    if (b9ArraySum(a) != 110) {
+        return 0;
+    }
+    var b = new Array(10);
+    b9ArrayCopy(b, a);
+    if (b9ArrayCompare(a, b) != 0) {
+        return 0;
+    }
+    b9ArrayMulScalar(b, 3);
+    b9ArrayAddScalar(b, -1);
+    b9ArrayAdd(b, a);
+    b9ArrayMul(b, a);
+    if (b[9] != 1580) {
+        return 0;
+    }
+    if (b9ArrayCompare(a, b) != -1) {
+        return 0;
+    }
+    if (b9ArrayFind(a, 14) != 6) {
+        return 0;
+    }
+    if (b9ArrayMin(a) != 2) {
+        return 0;
+    }
+    if (b9ArrayMax(b) != 1580) {
+        return 0;
+    }
+    return 1;
+}
+
+function scale(x, factor) {
+    return x * factor;
+}
+
+function test_double() {
+    var total = 0.0;
+    for (var i = 0; i < 4; i++) {
+        total += 1.25;
+    }
+    if (total != 5.0) {
+        return 0;
+    }
+    var score = scale(3, 0.5) + 1;
+    if (score >= 2.6) {
+        return 0;
+    }
+    if (Math.trunc(score) != 2) {
+        return 0;
+    }
+    if (Math.trunc(-7.9) != -7) {
+        return 0;
+    }
+    var x = 7;
+    var ratio = x / 2.0;
+    if (ratio != 3.5) {
+        return 0;
+    }
+    if (x / 2 != 3) {
+        return 0;
+    }
+    var neg = -ratio;
+    if (neg != -3.5) {
+        return 0;
+    }
+    return 1;
+}
+
+// Ordered comparisons with NaN are false both ways.
+function test_double_nan() {
+    var zero = 0.0;
+    var nan = zero / zero;
+    var count = 0;
+    if (nan < 1.0) {
+        return 0;
+    }
+    if (nan >= 1.0) {
+        return 0;
+    }
+    if (nan > 1.0) {
+        return 0;
+    } else {
+        count++;
+    }
+    if (nan == nan) {
+        return 0;
+    }
+    if (nan != nan) {
+        count++;
+    }
+    for (var i = 0.0; i < nan; i += 1.0) {
+        return 0;
+    }
+    while (nan <= 1.0) {
+        return 0;
+    }
+    if (count != 2) {
+        return 0;
+    }
+    return 1;
+}
+
+function test_wide_constant() {
+    var big = 123456789;
+    var small = -98765432100;
+    if (big + 1 != 123456790) {
+        return 0;
+    }
+    if (small / 100 != -987654321) {
+        return 0;
+    }
+    if (big - 8388608 != 115068181) {
+        return 0;
+    }
+    if (small >= -8388609) {
+        return 0;
+    }
+    return 1;
+}
+
+function hashValues(values) {
+    var hash = 5381;
+    for (var i = 0; i < values.length; i++) {
+        hash = ((hash << 5) + hash) ^ values[i];
+        hash &= 0xFFFFFF;
+    }
+    return hash;
+}
+
+function test_bitwise() {
+    if (17 % 5 != 2) {
+        return 0;
+    }
+    if (-17 % 5 != -2) {
+        return 0;
+    }
+    var x = 0x5A;
+    if ((x & 0x0F) != 0x0A) {
+        return 0;
+    }
+    if ((x | 0x0F) != 0x5F) {
+        return 0;
+    }
+    if ((x ^ 0xFF) != 0xA5) {
+        return 0;
+    }
+    if (x << 4 != 0x5A0) {
+        return 0;
+    }
+    if (-x >> 1 != -45) {
+        return 0;
+    }
+    if (~x != -91) {
+        return 0;
+    }
+    var n = 100;
+    n %= 7;
+    n <<= 3;
+    if (n != 16) {
+        return 0;
+    }
+    var values = new Array(3);
+    values[0] = 98;
+    values[1] = 57;
+    values[2] = 0;
+    if (hashValues(values) != 8864350) {
+        return 0;
+    }
+    return 1;
+}
+
+function route(type) {
+    var result = 0;
+    switch (type) {
+        case 1:
+            result = 10;
+            break;
+        case 2:
+        case 3:
+            result = 20;
+            break;
+        default:
+            result = -1;
+            break;
+        case 5:
+            result = 50;
+        case 6:
+            result += 6;
+            break;
+    }
+    return result;
+}
+
+function sparse(code) {
+    switch (code) {
+        case 1:
+            return 1;
+        case 1000:
+            return 2;
+        case -70000:
+            return 3;
+    }
+    return 0;
+}
+
+function priority(kind) {
+    if (kind == 0) {
+        return 5;
+    } else if (kind == 1) {
+        return 7;
+    } else if (kind == 2) {
+        return 9;
+    } else if (3 == kind) {
+        return 11;
+    } else {
+        return 0;
+    }
+}
+
+function test_switch() {
+    if (route(1) != 10) {
+        return 0;
+    }
+    if (route(3) != 20) {
+        return 0;
+    }
+    if (route(4) != -1) {
+        return 0;
+    }
+    if (route(5) != 56) {
+        return 0;
+    }
+    if (route(6) != 6) {
+        return 0;
+    }
+    if (route(-8000000) != -1) {
+        return 0;
+    }
+    if (route("1") != -1) {
+        return 0;
+    }
+    if (sparse(-70000) != 3) {
+        return 0;
+    }
+    if (sparse(7) != 0) {
+        return 0;
+    }
+    if (priority(3) != 11) {
+        return 0;
+    }
+    if (priority(4) != 0) {
+        return 0;
+    }
+    var i = 0;
+    while (i < 100) {
+        if (i == 7) {
+            break;
+        }
+        i++;
+    }
+    if (i != 7) {
+        return 0;
+    }
+    return 1;
+}
+
+function sumTo(n, total) {
+    if (n == 0) {
+        return total;
+    }
+    return sumTo(n - 1, total + n);
+}
+
+function isEven(n) {
+    if (n == 0) {
+        return 1;
+    }
+    return isOdd(n - 1);
+}
+
+function isOdd(n) {
+    if (n == 0) {
+        return 0;
+    }
+    return isEven(n - 1);
+}
+
+function halve(x) {
+    return x / 2;
+}
+
+function half(x) {
+    return halve(x + 0.0);
+}
+
+function test_tail_call() {
+    // Deeper than the operand stack, which holds 1000 values.
+    if (sumTo(100000, 0) != 5000050000) {
+        return 0;
+    }
+    if (isEven(5001) != 0) {
+        return 0;
+    }
+    if (half(3) != 1.5) {
+        return 0;
+    }
+    return 1;
+}
+
+function test_hash_map() {
+    var counts = b9MapNew();
+    var key = 0;
+    var i = 0;
+    while (i < 1000) {
+        key = i % 37;
+        b9MapPut(counts, key, b9MapGet(counts, key) + 1);
+        i++;
+    }
+    if (b9MapSize(counts) != 37) {
+        return 0;
+    }
+    if (b9MapGet(counts, 0) != 28) {
+        return 0;
+    }
+    if (b9MapGet(counts, 36) != 27) {
+        return 0;
+    }
+
+    // Strings are separate keys from ints.
+    b9MapPut(counts, "apple", 5);
+    b9MapPut(counts, b9StringConcat("app", "le"), b9MapGet(counts, "apple") * 2);
+    if (b9MapGet(counts, "apple") != 10) {
+        return 0;
+    }
+    if (b9MapSize(counts) != 38) {
+        return 0;
+    }
+    if (b9MapHas(counts, "pear")) {
+        return 0;
+    }
+
+    i = 0;
+    while (i < 37) {
+        if (!b9MapDelete(counts, i)) {
+            return 0;
+        }
+        i += 2;
+    }
+    if (b9MapDelete(counts, 0)) {
+        return 0;
+    }
+    if (b9MapHas(counts, 2)) {
+        return 0;
+    }
+    if (b9MapGet(counts, 3) != 27) {
+        return 0;
+    }
+    if (b9MapSize(counts) != 19) {
+        return 0;
+    }
+    return 1;
+}
+
 b9PrintString("This is the interpreter test suite - to run, run ./test/b9test");
@@ -1,11 +1,110 @@
+#include <b9/Module.hpp>
+#include <b9/assemble.hpp>
+#include <b9/deserialize.hpp>
 #include <b9/instructions.hpp>
 
+#include <gtest/gtest.h>
 #include <cstdint>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 namespace b9 {
-namespace test {}  // namespace test
+namespace test {
+
+TEST(AssembleTest, instruction) {
+  std::stringstream in("(int_push_constant -5) (int_add) 7 (jmp 3)");
+  EXPECT_EQ(assembleInstruction(in),
+            Instruction(OpCode::INT_PUSH_CONSTANT, -5));
+  EXPECT_EQ(assembleInstruction(in), Instruction(OpCode::INT_ADD));
+  EXPECT_EQ(assembleInstruction(in), Instruction(OpCode::JMP, 3));
+}
+
+TEST(AssembleTest, function) {
+  std::stringstream in(
+      "(function \"add\" 2 0 ; comment\n"
+      "  (push_from_param 0)\n"
+      "  (push_from_param 1)\n"
+      "  (int_add)\n"
+      "  (function_return))");
+  auto function = assembleFunction(in);
+  EXPECT_EQ(function.name, "add");
+  EXPECT_EQ(function.nparams, 2);
+  EXPECT_EQ(function.nlocals, 0);
+  std::vector<Instruction> expected = {{OpCode::PUSH_FROM_PARAM, 0},
+                                       {OpCode::PUSH_FROM_PARAM, 1},
+                                       {OpCode::INT_ADD},
+                                       {OpCode::FUNCTION_RETURN},
+                                       END_SECTION};
+  EXPECT_EQ(function.instructions, expected);
+}
+
+TEST(AssembleTest, roundTripDisassembly) {
+  Module module;
+  std::vector<Instruction> main = {{OpCode::STR_PUSH_CONSTANT, 1},
+                                   {OpCode::PRIMITIVE_CALL, 0},
+                                   {OpCode::JMP_LE, -3},
+                                   {OpCode::FUNCTION_CALL, 1},
+                                   {OpCode::FUNCTION_RETURN},
+                                   END_SECTION};
+  module.functions.push_back(FunctionDef{"main", main, 1, 2});
+  module.strings = {"plain", "with \"quotes\"\tand\\slashes\n"};
+  module.imports = {"print"};
+  module.exports = {"main"};
+  module.doubles = {0.1, -2.5e300, 3};
+  module.integers = {INT48_MIN, INT48_MAX, 16777216};
+  module.jumpTables = {{-2, 5, {1, -3, 0}}, {7, 0, {}}};
+
+  std::stringstream text;
+  text << module;
+  auto assembled = assembleModule(text);
+  EXPECT_EQ(*assembled, module);
+  EXPECT_EQ(assembled->functions[0].instructions, main);
+}
+
+TEST(AssembleTest, writeBinaryModule) {
+  std::stringstream text(
+      "(function \"answer\" 0 0\n"
+      "  0  (int_push_constant 42)\n"
+      "  1  (function_return)\n"
+      "  2  (end_section))\n"
+      "(string \"hello\")\n");
+  std::stringstream binary(std::ios::in | std::ios::out | std::ios::binary);
+  assemble(text, binary);
+
+  auto module = deserialize(binary);
+  ASSERT_EQ(module->functionCount(), 1);
+  EXPECT_EQ(module->getFunction(0).name, "answer");
+  EXPECT_EQ(module->getFunction(0).instructions.size(), 3);
+  EXPECT_EQ(module->strings, std::vector<std::string>{"hello"});
+}
+
+TEST(AssembleTest, reportErrors) {
+  std::vector<const char *> bad = {
+      "(function \"f\" 0 0 (no_such_op))",
+      "(function \"f\" 0 0 (int_push_constant 8388608))",
+      "(integer 140737488355328)",
+      "(integer -140737488355329)",
+      "(function \"f\" 0 0 (int_add)",
+      "(string \"unterminated)",
+      "(library \"x\")",
+      "(function f 0 0)",
+  };
+  for (auto source : bad) {
+    std::stringstream in(source);
+    EXPECT_THROW(assembleModule(in), AssemblerException) << source;
+  }
+
+  std::stringstream in("\n\n(function \"f\" 0 0\n (oops))");
+  try {
+    assembleModule(in);
+    FAIL();
+  } catch (const AssemblerException &e) {
+    EXPECT_EQ(std::string{e.what()}.find("line 4"), 0);
+  }
+}
+
+}  // namespace test
 }  // namespace b9
@@ -1,12 +1,17 @@
 #include <b9/ExecutionContext.hpp>
 #include <b9/Module.hpp>
 #include <b9/VirtualMachine.hpp>
+#include <b9/binaryformat.hpp>
 #include <b9/deserialize.hpp>
 #include <b9/serialize.hpp>
 
 #include <gtest/gtest.h>
 #include <stdlib.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <strstream>
+#include <thread>
 #include <vector>
 
 namespace b9 {
@@ -60,6 +65,11 @@ std::shared_ptr<Module> makeComplexModule() {
   m->functions.push_back(b9::FunctionDef{"b9PrintNumber", i3, 3, 3});
 
   m->strings = {"mercury", "Venus", "EARTH", "mars", "JuPiTeR", "sAtUrN"};
+  m->imports = {"b9PrintStack"};
+  m->exports = {"add_args", "b9PrintNumber"};
+  m->doubles = {0.5, -1e-300, 6.02214076e23};
+  m->integers = {0x8000'0000, -0x7FFF'FFFF'FFFF};
+  m->jumpTables = {{0, 2, {1, 3, 5}}, {-100, -4, {-2}}};
 
   return m;
 }
@@ -213,6 +223,149 @@ TEST(RoundTripSerializationTest, testSerializeDeserialize) {
   roundTripSerializeDeserialize(m4);
 }
 
+TEST(RoundTripSerializationTest, testSerializeDeserializeV1) {
+  for (auto m : {makeEmptyModule(), makeSimpleModule(), makeComplexModule()}) {
+    std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+    serializeV1(buffer, *m);
+    auto m2 = deserialize(buffer);
+    EXPECT_EQ(m2->loader, nullptr);
+    EXPECT_EQ(*m, *m2);
+  }
+}
+
+TEST(IndexedModuleTest, functionsAreMaterializedLazily) {
+  auto m = makeComplexModule();
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *m);
+
+  auto m2 = deserialize(buffer);
+  auto image = std::dynamic_pointer_cast<ModuleImage>(m2->loader);
+  ASSERT_NE(image, nullptr);
+  EXPECT_EQ(m2->functionCount(), 3);
+  EXPECT_EQ(m2->strings, m->strings);
+  EXPECT_EQ(image->materializedCount(), 0);
+
+  EXPECT_EQ(m2->getFunctionIndex("b9PrintNumber"), 2);
+  EXPECT_EQ(image->materializedCount(), 0);
+
+  const FunctionDef& f = m2->getFunction(2);
+  EXPECT_EQ(f, m->functions[2]);
+  EXPECT_EQ(f.instructions, m->functions[2].instructions);
+  EXPECT_EQ(image->materializedCount(), 1);
+  EXPECT_EQ(&f, &m2->getFunction(2));
+
+  EXPECT_THROW(m2->getFunctionIndex("b9PrintNothing"),
+               FunctionNotFoundException);
+}
+
+TEST(IndexedModuleTest, codeIsAligned) {
+  auto m = makeComplexModule();
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *m);
+  std::string data = buffer.str();
+
+  ModuleHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  EXPECT_EQ(header.tag, MODULE_INDEX_TAG);
+  EXPECT_EQ(header.version, MODULE_FORMAT_VERSION);
+
+  for (std::uint32_t i = 0; i < header.sectionCount; i++) {
+    SectionEntry section;
+    std::memcpy(&section,
+                data.data() + sizeof(header) + i * sizeof(SectionEntry),
+                sizeof(section));
+    if (section.code != std::uint32_t(SectionCode::FUNCTION_TABLE)) continue;
+    for (std::size_t j = 0; j < section.size / sizeof(FunctionEntry); j++) {
+      FunctionEntry entry;
+      std::memcpy(&entry,
+                  data.data() + section.offset + j * sizeof(FunctionEntry),
+                  sizeof(entry));
+      EXPECT_EQ(entry.codeOffset % CODE_ALIGNMENT, 0);
+    }
+  }
+}
+
+TEST(IndexedModuleTest, manyFunctions) {
+  auto m = makeEmptyModule();
+  for (int i = 0; i < 500; i++) {
+    std::vector<Instruction> instructions = {{OpCode::INT_PUSH_CONSTANT, i},
+                                             {OpCode::FUNCTION_RETURN},
+                                             END_SECTION};
+    m->functions.push_back(
+        FunctionDef{"f" + std::to_string(i), instructions, 0, 0});
+  }
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *m);
+  auto m2 = deserialize(buffer);
+
+  for (int i = 0; i < 500; i++) {
+    auto index = m2->getFunctionIndex("f" + std::to_string(i));
+    EXPECT_EQ(index, i);
+    EXPECT_EQ(m2->getFunction(index).instructions[0].immediate(), i);
+  }
+  EXPECT_EQ(*m, *m2);
+}
+
+TEST(IndexedModuleTest, truncatedModule) {
+  auto m = makeComplexModule();
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *m);
+  std::string data = buffer.str();
+
+  std::stringstream truncated(std::ios::in | std::ios::out | std::ios::binary);
+  truncated.write(data.data(), data.size() / 2);
+  EXPECT_THROW(deserialize(truncated), DeserializeException);
+}
+
+TEST(IndexedModuleTest, mappedFile) {
+  auto m = makeComplexModule();
+  const char *path = "b9serializeTest.b9mod";
+  {
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    serialize(out, *m);
+  }
+  auto m2 = deserializeFile(path);
+  std::remove(path);
+  auto image = std::dynamic_pointer_cast<ModuleImage>(m2->loader);
+  ASSERT_NE(image, nullptr);
+  EXPECT_EQ(image->materializedCount(), 0);
+  EXPECT_EQ(*m, *m2);
+
+  {
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    serializeV1(out, *m);
+  }
+  auto m3 = deserializeFile(path);
+  std::remove(path);
+  EXPECT_EQ(m3->loader, nullptr);
+  EXPECT_EQ(*m, *m3);
+
+  EXPECT_THROW(deserializeFile(path), DeserializeException);
+}
+
+TEST(IndexedModuleTest, concurrentMaterialization) {
+  auto m = makeComplexModule();
+  std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+  serialize(buffer, *m);
+  auto m2 = deserialize(buffer);
+  auto image = std::dynamic_pointer_cast<ModuleImage>(m2->loader);
+  ASSERT_NE(image, nullptr);
+
+  std::vector<const FunctionDef *> seen(8);
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < seen.size(); i++) {
+    threads.emplace_back([&, i] { seen[i] = &m2->getFunction(1); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto function : seen) {
+    EXPECT_EQ(function, seen[0]);
+  }
+  EXPECT_EQ(*seen[0], m->functions[1]);
+  EXPECT_EQ(image->materializedCount(), 1);
+}
+
 template <typename Number>
 void roundTripNumber(std::vector<Number> numbers) {
   for (auto number : numbers) {
@@ -270,6 +423,21 @@ TEST(ReadBinaryTest, testCorruptModule) {
   EXPECT_THROW(deserialize(buffer2), DeserializeException);
 }
 
+TEST(ReadBinaryTest, integerOutOfRange) {
+  for (auto integer : {INT48_MAX + 1, INT48_MIN - 1}) {
+    auto m = makeEmptyModule();
+    m->integers = {INT48_MIN, INT48_MAX, integer};
+
+    std::stringstream indexed(std::ios::in | std::ios::out | std::ios::binary);
+    serialize(indexed, *m);
+    EXPECT_THROW(deserialize(indexed), DeserializeException);
+
+    std::stringstream v1(std::ios::in | std::ios::out | std::ios::binary);
+    serializeV1(v1, *m);
+    EXPECT_THROW(deserialize(v1), DeserializeException);
+  }
+}
+
 TEST(ReadBinaryTest, runValidModule) {
   auto m1 = makeSimpleModule();
   std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);